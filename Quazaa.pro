@@ -25,6 +25,7 @@
 TEMPLATE = subdirs
 
 SUBDIRS = VersionTool \
-		  Quazaa
+		  Quazaa \
+		  Quazaa/tests
 
 CONFIG += ordered
@@ -52,7 +52,7 @@ void CChatCore::Add(CChatSession *pSession)
 
 	Start();
 
-	m_pController->addSocket(pSession);
+	m_pController->addSocket(pSession, tcChat);
 }
 void CChatCore::Remove(CChatSession *pSession)
 {
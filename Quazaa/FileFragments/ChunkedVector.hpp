@@ -0,0 +1,367 @@
+/*
+** $Id$
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef FILEFRAGMENTS_CHUNKEDVECTOR_HPP_INCLUDED
+#define FILEFRAGMENTS_CHUNKEDVECTOR_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace Ranges
+{
+
+// A sorted sequence stored as a vector of sorted chunks of at most ChunkSize elements each: a
+// flat vector split up, or a B-tree of height two. A chunk is found by a binary search over the
+// last elements of the chunks, so lookups take ~O( log( n ) ). Inserting or erasing an element
+// moves the elements of a single chunk, plus the chunk headers when a chunk is split or dropped,
+// which keeps random inserts cheap. Walking the sequence and appending at its end cost about as
+// much as with a std::vector, and there is no allocation per element.
+// The caller keeps the elements sorted; CompareT is only used for the lookups. Inserting or
+// erasing invalidates all iterators. Chunks are only ever swapped, never copied, when the chunk
+// headers move, so that costs no allocation either.
+template< class T, class CompareT, class AllocatorT = std::allocator< T >, std::size_t ChunkSize = 256 >
+class ChunkedVector
+{
+private:
+	typedef std::vector< T, AllocatorT > chunk_type;
+	typedef typename AllocatorT::template rebind< chunk_type >::other chunk_allocator_type;
+	typedef std::vector< chunk_type, chunk_allocator_type > chunks_type;
+
+public:
+	// Typedefs
+	typedef T value_type;
+	typedef CompareT key_compare;
+	typedef AllocatorT allocator_type;
+	typedef typename allocator_type::pointer pointer;
+	typedef typename allocator_type::const_pointer const_pointer;
+	typedef typename allocator_type::reference reference;
+	typedef typename allocator_type::const_reference const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	// Addresses an element by chunk and position in the chunk; end() is one past the last chunk.
+	template< class ChunksT, class ValueT >
+	class basic_iterator : public std::iterator< std::bidirectional_iterator_tag, T, difference_type, ValueT*, ValueT& >
+	{
+	public:
+		basic_iterator() : m_chunks( 0 ), m_chunk( 0 ), m_index( 0 ) { }
+		// iterator converts to const_iterator
+		template< class OtherChunksT, class OtherValueT >
+		basic_iterator(const basic_iterator< OtherChunksT, OtherValueT >& other)
+		: m_chunks( other.m_chunks ), m_chunk( other.m_chunk ), m_index( other.m_index ) { }
+
+		ValueT& operator*() const { return ( *m_chunks )[ m_chunk ][ m_index ]; }
+		ValueT* operator->() const { return &**this; }
+		basic_iterator& operator++()
+		{
+			if ( ++m_index == ( *m_chunks )[ m_chunk ].size() )
+			{
+				++m_chunk;
+				m_index = 0;
+			}
+			return *this;
+		}
+		basic_iterator operator++(int)
+		{
+			basic_iterator tmp( *this );
+			++*this;
+			return tmp;
+		}
+		basic_iterator& operator--()
+		{
+			if ( m_index == 0 ) m_index = ( *m_chunks )[ --m_chunk ].size();
+			--m_index;
+			return *this;
+		}
+		basic_iterator operator--(int)
+		{
+			basic_iterator tmp( *this );
+			--*this;
+			return tmp;
+		}
+		template< class OtherChunksT, class OtherValueT >
+		bool operator==(const basic_iterator< OtherChunksT, OtherValueT >& rhs) const
+		{
+			return m_chunk == rhs.m_chunk && m_index == rhs.m_index;
+		}
+		template< class OtherChunksT, class OtherValueT >
+		bool operator!=(const basic_iterator< OtherChunksT, OtherValueT >& rhs) const
+		{
+			return !operator==( rhs );
+		}
+
+	private:
+		basic_iterator(ChunksT* chunks, size_type chunk, size_type index)
+		: m_chunks( chunks ), m_chunk( chunk ), m_index( index ) { }
+
+		ChunksT* m_chunks;
+		size_type m_chunk;
+		size_type m_index;
+
+		friend class ChunkedVector;
+		template< class, class > friend class basic_iterator;
+	};
+
+	typedef basic_iterator< chunks_type, T > iterator;
+	typedef basic_iterator< const chunks_type, const T > const_iterator;
+	typedef std::reverse_iterator< iterator > reverse_iterator;
+	typedef std::reverse_iterator< const_iterator > const_reverse_iterator;
+
+	// Constructor
+	explicit ChunkedVector(const key_compare& compare = key_compare(), const allocator_type& alloc = allocator_type())
+	: m_chunks( chunk_allocator_type( alloc ) ), m_size( 0 ), m_compare( compare ) { }
+
+	// Iterators
+	iterator               begin()        { return iterator( &m_chunks, 0, 0 ); }
+	const_iterator         begin()  const { return const_iterator( &m_chunks, 0, 0 ); }
+	iterator               end()          { return iterator( &m_chunks, m_chunks.size(), 0 ); }
+	const_iterator         end()    const { return const_iterator( &m_chunks, m_chunks.size(), 0 ); }
+	reverse_iterator       rbegin()       { return reverse_iterator( end() ); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator( end() ); }
+	reverse_iterator       rend()         { return reverse_iterator( begin() ); }
+	const_reverse_iterator rend()   const { return const_reverse_iterator( begin() ); }
+
+	// Accessors
+	bool empty() const { return m_size == 0; }
+	size_type size() const { return m_size; }
+	allocator_type get_allocator() const { return allocator_type( m_chunks.get_allocator() ); }
+	// @nth     Returns the element at position n.
+	// @complexity   ~O( n / ChunkSize )
+	iterator nth(size_type n)
+	{
+		size_type chunk = 0;
+		for ( ; n >= m_chunks[ chunk ].size(); ++chunk ) n -= m_chunks[ chunk ].size();
+		return iterator( &m_chunks, chunk, n );
+	}
+	const_iterator nth(size_type n) const
+	{
+		size_type chunk = 0;
+		for ( ; n >= m_chunks[ chunk ].size(); ++chunk ) n -= m_chunks[ chunk ].size();
+		return const_iterator( &m_chunks, chunk, n );
+	}
+
+	// Operations
+	void clear()
+	{
+		m_chunks.clear();
+		m_size = 0;
+	}
+	void swap(ChunkedVector& rhs)
+	{
+		m_chunks.swap( rhs.m_chunks );
+		std::swap( m_size, rhs.m_size );
+		std::swap( m_compare, rhs.m_compare );
+	}
+	// @insert  Inserts value before where; the caller makes sure that keeps the sequence sorted.
+	// @return  Returns the iterator to the inserted element.
+	// @complexity   ~O( ChunkSize ), amortized ~O( 1 ) at end()
+	iterator insert(iterator where, const value_type& value);
+	// @erase   Erases the elements [first, last).
+	// @return  Returns the iterator to the element that followed the last one erased.
+	// @complexity   ~O( ChunkSize + number of chunks )
+	iterator erase(iterator first, iterator last);
+	iterator erase(iterator where)
+	{
+		iterator last( where );
+		return erase( where, ++last );
+	}
+
+	iterator       lower_bound(const value_type& key)       { return bound< iterator >( m_chunks, key, false ); }
+	const_iterator lower_bound(const value_type& key) const { return bound< const_iterator >( m_chunks, key, false ); }
+	iterator       upper_bound(const value_type& key)       { return bound< iterator >( m_chunks, key, true ); }
+	const_iterator upper_bound(const value_type& key) const { return bound< const_iterator >( m_chunks, key, true ); }
+	std::pair< iterator, iterator > equal_range(const value_type& key)
+	{
+		return std::make_pair( lower_bound( key ), upper_bound( key ) );
+	}
+	std::pair< const_iterator, const_iterator > equal_range(const value_type& key) const
+	{
+		return std::make_pair( lower_bound( key ), upper_bound( key ) );
+	}
+	iterator find(const value_type& key)
+	{
+		iterator result = lower_bound( key );
+		return result == end() || m_compare( key, *result ) ? end() : result;
+	}
+	const_iterator find(const value_type& key) const
+	{
+		const_iterator result = lower_bound( key );
+		return result == end() || m_compare( key, *result ) ? end() : result;
+	}
+
+// Implementation
+private:
+	chunks_type m_chunks;	// never holds an empty chunk
+	size_type m_size;
+	key_compare m_compare;
+
+	// compares the last element of a chunk with a key
+	struct chunk_compare
+	{
+		chunk_compare(const key_compare& compare) : m_compare( compare ) { }
+		bool operator()(const chunk_type& lhs, const value_type& rhs) const { return m_compare( lhs.back(), rhs ); }
+		bool operator()(const value_type& lhs, const chunk_type& rhs) const { return m_compare( lhs, rhs.back() ); }
+		const key_compare& m_compare;
+	};
+
+	template< class iterator_type, class chunks_type_ >
+	iterator_type bound(chunks_type_& chunks, const value_type& key, bool upper) const
+	{
+		// the first chunk with an element not before (after) key holds the bound
+		const size_type chunk = ( upper
+			? std::upper_bound( chunks.begin(), chunks.end(), key, chunk_compare( m_compare ) )
+			: std::lower_bound( chunks.begin(), chunks.end(), key, chunk_compare( m_compare ) ) ) - chunks.begin();
+		if ( chunk == chunks.size() ) return iterator_type( &chunks, chunk, 0 );
+		const chunk_type& elements = chunks[ chunk ];
+		const size_type index = ( upper
+			? std::upper_bound( elements.begin(), elements.end(), key, m_compare )
+			: std::lower_bound( elements.begin(), elements.end(), key, m_compare ) ) - elements.begin();
+		return iterator_type( &chunks, chunk, index );
+	}
+	// drops chunk if it is empty and joins it with a neighbour if both fit into half a chunk, so
+	// the chunks stay reasonably full; returns the iterator to the element at index of chunk
+	iterator repair(size_type chunk, size_type index);
+	// inserts an empty chunk before chunk
+	void insert_chunk(size_type chunk)
+	{
+		if ( m_chunks.size() == m_chunks.capacity() )
+		{
+			// grow by hand, a reallocation would copy every chunk
+			chunks_type chunks( m_chunks.get_allocator() );
+			chunks.reserve( 2 * m_chunks.size() + 1 );
+			chunks.resize( m_chunks.size(), chunk_type( get_allocator() ) );
+			for ( size_type i = 0; i < m_chunks.size(); ++i ) chunks[ i ].swap( m_chunks[ i ] );
+			m_chunks.swap( chunks );
+		}
+		m_chunks.push_back( chunk_type( get_allocator() ) );
+		for ( size_type i = m_chunks.size() - 1; i > chunk; --i ) m_chunks[ i ].swap( m_chunks[ i - 1 ] );
+	}
+	// erases the chunks [first, last)
+	void erase_chunks(size_type first, size_type last)
+	{
+		for ( size_type i = last; i < m_chunks.size(); ++i ) m_chunks[ first++ ].swap( m_chunks[ i ] );
+		m_chunks.erase( m_chunks.begin() + first, m_chunks.end() );
+	}
+};
+
+template< class T, class CompareT, class AllocatorT, std::size_t ChunkSize >
+typename ChunkedVector< T, CompareT, AllocatorT, ChunkSize >::iterator
+ChunkedVector< T, CompareT, AllocatorT, ChunkSize >::insert(iterator where, const value_type& value)
+{
+	size_type chunk = where.m_chunk, index = where.m_index;
+	// appending goes to the end of the chunk before where, which fills the chunks one by one
+	if ( chunk == m_chunks.size() && chunk > 0 && m_chunks.back().size() < ChunkSize )
+	{
+		m_chunks.back().push_back( value );
+		++m_size;
+		return iterator( &m_chunks, chunk - 1, m_chunks.back().size() - 1 );
+	}
+	if ( index == 0 && chunk > 0 && m_chunks[ chunk - 1 ].size() < ChunkSize )
+	{
+		index = m_chunks[ --chunk ].size();
+	}
+	else if ( chunk == m_chunks.size() || m_chunks[ chunk ].size() == ChunkSize )
+	{
+		if ( chunk == m_chunks.size() || index == 0 )
+		{
+			// before a full chunk, or behind the last one when it is full; a list that grows
+			// at its end will fill this one as well
+			insert_chunk( chunk );
+			if ( chunk > 0 ) m_chunks[ chunk ].reserve( ChunkSize );
+		}
+		else
+		{
+			// split the full chunk in halves
+			const size_type half = ChunkSize / 2;
+			insert_chunk( chunk + 1 );
+			chunk_type& lower = m_chunks[ chunk ];
+			chunk_type& upper = m_chunks[ chunk + 1 ];
+			upper.assign( lower.begin() + half, lower.end() );
+			lower.erase( lower.begin() + half, lower.end() );
+			if ( index > half )
+			{
+				++chunk;
+				index -= half;
+			}
+		}
+	}
+	m_chunks[ chunk ].insert( m_chunks[ chunk ].begin() + index, value );
+	++m_size;
+	return iterator( &m_chunks, chunk, index );
+}
+
+template< class T, class CompareT, class AllocatorT, std::size_t ChunkSize >
+typename ChunkedVector< T, CompareT, AllocatorT, ChunkSize >::iterator
+ChunkedVector< T, CompareT, AllocatorT, ChunkSize >::erase(iterator first, iterator last)
+{
+	if ( first == last ) return last;
+	const size_type chunk = first.m_chunk;
+	if ( chunk == last.m_chunk )
+	{
+		m_chunks[ chunk ].erase( m_chunks[ chunk ].begin() + first.m_index, m_chunks[ chunk ].begin() + last.m_index );
+		m_size -= last.m_index - first.m_index;
+		return repair( chunk, first.m_index );
+	}
+	// the tail of the first chunk, the chunks in between and the head of the last one
+	m_size -= m_chunks[ chunk ].size() - first.m_index + last.m_index;
+	m_chunks[ chunk ].erase( m_chunks[ chunk ].begin() + first.m_index, m_chunks[ chunk ].end() );
+	for ( size_type i = chunk + 1; i < last.m_chunk; ++i ) m_size -= m_chunks[ i ].size();
+	if ( last.m_chunk < m_chunks.size() )
+	{
+		m_chunks[ last.m_chunk ].erase( m_chunks[ last.m_chunk ].begin(), m_chunks[ last.m_chunk ].begin() + last.m_index );
+	}
+	erase_chunks( chunk + 1, last.m_chunk );
+	return repair( chunk, first.m_index );
+}
+
+template< class T, class CompareT, class AllocatorT, std::size_t ChunkSize >
+typename ChunkedVector< T, CompareT, AllocatorT, ChunkSize >::iterator
+ChunkedVector< T, CompareT, AllocatorT, ChunkSize >::repair(size_type chunk, size_type index)
+{
+	if ( m_chunks[ chunk ].empty() )
+	{
+		erase_chunks( chunk, chunk + 1 );
+		return iterator( &m_chunks, chunk, 0 );
+	}
+	if ( chunk + 1 < m_chunks.size() && m_chunks[ chunk ].size() + m_chunks[ chunk + 1 ].size() <= ChunkSize / 2 )
+	{
+		m_chunks[ chunk ].insert( m_chunks[ chunk ].end(), m_chunks[ chunk + 1 ].begin(), m_chunks[ chunk + 1 ].end() );
+		erase_chunks( chunk + 1, chunk + 2 );
+	}
+	if ( chunk > 0 && m_chunks[ chunk - 1 ].size() + m_chunks[ chunk ].size() <= ChunkSize / 2 )
+	{
+		index += m_chunks[ chunk - 1 ].size();
+		m_chunks[ chunk - 1 ].insert( m_chunks[ chunk - 1 ].end(), m_chunks[ chunk ].begin(), m_chunks[ chunk ].end() );
+		erase_chunks( chunk, chunk + 1 );
+		--chunk;
+	}
+	return index < m_chunks[ chunk ].size() ? iterator( &m_chunks, chunk, index ) : iterator( &m_chunks, chunk + 1, 0 );
+}
+
+} // namespace Ranges
+
+#endif // #ifndef FILEFRAGMENTS_CHUNKEDVECTOR_HPP_INCLUDED
@@ -42,7 +42,7 @@ public:
 	typedef ContainerT container_type;
 	typedef typename range_type::size_type range_size_type;
 	typedef typename range_type::payload_type payload_type;
-	typedef Ranges::RangeCompare< payload_type, range_size_type > compare_type;
+	typedef Ranges::RangeCompare< range_size_type, payload_type > compare_type;
 	typedef typename container_type::iterator iterator;
 	typedef std::pair< iterator, iterator > iterator_pair;
 
@@ -80,13 +80,11 @@ protected:
 		range_size_type old_sum = m_length_sum;
 		range_size_type low = qMin( sequence.first->begin(), new_range.begin() );
 		range_size_type high = qMax( ( --sequence.second )->end(), new_range.end() );
-		for ( ++sequence.second; sequence.first != sequence.second; )
-		{
-			range_size_type length = sequence.first->size();
-			set.erase( sequence.first++ );
-			m_length_sum -= length;
-		}
-		set.insert( sequence.second, range_type( low, high ) );
+		++sequence.second;
+		for ( iterator i = sequence.first; i != sequence.second; ++i ) m_length_sum -= i->size();
+		// the merged range takes the place of the first one, the rest is closed up in one move
+		*sequence.first = range_type( low, high );
+		set.erase( ++sequence.first, sequence.second );
 		m_length_sum += high - low;
 		return m_length_sum - old_sum;
 	}
@@ -97,6 +95,29 @@ protected:
 		m_length_sum += new_range.size();
 		return new_range.size();
 	}
+	// replaces the ranges of sequence with the parts of them that are left, front
+	// and back, either of which may be empty
+	template< class container_type >
+	range_size_type cut(container_type& set, iterator_pair sequence,
+		const range_type& front, const range_type& back)
+	{
+		Q_ASSERT( sequence.first != sequence.second );
+		range_size_type old_sum = m_length_sum;
+		for ( iterator i = sequence.first; i != sequence.second; ++i ) m_length_sum -= i->size();
+		iterator where = sequence.first;
+		if ( front.size() ) *where++ = front;
+		if ( back.size() && where == sequence.second )
+		{
+			set.insert( where, back ); // a single range split in two
+		}
+		else
+		{
+			if ( back.size() ) *where++ = back;
+			set.erase( where, sequence.second );
+		}
+		m_length_sum += front.size() + back.size();
+		return old_sum - m_length_sum;
+	}
 
 private:
 	range_size_type m_limit;
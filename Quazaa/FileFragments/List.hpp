@@ -29,12 +29,18 @@
 #define FILEFRAGMENTS_LIST_HPP_INCLUDED
 
 #include "commonfunctions.h"
+#include "ChunkedVector.hpp"
 #include <QDebug>
 
 namespace Ranges
 {
 
-template< class RangeT, template< class, class > class TraitsT, class ContainerT = std::set
+// The ranges are kept sorted in a ChunkedVector: lookups are binary searches, a range is
+// inserted or erased anywhere by moving the ranges of one chunk only, as completions arrive in
+// random order, and there is no allocation per range. The whole list operations inverse(),
+// intersect() and subtract() walk both lists once and append their result in order, so they
+// are linear. Any allocator can be passed in through ContainerT.
+template< class RangeT, template< class, class > class TraitsT, class ContainerT = ChunkedVector
 	<
 		RangeT,
 		RangeCompare< typename RangeT::size_type, typename RangeT::payload_type >
@@ -49,9 +55,10 @@ public:
 	typedef TraitsT< RangeT, ContainerT > Traits;
 	typedef typename range_type::size_type range_size_type;
 	typedef typename range_type::payload_type payload_type;
-	typedef RangeCompare< payload_type, range_size_type > compare_type;
+	typedef RangeCompare< range_size_type, payload_type > compare_type;
 	typedef ListError< range_type > ListException;
 	typedef typename container_type::value_type value_Type;
+	typedef typename container_type::allocator_type allocator_type;
 	typedef typename container_type::pointer pointer;
 	typedef typename container_type::const_pointer const_pointer;
 	typedef typename container_type::reference reference;
@@ -65,26 +72,28 @@ public:
 	typedef std::pair< iterator, iterator > iterator_pair;
 	typedef std::pair< const_iterator, const_iterator > const_iterator_pair;
 	// Constructor
-	explicit List() : Traits(), m_set() { }
-	explicit List(typename Traits::ctor_arg_type arg) : Traits( arg ), m_set() { }
+	explicit List() : Traits(), m_ranges() { }
+	explicit List(typename Traits::ctor_arg_type arg) : Traits( arg ), m_ranges() { }
+	List(typename Traits::ctor_arg_type arg, const allocator_type& alloc) : Traits( arg ), m_ranges( compare_type(), alloc ) { }
 
 	// Iterators
-	iterator               begin()        { return m_set.begin(); }
-	const_iterator         begin()  const { return m_set.begin(); }
-	iterator               end()          { return m_set.end(); }
-	const_iterator         end()    const { return m_set.end(); }
-	reverse_iterator       rbegin()       { return m_set.rbegin(); }
-	const_reverse_iterator rbegin() const { return m_set.rbegin(); }
-	reverse_iterator       rend()         { return m_set.rend(); }
-	const_reverse_iterator rend()   const { return m_set.rend(); }
+	iterator               begin()        { return m_ranges.begin(); }
+	const_iterator         begin()  const { return m_ranges.begin(); }
+	iterator               end()          { return m_ranges.end(); }
+	const_iterator         end()    const { return m_ranges.end(); }
+	reverse_iterator       rbegin()       { return m_ranges.rbegin(); }
+	const_reverse_iterator rbegin() const { return m_ranges.rbegin(); }
+	reverse_iterator       rend()         { return m_ranges.rend(); }
+	const_reverse_iterator rend()   const { return m_ranges.rend(); }
 
 	// Accessors
-	bool empty() const { return m_set.empty(); }
-	size_type size()  const { return m_set.size(); }
+	bool empty() const { return m_ranges.empty(); }
+	size_type size()  const { return m_ranges.size(); }
+	allocator_type get_allocator() const { return m_ranges.get_allocator(); }
 	// Operations
 	void clear()
 	{
-		m_set.clear();
+		m_ranges.clear();
 		Traits::clear();
 	}
 	// @insert  Inserts a fragment into the container. Because of the automatic
@@ -96,11 +105,11 @@ public:
 	//          but does nothing.
 	// @return  Returns the length of the range that has been inserted.
 	//          Effectively it reflects the change of sumLength().
-	// @complexity   ~O( log( n ) )
+	// @complexity   ~O( log( n ) + ChunkSize )
 	range_size_type insert(const range_type& value);
 	// @insert  Inserts a sequence of fragments. An optimized version should be
 	//          written if 2 large containers have to be merged often.
-	// @complexity   ~O( n_insert * log( n ) )
+	// @complexity   ~O( n_insert * ( log( n ) + ChunkSize ) )
 	template< typename input_iterator >
 	range_size_type insert(input_iterator first, input_iterator last)
 	{
@@ -109,9 +118,10 @@ public:
 		return sum;
 	}
 	// @insert  Inserts a fragment using an iterator as hint. Insertion is done
-	//          in constant time, if no merging occurs and the element can be
+	//          without a lookup, if no merging occurs and the element can be
 	//          inserted before the hint. Otherwise normal insertion occurs.
-	// @complexity   ~O( 1 ) or ~O( log( n ) )
+	//          Appending ranges in order at end() builds a list in linear time.
+	// @complexity   ~O( 1 ) at end(), ~O( ChunkSize ) or ~O( log( n ) + ChunkSize )
 	range_size_type insert(const iterator where, const range_type& value);
 	// @erase   Deletes a fragment from the container. Because of the automatic
 	//          sorting and merging guarantied by the container, this might
@@ -126,8 +136,8 @@ public:
 	//          which indictaes the number of elements being erased.
 	range_size_type erase(const range_type& value);
 	// @erase   Deletes a sequence of fragments from the container. That
-	//          sequence need not be part of the list. If it is, use a loop
-	//          over the next function instead, if speed is important.
+	//          sequence need not be part of the list. To remove a whole list,
+	//          subtract() does it in one pass.
 	template< typename input_iterator >
 	range_size_type erase(input_iterator first, input_iterator last)
 	{
@@ -136,14 +146,13 @@ public:
 		return sum;
 	}
 	// @erase   This deletes the fragment the argument points to.
-	//          Iterators that point to other fragments remain valid.
-	// @return  Returns iterator that points to the next fragment after the one
-	//          pointed to by the argument.
-	// @complexity   ~O( log( n ) )
+	//          All iterators are invalidated.
+	// @return  Returns the length of the range that has been deleted.
+	// @complexity   ~O( ChunkSize )
 	range_size_type erase(const iterator where)
 	{
 		range_size_type result = Traits::erase( where );
-		m_set.erase( where );
+		m_ranges.erase( where );
 		return result;
 	}
 	// @swap    Swaps two lists.
@@ -151,30 +160,30 @@ public:
 	void swap(List& rhs)                    // throw ()
 	{
 		Traits::swap( rhs );
-		m_set.swap( rhs.m_set );
+		m_ranges.swap( rhs.m_ranges );
 	}
 
-	iterator            lower_bound(const range_type& key)       { return m_set.lower_bound( key ); }
-	const_iterator      lower_bound(const range_type& key) const { return m_set.lower_bound( key ); }
-	iterator            upper_bound(const range_type& key)       { return m_set.upper_bound( key ); }
-	const_iterator      upper_bound(const range_type& key) const { return m_set.upper_bound( key ); }
-	iterator_pair       equal_range(const range_type& key)       { return m_set.equal_range( key ); }
-	const_iterator_pair equal_range(const range_type& key) const { return m_set.equal_range( key ); }
+	iterator            lower_bound(const range_type& key)       { return m_ranges.lower_bound( key ); }
+	const_iterator      lower_bound(const range_type& key) const { return m_ranges.lower_bound( key ); }
+	iterator            upper_bound(const range_type& key)       { return m_ranges.upper_bound( key ); }
+	const_iterator      upper_bound(const range_type& key) const { return m_ranges.upper_bound( key ); }
+	iterator_pair       equal_range(const range_type& key)       { return m_ranges.equal_range( key ); }
+	const_iterator_pair equal_range(const range_type& key) const { return m_ranges.equal_range( key ); }
 	iterator_pair       merge_range(const range_type& key)
 	{
 		iterator_pair sequence( equal_range( key ) );
-		if ( sequence.first != m_set.begin() && ( --sequence.first )->end() < key.begin() )
+		if ( sequence.first != m_ranges.begin() && ( --sequence.first )->end() < key.begin() )
 			++sequence.first;
-		if ( sequence.second != m_set.end() && sequence.second->begin() == key.end() )
+		if ( sequence.second != m_ranges.end() && sequence.second->begin() == key.end() )
 			++sequence.second;
 		return sequence;
 	}
 	const_iterator_pair merge_range(const range_type& key) const
 	{
 		const_iterator_pair sequence( equal_range( key ) );
-		if ( sequence.first != m_set.begin() && ( --sequence.first )->end() < key.begin() )
+		if ( sequence.first != m_ranges.begin() && ( --sequence.first )->end() < key.begin() )
 			++sequence.first;
-		if ( sequence.second != m_set.end() && sequence.second->begin() == key.end() )
+		if ( sequence.second != m_ranges.end() && sequence.second->begin() == key.end() )
 			++sequence.second;
 		return sequence;
 	}
@@ -185,17 +194,17 @@ public:
 	iterator random_range()
 	{
 		iterator result = begin();
-		if ( !empty() ) std::advance( result, common::getRandomNum<quint64>( 0u, size() - 1 ) );
+		if ( !empty() ) result = m_ranges.nth( common::getRandomNum<quint64>( 0u, size() - 1 ) );
 		return result;
 	}
 	const_iterator random_range() const
 	{
 		const_iterator result = begin();
-		if ( !empty() ) std::advance( result, common::getRandomNum<quint64>( 0u, size() - 1 ) );
+		if ( !empty() ) result = m_ranges.nth( common::getRandomNum<quint64>( 0u, size() - 1 ) );
 		return result;
 	}
 
-	bool overlaps(const range_type& key) const { return m_set.find( key ) != end(); }
+	bool overlaps(const range_type& key) const { return m_ranges.find( key ) != end(); }
 	bool overlaps(const List& rhs) const
 	{
 		return size() < rhs.size()
@@ -217,7 +226,7 @@ public:
 
 // Implementation
 private:
-	container_type m_set;
+	container_type m_ranges;
 	struct cmp_size : public std::binary_function< RangeT, RangeT, bool >
 	{
 		typename cmp_size::result_type operator()(typename cmp_size::first_argument_type lhs, typename cmp_size::second_argument_type rhs) const
@@ -238,10 +247,22 @@ private:
 
 // @inverse returns a list containing each range out of the base range 0..limit
 //          that is not part of the sourcelist
-// @complexity   ~O( n * log( n ) )
+// @complexity   ~O( n ), amortized
 template< class list_type >
 list_type inverse(const list_type& src);
 
+// @intersect returns a list containing each range that is part of both lists,
+//          with the limit of lhs
+// @complexity   ~O( n_lhs + n_rhs ), amortized
+template< class list_type >
+list_type intersect(const list_type& lhs, const list_type& rhs);
+
+// @subtract returns a list containing each range of lhs that is not part of rhs,
+//          with the limit of lhs
+// @complexity   ~O( n_lhs + n_rhs ), amortized
+template< class list_type >
+list_type subtract(const list_type& lhs, const list_type& rhs);
+
 } // namespace Ranges
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -263,8 +284,8 @@ typename RangeT::size_type List< RangeT, TraitsT, ContainerT >::insert(const Ran
 	if ( value.size() == 0 ) return 0;
 	iterator_pair sequence( merge_range( value ) );
 	return sequence.first != sequence.second
-		? Traits::merge_and_replace( m_set, sequence, value )
-		: Traits::simple_merge( m_set, sequence.first, value );
+		? Traits::merge_and_replace( m_ranges, sequence, value )
+		: Traits::simple_merge( m_ranges, sequence.first, value );
 }
 
 template< class RangeT, template< class, class > class TraitsT, class ContainerT >
@@ -281,7 +302,7 @@ typename RangeT::size_type List< RangeT, TraitsT, ContainerT >::insert(
 	iterator tmp( where );
 	return ( where == begin() || ( --tmp )->end() < value.begin() )
 			&& ( where == end() || value.end() < where->begin() )
-		? Traits::simple_merge( m_set, where, value )
+		? Traits::simple_merge( m_ranges, where, value )
 		: insert( value );
 }
 
@@ -299,13 +320,10 @@ typename RangeT::size_type List< RangeT, TraitsT, ContainerT >::erase(const Rang
 	if ( sequence.first == sequence.second ) return 0;
 	const range_type front( qMin( sequence.first->begin(), value.begin() ),
 		value.begin(), value.value() );
+	iterator last( sequence.second );
 	const range_type back( value.end(),
-		qMax( ( --sequence.second )->end(), value.end() ), value.value() );
-	range_size_type sum = 0;
-	for ( ++sequence.second; sequence.first != sequence.second; ) sum += erase( sequence.first++ );
-	sum -= insert( sequence.second, front );
-	sum -= insert( sequence.second, back );
-	return sum;
+		qMax( ( --last )->end(), value.end() ), value.value() );
+	return Traits::cut( m_ranges, sequence, front, back );
 }
 
 template< class list_type >
@@ -315,14 +333,57 @@ list_type inverse(const list_type& src)
 	typedef typename list_type::payload_type payload_type;
 	typedef typename list_type::range_size_type range_size_type;
 	typedef typename list_type::const_iterator const_iterator;
-	list_type result( src.limit() );
+	list_type result( src.limit(), src.get_allocator() );
 	range_size_type last = 0;
 	for ( const_iterator i = src.begin(); i != src.end(); ++i )
 	{
-		result.insert( range_type( last, i->begin() ) );
+		result.insert( result.end(), range_type( last, i->begin() ) );
 		last = i->end();
 	}
-	result.insert( range_type( last, src.limit() ) );
+	result.insert( result.end(), range_type( last, src.limit() ) );
+	return result;
+}
+
+template< class list_type >
+list_type intersect(const list_type& lhs, const list_type& rhs)
+{
+	typedef typename list_type::range_type range_type;
+	typedef typename list_type::range_size_type range_size_type;
+	typedef typename list_type::const_iterator const_iterator;
+	list_type result( lhs.limit(), lhs.get_allocator() );
+	const_iterator i = lhs.begin(), j = rhs.begin();
+	while ( i != lhs.end() && j != rhs.end() )
+	{
+		const range_size_type low = qMax( i->begin(), j->begin() );
+		const range_size_type high = qMin( i->end(), j->end() );
+		if ( low < high ) result.insert( result.end(), range_type( low, high, i->value() ) );
+		if ( i->end() < j->end() ) ++i;
+		else ++j;
+	}
+	return result;
+}
+
+template< class list_type >
+list_type subtract(const list_type& lhs, const list_type& rhs)
+{
+	typedef typename list_type::range_type range_type;
+	typedef typename list_type::range_size_type range_size_type;
+	typedef typename list_type::const_iterator const_iterator;
+	list_type result( lhs.limit(), lhs.get_allocator() );
+	const_iterator j = rhs.begin();
+	for ( const_iterator i = lhs.begin(); i != lhs.end(); ++i )
+	{
+		range_size_type low = i->begin();
+		while ( j != rhs.end() && j->end() <= low ) ++j;
+		for ( ; j != rhs.end() && j->begin() < i->end(); ++j )
+		{
+			if ( low < j->begin() ) result.insert( result.end(), range_type( low, j->begin(), i->value() ) );
+			low = j->end();
+			// a range reaching past i can cut the next ones as well
+			if ( low > i->end() ) break;
+		}
+		if ( low < i->end() ) result.insert( result.end(), range_type( low, i->end(), i->value() ) );
+	}
 	return result;
 }
 
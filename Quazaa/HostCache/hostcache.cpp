@@ -39,9 +39,20 @@
 
 CHostCache hostCache;
 
+template<>
+class qLess <CHostCacheHost*>
+{
+public:
+	inline bool operator()(const CHostCacheHost* l, const CHostCacheHost* r) const
+	{
+		return l->m_tTimestamp > r->m_tTimestamp;
+	}
+};
+
 CHostCache::CHostCache():
 	m_tLastSave( common::getTNowUTC() ),
-	m_nMaxCacheHosts( 3000 )
+	m_nMaxCacheHosts( 3000 ),
+	m_nQueueSequence( 0 )
 {
 }
 
@@ -83,7 +94,9 @@ CHostCacheHost* CHostCache::add(CEndPoint host, quint32 tTimeStamp)
 		int nMax = m_nMaxCacheHosts / 2;
 		while ( m_lHosts.size() > nMax )
 		{
-			delete m_lHosts.takeLast();
+			CHostCacheHost* pHost = m_lHosts.last();
+			unlink( m_lHosts.end() - 1 );
+			delete pHost;
 		}
 
 		save( tNow );
@@ -96,39 +109,40 @@ CHostCacheHost* CHostCache::add(CEndPoint host, quint32 tTimeStamp)
 		tTimeStamp = tNow - 60 ;
 	}
 
-	CHostCacheIterator itPrev = find( host );
+	CHostCacheHost* pPrev = m_lhAddressIndex.value( host, NULL );
 
-	if ( itPrev != m_lHosts.end() )
+	if ( pPrev )
 	{
-		return update( itPrev, tTimeStamp );
+		return update( find( pPrev ), tTimeStamp );
 	}
 
 	CHostCacheHost* pNew = new CHostCacheHost( host, tTimeStamp );
-
-	CHostCacheIterator it = qLowerBound( m_lHosts.begin(), m_lHosts.end(),
-										 pNew, qLess<CHostCacheHost*>() );
-	m_lHosts.insert( it, pNew );
+	insert( pNew );
 
 	return pNew;
 }
 
 CHostCacheIterator CHostCache::find(CEndPoint oHost)
 {
-	for ( CHostCacheIterator it = m_lHosts.begin(); it != m_lHosts.end(); ++it )
+	CHostCacheHost* pHost = m_lhAddressIndex.value( oHost, NULL );
+	return pHost ? find( pHost ) : m_lHosts.end();
+}
+
+CHostCacheIterator CHostCache::find(CHostCacheHost *pHost)
+{
+	// m_lHosts is sorted by timestamp, so only hosts sharing the timestamp of pHost need to be checked.
+	CHostCacheIterator it = qLowerBound( m_lHosts.begin(), m_lHosts.end(),
+										 pHost, qLess<CHostCacheHost*>() );
+
+	for ( ; it != m_lHosts.end() && (*it)->m_tTimestamp == pHost->m_tTimestamp; ++it )
 	{
-		if ( (*it)->m_oAddress == oHost )
+		if ( *it == pHost )
 			return it;
 	}
 
 	return m_lHosts.end();
 }
 
-CHostCacheIterator CHostCache::find(CHostCacheHost *pHost)
-{
-	CHostCacheIterator it = qFind( m_lHosts.begin(), m_lHosts.end(), pHost );
-	return it;
-}
-
 CHostCacheHost* CHostCache::update(CEndPoint oHost, const quint32 tTimeStamp)
 {
 	CHostCacheIterator it = find( oHost );
@@ -152,9 +166,9 @@ CHostCacheHost* CHostCache::update(CHostCacheHost* pHost, const quint32 tTimeSta
 CHostCacheHost* CHostCache::update(CHostCacheIterator itHost, const quint32 tTimeStamp)
 {
 	CHostCacheHost* pHost = *itHost;
-	m_lHosts.erase( itHost );
+	unlink( itHost );
 	pHost->m_tTimestamp = tTimeStamp;
-	m_lHosts.prepend( pHost );
+	insert( pHost );
 	return pHost;
 }
 
@@ -164,7 +178,7 @@ void CHostCache::remove(CHostCacheHost* pRemove)
 
 	if ( it != m_lHosts.end() )
 	{
-		m_lHosts.erase( it );
+		unlink( it );
 	}
 
 	delete pRemove;
@@ -176,8 +190,9 @@ void CHostCache::remove(CEndPoint oHost)
 
 	if ( it != m_lHosts.end() )
 	{
-		delete *it;
-		m_lHosts.erase( it );
+		CHostCacheHost* pHost = *it;
+		unlink( it );
+		delete pHost;
 	}
 }
 
@@ -260,17 +275,53 @@ QString CHostCache::getXTry()
 
 void CHostCache::onFailure(CEndPoint addr)
 {
-	CHostCacheIterator itHost = find( addr );
+	CHostCacheHost* pHost = m_lhAddressIndex.value( addr, NULL );
 
-	if ( itHost != m_lHosts.end() )
+	if ( pHost )
 	{
-		if ( (int)(++(*itHost)->m_nFailures) > quazaaSettings.Connection.FailureLimit )
+		if ( (int)(++pHost->m_nFailures) > quazaaSettings.Connection.FailureLimit )
 		{
-			remove( addr );
+			remove( pHost );
 		}
+		else
+		{
+			dequeue( pHost );
+			enqueue( pHost );
+		}
+	}
+}
+
+/**
+ * @brief onSuccess resets the failure counter of a host and moves it back to the front of the
+ * connection queues. Always use this instead of modifying m_nFailures directly.
+ * Locking: RW
+ */
+void CHostCache::onSuccess(CHostCacheHost* pHost)
+{
+	ASSUME_LOCK( hostCache.m_pSection );
+
+	if ( pHost->m_nFailures )
+	{
+		dequeue( pHost );
+		pHost->m_nFailures = 0;
+		enqueue( pHost );
 	}
 }
 
+/**
+ * @brief onConnectAttempt records a connection attempt to a host and moves it to the throttled
+ * hosts of its queue. Always use this instead of modifying m_tLastConnect directly.
+ * Locking: RW
+ */
+void CHostCache::onConnectAttempt(CHostCacheHost* pHost, const quint32 tNow)
+{
+	ASSUME_LOCK( hostCache.m_pSection );
+
+	dequeue( pHost );
+	pHost->m_tLastConnect = tNow;
+	enqueue( pHost );
+}
+
 CHostCacheHost* CHostCache::get()
 {
 	CHostCacheHost* pHost = NULL;
@@ -281,7 +332,7 @@ CHostCacheHost* CHostCache::get()
 	}
 
 	pHost = m_lHosts.first();
-	m_lHosts.removeFirst();
+	unlink( m_lHosts.begin() );
 
 	return pHost;
 }
@@ -289,35 +340,67 @@ CHostCacheHost* CHostCache::get()
 CHostCacheHost* CHostCache::getConnectable(const quint32 tNow, QList<CHostCacheHost*> oExcept,
 										   QString sCountry)
 {
-	// TODO: getConnectable should return things with m_tLastConnect either null or when "expired"
-
-
-	bool bCountry = ( sCountry != "ZZ" );
-
 	if ( m_lHosts.isEmpty() )
 	{
 		return NULL;
 	}
 
+	const QSet<CHostCacheHost*> lsExcept = oExcept.toSet();
+
+	if ( sCountry != "ZZ" )
+	{
+		QHash<CountryID, QVector<CHostCacheQueue> >::iterator itCountry =
+				m_lhCountryQueues.find( CGeoIPList::countryID( sCountry ) );
+
+		if ( itCountry == m_lhCountryQueues.end() )
+		{
+			return NULL;
+		}
+
+		return getConnectable( itCountry.value(), tNow, lsExcept );
+	}
+
+	return getConnectable( m_vConnectQueues, tNow, lsExcept );
+}
+
+/**
+  * Helper method for getConnectable()
+  * Requires Locking: RW
+  */
+CHostCacheHost* CHostCache::getConnectable(QVector<CHostCacheQueue>& vQueues, const quint32 tNow,
+										   const QSet<CHostCacheHost*>& lsExcept)
+{
+	const int nLevels = qMin( vQueues.size(), quazaaSettings.Connection.FailureLimit );
+
 	// First try untested or working hosts, then fall back to failed hosts to increase chances for
-	// successful connection
-	for ( int nFailures = 0; nFailures < quazaaSettings.Connection.FailureLimit; ++nFailures )
+	// successful connection. Within each failure level, the most recently seen connectable host wins.
+	for ( int nFailures = 0; nFailures < nLevels; ++nFailures )
 	{
-		foreach ( CHostCacheHost * pHost, m_lHosts )
+		const quint32 tThrottle = quazaaSettings.Gnutella.ConnectThrottle +
+								  nFailures * quazaaSettings.Connection.FailurePenalty;
+
+		CHostCacheQueue& oQueue = vQueues[nFailures];
+
+		// Release the hosts whose throttle has run out. The waiting hosts are ordered by their last
+		// connection attempt, so this stops at the first host that is still throttled.
+		while ( !oQueue.m_lWaiting.isEmpty() )
 		{
-			if ( nFailures != pHost->m_nFailures )
-				continue;
+			CHostCacheHost* pHost = oQueue.m_lWaiting.first();
 
-			if ( bCountry && geoIP.findCountryCode(pHost->m_oAddress.toIPv4Address()) != sCountry )
-			{
-				continue;
-			}
+			if ( tNow - pHost->m_tLastConnect <= tThrottle )
+				break;
 
-			if ( tNow - pHost->m_tLastConnect > ( quazaaSettings.Gnutella.ConnectThrottle +
-												  pHost->m_nFailures * quazaaSettings.Connection.FailurePenalty ) )
+			oQueue.m_lWaiting.erase( oQueue.m_lWaiting.begin() );
+			oQueue.m_lDue.insert( pHost->m_nQueueKey, pHost );
+		}
+
+		// Only hosts the caller explicitly excluded are skipped over here.
+		for ( QMap<quint64, CHostCacheHost*>::const_iterator it = oQueue.m_lDue.constBegin();
+			  it != oQueue.m_lDue.constEnd(); ++it )
+		{
+			if ( !lsExcept.contains( it.value() ) )
 			{
-				if ( !oExcept.contains( pHost ) )
-					return pHost;
+				return it.value();
 			}
 		}
 	}
@@ -396,8 +479,10 @@ void CHostCache::load()
 				if ( tLastConnect - tNow > 0 )
 					tLastConnect = tNow - 60;
 
+				dequeue( pHost );
 				pHost->m_nFailures    = nFailures;
 				pHost->m_tLastConnect = tLastConnect;
+				enqueue( pHost );
 			}
 
 			--nCount;
@@ -423,8 +508,11 @@ void CHostCache::pruneOldHosts(const quint32 tNow)
 		it.previous();
 		if ( (qint64)( tNow - it.value()->m_tTimestamp ) > quazaaSettings.Gnutella2.HostExpire )
 		{
-			delete it.value();
+			CHostCacheHost* pHost = it.value();
+			m_lhAddressIndex.remove( pHost->m_oAddress );
+			dequeue( pHost );
 			it.remove();
+			delete pHost;
 		}
 		else
 		{
@@ -439,8 +527,9 @@ void CHostCache::pruneByQueryAck(const quint32 tNow)
 	{
 		if ( (*it)->m_tAck && tNow - (*it)->m_tAck > quazaaSettings.Gnutella2.QueryHostDeadline )
 		{
-			delete *it;
-			it = m_lHosts.erase( it );
+			CHostCacheHost* pHost = *it;
+			it = unlink( it );
+			delete pHost;
 		}
 		else
 		{
@@ -478,3 +567,110 @@ quint32 CHostCache::writeToFile(const void * const pManager, QFile& oFile)
 	return nCount;
 }
 
+/**
+  * Inserts a host into the timestamp sorted list, the address index and the connection queues.
+  * Requires Locking: RW
+  */
+void CHostCache::insert(CHostCacheHost* pHost)
+{
+	CHostCacheIterator it = qLowerBound( m_lHosts.begin(), m_lHosts.end(),
+										 pHost, qLess<CHostCacheHost*>() );
+	m_lHosts.insert( it, pHost );
+	m_lhAddressIndex.insert( pHost->m_oAddress, pHost );
+	enqueue( pHost );
+}
+
+/**
+  * Removes a host from all containers without deleting it.
+  * Requires Locking: RW
+  * @return an iterator pointing to the host following the removed one
+  */
+CHostCacheIterator CHostCache::unlink(CHostCacheIterator itHost)
+{
+	CHostCacheHost* pHost = *itHost;
+	m_lhAddressIndex.remove( pHost->m_oAddress );
+	dequeue( pHost );
+	return m_lHosts.erase( itHost );
+}
+
+/**
+  * Adds a host to the connection queue matching its failure count. Hosts with more failures than
+  * allowed share the last queue, which is never used by getConnectable().
+  * Requires Locking: RW
+  */
+void CHostCache::enqueue(CHostCacheHost* pHost)
+{
+	const quint32 nLevel = qMin( pHost->m_nFailures, (quint32)quazaaSettings.Connection.FailureLimit );
+
+	// Most recently seen hosts first; among hosts sharing a timestamp, the last inserted host wins.
+	// Throttled hosts are ordered by their last connection attempt, using the same tie breaker.
+	const quint32 nSequence = ~m_nQueueSequence++;
+	pHost->m_nQueueFailures = nLevel;
+	pHost->m_nQueueKey      = ( (quint64)( ~pHost->m_tTimestamp ) << 32 ) | nSequence;
+	pHost->m_nWaitKey       = ( (quint64)pHost->m_tLastConnect << 32 ) | nSequence;
+
+	if ( (quint32)m_vConnectQueues.size() <= nLevel )
+	{
+		m_vConnectQueues.resize( nLevel + 1 );
+	}
+
+	enqueue( m_vConnectQueues[nLevel], pHost );
+
+	QVector<CHostCacheQueue>& vCountryQueues = m_lhCountryQueues[pHost->m_nCountry];
+	if ( (quint32)vCountryQueues.size() <= nLevel )
+	{
+		vCountryQueues.resize( nLevel + 1 );
+	}
+
+	enqueue( vCountryQueues[nLevel], pHost );
+}
+
+/**
+  * Removes a host from its connection queue.
+  * Requires Locking: RW
+  */
+void CHostCache::dequeue(CHostCacheHost* pHost)
+{
+	if ( (quint32)m_vConnectQueues.size() > pHost->m_nQueueFailures )
+	{
+		dequeue( m_vConnectQueues[pHost->m_nQueueFailures], pHost );
+	}
+
+	QHash<CountryID, QVector<CHostCacheQueue> >::iterator itCountry =
+			m_lhCountryQueues.find( pHost->m_nCountry );
+
+	if ( itCountry != m_lhCountryQueues.end() &&
+		 (quint32)itCountry.value().size() > pHost->m_nQueueFailures )
+	{
+		dequeue( itCountry.value()[pHost->m_nQueueFailures], pHost );
+	}
+}
+
+/**
+  * Adds a host to a single queue. Hosts that have been tried before start out as throttled; they
+  * are moved to the connectable hosts by getConnectable() once their throttle has run out.
+  * Requires Locking: RW
+  */
+void CHostCache::enqueue(CHostCacheQueue& oQueue, CHostCacheHost* pHost)
+{
+	if ( pHost->m_tLastConnect )
+	{
+		oQueue.m_lWaiting.insert( pHost->m_nWaitKey, pHost );
+	}
+	else
+	{
+		oQueue.m_lDue.insert( pHost->m_nQueueKey, pHost );
+	}
+}
+
+/**
+  * Removes a host from a single queue, wherever it currently is within that queue.
+  * Requires Locking: RW
+  */
+void CHostCache::dequeue(CHostCacheQueue& oQueue, CHostCacheHost* pHost)
+{
+	if ( !oQueue.m_lDue.remove( pHost->m_nQueueKey ) )
+	{
+		oQueue.m_lWaiting.remove( pHost->m_nWaitKey );
+	}
+}
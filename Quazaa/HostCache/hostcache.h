@@ -25,7 +25,11 @@
 #ifndef HOSTCACHE_H
 #define HOSTCACHE_H
 
+#include <QHash>
+#include <QMap>
 #include <QMutex>
+#include <QSet>
+#include <QVector>
 
 #include "hostcachehost.h"
 
@@ -39,17 +43,32 @@ class QFile;
 
 typedef QList<CHostCacheHost*>::iterator CHostCacheIterator;
 
+// Connection candidates sharing a failure count. All hosts of a queue share the same connect
+// throttle, so ordering the throttled hosts by their last connection attempt also orders them by
+// the time they become connectable again.
+struct CHostCacheQueue
+{
+	QMap<quint64, CHostCacheHost*> m_lDue;     // connectable hosts, most recently seen first
+	QMap<quint64, CHostCacheHost*> m_lWaiting; // hosts inside their connect throttle, oldest attempt first
+};
+
 class CHostCache
 {
 
 public:
-	QList<CHostCacheHost*>  m_lHosts;
+	QList<CHostCacheHost*>  m_lHosts;       // sorted by timestamp, most recent hosts first
 	mutable QMutex          m_pSection;
 	quint32                 m_tLastSave;
 
 	quint32                 m_nMaxCacheHosts;
 	QString                 m_sMessage;
 
+private:
+	QHash<CEndPoint, CHostCacheHost*> m_lhAddressIndex;
+	QVector<CHostCacheQueue>          m_vConnectQueues; // one queue per failure count
+	QHash<CountryID, QVector<CHostCacheQueue> > m_lhCountryQueues; // the same, per country
+	quint32                           m_nQueueSequence;
+
 public:
 	CHostCache();
 	~CHostCache();
@@ -73,6 +92,8 @@ public:
 	QString getXTry();
 
 	void onFailure(CEndPoint addr);
+	void onSuccess(CHostCacheHost* pHost);
+	void onConnectAttempt(CHostCacheHost* pHost, const quint32 tNow);
 	CHostCacheHost* get();
 	CHostCacheHost* getConnectable(const quint32 tNow = common::getTNowUTC(),
 	                               QList<CHostCacheHost*> oExcept = QList<CHostCacheHost*>(),
@@ -88,12 +109,21 @@ public:
 
 	inline quint32 count();
 	inline bool isEmpty();
+
+private:
+	void insert(CHostCacheHost* pHost);
+	CHostCacheIterator unlink(CHostCacheIterator itHost);
+	void enqueue(CHostCacheHost* pHost);
+	void dequeue(CHostCacheHost* pHost);
+	CHostCacheHost* getConnectable(QVector<CHostCacheQueue>& vQueues, const quint32 tNow,
+								   const QSet<CHostCacheHost*>& lsExcept);
+	static void enqueue(CHostCacheQueue& oQueue, CHostCacheHost* pHost);
+	static void dequeue(CHostCacheQueue& oQueue, CHostCacheHost* pHost);
 };
 
 CHostCacheHost* CHostCache::take(CEndPoint oHost)
 {
-	CHostCacheIterator it = find( oHost );
-	return it == m_lHosts.end() ? NULL : *it;
+	return m_lhAddressIndex.value( oHost, NULL );
 }
 CHostCacheHost* CHostCache::take(CHostCacheHost *pHost)
 {
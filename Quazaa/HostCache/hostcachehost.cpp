@@ -23,16 +23,7 @@
 */
 
 #include "hostcachehost.h"
-
-template<>
-class qLess <CHostCacheHost*>
-{
-public:
-	inline bool operator()(const CHostCacheHost* l, const CHostCacheHost* r) const
-	{
-		return l->m_tTimestamp > r->m_tTimestamp;
-	}
-};
+#include "hostcache.h"
 
 CHostCacheHost::CHostCacheHost(CEndPoint oAddress, quint32 tTimestamp) :
 	m_oAddress( oAddress ),
@@ -44,7 +35,11 @@ CHostCacheHost::CHostCacheHost(CEndPoint oAddress, quint32 tTimestamp) :
 	m_tLastQuery(   0 ),
 	m_tRetryAfter(  0 ),
 	m_tLastConnect( 0 ),
-	m_nFailures(    0 )
+	m_nFailures(    0 ),
+	m_nCountry( geoIP.findCountryID( oAddress ) ),
+	m_nQueueKey(    0 ),
+	m_nWaitKey(     0 ),
+	m_nQueueFailures( 0 )
 {
 }
 
@@ -84,7 +79,7 @@ bool CHostCacheHost::canQuery(const quint32 tNow)
 void CHostCacheHost::setKey(quint32 nKey, const quint32 tNow, CEndPoint* pHost)
 {
 	m_tAck      = 0;
-	m_nFailures = 0;
+	hostCache.onSuccess( this );
 	m_nQueryKey = nKey;
 	m_nKeyTime  = tNow;
 	m_nKeyHost  = pHost ? *pHost : Network.getLocalAddress();
@@ -28,6 +28,7 @@
 #include "types.h"
 #include "network.h"
 #include "quazaasettings.h"
+#include "geoiplist.h"
 
 class CHostCacheHost
 {
@@ -45,8 +46,13 @@ public:
 	quint32     m_tRetryAfter;  // kiedy mozna ponowic?
 	quint32     m_tLastConnect; // kiedy ostatnio sie polaczylismy?
 	quint32     m_nFailures;
+	CountryID   m_nCountry;     // looked up once when the host is created
 
 private:
+	quint64     m_nQueueKey;      // position in the connection queue, maintained by CHostCache
+	quint64     m_nWaitKey;       // position in the throttled hosts queue, maintained by CHostCache
+	quint32     m_nQueueFailures; // failure count the host has been queued with
+
 	CHostCacheHost(CEndPoint oAddress, quint32 tTimestamp);
 public:
 	~CHostCacheHost();
@@ -44,6 +44,9 @@ CDownloadsTreeModel::CDownloadsTreeModel(QObject *parent) :
 	rootItem = new CDownloadsItemBase(this);
 	connect(&Downloads, SIGNAL(downloadAdded(CDownload*)), this, SLOT(onDownloadAdded(CDownload*)), Qt::QueuedConnection);
 	QMetaObject::invokeMethod(&Downloads, "emitDownloads");
+
+	connect(&m_oStatsTimer, SIGNAL(timeout()), this, SLOT(updateStats()));
+	m_oStatsTimer.start(1000);
 }
 
 CDownloadsTreeModel::~CDownloadsTreeModel()
@@ -218,6 +221,38 @@ void CDownloadsTreeModel::onDownloadAdded(CDownload *pDownload)
 	endInsertRows();
 }
 
+/**
+  * Refreshes rates and byte counts from the transfer stats of the downloads and their sources.
+  * Skips a round rather than blocking the GUI when the transfers thread holds the lock.
+  */
+void CDownloadsTreeModel::updateStats()
+{
+	if( !rootItem->childCount() || !Downloads.m_pSection.tryLock() )
+		return;
+
+	const qint64 tNow = CTransferStats::now();
+
+	for( int i = 0; i < rootItem->childCount(); ++i )
+	{
+		static_cast<CDownloadItem*>(rootItem->child(i))->updateStats(tNow);
+	}
+
+	Downloads.m_pSection.unlock();
+
+	emit dataChanged(index(0, BANDWIDTH), index(rootItem->childCount() - 1, COMPLETED));
+
+	for( int i = 0; i < rootItem->childCount(); ++i )
+	{
+		CDownloadsItemBase* pItem = rootItem->child(i);
+
+		if( pItem->childCount() )
+		{
+			QModelIndex idxParent = index(i, 0);
+			emit dataChanged(index(0, BANDWIDTH, idxParent), index(pItem->childCount() - 1, COMPLETED, idxParent));
+		}
+	}
+}
+
 
 
 CDownloadsItemBase::CDownloadsItemBase(QObject *parent)
@@ -397,6 +432,21 @@ QVariant CDownloadItem::data(int column) const
 	}
 }
 
+// Requires Locking: Downloads
+void CDownloadItem::updateStats(qint64 tNow)
+{
+	if( !Downloads.exists(m_pDownload) )
+		return;
+
+	m_nBandwidth = m_pDownload->m_oStats.m_oRate.rate(tNow);
+	m_nCompleted = m_pDownload->m_nCompletedSize;
+
+	for( int i = 0; i < childCount(); ++i )
+	{
+		static_cast<CDownloadSourceItem*>(child(i))->updateStats(m_pDownload, tNow);
+	}
+}
+
 void CDownloadItem::onSourceAdded(CDownloadSource *pSource)
 {
 	QMutexLocker l(&Downloads.m_pSection);
@@ -506,6 +556,16 @@ QVariant CDownloadSourceItem::data(int column) const
 	}
 }
 
+// Requires Locking: Downloads
+void CDownloadSourceItem::updateStats(CDownload* pDownload, qint64 tNow)
+{
+	if( !pDownload->sourceExists(m_pDownloadSource) )
+		return;
+
+	m_nBandwidth = m_pDownloadSource->m_oStats.m_oRate.rate(tNow);
+	m_nDownloaded = m_pDownloadSource->m_oStats.m_nBytes;
+}
+
 QString CDownloadSourceItem::getCountryCode()
 {
 	return m_sCountryCode;
@@ -32,6 +32,7 @@
 
 #include <QItemDelegate>
 #include <QPalette>
+#include <QTimer>
 
 class CDownload;
 class CDownloadSource;
@@ -78,6 +79,7 @@ public:
 
 	void appendChild(CDownloadsItemBase* child);
 	QVariant data(int column) const;
+	void updateStats(qint64 tNow);
 protected:
 	CDownload* m_pDownload; // pointer to corresponding CDownload object
 
@@ -111,6 +113,7 @@ public:
 
 	void appendChild(CDownloadsItemBase* child);
 	QVariant data(int column) const;
+	void updateStats(CDownload* pDownload, qint64 tNow);
 protected:
 	CDownloadSource* m_pDownloadSource; // pointer to corresponding CDownloadSource object
 
@@ -168,10 +171,12 @@ public:
 private:
 	CDownloadsItemBase* rootItem;
 	CFileIconProvider* m_pIconProvider;
+	QTimer m_oStatsTimer;
 signals:
 
 public slots:
 	void onDownloadAdded(CDownload* pDownload);
+	void updateStats();
 
 	friend class CDownloadItem;
 };
@@ -255,18 +260,14 @@ public:
 
 			if( item->m_nSize != -1 )
 			{
-				Fragments::List completedFrags(item->m_nSize);
-
-				for( Fragments::List::iterator it = item->m_oCompletedFrags.begin(); it != item->m_oCompletedFrags.end(); it++ )
-				{
-					completedFrags.insert(*it);
-				}
+				Fragments::List completedFrags(item->m_oCompletedFrags);
 
 				for( int i = 0; i < item->childCount(); i++ )
 				{
 					CDownloadSourceItem* sourceItem = static_cast<CDownloadSourceItem*>(item->child(i));
 
-					completedFrags.erase(sourceItem->m_oDownloaded.begin(), sourceItem->m_oDownloaded.end());
+					Fragments::List oRemaining = subtract(completedFrags, sourceItem->m_oDownloaded);
+					completedFrags.swap(oRemaining);
 
 					QColor thisColor = QColor::fromHsl(qHash(sourceItem->m_sAddress) % 359, 255, 64);
 
@@ -30,6 +30,7 @@
 #include "Hashes/hash.h"
 #include "fileiconprovider.h"
 #include "networkiconprovider.h"
+#include "securitymanager.h"
 
 #include "debug_new.h"
 
@@ -51,6 +52,8 @@ SearchTreeModel::SearchTreeModel() :
 				 << "Country";
 	rootItem = new SearchTreeItem( rootItemData );
 	nFileCount = 0;
+
+	connect( &securityManager, SIGNAL( performSanityCheck() ), this, SLOT( sanityCheck() ) );
 }
 
 SearchTreeModel::~SearchTreeModel()
@@ -95,6 +98,76 @@ void SearchTreeModel::removeQueryHit(int position, const QModelIndex &parent)
 	}
 }
 
+/**
+  * Qt slot. Starts checking all hits against the rules loaded for the current sanity check. Hit
+  * content and sender addresses are checked by the thread pool while the GUI keeps running; the
+  * denied hits are removed in sanityCheckFinished().
+  */
+void SearchTreeModel::sanityCheck()
+{
+	CSanityRuleSetPtr pRules = securityManager.sanityRules();
+
+	if ( !pRules )
+	{
+		QMetaObject::invokeMethod( &securityManager, "sanityCheckPerformed", Qt::QueuedConnection );
+		return;
+	}
+
+	m_lSanityHits.clear();
+
+	for ( int i = 0; i < rootItem->childCount(); ++i )
+	{
+		SearchTreeItem* pFileItem = rootItem->child( i );
+		for ( int j = 0; j < pFileItem->childCount(); ++j )
+		{
+			m_lSanityHits.append( pFileItem->child( j )->HitData.pQueryHit );
+		}
+	}
+
+	CSanityCheckJob* pJob = CSanityCheckJob::checkHits( pRules, m_lSanityHits );
+	connect( pJob, SIGNAL( finished( QList<int> ) ), this, SLOT( sanityCheckFinished( QList<int> ) ) );
+	pJob->start();
+}
+
+/**
+  * Qt slot. Removes the hits found denied by the sanity check job in a single pass. Hits that
+  * have been removed from the model while the job was running are ignored.
+  */
+void SearchTreeModel::sanityCheckFinished(QList<int> lDenied)
+{
+	QSet<const CQueryHit*> lsDenied;
+	foreach ( int nIndex, lDenied )
+		lsDenied.insert( m_lSanityHits.at( nIndex ).data() );
+
+	if ( !lsDenied.isEmpty() )
+	{
+		beginResetModel();
+
+		for ( int i = rootItem->childCount() - 1; i >= 0; --i )
+		{
+			SearchTreeItem* pFileItem = rootItem->child( i );
+			for ( int j = pFileItem->childCount() - 1; j >= 0; --j )
+			{
+				if ( lsDenied.contains( pFileItem->child( j )->HitData.pQueryHit.data() ) )
+					pFileItem->removeChild( j );
+			}
+
+			if ( pFileItem->childCount() )
+				pFileItem->updateHitCount( pFileItem->childCount() );
+			else
+				rootItem->removeChild( i );
+		}
+
+		nFileCount = rootItem->childCount();
+
+		endResetModel();
+
+		emit updateStats();
+	}
+
+	m_lSanityHits.clear();
+}
+
 int SearchTreeModel::columnCount(const QModelIndex& parent) const
 {
 	if ( parent.isValid() )
@@ -112,6 +112,8 @@ private:
 
 	SearchTreeItem*    rootItem;
 
+	QList<QueryHitSharedPtr> m_lSanityHits; // hits of the running sanity check, by job index
+
 public:
 	SearchTreeModel();
 	~SearchTreeModel();
@@ -140,9 +142,11 @@ public slots:
 	void clear();
 	bool isRoot(QModelIndex index);
 	void removeQueryHit(int position, const QModelIndex &parent);
+	void sanityCheck();
 
 private slots:
 	void addQueryHit(QueryHitSharedPtr pHit);
+	void sanityCheckFinished(QList<int> lDenied);
 };
 
 #endif // SEARCHTREEMODEL_H
@@ -25,12 +25,26 @@
 
 #include "hash.h"
 #include "systemlog.h"
+#include "sha1.h"
+#include "tigertree.h"
 #include <QCryptographicHash>
 #include "3rdparty/CyoEncode/CyoEncode.h"
 #include "3rdparty/CyoEncode/CyoDecode.h"
 
 #include "debug_new.h"
 
+// eDonkey hashes files in parts of this size; the ED2K hash is the MD4 of the part hashes.
+static const quint32 ED2K_PART_SIZE = 9728000;
+
+struct CED2KContext
+{
+	QCryptographicHash	oPart;
+	quint32				nPart;		// bytes hashed into oPart
+	QByteArray			baParts;	// MD4s of all completed parts
+
+	CED2KContext() : oPart( QCryptographicHash::Md4 ), nPart( 0 ) {}
+};
+
 CHash::CHash(const CHash &rhs) //Right Hash Set
 {
 	if ( !rhs.m_bFinalized )
@@ -52,7 +66,7 @@ CHash::CHash(Algorithm algo)
 	switch( algo )
 	{
 	case CHash::SHA1:
-		m_pContext = new QCryptographicHash( QCryptographicHash::Sha1 );
+		m_pContext = new CSHA1();
 		break;
 	case CHash::MD4:
 		m_pContext = new QCryptographicHash( QCryptographicHash::Md4 );
@@ -60,6 +74,12 @@ CHash::CHash(Algorithm algo)
 	case CHash::MD5:
 		m_pContext = new QCryptographicHash( QCryptographicHash::Md5 );
 		break;
+	case CHash::ED2K:
+		m_pContext = new CED2KContext();
+		break;
+	case CHash::TIGERTREE:
+		m_pContext = new CTigerTree();
+		break;
 	default:
 		m_pContext = 0; /* error? */
 	}
@@ -84,9 +104,18 @@ CHash::~CHash()
 		switch( m_nHashAlgorithm )
 		{
 		case CHash::SHA1:
+			delete ( (CSHA1*)m_pContext );
+			break;
 		case CHash::MD5:
 		case CHash::MD4:
 			delete ( (QCryptographicHash*)m_pContext );
+			break;
+		case CHash::ED2K:
+			delete ( (CED2KContext*)m_pContext );
+			break;
+		case CHash::TIGERTREE:
+			delete ( (CTigerTree*)m_pContext );
+			break;
 		}
 	}
 }
@@ -102,6 +131,10 @@ int CHash::byteCount(int algo)
 		return 16;
 	case CHash::MD5:
 		return 16;
+	case CHash::ED2K:
+		return 16;
+	case CHash::TIGERTREE:
+		return 24;
 	default:
 		return 0;
 	}
@@ -132,7 +165,7 @@ CHash* CHash::fromURN(QString sURN)
 		{
 			// valid sha1/base32
 			cyoBase32Decode( (char*)&pVal, baValue.data(), baValue.length() );
-			CHash* pRet = new CHash(QByteArray( (char*)&pVal ), CHash::SHA1);
+			CHash* pRet = new CHash( QByteArray( pVal, 20 ), CHash::SHA1 );
 			return pRet;
 		}
 	}
@@ -141,10 +174,32 @@ CHash* CHash::fromURN(QString sURN)
 		if(cyoBase16Validate(baValue.data(), baValue.length()) == 0)
 		{
 			cyoBase16Decode((char*)&pVal, baValue.data(), baValue.length());
-			CHash* pRet = new CHash(QByteArray((char*)&pVal), CHash::MD5);
+			CHash* pRet = new CHash(QByteArray(pVal, 16), CHash::MD5);
 			return pRet;
 		}
 	}
+	else if ( ( baFamily == "ed2k" || baFamily == "ed2khash" ) && baValue.length() == 32 )
+	{
+		if ( cyoBase16Validate( baValue.data(), baValue.length() ) == 0 )
+		{
+			cyoBase16Decode( (char*)&pVal, baValue.data(), baValue.length() );
+			return new CHash( QByteArray( pVal, 16 ), CHash::ED2K );
+		}
+	}
+	else if ( baFamily == "tree" && baValue.startsWith( "tiger:" ) )
+	{
+		// urn:tree:tiger:<39 base32 characters>, the decoder needs the padding back
+		baValue = baValue.mid( 6 );
+		if ( baValue.length() == 39 )
+		{
+			baValue.append( '=' );
+			if ( cyoBase32Validate( baValue.data(), baValue.length() ) == 0 )
+			{
+				cyoBase32Decode( (char*)&pVal, baValue.data(), baValue.length() );
+				return new CHash( QByteArray( pVal, 24 ), CHash::TIGERTREE );
+			}
+		}
+	}
 
 	return 0;
 }
@@ -191,6 +246,10 @@ QString CHash::toURN() const
 			return QString( "urn:sha1:" ) + toString();
 		case CHash::MD5:
 			return QString("urn:md5:") + toString();
+		case CHash::ED2K:
+			return QString( "urn:ed2k:" ) + toString();
+		case CHash::TIGERTREE:
+			return QString( "urn:tree:tiger:" ) + toString();
 		case CHash::MD4:
 			break;
 	}
@@ -212,6 +271,13 @@ QString CHash::toString() const
 		case CHash::MD5:
 			cyoBase16Encode((char*)&pBuff, rawValue().data(), 16);
 			break;
+		case CHash::ED2K:
+			cyoBase16Encode( (char*)&pBuff, rawValue().data(), 16 );
+			break;
+		case CHash::TIGERTREE:
+			cyoBase32Encode( (char*)&pBuff, rawValue().data(), 24 );
+			pBuff[39] = 0; // strip the padding
+			break;
 		case CHash::MD4:
 			break;
 	}
@@ -228,13 +294,41 @@ void CHash::finalize()
 		switch(m_nHashAlgorithm)
 		{
 		case CHash::SHA1:
+			m_baRawValue = ((CSHA1*)m_pContext)->result();
+			delete((CSHA1*)m_pContext);
+			break;
 		case CHash::MD5:
 		case CHash::MD4:
 			m_baRawValue = ((QCryptographicHash*)m_pContext)->result();
 			delete((QCryptographicHash*)m_pContext);
-			m_pContext = 0;
-			m_bFinalized = true;
+			break;
+		case CHash::ED2K:
+		{
+			CED2KContext* pContext = (CED2KContext*)m_pContext;
+
+			// Files of less than one part use the part hash directly. Otherwise the hash of the
+			// last, possibly empty part is appended (eMule's convention for exact multiples).
+			if ( pContext->baParts.isEmpty() )
+			{
+				m_baRawValue = pContext->oPart.result();
+			}
+			else
+			{
+				pContext->baParts.append( pContext->oPart.result() );
+				m_baRawValue = QCryptographicHash::hash( pContext->baParts, QCryptographicHash::Md4 );
+			}
+
+			delete pContext;
+			break;
 		}
+		case CHash::TIGERTREE:
+			m_baRawValue = ((CTigerTree*)m_pContext)->finalize();
+			delete((CTigerTree*)m_pContext);
+			break;
+		}
+
+		m_pContext = 0;
+		m_bFinalized = true;
 	}
 }
 
@@ -245,9 +339,36 @@ void CHash::addData(const char *pData, quint32 nLength)
 	switch( m_nHashAlgorithm )
 	{
 	case CHash::SHA1:
+		( (CSHA1*)m_pContext )->addData( pData, nLength );
+		break;
 	case CHash::MD5:
 	case CHash::MD4:
 		( (QCryptographicHash*)m_pContext )->addData( pData, nLength );
+		break;
+	case CHash::ED2K:
+	{
+		CED2KContext* pContext = (CED2KContext*)m_pContext;
+
+		while ( nLength )
+		{
+			const quint32 nChunk = qMin( nLength, ED2K_PART_SIZE - pContext->nPart );
+			pContext->oPart.addData( pData, nChunk );
+			pContext->nPart += nChunk;
+			pData += nChunk;
+			nLength -= nChunk;
+
+			if ( pContext->nPart == ED2K_PART_SIZE )
+			{
+				pContext->baParts.append( pContext->oPart.result() );
+				pContext->oPart.reset();
+				pContext->nPart = 0;
+			}
+		}
+		break;
+	}
+	case CHash::TIGERTREE:
+		( (CTigerTree*)m_pContext )->addData( pData, nLength );
+		break;
 	}
 }
 void CHash::addData(QByteArray baData)
@@ -265,11 +386,56 @@ QString CHash::getFamilyName()
 		return QString( "md5" );
 	case CHash::MD4:
 		return QString( "md4" );
+	case CHash::ED2K:
+		return QString( "ed2k" );
+	case CHash::TIGERTREE:
+		return QString( "tiger" );
 	}
 
 	return "";
 }
 
+// Checks all algorithms against published test vectors. Reports the SHA1 block function in use.
+bool CHash::selfTest()
+{
+	struct TestVector
+	{
+		CHash::Algorithm	nAlgorithm;
+		QByteArray			baInput;
+		const char*			szExpected;
+	};
+
+	const TestVector pVectors[] =
+	{
+		{ CHash::SHA1,      QByteArray( "abc" ),             "urn:sha1:VGMT4NSHA2AWVOR6EVYXQUGCNSONBWE5" },
+		{ CHash::SHA1,      QByteArray( 1000000, 'a' ),      "urn:sha1:GSVJOPGUYTNKJ5Q65MV5XLJHGFSTIALP" },
+		{ CHash::MD5,       QByteArray( "abc" ),             "urn:md5:900150983CD24FB0D6963F7D28E17F72" },
+		{ CHash::ED2K,      QByteArray( "abc" ),             "urn:ed2k:A448017AAF21D8525FC10AE87AA6729D" },
+		{ CHash::TIGERTREE, QByteArray(),                    "urn:tree:tiger:LWPNACQDBZRYXW3VHJVCJ64QBZNGHOHHHZWCLNQ" },
+		{ CHash::TIGERTREE, QByteArray( 1025, 'A' ),         "urn:tree:tiger:PZMRYHGY6LTBEH63ZWAHDORHSYTLO4LEFUIKHWY" }
+	};
+
+	bool bPassed = true;
+
+	for ( uint i = 0; i < sizeof( pVectors ) / sizeof( pVectors[0] ); ++i )
+	{
+		CHash oHash( pVectors[i].nAlgorithm );
+		oHash.addData( pVectors[i].baInput );
+		oHash.finalize();
+
+		if ( oHash.toURN().compare( pVectors[i].szExpected, Qt::CaseInsensitive ) )
+		{
+			systemLog.postLog( LogSeverity::Error, QString( "Hash self-test failed: expected %1, got %2"
+															).arg( pVectors[i].szExpected ).arg( oHash.toURN() ) );
+			bPassed = false;
+		}
+	}
+
+	systemLog.postLog( LogSeverity::Debug, QString( "Hash self-test %1, SHA1 implementation: %2"
+													).arg( bPassed ? "passed" : "failed" ).arg( CSHA1::implementation() ) );
+	return bPassed;
+}
+
 QDataStream& operator<<(QDataStream& s, const CHash& rhs)
 {
 	s << rhs.toURN();
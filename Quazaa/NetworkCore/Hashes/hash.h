@@ -33,7 +33,7 @@ class CHash
 {
 
 public:
-	enum Algorithm {SHA1, MD5, MD4};
+	enum Algorithm {SHA1, MD5, MD4, ED2K, TIGERTREE};
 
 protected:
 	void*				m_pContext;
@@ -54,6 +54,8 @@ public:
 
 	static int lengthForUrn(const QString& urn);
 
+	static bool selfTest();
+
 	QString toURN() const;
 	QString toString() const;
 
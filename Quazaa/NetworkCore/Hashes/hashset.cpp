@@ -0,0 +1,149 @@
+/*
+** hashset.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "hashset.h"
+#include "tigertree.h"
+
+#include <QVector>
+#include <QtEndian>
+
+#include "debug_new.h"
+
+// DIME fields are padded to multiples of 4 bytes
+static inline quint32 dimePadded(quint32 nLength)
+{
+	return ( nLength + 3 ) & ~3u;
+}
+
+CHashSet::CHashSet() :
+	m_nAlgorithm( CHash::SHA1 ),
+	m_nFileSize( 0 ),
+	m_nBlockSize( 0 )
+{
+}
+
+/**
+  * Makes a set of one block covering the whole file, verified with the file hash oHash.
+  */
+bool CHashSet::fromFileHash(const CHash& oHash, quint64 nFileSize)
+{
+	if ( !nFileSize || oHash.rawValue().isEmpty() )
+		return false;
+
+	m_nAlgorithm = oHash.getAlgorithm();
+	m_nFileSize  = nFileSize;
+	m_nBlockSize = nFileSize;
+	m_baHashes   = oHash.rawValue();
+
+	return true;
+}
+
+/**
+  * Takes one level of the breadth-first serialized THEX tree baTree: the deepest level that is
+  * complete in baTree and has at most nMaxBlocks nodes. The level is only accepted if it
+  * reproduces the tree root oRoot.
+  */
+bool CHashSet::fromTigerTree(const QByteArray& baTree, const CHash& oRoot, quint64 nFileSize, int nMaxBlocks)
+{
+	if ( oRoot.getAlgorithm() != CHash::TIGERTREE || !nFileSize )
+		return false;
+
+	// node counts of the levels, root first
+	QVector<quint64> vCounts;
+	quint64 nCount = ( nFileSize + CTigerTree::LeafSize - 1 ) / CTigerTree::LeafSize;
+
+	while ( nCount > 1 )
+	{
+		vCounts.prepend( nCount );
+		nCount = ( nCount + 1 ) / 2;
+	}
+	vCounts.prepend( 1 );
+
+	const quint64 nNodes = baTree.size() / CTiger::HashSize;
+	quint64 nStart = 0, nLevelStart = 0;
+	int nLevel = -1;
+
+	for ( int i = 0; i < vCounts.size() && nStart + vCounts[i] <= nNodes && vCounts[i] <= (quint64)nMaxBlocks; ++i )
+	{
+		nLevel = i;
+		nLevelStart = nStart;
+		nStart += vCounts[i];
+	}
+
+	if ( nLevel < 0 )
+		return false;
+
+	const QByteArray baLevel = baTree.mid( nLevelStart * CTiger::HashSize, vCounts[nLevel] * CTiger::HashSize );
+
+	if ( CTigerTree::rootFromLevel( baLevel ) != oRoot.rawValue() )
+		return false;
+
+	m_nAlgorithm = CHash::TIGERTREE;
+	m_nFileSize  = nFileSize;
+	m_nBlockSize = (quint64)CTigerTree::LeafSize << ( vCounts.size() - 1 - nLevel );
+	m_baHashes   = baLevel;
+
+	return true;
+}
+
+/**
+  * Returns the payload of the first record of the DIME message baMessage whose type contains
+  * baType, as used by THEX to send the tree. Returns an empty array if there is none.
+  */
+QByteArray CHashSet::readDIME(const QByteArray& baMessage, const QByteArray& baType)
+{
+	const uchar* pData = (const uchar*)baMessage.constData();
+	const quint32 nSize = baMessage.size();
+	quint32 nPos = 0;
+
+	while ( nPos + 12 <= nSize )
+	{
+		const uchar nFlags    = pData[nPos];
+		const quint32 nOption = qFromBigEndian<quint16>( pData + nPos + 2 );
+		const quint32 nID     = qFromBigEndian<quint16>( pData + nPos + 4 );
+		const quint32 nType   = qFromBigEndian<quint16>( pData + nPos + 6 );
+		const quint32 nLength = qFromBigEndian<quint32>( pData + nPos + 8 );
+
+		nPos += 12 + dimePadded( nOption ) + dimePadded( nID );
+
+		if ( nPos + dimePadded( nType ) > nSize )
+			break;
+
+		const QByteArray baRecordType = baMessage.mid( nPos, nType );
+		nPos += dimePadded( nType );
+
+		if ( nLength > nSize - nPos )
+			break;
+
+		if ( baRecordType.contains( baType ) )
+			return baMessage.mid( nPos, nLength );
+
+		nPos += dimePadded( nLength );
+
+		if ( nFlags & 0x02 ) // message end
+			break;
+	}
+
+	return QByteArray();
+}
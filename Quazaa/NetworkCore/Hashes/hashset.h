@@ -0,0 +1,73 @@
+/*
+** hashset.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef HASHSET_H
+#define HASHSET_H
+
+#include "hash.h"
+
+/**
+ * @brief CHashSet holds the expected hashes of the blocks of one file, so each block can be
+ * checked on its own once it is complete. A block is hashed with m_nAlgorithm and compared to
+ * blockHash(). The set is either a level of the THEX Tiger tree of the file, checked against
+ * its root, or a single block covering the whole file and verified with a whole file hash.
+ */
+class CHashSet
+{
+public:
+	CHash::Algorithm	m_nAlgorithm;	// used to hash a block
+	quint64				m_nFileSize;
+	quint64				m_nBlockSize;	// 0 for an empty set
+	QByteArray			m_baHashes;		// hashes of all blocks back to back
+
+public:
+	CHashSet();
+
+	bool fromFileHash(const CHash& oHash, quint64 nFileSize);
+	bool fromTigerTree(const QByteArray& baTree, const CHash& oRoot, quint64 nFileSize, int nMaxBlocks);
+
+	static QByteArray readDIME(const QByteArray& baMessage, const QByteArray& baType);
+
+	inline bool isEmpty() const;
+	inline int blockCount() const;
+	inline QByteArray blockHash(int nBlock) const;
+};
+
+bool CHashSet::isEmpty() const
+{
+	return m_nBlockSize == 0;
+}
+
+int CHashSet::blockCount() const
+{
+	return isEmpty() ? 0 : (int)( ( m_nFileSize + m_nBlockSize - 1 ) / m_nBlockSize );
+}
+
+QByteArray CHashSet::blockHash(int nBlock) const
+{
+	const int nSize = m_baHashes.size() / qMax( 1, blockCount() );
+	return m_baHashes.mid( nBlock * nSize, nSize );
+}
+
+#endif // HASHSET_H
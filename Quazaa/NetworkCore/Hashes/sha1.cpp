@@ -0,0 +1,343 @@
+/*
+** sha1.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "sha1.h"
+
+#include <QtEndian>
+#include <string.h>
+
+// The SHA extensions kernel needs compiler support for the intrinsics and, with GCC and Clang,
+// per function target attributes so the rest of the binary keeps the baseline instruction set.
+#if defined(Q_PROCESSOR_X86) && ( defined(Q_CC_MSVC) || \
+	( defined(Q_CC_GNU) && ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) ) ) || \
+	defined(Q_CC_CLANG) )
+#define QUAZAA_SHA1_X86
+#endif
+
+#ifdef QUAZAA_SHA1_X86
+#ifdef Q_CC_MSVC
+#include <intrin.h>
+#define SHA1_TARGET
+#else
+#include <cpuid.h>
+#define SHA1_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+#endif
+#include <immintrin.h>
+#endif
+
+#include "debug_new.h"
+
+#define SHA1_ROTL(x, n) ( ( (x) << (n) ) | ( (x) >> ( 32 - (n) ) ) )
+
+#define SHA1_STEP(f, k) \
+	{ \
+		const quint32 t = SHA1_ROTL( a, 5 ) + ( f ) + e + k + W[i]; \
+		e = d; \
+		d = c; \
+		c = SHA1_ROTL( b, 30 ); \
+		b = a; \
+		a = t; \
+	}
+
+static void compressPortable(quint32* pState, const uchar* pData, quint32 nBlocks)
+{
+	quint32 W[80];
+
+	for ( ; nBlocks; --nBlocks, pData += CSHA1::BlockSize )
+	{
+		for ( int i = 0; i < 16; ++i )
+		{
+			W[i] = qFromBigEndian<quint32>( pData + 4 * i );
+		}
+		for ( int i = 16; i < 80; ++i )
+		{
+			W[i] = SHA1_ROTL( W[i - 3] ^ W[i - 8] ^ W[i - 14] ^ W[i - 16], 1 );
+		}
+
+		quint32 a = pState[0], b = pState[1], c = pState[2], d = pState[3], e = pState[4];
+
+		for ( int i = 0; i < 20; ++i )
+			SHA1_STEP( ( b & c ) | ( ~b & d ), 0x5A827999 )
+		for ( int i = 20; i < 40; ++i )
+			SHA1_STEP( b ^ c ^ d, 0x6ED9EBA1 )
+		for ( int i = 40; i < 60; ++i )
+			SHA1_STEP( ( b & c ) | ( b & d ) | ( c & d ), 0x8F1BBCDC )
+		for ( int i = 60; i < 80; ++i )
+			SHA1_STEP( b ^ c ^ d, 0xCA62C1D6 )
+
+		pState[0] += a;
+		pState[1] += b;
+		pState[2] += c;
+		pState[3] += d;
+		pState[4] += e;
+	}
+}
+
+#ifdef QUAZAA_SHA1_X86
+
+// One group of four rounds. Group i uses message words 4i..4i+3 held in M[i % 4] and derives the
+// words of the following groups from them; E[i % 2] carries the E value into the round.
+#define SHA1_GROUP(i, f) \
+	if ( i == 0 ) \
+		E[0] = _mm_add_epi32( E[0], M[0] ); \
+	else \
+		E[i % 2] = _mm_sha1nexte_epu32( E[i % 2], M[i % 4] ); \
+	E[( i + 1 ) % 2] = ABCD; \
+	if ( i >= 3 && i <= 18 ) \
+		M[( i + 1 ) % 4] = _mm_sha1msg2_epu32( M[( i + 1 ) % 4], M[i % 4] ); \
+	ABCD = _mm_sha1rnds4_epu32( ABCD, E[i % 2], f ); \
+	if ( i >= 1 && i <= 16 ) \
+		M[( i + 3 ) % 4] = _mm_sha1msg1_epu32( M[( i + 3 ) % 4], M[i % 4] ); \
+	if ( i >= 2 && i <= 17 ) \
+		M[( i + 2 ) % 4] = _mm_xor_si128( M[( i + 2 ) % 4], M[i % 4] );
+
+SHA1_TARGET static void compressSHANI(quint32* pState, const uchar* pData, quint32 nBlocks)
+{
+	const __m128i oMask = _mm_set_epi64x( Q_INT64_C(0x0001020304050607), Q_INT64_C(0x08090a0b0c0d0e0f) );
+
+	__m128i ABCD = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*)pState ), 0x1B );
+	__m128i E[2];
+	__m128i M[4];
+
+	E[0] = _mm_set_epi32( pState[4], 0, 0, 0 );
+
+	for ( ; nBlocks; --nBlocks, pData += CSHA1::BlockSize )
+	{
+		const __m128i ABCDSave = ABCD;
+		const __m128i ESave = E[0];
+
+		for ( int i = 0; i < 4; ++i )
+		{
+			M[i] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)( pData + 16 * i ) ), oMask );
+		}
+
+		SHA1_GROUP(  0, 0 ) SHA1_GROUP(  1, 0 ) SHA1_GROUP(  2, 0 ) SHA1_GROUP(  3, 0 ) SHA1_GROUP(  4, 0 )
+		SHA1_GROUP(  5, 1 ) SHA1_GROUP(  6, 1 ) SHA1_GROUP(  7, 1 ) SHA1_GROUP(  8, 1 ) SHA1_GROUP(  9, 1 )
+		SHA1_GROUP( 10, 2 ) SHA1_GROUP( 11, 2 ) SHA1_GROUP( 12, 2 ) SHA1_GROUP( 13, 2 ) SHA1_GROUP( 14, 2 )
+		SHA1_GROUP( 15, 3 ) SHA1_GROUP( 16, 3 ) SHA1_GROUP( 17, 3 ) SHA1_GROUP( 18, 3 ) SHA1_GROUP( 19, 3 )
+
+		E[0] = _mm_sha1nexte_epu32( E[0], ESave );
+		ABCD = _mm_add_epi32( ABCD, ABCDSave );
+	}
+
+	_mm_storeu_si128( (__m128i*)pState, _mm_shuffle_epi32( ABCD, 0x1B ) );
+	pState[4] = _mm_extract_epi32( E[0], 3 );
+}
+
+static bool cpuHasSHA()
+{
+	quint32 pLeaf1[4] = { 0, 0, 0, 0 };
+	quint32 pLeaf7[4] = { 0, 0, 0, 0 };
+
+#ifdef Q_CC_MSVC
+	int pInfo[4];
+	__cpuid( pInfo, 0 );
+	const int nMaxLeaf = pInfo[0];
+	__cpuid( pInfo, 1 );
+	memcpy( pLeaf1, pInfo, sizeof( pLeaf1 ) );
+	if ( nMaxLeaf >= 7 )
+	{
+		__cpuidex( pInfo, 7, 0 );
+		memcpy( pLeaf7, pInfo, sizeof( pLeaf7 ) );
+	}
+#else
+	const unsigned int nMaxLeaf = __get_cpuid_max( 0, 0 );
+	if ( nMaxLeaf >= 1 )
+		__cpuid( 1, pLeaf1[0], pLeaf1[1], pLeaf1[2], pLeaf1[3] );
+	if ( nMaxLeaf >= 7 )
+		__cpuid_count( 7, 0, pLeaf7[0], pLeaf7[1], pLeaf7[2], pLeaf7[3] );
+#endif
+
+	const bool bSSSE3 = pLeaf1[2] & ( 1 << 9 );
+	const bool bSSE41 = pLeaf1[2] & ( 1 << 19 );
+	const bool bSHA   = pLeaf7[1] & ( 1 << 29 );
+
+	return bSSSE3 && bSSE41 && bSHA;
+}
+
+#endif // QUAZAA_SHA1_X86
+
+CSHA1::CompressFunction CSHA1::s_pCompress = &compressPortable;
+const char* CSHA1::s_sImplementation = "portable";
+
+/**
+ * @brief CSHA1Dispatcher selects the block function during static initialization. Until then the
+ * portable implementation is used.
+ */
+class CSHA1Dispatcher
+{
+public:
+	CSHA1Dispatcher()
+	{
+#ifdef QUAZAA_SHA1_X86
+		if ( cpuHasSHA() && matchesPortable( &compressSHANI ) )
+		{
+			CSHA1::s_pCompress = &compressSHANI;
+			CSHA1::s_sImplementation = "SHA-NI";
+		}
+#endif
+	}
+
+private:
+	// Hashes a few block runs with pCompress and with the portable function and compares the
+	// resulting states.
+	static bool matchesPortable(CSHA1::CompressFunction pCompress)
+	{
+		uchar pData[4 * CSHA1::BlockSize];
+		for ( int i = 0; i < (int)sizeof( pData ); ++i )
+		{
+			pData[i] = (uchar)( i * 167 + 13 );
+		}
+
+		for ( quint32 nBlocks = 1; nBlocks <= 4; ++nBlocks )
+		{
+			quint32 pExpected[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+			quint32 pActual[5]   = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+			compressPortable( pExpected, pData, nBlocks );
+			pCompress( pActual, pData, nBlocks );
+
+			if ( memcmp( pExpected, pActual, sizeof( pExpected ) ) )
+				return false;
+		}
+
+		return true;
+	}
+};
+
+static CSHA1Dispatcher s_oDispatcher;
+
+CSHA1::CSHA1()
+{
+	reset();
+}
+
+void CSHA1::reset()
+{
+	m_pState[0] = 0x67452301;
+	m_pState[1] = 0xEFCDAB89;
+	m_pState[2] = 0x98BADCFE;
+	m_pState[3] = 0x10325476;
+	m_pState[4] = 0xC3D2E1F0;
+	m_nBuffer = 0;
+	m_nLength = 0;
+}
+
+void CSHA1::addData(const char* pData, quint32 nLength)
+{
+	m_nLength += nLength;
+
+	if ( m_nBuffer )
+	{
+		const quint32 nCopy = qMin<quint32>( BlockSize - m_nBuffer, nLength );
+		memcpy( m_pBuffer + m_nBuffer, pData, nCopy );
+		m_nBuffer += nCopy;
+		pData += nCopy;
+		nLength -= nCopy;
+
+		if ( m_nBuffer < BlockSize )
+			return;
+
+		s_pCompress( m_pState, m_pBuffer, 1 );
+		m_nBuffer = 0;
+	}
+
+	if ( nLength >= BlockSize )
+	{
+		const quint32 nBlocks = nLength / BlockSize;
+		s_pCompress( m_pState, (const uchar*)pData, nBlocks );
+		pData += nBlocks * BlockSize;
+		nLength -= nBlocks * BlockSize;
+	}
+
+	memcpy( m_pBuffer, pData, nLength );
+	m_nBuffer = nLength;
+}
+
+/**
+  * Returns the digest of the data added so far. Like QCryptographicHash::result(), this does not
+  * change the state, so more data may be added afterwards.
+  */
+QByteArray CSHA1::result()
+{
+	quint32 pState[5];
+	memcpy( pState, m_pState, sizeof( pState ) );
+
+	uchar pBlock[2 * BlockSize];
+	memcpy( pBlock, m_pBuffer, m_nBuffer );
+	pBlock[m_nBuffer] = 0x80;
+
+	const quint32 nBlocks = ( m_nBuffer + 1 + 8 > BlockSize ) ? 2 : 1;
+	memset( pBlock + m_nBuffer + 1, 0, nBlocks * BlockSize - m_nBuffer - 1 );
+	qToBigEndian<quint64>( m_nLength << 3, pBlock + nBlocks * BlockSize - 8 );
+
+	s_pCompress( pState, pBlock, nBlocks );
+
+	uchar pDigest[HashSize];
+	for ( int i = 0; i < 5; ++i )
+	{
+		qToBigEndian<quint32>( pState[i], pDigest + 4 * i );
+	}
+
+	return QByteArray( (const char*)pDigest, HashSize );
+}
+
+const char* CSHA1::implementation()
+{
+	return s_sImplementation;
+}
+
+QStringList CSHA1::implementations()
+{
+	QStringList lNames;
+	lNames << "portable";
+
+#ifdef QUAZAA_SHA1_X86
+	if ( cpuHasSHA() )
+		lNames << "SHA-NI";
+#endif
+
+	return lNames;
+}
+
+bool CSHA1::setImplementation(const QString& sName)
+{
+	if ( sName == "portable" )
+	{
+		s_pCompress = &compressPortable;
+		s_sImplementation = "portable";
+		return true;
+	}
+
+#ifdef QUAZAA_SHA1_X86
+	if ( sName == "SHA-NI" && cpuHasSHA() )
+	{
+		s_pCompress = &compressSHANI;
+		s_sImplementation = "SHA-NI";
+		return true;
+	}
+#endif
+
+	return false;
+}
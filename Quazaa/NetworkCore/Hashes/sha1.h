@@ -0,0 +1,71 @@
+/*
+** sha1.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <QByteArray>
+#include <QStringList>
+#include <QtGlobal>
+
+/**
+ * @brief CSHA1 computes SHA1 digests. The block function is picked once at startup: the x86 SHA
+ * extensions are used if the CPU reports them and they reproduce the results of the portable
+ * implementation on a set of reference inputs; otherwise the portable implementation is used.
+ */
+class CSHA1
+{
+public:
+	enum { BlockSize = 64, HashSize = 20 };
+
+	typedef void (*CompressFunction)(quint32* pState, const uchar* pData, quint32 nBlocks);
+
+private:
+	quint32	m_pState[5];
+	uchar	m_pBuffer[BlockSize];
+	quint32	m_nBuffer;
+	quint64	m_nLength;
+
+public:
+	CSHA1();
+
+	void reset();
+	void addData(const char* pData, quint32 nLength);
+	QByteArray result();
+
+	static const char* implementation();
+
+	// Lists the block functions usable on this CPU and switches between them. Only meant for
+	// tests and benchmarks; must not be called while other threads are hashing.
+	static QStringList implementations();
+	static bool setImplementation(const QString& sName);
+
+private:
+	static CompressFunction	s_pCompress;
+	static const char*		s_sImplementation;
+
+	friend class CSHA1Dispatcher;
+};
+
+#endif // SHA1_H
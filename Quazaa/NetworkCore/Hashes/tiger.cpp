@@ -0,0 +1,227 @@
+/*
+** tiger.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "tiger.h"
+
+#include <QtEndian>
+#include <string.h>
+
+#include "debug_new.h"
+
+// The four S-boxes, 256 entries each.
+static quint64 s_pTable[4 * 256];
+
+#define TIGER_T1(i) s_pTable[i]
+#define TIGER_T2(i) s_pTable[256 + (i)]
+#define TIGER_T3(i) s_pTable[512 + (i)]
+#define TIGER_T4(i) s_pTable[768 + (i)]
+
+#define TIGER_ROUND(a, b, c, x, mul) \
+	c ^= x; \
+	a -= TIGER_T1((quint8)(c)) ^ TIGER_T2((quint8)(c >> 16)) ^ \
+		 TIGER_T3((quint8)(c >> 32)) ^ TIGER_T4((quint8)(c >> 48)); \
+	b += TIGER_T4((quint8)(c >> 8)) ^ TIGER_T3((quint8)(c >> 24)) ^ \
+		 TIGER_T2((quint8)(c >> 40)) ^ TIGER_T1((quint8)(c >> 56)); \
+	b *= mul;
+
+#define TIGER_PASS(a, b, c, mul) \
+	TIGER_ROUND(a, b, c, x0, mul) \
+	TIGER_ROUND(b, c, a, x1, mul) \
+	TIGER_ROUND(c, a, b, x2, mul) \
+	TIGER_ROUND(a, b, c, x3, mul) \
+	TIGER_ROUND(b, c, a, x4, mul) \
+	TIGER_ROUND(c, a, b, x5, mul) \
+	TIGER_ROUND(a, b, c, x6, mul) \
+	TIGER_ROUND(b, c, a, x7, mul)
+
+#define TIGER_KEY_SCHEDULE \
+	x0 -= x7 ^ Q_UINT64_C(0xA5A5A5A5A5A5A5A5); \
+	x1 ^= x0; \
+	x2 += x1; \
+	x3 -= x2 ^ ((~x1) << 19); \
+	x4 ^= x3; \
+	x5 += x4; \
+	x6 -= x5 ^ ((~x4) >> 23); \
+	x7 ^= x6; \
+	x0 += x7; \
+	x1 -= x0 ^ ((~x7) << 19); \
+	x2 ^= x1; \
+	x3 += x2; \
+	x4 -= x3 ^ ((~x2) >> 23); \
+	x5 ^= x4; \
+	x6 += x5; \
+	x7 -= x6 ^ Q_UINT64_C(0x0123456789ABCDEF);
+
+// Fills the S-boxes using the generator published with the reference implementation. The
+// generator runs the compression function on the table being built, so the order of the
+// permutation steps matters.
+class CTigerTableGenerator
+{
+public:
+	CTigerTableGenerator()
+	{
+		static const char* const szSeed = "Tiger - A Fast New Hash Function, by Ross Anderson and Eli Biham";
+
+		uchar pTable[4 * 256][8];
+		for ( int i = 0; i < 4 * 256; ++i )
+		{
+			memset( pTable[i], i & 0xFF, 8 );
+		}
+
+		quint64 pState[3] = { Q_UINT64_C(0x0123456789ABCDEF), Q_UINT64_C(0xFEDCBA9876543210),
+							  Q_UINT64_C(0xF096A5B4C3B2E187) };
+		int nState = 2;
+
+		for ( int nPass = 0; nPass < 5; ++nPass )
+		{
+			for ( int i = 0; i < 256; ++i )
+			{
+				for ( int nBox = 0; nBox < 4 * 256; nBox += 256 )
+				{
+					if ( ++nState == 3 )
+					{
+						nState = 0;
+						publish( pTable );
+						CTiger::compress( (const uchar*)szSeed, pState );
+					}
+
+					for ( int nCol = 0; nCol < 8; ++nCol )
+					{
+						const int nOther = nBox + (quint8)( pState[nState] >> ( 8 * nCol ) );
+						qSwap( pTable[nBox + i][nCol], pTable[nOther][nCol] );
+					}
+				}
+			}
+		}
+
+		publish( pTable );
+	}
+
+private:
+	static void publish(const uchar pTable[4 * 256][8])
+	{
+		for ( int i = 0; i < 4 * 256; ++i )
+		{
+			s_pTable[i] = qFromLittleEndian<quint64>( pTable[i] );
+		}
+	}
+};
+
+static CTigerTableGenerator s_oTableGenerator;
+
+CTiger::CTiger()
+{
+	reset();
+}
+
+void CTiger::reset()
+{
+	m_pState[0] = Q_UINT64_C(0x0123456789ABCDEF);
+	m_pState[1] = Q_UINT64_C(0xFEDCBA9876543210);
+	m_pState[2] = Q_UINT64_C(0xF096A5B4C3B2E187);
+	m_nBuffer = 0;
+	m_nLength = 0;
+}
+
+void CTiger::addData(const char* pData, quint32 nLength)
+{
+	m_nLength += nLength;
+
+	if ( m_nBuffer )
+	{
+		const quint32 nCopy = qMin<quint32>( BlockSize - m_nBuffer, nLength );
+		memcpy( m_pBuffer + m_nBuffer, pData, nCopy );
+		m_nBuffer += nCopy;
+		pData += nCopy;
+		nLength -= nCopy;
+
+		if ( m_nBuffer < BlockSize )
+			return;
+
+		compress( m_pBuffer, m_pState );
+		m_nBuffer = 0;
+	}
+
+	while ( nLength >= BlockSize )
+	{
+		compress( (const uchar*)pData, m_pState );
+		pData += BlockSize;
+		nLength -= BlockSize;
+	}
+
+	memcpy( m_pBuffer, pData, nLength );
+	m_nBuffer = nLength;
+}
+
+/**
+  * Writes the 24 byte digest to pDigest. The object has to be reset() before it can be reused.
+  */
+void CTiger::finalize(uchar* pDigest)
+{
+	const quint64 nBits = m_nLength << 3;
+
+	m_pBuffer[m_nBuffer++] = 0x01;
+
+	if ( m_nBuffer > BlockSize - 8 )
+	{
+		memset( m_pBuffer + m_nBuffer, 0, BlockSize - m_nBuffer );
+		compress( m_pBuffer, m_pState );
+		m_nBuffer = 0;
+	}
+
+	memset( m_pBuffer + m_nBuffer, 0, BlockSize - 8 - m_nBuffer );
+	qToLittleEndian<quint64>( nBits, m_pBuffer + BlockSize - 8 );
+	compress( m_pBuffer, m_pState );
+
+	for ( int i = 0; i < 3; ++i )
+	{
+		qToLittleEndian<quint64>( m_pState[i], pDigest + 8 * i );
+	}
+}
+
+void CTiger::compress(const uchar* pBlock, quint64* pState)
+{
+	quint64 a = pState[0], b = pState[1], c = pState[2];
+
+	quint64 x0 = qFromLittleEndian<quint64>( pBlock );
+	quint64 x1 = qFromLittleEndian<quint64>( pBlock + 8 );
+	quint64 x2 = qFromLittleEndian<quint64>( pBlock + 16 );
+	quint64 x3 = qFromLittleEndian<quint64>( pBlock + 24 );
+	quint64 x4 = qFromLittleEndian<quint64>( pBlock + 32 );
+	quint64 x5 = qFromLittleEndian<quint64>( pBlock + 40 );
+	quint64 x6 = qFromLittleEndian<quint64>( pBlock + 48 );
+	quint64 x7 = qFromLittleEndian<quint64>( pBlock + 56 );
+
+	const quint64 aa = a, bb = b, cc = c;
+
+	TIGER_PASS( a, b, c, 5 )
+	TIGER_KEY_SCHEDULE
+	TIGER_PASS( c, a, b, 7 )
+	TIGER_KEY_SCHEDULE
+	TIGER_PASS( b, c, a, 9 )
+
+	pState[0] = a ^ aa;
+	pState[1] = b - bb;
+	pState[2] = c + cc;
+}
@@ -0,0 +1,57 @@
+/*
+** tiger.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TIGER_H
+#define TIGER_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+/**
+ * @brief CTiger implements the Tiger/192 hash function (Anderson & Biham, original 0x01 padding)
+ * as used by the THEX Tiger tree hash. The S-boxes are generated once at startup from the
+ * reference generator instead of being stored as tables.
+ */
+class CTiger
+{
+public:
+	enum { BlockSize = 64, HashSize = 24 };
+
+private:
+	quint64	m_pState[3];
+	uchar	m_pBuffer[BlockSize];
+	quint32	m_nBuffer;
+	quint64	m_nLength;
+
+public:
+	CTiger();
+
+	void reset();
+	void addData(const char* pData, quint32 nLength);
+	void finalize(uchar* pDigest);
+
+	static void compress(const uchar* pBlock, quint64* pState);
+};
+
+#endif // TIGER_H
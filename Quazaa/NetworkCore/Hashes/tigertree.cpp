@@ -0,0 +1,160 @@
+/*
+** tigertree.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "tigertree.h"
+
+#include <string.h>
+
+#include "debug_new.h"
+
+CTigerTree::CTigerTree()
+{
+	reset();
+}
+
+void CTigerTree::reset()
+{
+	m_nLeaf   = 0;
+	m_nLeaves = 0;
+	m_nStack  = 0;
+}
+
+void CTigerTree::addData(const char* pData, quint32 nLength)
+{
+	if ( m_nLeaf )
+	{
+		const quint32 nCopy = qMin<quint32>( LeafSize - m_nLeaf, nLength );
+		memcpy( m_pLeaf + m_nLeaf, pData, nCopy );
+		m_nLeaf += nCopy;
+		pData += nCopy;
+		nLength -= nCopy;
+
+		if ( m_nLeaf < LeafSize )
+			return;
+
+		addLeaf( m_pLeaf, LeafSize );
+		m_nLeaf = 0;
+	}
+
+	while ( nLength >= LeafSize )
+	{
+		addLeaf( (const uchar*)pData, LeafSize );
+		pData += LeafSize;
+		nLength -= LeafSize;
+	}
+
+	memcpy( m_pLeaf, pData, nLength );
+	m_nLeaf = nLength;
+}
+
+/**
+  * Returns the 24 byte root hash. An empty stream hashes as a single empty leaf. Nodes without a
+  * sibling are promoted unchanged, as required by THEX.
+  */
+QByteArray CTigerTree::finalize()
+{
+	if ( m_nLeaf || !m_nLeaves )
+	{
+		addLeaf( m_pLeaf, m_nLeaf );
+		m_nLeaf = 0;
+	}
+
+	uchar pRoot[CTiger::HashSize];
+	memcpy( pRoot, m_pStack[m_nStack - 1], CTiger::HashSize );
+
+	for ( int i = m_nStack - 2; i >= 0; --i )
+	{
+		combine( m_pStack[i], pRoot, pRoot );
+	}
+
+	return QByteArray( (const char*)pRoot, CTiger::HashSize );
+}
+
+/**
+  * Computes the root hash from the nodes of one complete tree level, given back to back in
+  * baNodes. Returns an empty array if baNodes is not a whole number of nodes.
+  */
+QByteArray CTigerTree::rootFromLevel(const QByteArray& baNodes)
+{
+	if ( baNodes.isEmpty() || baNodes.size() % CTiger::HashSize )
+		return QByteArray();
+
+	CTigerTree oTree;
+	QByteArray baLevel = baNodes;
+
+	while ( baLevel.size() > CTiger::HashSize )
+	{
+		const int nNodes = baLevel.size() / CTiger::HashSize;
+		QByteArray baParent( ( nNodes + 1 ) / 2 * CTiger::HashSize, 0 );
+		const uchar* pChild = (const uchar*)baLevel.constData();
+		uchar* pParent = (uchar*)baParent.data();
+
+		for ( int i = 0; i + 1 < nNodes; i += 2 )
+		{
+			oTree.combine( pChild + i * CTiger::HashSize, pChild + ( i + 1 ) * CTiger::HashSize,
+						   pParent + i / 2 * CTiger::HashSize );
+		}
+
+		// a node without sibling is promoted
+		if ( nNodes % 2 )
+			memcpy( pParent + ( nNodes / 2 ) * CTiger::HashSize, pChild + ( nNodes - 1 ) * CTiger::HashSize, CTiger::HashSize );
+
+		baLevel = baParent;
+	}
+
+	return baLevel;
+}
+
+void CTigerTree::addLeaf(const uchar* pData, quint32 nLength)
+{
+	static const char cLeafPrefix = 0x00;
+
+	m_oTiger.reset();
+	m_oTiger.addData( &cLeafPrefix, 1 );
+	m_oTiger.addData( (const char*)pData, nLength );
+	m_oTiger.finalize( m_pStack[m_nStack] );
+	m_pLevel[m_nStack] = 0;
+	++m_nStack;
+	++m_nLeaves;
+
+	// Merge complete subtrees of equal height.
+	while ( m_nStack > 1 && m_pLevel[m_nStack - 1] == m_pLevel[m_nStack - 2] )
+	{
+		combine( m_pStack[m_nStack - 2], m_pStack[m_nStack - 1], m_pStack[m_nStack - 2] );
+		++m_pLevel[m_nStack - 2];
+		--m_nStack;
+	}
+}
+
+void CTigerTree::combine(const uchar* pLeft, const uchar* pRight, uchar* pResult)
+{
+	uchar pNode[1 + 2 * CTiger::HashSize];
+	pNode[0] = 0x01;
+	memcpy( pNode + 1, pLeft, CTiger::HashSize );
+	memcpy( pNode + 1 + CTiger::HashSize, pRight, CTiger::HashSize );
+
+	m_oTiger.reset();
+	m_oTiger.addData( (const char*)pNode, sizeof( pNode ) );
+	m_oTiger.finalize( pResult );
+}
@@ -0,0 +1,66 @@
+/*
+** tigertree.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TIGERTREE_H
+#define TIGERTREE_H
+
+#include "tiger.h"
+
+/**
+ * @brief CTigerTree computes the THEX Tiger tree root hash (urn:tree:tiger) of a stream. Leaves are
+ * 1024 byte segments; only the open path of the tree is kept, so memory use is independent of the
+ * stream length.
+ */
+class CTigerTree
+{
+public:
+	enum { LeafSize = 1024, MaxDepth = 64 };
+
+private:
+	uchar	m_pLeaf[LeafSize];
+	quint32	m_nLeaf;
+	quint64	m_nLeaves;
+
+	// Completed subtrees waiting for a sibling, levels strictly decreasing from the bottom.
+	uchar	m_pStack[MaxDepth][CTiger::HashSize];
+	int		m_pLevel[MaxDepth];
+	int		m_nStack;
+
+	CTiger	m_oTiger;
+
+public:
+	CTigerTree();
+
+	void reset();
+	void addData(const char* pData, quint32 nLength);
+	QByteArray finalize();
+
+	static QByteArray rootFromLevel(const QByteArray& baNodes);
+
+private:
+	void addLeaf(const uchar* pData, quint32 nLength);
+	void combine(const uchar* pLeft, const uchar* pRight, uchar* pResult);
+};
+
+#endif // TIGERTREE_H
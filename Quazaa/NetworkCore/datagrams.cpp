@@ -37,12 +37,14 @@
 #include "securitymanager.h"
 
 #include "HostCache/hostcache.h"
+#include "localsearch.h"
 
 #include "quazaaglobals.h"
 #include "quazaasettings.h"
 
 #include "thread.h"
 #include "buffer.h"
+#include "trafficshaper.h"
 
 #include "debug_new.h"
 
@@ -210,6 +212,9 @@ void CDatagrams::onDatagram()
 			return;
 		}
 
+		// UDP can not be held back, but it uses the link like everything else
+		TrafficShaper.consume(tcSearch, tdIn, nReadSize);
+
 		m_nInFrags++;
 
 		GND_HEADER* pHeader = (GND_HEADER*)m_pRecvBuffer->data();
@@ -485,7 +490,8 @@ void CDatagrams::__FlushSendCache()
 
 	quint32 tNow = time(0);
 
-	qint64 nToWrite = qint64(m_nUploadLimit) - qint64(m_mOutput.Usage());
+	qint64 nToWrite = qMin(qint64(m_nUploadLimit) - qint64(m_mOutput.Usage()), TrafficShaper.available(tcSearch, tdOut));
+	const quint64 nTotal = m_mOutput.m_nTotal;
 
 	static TCPBandwidthMeter meter;
 
@@ -573,6 +579,8 @@ void CDatagrams::__FlushSendCache()
 		}
 	}
 
+	TrafficShaper.consume(tcSearch, tdOut, m_mOutput.m_nTotal - nTotal);
+
 	while(!m_SendCache.isEmpty() && tNow - m_SendCache.back()->m_tSent > quazaaSettings.Gnutella2.UdpOutExpire)
 	{
 		remove(m_SendCache.back());
@@ -1114,4 +1122,9 @@ void CDatagrams::onQuery(CEndPoint &addr, G2Packet *pPacket)
 	Neighbours.m_pSection.unlock();
 
 	// local search
+	foreach(G2Packet* pHit, CLocalSearch::search(pQuery))
+	{
+		sendPacket(pQuery->m_oEndpoint, pHit, true);
+		pHit->release();
+	}
 }
@@ -330,3 +330,8 @@ QDataStream &operator>>(QDataStream &s, CEndPoint &rhs)
 
 	return s;
 }
+
+uint qHash(const CEndPoint& key)
+{
+	return qHash( *static_cast<const QHostAddress*>( &key ) ) ^ ( uint( key.port() ) << 16 );
+}
@@ -158,4 +158,7 @@ bool CEndPoint::operator !=(const QHostAddress& rhs) const
 
 QDataStream &operator<<(QDataStream &s, const CEndPoint &rhs);
 QDataStream &operator>>(QDataStream &s, CEndPoint &rhs);
+
+uint qHash(const CEndPoint& key);
+
 #endif // ENDPOINT_H
@@ -38,6 +38,7 @@
 #include "securitymanager.h"
 
 #include "HostCache/hostcache.h"
+#include "localsearch.h"
 
 #include "quazaasettings.h"
 #include "quazaaglobals.h"
@@ -597,7 +598,7 @@ void CG2Node::parseOutgoingHandshake()
 	hostCache.m_pSection.lock();
 	CHostCacheHost* pThisHost = hostCache.take(m_oAddress);
 	if( pThisHost )
-		pThisHost->m_nFailures = 0;
+		hostCache.onSuccess(pThisHost);
 	hostCache.m_pSection.unlock();
 
 #ifndef _DISABLE_COMPRESSION
@@ -1439,6 +1440,20 @@ void CG2Node::onQuery(G2Packet* pPacket)
 		{
 			Neighbours.routeQuery(pQuery, pPacket, this, (m_nType != G2_HUB));
 		}
+
+		// local search - leaves get their hits back over TCP, everyone else via the return address
+		foreach(G2Packet* pHit, CLocalSearch::search(pQuery))
+		{
+			if( m_nType == G2_LEAF || !pQuery->m_oEndpoint.isValid() )
+			{
+				sendPacket(pHit, true, true);
+			}
+			else
+			{
+				Datagrams.sendPacket(pQuery->m_oEndpoint, pHit, true);
+				pHit->release();
+			}
+		}
 	}
 }
 
@@ -73,12 +73,21 @@ void CHandshake::onRead()
 		Handshakes.processNeighbour(this);
 		delete this;
 	}
-	else if(peek(5).startsWith("GET /"))
+	else if(peek(5).startsWith("GET /") || peek(5).startsWith("HEAD "))
 	{
 		if( peek(bytesAvailable()).indexOf("\r\n\r\n") != -1 )
 		{
-			systemLog.postLog(LogSeverity::Debug, QString("Incoming connection from %1 is a Web request").arg(m_pSocket->peerAddress().toString().toLocal8Bit().constData()));
-			onWebRequest();
+			if( peek(13).startsWith("GET /uri-res/") || peek(14).startsWith("HEAD /uri-res/") )
+			{
+				systemLog.postLog(LogSeverity::Debug, QString("Incoming connection from %1 is an upload request").arg(m_pSocket->peerAddress().toString().toLocal8Bit().constData()));
+				Handshakes.processUpload(this);
+				delete this;
+			}
+			else
+			{
+				systemLog.postLog(LogSeverity::Debug, QString("Incoming connection from %1 is a Web request").arg(m_pSocket->peerAddress().toString().toLocal8Bit().constData()));
+				onWebRequest();
+			}
 		}
 	}
 	else
@@ -27,6 +27,7 @@
 #include "handshake.h"
 #include "ratecontroller.h"
 #include "neighbours.h"
+#include "uploads.h"
 #include "securitymanager.h"
 
 #include <QTimer>
@@ -123,6 +124,12 @@ void CHandshakes::processNeighbour(CHandshake* pHs)
 	Neighbours.onAccept(pHs);
 }
 
+void CHandshakes::processUpload(CHandshake* pHs)
+{
+	removeHandshake(pHs);
+	Uploads.onAccept(pHs);
+}
+
 void CHandshakes::setupThread()
 {
 	m_pController = new CRateController(&m_pSection);
@@ -75,6 +75,7 @@ protected:
 	void removeHandshake(CHandshake* pHs);
 
 	void processNeighbour(CHandshake* pHs);
+	void processUpload(CHandshake* pHs);
 
 	friend class CHandshake;
 };
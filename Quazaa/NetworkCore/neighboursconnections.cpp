@@ -62,12 +62,16 @@ void CNeighboursConnections::connectNode()
 
 	m_nHubsConnectedG2 = m_nLeavesConnectedG2 = 0;
 
+	connect( &securityManager, SIGNAL( performSanityCheck() ), this, SLOT( sanityCheck() ) );
+
 	CNeighboursRouting::connectNode();
 }
 void CNeighboursConnections::disconnectNode()
 {
 	QMutexLocker l(&m_pSection);
 
+	disconnect( &securityManager, SIGNAL( performSanityCheck() ), this, SLOT( sanityCheck() ) );
+
 	while(!m_lNodes.isEmpty())
 	{
 		CNeighbour* pCurr = m_lNodes.takeFirst();
@@ -293,7 +297,7 @@ void CNeighboursConnections::maintain()
 							continue;
 						}
 						connectTo(pHost->m_oAddress, dpG2);
-						pHost->m_tLastConnect = tNow;
+						hostCache.onConnectAttempt( pHost, tNow );
 					}
 					else
 					{
@@ -363,7 +367,7 @@ void CNeighboursConnections::maintain()
 						}
 
 						connectTo( pHost->m_oAddress, dpG2 );
-						pHost->m_tLastConnect = tNow;
+						hostCache.onConnectAttempt( pHost, tNow );
 					}
 					else
 					{
@@ -390,6 +394,65 @@ void CNeighboursConnections::maintain()
 	}
 }
 
+/**
+  * Qt slot. Starts checking all neighbours against the rules loaded for the current sanity check.
+  * The addresses are checked by the thread pool while the neighbours are unlocked; the newly
+  * banned ones are disconnected in sanityCheckFinished().
+  */
+void CNeighboursConnections::sanityCheck()
+{
+	CSanityRuleSetPtr pRules = securityManager.sanityRules();
+
+	if ( !pRules )
+	{
+		QMetaObject::invokeMethod( &securityManager, "sanityCheckPerformed", Qt::QueuedConnection );
+		return;
+	}
+
+	QList<CEndPoint> lAddresses;
+
+	m_pSection.lock();
+	m_lSanityNodes.clear();
+	foreach ( CNeighbour* pNode, m_lNodes )
+	{
+		m_lSanityNodes.append( qMakePair( pNode, pNode->m_oAddress ) );
+		lAddresses.append( pNode->m_oAddress );
+	}
+	m_pSection.unlock();
+
+	CSanityCheckJob* pJob = CSanityCheckJob::checkAddresses( pRules, lAddresses );
+	connect( pJob, SIGNAL( finished( QList<int> ) ), this, SLOT( sanityCheckFinished( QList<int> ) ) );
+	pJob->start();
+}
+
+/**
+  * Qt slot. Disconnects the neighbours found denied by the sanity check job, all at once.
+  */
+void CNeighboursConnections::sanityCheckFinished(QList<int> lDenied)
+{
+	if ( !lDenied.isEmpty() )
+	{
+		QMutexLocker l( &m_pSection );
+
+		foreach ( int nIndex, lDenied )
+		{
+			CNeighbour* pNode = m_lSanityNodes.at( nIndex ).first;
+
+			// The node might have been removed while the job was running, and a new node might
+			// have been allocated at the same address since.
+			if ( neighbourExists( pNode ) && pNode->m_oAddress == m_lSanityNodes.at( nIndex ).second )
+			{
+				systemLog.postLog( LogSeverity::Security, Components::Network,
+								   tr( "Disconnecting newly banned neighbour %1." )
+								   .arg( pNode->m_oAddress.toString() ) );
+				pNode->close();
+			}
+		}
+	}
+
+	m_lSanityNodes.clear();
+}
+
 quint32 CNeighboursConnections::downloadSpeed()
 {
 	return m_pController ? m_pController->downloadSpeed() : 0;
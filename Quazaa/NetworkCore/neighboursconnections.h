@@ -36,6 +36,7 @@ class CNeighboursConnections : public CNeighboursRouting
 	Q_OBJECT
 protected:
 	CRateController* m_pController;
+	QList< QPair<CNeighbour*, CEndPoint> > m_lSanityNodes;	// neighbours of the running sanity check and their addresses, by job index
 public:
 	quint32 m_nHubsConnectedG2;
 	quint32 m_nLeavesConnectedG2;
@@ -65,6 +66,11 @@ public slots:
 	CNeighbour* onAccept(CNetworkConnection* pConn);
 
 	virtual void maintain();
+
+	void sanityCheck();
+
+private slots:
+	void sanityCheckFinished(QList<int> lDenied);
 };
 
 #endif // NEIGHBOURSCONNECTIONS_H
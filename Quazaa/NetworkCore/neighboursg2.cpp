@@ -98,11 +98,17 @@ void CNeighboursG2::maintain()
 		m_bNeedLNI = true;
 	}
 
+	// getConnectable() updates the host cache queues, so it needs the write lock.
+	hostCache.m_pSection.lock();
+	const bool bEmptyCache  = hostCache.isEmpty();
+	const bool bConnectable  = !bEmptyCache && hostCache.getConnectable();
+	hostCache.m_pSection.unlock();
+
 	// TODO: Test whether already active checking is required
 	if ( !m_nHubsConnectedG2 && !discoveryManager.isActive( Discovery::stGWC )
-		 && ( hostCache.isEmpty() || !hostCache.getConnectable() ) && m_nUnknownInitiated == 0 )
+		 && !bConnectable && m_nUnknownInitiated == 0 )
 	{
-		qDebug() << "GWC query: Active:" << discoveryManager.isActive(Discovery::stGWC) << ", empty cache:" << hostCache.isEmpty() << ", has connectable:" << (hostCache.getConnectable() != 0) << "has unknown initiated:" << (m_nUnknownInitiated != 0);
+		qDebug() << "GWC query: Active:" << discoveryManager.isActive(Discovery::stGWC) << ", empty cache:" << bEmptyCache << ", has connectable:" << bConnectable << "has unknown initiated:" << (m_nUnknownInitiated != 0);
 		discoveryManager.queryService( CNetworkType( dpG2 ) );
 	}
 
@@ -49,6 +49,7 @@ CNetworkConnection::CNetworkConnection(QObject* parent)
 	m_bInitiated = false;
 	m_bConnected = false;
 	m_tConnected = 0;
+	m_nReadBufferSize = 0;
 }
 CNetworkConnection::~CNetworkConnection()
 {
@@ -184,6 +185,7 @@ void CNetworkConnection::moveToThread(QThread* thread)
 void CNetworkConnection::initializeSocket()
 {
 	m_pSocket->disconnect();
+	m_pSocket->setReadBufferSize(m_nReadBufferSize);
 
 	connect(m_pSocket, SIGNAL(connected()),
 			this, SIGNAL(connected()));
@@ -326,11 +328,16 @@ bool CNetworkConnection::isValid() const
 
 	return m_pSocket->isValid();
 }
+// Transfers are registered with the rate controller before they get a socket, so the size is
+// remembered and set by initializeSocket().
 void CNetworkConnection::setReadBufferSize(qint64 nSize)
 {
-	Q_ASSERT(m_pSocket != 0);
+	m_nReadBufferSize = nSize;
 
-	m_pSocket->setReadBufferSize(nSize);
+	if(m_pSocket)
+	{
+		m_pSocket->setReadBufferSize(nSize);
+	}
 }
 
 QByteArray CNetworkConnection::read(qint64 nMaxSize)
@@ -70,6 +70,9 @@ public:
 	bool    m_bConnected;
 	qint32  m_tConnected;
 
+protected:
+	qint64  m_nReadBufferSize; // applied to the socket once there is one
+
 public:
 	CNetworkConnection(QObject* parent = 0);
 	virtual ~CNetworkConnection();
@@ -52,6 +52,8 @@ CQueryHashTable::CQueryHashTable() : QObject(0),
 	,	m_nCount(0ul)
 	,	m_pBuffer(new CBuffer(131072))    // 128KB
 	,	m_pGroup(0)
+	,	m_bCounted(false)
+	,	m_pCounts(0)
 {
 }
 
@@ -63,9 +65,19 @@ CQueryHashTable::~CQueryHashTable()
 	}
 
 	delete [] m_pHash;
+	delete [] m_pCounts;
 	delete m_pBuffer;
 }
 
+/**
+  * Counted tables keep track of how many entries have been added to every slot, so entries can be
+  * removed again with removeExactString() without rebuilding the table. Takes effect on create().
+  */
+void CQueryHashTable::setCounted(bool bCounted)
+{
+	m_bCounted = bCounted;
+}
+
 void CQueryHashTable::create()
 {
 	const bool bGrouped = (m_pGroup != 0);
@@ -75,6 +87,8 @@ void CQueryHashTable::create()
 	}
 
 	delete [] m_pHash;
+	delete [] m_pCounts;
+	m_pCounts = 0;
 
 	m_bLive		= true;
 	m_nCookie	= time(0) + 1;
@@ -85,6 +99,12 @@ void CQueryHashTable::create()
 
 	memset(m_pHash, 0xFF, (m_nHash + 31) / 8);
 
+	if(m_bCounted)
+	{
+		m_pCounts = new quint16[m_nHash];
+		memset(m_pCounts, 0, m_nHash * sizeof(quint16));
+	}
+
 	if(bGrouped)
 	{
 		QueryHashMaster.add(this);
@@ -109,6 +129,11 @@ void CQueryHashTable::clear()
 
 	memset(m_pHash, 0xFF, (m_nHash + 31) / 8);
 
+	if(m_pCounts)
+	{
+		memset(m_pCounts, 0, m_nHash * sizeof(quint16));
+	}
+
 	if(bGrouped)
 	{
 		QueryHashMaster.add(this);
@@ -704,50 +729,53 @@ void CQueryHashTable::add(const char* pszString, quint32 nLength)
 		return;
 	}
 
-	quint32 tNow = time(0);
+	setSlot(hashWord(pszString, nLength, m_nBits));
 
-	quint32 nHash	= hashWord(pszString, nLength, m_nBits);
-	uchar* pHash	= m_pHash + (nHash >> 3);
-	uchar nMask	= uchar(1 << (nHash & 7));
-	if(*pHash & nMask)
+	if(nLength >= 5)
 	{
-		m_nCookie = tNow;
-		++m_nCount;
-		*pHash &= ~nMask;
+		setSlot(hashWord(pszString, nLength - 1, m_nBits));
+		setSlot(hashWord(pszString, nLength - 2, m_nBits));
 	}
+}
 
-	if(nLength >= 5)
+void CQueryHashTable::addExact(const char* pszString, quint32 nLength)
+{
+	if(! nLength)
 	{
-		nHash	= hashWord(pszString, nLength - 1, m_nBits);
-		pHash	= m_pHash + (nHash >> 3);
-		nMask	= uchar(1 << (nHash & 7));
-		if(*pHash & nMask)
-		{
-			m_nCookie = tNow;
-			++m_nCount;
-			*pHash &= ~nMask;
-		}
+		return;
+	}
 
-		nHash	= hashWord(pszString, nLength - 2, m_nBits);
-		pHash	= m_pHash + (nHash >> 3);
-		nMask	= uchar(1 << (nHash & 7));
-		if(*pHash & nMask)
-		{
-			m_nCookie = tNow;
-			++m_nCount;
-			*pHash &= ~nMask;
-		}
+	setSlot(hashWord(pszString, nLength, m_nBits));
+}
+
+void CQueryHashTable::removeExactString(const QString& strString)
+{
+	if(!m_pHash)
+	{
+		return;
 	}
+
+	QByteArray baUTF8 = strString.toUtf8();
+	removeExact(baUTF8.data(), baUTF8.size());
 }
 
-void CQueryHashTable::addExact(const char* pszString, quint32 nLength)
+void CQueryHashTable::removeExact(const char* pszString, quint32 nLength)
 {
-	if(! nLength)
+	if(!nLength)
 	{
 		return;
 	}
 
-	quint32 nHash	= hashWord(pszString, nLength, m_nBits);
+	releaseSlot(hashWord(pszString, nLength, m_nBits));
+}
+
+void CQueryHashTable::setSlot(quint32 nHash)
+{
+	if(m_pCounts && m_pCounts[nHash] < 0xFFFF)
+	{
+		++m_pCounts[nHash];
+	}
+
 	uchar* pHash	= m_pHash + (nHash >> 3);
 	uchar nMask		= uchar(1 << (nHash & 7));
 	if(*pHash & nMask)
@@ -758,6 +786,29 @@ void CQueryHashTable::addExact(const char* pszString, quint32 nLength)
 	}
 }
 
+void CQueryHashTable::releaseSlot(quint32 nHash)
+{
+	// Without counts we cannot know if other entries share the slot; saturated slots stay set.
+	if(!m_pCounts || m_pCounts[nHash] == 0 || m_pCounts[nHash] == 0xFFFF)
+	{
+		return;
+	}
+
+	if(--m_pCounts[nHash])
+	{
+		return;
+	}
+
+	uchar* pHash	= m_pHash + (nHash >> 3);
+	uchar nMask		= uchar(1 << (nHash & 7));
+	if(!(*pHash & nMask))
+	{
+		m_nCookie = time(0);
+		--m_nCount;
+		*pHash |= nMask;
+	}
+}
+
 bool CQueryHashTable::checkString(const QString& strString) const
 {
 	if(!m_bLive || !m_pHash || strString.isEmpty())
@@ -841,9 +892,6 @@ void CQueryHashTable::addString(const QString& strString)
 
 int CQueryHashTable::makeKeywords(QString sPhrase, QStringList& outList)
 {
-	systemLog.postLog(LogSeverity::Debug, QString("Making keywords from: %1").arg(sPhrase));
-	//qDebug() << "Making keywords from:" << sPhrase;
-
 	sPhrase = sPhrase.replace("_", " ").simplified().toLower();
 
 	// split it into words
@@ -874,12 +922,6 @@ int CQueryHashTable::makeKeywords(QString sPhrase, QStringList& outList)
 		}
 	}
 
-	foreach(QString sDebug, outList)
-	{
-		systemLog.postLog(LogSeverity::Debug, QString("Added keyword: %1").arg(sDebug));
-		//qDebug() << "Added keyword:" << sDebug;
-	}
-
 	return outList.size();
 }
 
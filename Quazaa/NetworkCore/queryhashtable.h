@@ -55,6 +55,8 @@ public:
 	quint32				m_nCount;
 	CBuffer*			m_pBuffer;
 	CQueryHashGroup* 	m_pGroup;
+	bool				m_bCounted;
+	quint16*			m_pCounts;		// entries per slot, only kept by counted tables
 
 public:
 	static quint32 hashWord(const char* pSz, const quint32 nLength, qint32 nBits);
@@ -64,6 +66,7 @@ public:
 	static int makeKeywords(QString sPhrase, QStringList& outList);
 
 public:
+	void	setCounted(bool bCounted);
 	void	create();
 	void	clear();
 	bool	merge(const CQueryHashTable* pSource);
@@ -73,6 +76,7 @@ public:
 	void	addString(const QString& strString);
 	void	addExactString(const QString& strString);
 	void	addWord(const QByteArray& sWord);
+	void	removeExactString(const QString& strString);
 	bool	checkString(const QString& strString) const;
 	bool	checkHash(const quint32 nHash) const;
 	bool	checkQuery(CQueryPtr pQuery);
@@ -82,6 +86,9 @@ protected:
 	bool	onPatch(G2Packet* pPacket);
 	void	add(const char* pszString, quint32 nLength);
 	void	addExact(const char* pszString, quint32 nLength);
+	void	removeExact(const char* pszString, quint32 nLength);
+	void	setSlot(quint32 nHash);
+	void	releaseSlot(quint32 nHash);
 };
 
 #pragma pack(push,1)
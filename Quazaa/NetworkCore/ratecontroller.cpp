@@ -25,7 +25,6 @@
 #include "ratecontroller.h"
 #include "networkconnection.h"
 
-#include <limits>
 #include <QTcpSocket>
 #include <QMutexLocker>
 #include <QTimer>
@@ -34,23 +33,44 @@
 
 #include "debug_new.h"
 
-CRateController::CRateController(QMutex* pMutex, QObject* parent): QObject(parent)
+CRateController::CRateController(QMutex* pMutex, QObject* parent): QObject(parent),
+	m_oTimer(this)
 {
 	m_bTransferSheduled = false;
-	m_nUploadLimit = std::numeric_limits<qint32>::max() / 2;
-	m_nDownloadLimit = std::numeric_limits<qint32>::max() / 2;
+	m_bReadPaused = false;
 	m_tStopWatch.invalidate();
 
 	m_pMutex = pMutex;
+
+	m_oTimer.setSingleShot(true);
+	connect(&m_oTimer, SIGNAL(timeout()), this, SLOT(transfer()));
+}
+CRateController::~CRateController()
+{
+	qDeleteAll(m_lSockets);
 }
 
-void CRateController::addSocket(CNetworkConnection* pSock)
+void CRateController::addSocket(CNetworkConnection* pSock, TrafficClass nClass, quint32 nWeight)
 {
 	ASSUME_LOCK(*m_pMutex);
 
+	if(m_lSockets.contains(pSock))
+	{
+		return;
+	}
+
 	connect(pSock, SIGNAL(readyToTransfer()), this, SLOT(sheduleTransfer()));
 	pSock->setReadBufferSize(8192);
-	m_lSockets.insert(pSock);
+
+	RateSocket* pSocket = new RateSocket();
+	pSocket->pConn = pSock;
+	pSocket->nClass = nClass;
+	pSocket->nWeight = qMax(1u, nWeight);
+	pSocket->nDeficitIn = 0;
+	pSocket->nDeficitOut = 0;
+
+	m_lSockets.insert(pSock, pSocket);
+	m_lClasses[nClass].append(pSocket);
 
 	QMetaObject::invokeMethod(this, "sheduleTransfer", Qt::QueuedConnection);
 }
@@ -58,12 +78,18 @@ void CRateController::removeSocket(CNetworkConnection* pSock)
 {
 	ASSUME_LOCK(*m_pMutex);
 
-	if(m_lSockets.remove(pSock))
+	RateSocket* pSocket = m_lSockets.take(pSock);
+
+	if(pSocket)
 	{
 		disconnect(pSock, SIGNAL(readyToTransfer()), this, SLOT(sheduleTransfer()));
 		pSock->setReadBufferSize(0);
+
+		m_lClasses[pSocket->nClass].removeOne(pSocket);
+		delete pSocket;
 	}
 }
+// A socket has something to do: transfer as soon as the event loop gets to it.
 void CRateController::sheduleTransfer()
 {
 	if(m_bTransferSheduled)
@@ -72,117 +98,191 @@ void CRateController::sheduleTransfer()
 	}
 
 	m_bTransferSheduled = true;
-	QTimer::singleShot(50, this, SLOT(transfer()));
+	QMetaObject::invokeMethod(this, "transfer", Qt::QueuedConnection);
+}
+// Sockets wait for tokens: transfer again in nMsecs, unless something else comes first.
+void CRateController::sheduleTransfer(qint64 nMsecs)
+{
+	if(m_bTransferSheduled)
+	{
+		return;
+	}
+
+	if(!m_oTimer.isActive() || m_oTimer.remainingTime() > nMsecs)
+	{
+		m_oTimer.start(nMsecs);
+	}
 }
 void CRateController::transfer()
 {
 	m_bTransferSheduled = false;
+	m_oTimer.stop();
 
 	QMutexLocker l(m_pMutex);
 
-	qint64 nMsecs = 1000;
 	if(m_tStopWatch.isValid())
 	{
-		nMsecs = qMin(nMsecs, m_tStopWatch.elapsed());
+		const qint64 nMsecs = m_tStopWatch.restart();
+		m_oDownloadLimit.refill(nMsecs);
+		m_oUploadLimit.refill(nMsecs);
 	}
-
-	qint64 nToRead = (m_nDownloadLimit * nMsecs) / 1000;
-	qint64 nToWrite = (m_nUploadLimit * nMsecs) / 1000;
-
-	if(nToRead == 0 && nToWrite == 0)
+	else
 	{
-		sheduleTransfer();
-		return;
+		m_tStopWatch.start();
 	}
 
-	QSet<CNetworkConnection*> lSockets;
-	for(QSet<CNetworkConnection*>::const_iterator itSocket = m_lSockets.constBegin(); itSocket != m_lSockets.constEnd(); ++itSocket)
+	qint64 tWait = -1;
+
+	// in order of priority, control traffic first
+	for(int i = 0; i < tcClassCount; ++i)
 	{
-		CNetworkConnection* pSock = *itSocket;
-		if(pSock->hasData())
+		const qint64 tClass = transferClass(TrafficClass(i));
+
+		if(tClass >= 0 && (tWait < 0 || tClass < tWait))
 		{
-			lSockets.insert(pSock);
+			tWait = tClass;
 		}
 	}
 
+	if(tWait >= 0)
+	{
+		sheduleTransfer(tWait);
+	}
+}
+
+/**
+  * Serves the sockets of nClass by weighted deficit round robin: every round a socket may move
+  * RATE_QUANTUM times its weight in each direction, plus what it could not use before while it
+  * stayed busy. Rounds go on until the sockets are idle or the budget of the class is used.
+  * Returns the milliseconds after which the class needs to be served again, -1 if it is idle.
+  * Requires Locking: m_pMutex
+  */
+qint64 CRateController::transferClass(TrafficClass nClass)
+{
+	QList<RateSocket*>& lSockets = m_lClasses[nClass];
+
 	if(lSockets.isEmpty())
 	{
-		return;
+		return -1;
 	}
 
-	m_tStopWatch.start();
+	qint64 nToRead = m_bReadPaused ? 0 : qMin(m_oDownloadLimit.available(), TrafficShaper.available(nClass, tdIn));
+	qint64 nToWrite = qMin(m_oUploadLimit.available(), TrafficShaper.available(nClass, tdOut));
+	qint64 nDownloaded = 0, nUploaded = 0;
+	bool bProgress = true;
 
-	bool bCanTransferMore = false;
-	bool bRestart = false;
+	// no socket is always the first to be served
+	lSockets.append(lSockets.takeFirst());
 
-	do
+	while(bProgress && (nToRead > 0 || nToWrite > 0))
 	{
-		bCanTransferMore = false;
-		bRestart = false;
-		qint64 nWriteChunk = qMax(qint64(1), nToWrite / lSockets.size());
-		qint64 nReadChunk = qMax(qint64(1), nToRead / lSockets.size());
-
-		quint32 nDownloaded = 0, nUploaded = 0;
+		bProgress = false;
 
-		for(QSet<CNetworkConnection*>::iterator itSocket = lSockets.begin(); itSocket != lSockets.end() && (nToRead > 0 || nToWrite > 0);)
+		foreach(RateSocket* pSocket, lSockets)
 		{
-			CNetworkConnection* pConn = *itSocket;
+			CNetworkConnection* pConn = pSocket->pConn;
 
-			bool bDataTransferred = false;
+			if(!pConn->hasData())
+			{
+				// idle sockets keep no credit
+				pSocket->nDeficitIn = pSocket->nDeficitOut = 0;
+				continue;
+			}
+
+			const qint64 nQuantum = RATE_QUANTUM * pSocket->nWeight;
+			const qint64 nBuffer = RATE_SOCKET_BUFFER - pConn->bytesToWrite();
 
-			if(m_nUploadLimit * 2 > pConn->bytesToWrite())
+			if(nToWrite > 0 && nBuffer > 0)
 			{
-				qint64 nChunkSize = qMin(qMin(nWriteChunk, nToWrite), m_nUploadLimit * 2 - pConn->bytesToWrite());
+				pSocket->nDeficitOut = qMin(pSocket->nDeficitOut + nQuantum, qint64(RATE_SOCKET_BUFFER));
+
+				const qint64 nChunk = qMin(qMin(pSocket->nDeficitOut, nToWrite), nBuffer);
+				const qint64 nBytes = pConn->writeToNetwork(nChunk);
 
-				if(nChunkSize > 0)
+				if(nBytes > 0)
 				{
-					qint64 nBytesWritten = pConn->writeToNetwork(nChunkSize);
-					if(nBytesWritten > 0)
-					{
-						nToWrite -= nBytesWritten;
-						nUploaded += nBytesWritten;
-						bDataTransferred = true;
-					}
-					else if( nBytesWritten == 0 )
-					{
-						bRestart = true;
-					}
+					pSocket->nDeficitOut -= nBytes;
+					nToWrite -= nBytes;
+					nUploaded += nBytes;
+					bProgress = true;
 				}
-			}
 
-			qint64 nAvailable = qMin(nReadChunk, pConn->networkBytesAvailable());
-			if(nAvailable > 0)
-			{
-				qint64 nReadBytes = pConn->readFromNetwork(qMin(nAvailable, nToRead));
-				if(nReadBytes > 0)
+				if(nBytes < nChunk)
 				{
-					nToRead -= nReadBytes;
-					nDownloaded += nReadBytes;
-					bDataTransferred = true;
+					pSocket->nDeficitOut = 0;
 				}
 			}
 
-			if(bDataTransferred && pConn->hasData())
-			{
-				bCanTransferMore = true;
-			}
-			else
+			const qint64 nAvailable = pConn->networkBytesAvailable();
+
+			if(nToRead > 0 && nAvailable > 0)
 			{
-				itSocket = lSockets.erase(itSocket);
-				continue;
+				pSocket->nDeficitIn = qMin(pSocket->nDeficitIn + nQuantum, qint64(RATE_SOCKET_BUFFER));
+
+				const qint64 nChunk = qMin(qMin(pSocket->nDeficitIn, nToRead), nAvailable);
+				const qint64 nBytes = pConn->readFromNetwork(nChunk);
+
+				if(nBytes > 0)
+				{
+					pSocket->nDeficitIn -= nBytes;
+					nToRead -= nBytes;
+					nDownloaded += nBytes;
+					bProgress = true;
+				}
+
+				if(nBytes >= nAvailable || nBytes < nChunk)
+				{
+					pSocket->nDeficitIn = 0;
+				}
 			}
+		}
+	}
 
-			++itSocket;
+	m_oDownloadLimit.consume(nDownloaded);
+	m_oUploadLimit.consume(nUploaded);
+	TrafficShaper.consume(nClass, tdIn, nDownloaded);
+	TrafficShaper.consume(nClass, tdOut, nUploaded);
+	m_mDownload.Add(nDownloaded);
+	m_mUpload.Add(nUploaded);
+
+	bool bPending = false;
+	foreach(RateSocket* pSocket, lSockets)
+	{
+		if(pSocket->pConn->hasData())
+		{
+			bPending = true;
+			break;
 		}
+	}
 
-		m_mDownload.Add(nDownloaded);
-		m_mUpload.Add(nUploaded);
+	if(!bPending)
+	{
+		return -1;
 	}
-	while(bCanTransferMore && (nToRead > 0 || nToWrite > 0) && !lSockets.isEmpty());
 
-	if(bCanTransferMore || bRestart || nToRead == 0 || nToWrite == 0)
+	// with budget left the sockets could not take more, try again a little later
+	qint64 tWait = RATE_RETRY;
+
+	if(nToRead <= 0 && !m_bReadPaused)
 	{
-		sheduleTransfer();
+		tWait = qMin(tWait, qMax(TrafficShaper.waitTime(nClass, tdIn, RATE_QUANTUM), m_oDownloadLimit.waitTime(RATE_QUANTUM)));
 	}
+
+	if(nToWrite <= 0)
+	{
+		tWait = qMin(tWait, qMax(TrafficShaper.waitTime(nClass, tdOut, RATE_QUANTUM), m_oUploadLimit.waitTime(RATE_QUANTUM)));
+	}
+
+	return qMax(qint64(1), tWait);
 }
 
+// While reading is paused data stays in the socket buffers and TCP slows the senders down.
+void CRateController::setReadPaused(bool bPaused)
+{
+	m_bReadPaused = bPaused;
+
+	if(!bPaused)
+	{
+		sheduleTransfer();
+	}
+}
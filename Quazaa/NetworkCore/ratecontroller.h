@@ -28,23 +28,50 @@
 #include <QtGlobal>
 #include <QObject>
 #include <QElapsedTimer>
-#include <QSet>
+#include <QHash>
+#include <QList>
 #include <QMutex>
+#include <QTimer>
 
 #include "networkconnection.h"
+#include "trafficshaper.h"
 
+#define RATE_QUANTUM	4096	// bytes a socket of weight 1 may transfer per round
+#define RATE_RETRY		50		// ms before sockets that could not take data are tried again
+#define RATE_SOCKET_BUFFER	65536	// most data queued in a socket or credited to it
+
+/**
+ * @brief CRateController moves data between the sockets of one thread and the network.
+ * Sockets belong to a traffic class; how much a class may transfer is decided by TrafficShaper,
+ * within a class the budget is shared by weighted deficit round robin. A transfer runs as soon
+ * as a socket has something to do, if the budget is used up it is timed for when tokens are
+ * available again. The controller limits cap all its classes together.
+ * Locking: m_pMutex, the section of the owner, must be held for addSocket() and removeSocket().
+ */
 class CRateController : public QObject
 {
 	Q_OBJECT
 protected:
-	qint64  m_nUploadLimit;
-	qint64  m_nDownloadLimit;
+	struct RateSocket
+	{
+		CNetworkConnection*	pConn;
+		TrafficClass		nClass;
+		quint32				nWeight;
+		qint64				nDeficitIn;		// bytes it may still read in this round
+		qint64				nDeficitOut;	// bytes it may still write in this round
+	};
+
+	CTokenBucket	m_oDownloadLimit;
+	CTokenBucket	m_oUploadLimit;
 	bool    m_bTransferSheduled;
+	bool    m_bReadPaused;	// the data can not be stored as fast as it arrives
 	QMutex* 	m_pMutex;
 
 	QElapsedTimer   m_tStopWatch;
+	QTimer			m_oTimer;	// wakes the controller when tokens are available
 
-	QSet<CNetworkConnection*>   m_lSockets;
+	QHash<CNetworkConnection*, RateSocket*>	m_lSockets;
+	QList<RateSocket*>	m_lClasses[tcClassCount];	// round robin order of each class
 
 public:
 	TCPBandwidthMeter	m_mDownload;
@@ -52,26 +79,27 @@ public:
 
 public:
 	CRateController(QMutex* pMutex, QObject* parent = 0);
-	void addSocket(CNetworkConnection* pSock);
+	virtual ~CRateController();
+	void addSocket(CNetworkConnection* pSock, TrafficClass nClass = tcControl, quint32 nWeight = 1);
 	void removeSocket(CNetworkConnection* pSock);
 
 	void setDownloadLimit(qint32 nLimit)
 	{
 		systemLog.postLog(LogSeverity::Debug, QString("New download limit: %1").arg(nLimit));
-		m_nDownloadLimit = nLimit;
+		m_oDownloadLimit.setRate(nLimit);
 	}
 	void setUploadLimit(qint32 nLimit)
 	{
 		systemLog.postLog(LogSeverity::Debug, QString("New upload limit: %1").arg(nLimit));
-		m_nUploadLimit = nLimit;
+		m_oUploadLimit.setRate(nLimit);
 	}
 	qint32 uploadLimit() const
 	{
-		return m_nUploadLimit;
+		return m_oUploadLimit.m_nRate;
 	}
 	qint32 downloadLimit() const
 	{
-		return m_nDownloadLimit;
+		return m_oDownloadLimit.m_nRate;
 	}
 
 	quint32 downloadSpeed()
@@ -86,6 +114,11 @@ public:
 public slots:
 	void sheduleTransfer();
 	void transfer();
+	void setReadPaused(bool bPaused);
+
+protected:
+	qint64 transferClass(TrafficClass nClass);
+	void sheduleTransfer(qint64 nMsecs);
 };
 
 #endif // RATECONTROLLER_H
@@ -0,0 +1,270 @@
+/*
+** trafficshaper.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "trafficshaper.h"
+#include "quazaasettings.h"
+
+#include <limits>
+#include <QMutexLocker>
+
+#include "debug_new.h"
+
+CTrafficShaper TrafficShaper;
+
+static const qint64 TRAFFIC_UNLIMITED = std::numeric_limits<qint64>::max() / 4;
+
+// Assured rate and ceiling of each class in percent of the link, and the minimum assured rate in
+// bytes per second. The assured shares of a direction must not add up to more than 100.
+struct TrafficShare
+{
+	int nAssuredIn;
+	int nCeilIn;
+	int nAssuredOut;
+	int nCeilOut;
+	int nFloor;
+};
+
+static const TrafficShare aShares[tcClassCount] =
+{
+	{ 20, 100, 30, 100, 2048 },	// tcControl
+	{  5, 100, 10, 100, 4096 },	// tcSearch
+	{ 50, 100,  5, 100,    0 },	// tcDownload
+	{  5, 100, 40, 100,    0 },	// tcUpload
+	{  5,  25,  5,  25,    0 }	// tcChat
+};
+
+CTokenBucket::CTokenBucket(qint64 nRate) :
+	m_nRate(nRate),
+	m_nTokens(0),
+	m_nFraction(0)
+{
+	m_nTokens = depth();
+}
+
+void CTokenBucket::setRate(qint64 nRate)
+{
+	m_nRate = nRate;
+	m_nTokens = qMin(m_nTokens, depth());
+}
+
+void CTokenBucket::refill(qint64 nMsecs)
+{
+	if(m_nRate == 0)
+	{
+		return;
+	}
+
+	// keep the remainder, or slow buckets refilled often would never fill
+	const qint64 nUnits = m_nRate * nMsecs + m_nFraction;
+	m_nTokens = qMin(depth(), m_nTokens + nUnits / 1000);
+	m_nFraction = nUnits % 1000;
+}
+
+void CTokenBucket::consume(qint64 nBytes)
+{
+	if(m_nRate != 0)
+	{
+		m_nTokens -= nBytes;
+	}
+}
+
+qint64 CTokenBucket::available() const
+{
+	return m_nRate ? qMax(qint64(0), m_nTokens) : TRAFFIC_UNLIMITED;
+}
+
+// Milliseconds until nBytes, or as much as the bucket holds, can be taken.
+qint64 CTokenBucket::waitTime(qint64 nBytes) const
+{
+	nBytes = qMin(nBytes, depth());
+
+	if(m_nRate == 0 || m_nTokens >= nBytes)
+	{
+		return 0;
+	}
+
+	return (nBytes - m_nTokens) * 1000 / m_nRate + 1;
+}
+
+qint64 CTokenBucket::depth() const
+{
+	return qMax(qint64(TRAFFIC_BURST_MIN), m_nRate * TRAFFIC_BURST_MS / 1000);
+}
+
+CTrafficShaper::CTrafficShaper(QObject* parent) :
+	QObject(parent),
+	m_tLast(0)
+{
+	m_tClock.start();
+}
+
+// Takes the link rates from the settings, now and whenever they are changed.
+void CTrafficShaper::start()
+{
+	connect(&quazaaSettings, SIGNAL(connectionSettingsChanged()), SLOT(settingsChanged()));
+
+	settingsChanged();
+}
+
+void CTrafficShaper::settingsChanged()
+{
+	setLinkRate(quazaaSettings.Connection.InSpeed, quazaaSettings.Connection.OutSpeed);
+}
+
+/**
+  * Sets the speed of the internet connection in bytes per second, 0 for unlimited.
+  * The rates of the classes follow from it.
+  */
+void CTrafficShaper::setLinkRate(qint64 nIn, qint64 nOut)
+{
+	QMutexLocker l(&m_pSection);
+
+	refill();
+
+	m_aLink[tdIn].setRate(nIn);
+	m_aLink[tdOut].setRate(nOut);
+
+	setClassRates(tdIn, nIn);
+	setClassRates(tdOut, nOut);
+}
+
+// Bytes nClass may transfer now: its assured tokens plus what it can borrow from the link.
+qint64 CTrafficShaper::available(TrafficClass nClass, TrafficDirection nDirection)
+{
+	QMutexLocker l(&m_pSection);
+
+	refill();
+
+	return qMin(m_aCeil[nDirection][nClass].available(),
+				m_aAssured[nDirection][nClass].available() + m_aLink[nDirection].available());
+}
+
+// Charges nBytes transferred by nClass, to its assured tokens first, the rest is borrowed.
+void CTrafficShaper::consume(TrafficClass nClass, TrafficDirection nDirection, qint64 nBytes)
+{
+	QMutexLocker l(&m_pSection);
+
+	refill();
+
+	CTokenBucket& oAssured = m_aAssured[nDirection][nClass];
+	oAssured.consume(qMin(nBytes, oAssured.available()));
+
+	m_aCeil[nDirection][nClass].consume(nBytes);
+	m_aLink[nDirection].consume(nBytes);
+}
+
+// Milliseconds until nClass can transfer nBytes, either from its assured rate or by borrowing.
+qint64 CTrafficShaper::waitTime(TrafficClass nClass, TrafficDirection nDirection, qint64 nBytes)
+{
+	QMutexLocker l(&m_pSection);
+
+	refill();
+
+	const qint64 tBorrow = qMax(m_aCeil[nDirection][nClass].waitTime(nBytes), m_aLink[nDirection].waitTime(nBytes));
+
+	return qMin(m_aAssured[nDirection][nClass].waitTime(nBytes), tBorrow);
+}
+
+/**
+  * Splits nLink between the classes. A class is assured its share of the link, but at least its
+  * floor; the floors are taken out of the shares of the other classes, and never amount to more
+  * than half of the link together.
+  * Requires Locking: m_pSection
+  */
+void CTrafficShaper::setClassRates(TrafficDirection nDirection, qint64 nLink)
+{
+	qint64 aAssured[tcClassCount];
+	qint64 nFloors = 0;		// assured by floors
+	qint64 nShares = 0;		// assured by shares
+
+	for(int i = 0; i < tcClassCount; ++i)
+	{
+		const int nShare = (nDirection == tdIn) ? aShares[i].nAssuredIn : aShares[i].nAssuredOut;
+		aAssured[i] = nLink * nShare / 100;
+
+		if(aAssured[i] < aShares[i].nFloor)
+		{
+			aAssured[i] = aShares[i].nFloor;
+			nFloors += aAssured[i];
+		}
+		else
+		{
+			nShares += aAssured[i];
+		}
+	}
+
+	// scale down so that everything assured fits into the link
+	const qint64 nFloorMax = qMin(nFloors, nLink / 2);
+	const qint64 nShareMax = qMin(nShares, nLink - nFloorMax);
+
+	for(int i = 0; i < tcClassCount; ++i)
+	{
+		const int nShare = (nDirection == tdIn) ? aShares[i].nAssuredIn : aShares[i].nAssuredOut;
+		const int nCeil = (nDirection == tdIn) ? aShares[i].nCeilIn : aShares[i].nCeilOut;
+
+		if(nLink == 0)
+		{
+			aAssured[i] = 0;
+		}
+		else if(nLink * nShare / 100 < aShares[i].nFloor)
+		{
+			aAssured[i] = qMax(qint64(1), aAssured[i] * nFloorMax / nFloors);
+		}
+		else
+		{
+			aAssured[i] = qMax(qint64(1), aAssured[i] * nShareMax / qMax(qint64(1), nShares));
+		}
+
+		// a rate of 0 would be unlimited
+		const qint64 nCeilRate = nLink ? qMax(aAssured[i], nLink * nCeil / 100) : 0;
+
+		m_aAssured[nDirection][i].setRate(aAssured[i]);
+		m_aCeil[nDirection][i].setRate(nCeilRate);
+	}
+}
+
+// Requires Locking: m_pSection
+void CTrafficShaper::refill()
+{
+	const qint64 tNow = m_tClock.elapsed();
+	const qint64 nMsecs = tNow - m_tLast;
+
+	if(nMsecs <= 0)
+	{
+		return;
+	}
+
+	m_tLast = tNow;
+
+	for(int nDirection = tdIn; nDirection <= tdOut; ++nDirection)
+	{
+		m_aLink[nDirection].refill(nMsecs);
+
+		for(int i = 0; i < tcClassCount; ++i)
+		{
+			m_aAssured[nDirection][i].refill(nMsecs);
+			m_aCeil[nDirection][i].refill(nMsecs);
+		}
+	}
+}
@@ -0,0 +1,119 @@
+/*
+** trafficshaper.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TRAFFICSHAPER_H
+#define TRAFFICSHAPER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QMutex>
+
+#define TRAFFIC_BURST_MS	250		// a bucket holds the tokens of this many milliseconds
+#define TRAFFIC_BURST_MIN	1500	// but at least one full size packet
+
+enum TrafficClass
+{
+	tcControl,		// neighbour and handshake traffic
+	tcSearch,		// G2 UDP
+	tcDownload,
+	tcUpload,
+	tcChat,
+	tcClassCount
+};
+
+enum TrafficDirection
+{
+	tdIn,
+	tdOut
+};
+
+/**
+ * @brief CTokenBucket allows m_nRate bytes per second, with bursts of up to TRAFFIC_BURST_MS
+ * worth of tokens. A rate of 0 means no limit. Tokens may go negative when more was
+ * transferred than allowed, the debt is paid back before anything else is allowed.
+ */
+class CTokenBucket
+{
+public:
+	qint64	m_nRate;	// bytes per second, 0 for unlimited
+	qint64	m_nTokens;
+
+public:
+	CTokenBucket(qint64 nRate = 0);
+
+	void setRate(qint64 nRate);
+	void refill(qint64 nMsecs);
+	void consume(qint64 nBytes);
+	qint64 available() const;
+	qint64 waitTime(qint64 nBytes) const;
+
+protected:
+	qint64	m_nFraction;	// refill remainder, in thousandths of a byte
+
+	qint64 depth() const;
+};
+
+/**
+ * @brief CTrafficShaper is a two level hierarchical token bucket over all TCP and UDP traffic.
+ * The link buckets are the connection speeds from the settings, updated whenever those change.
+ * Every traffic class has an assured rate it can always use, and a ceiling up to which it
+ * borrows whatever the link has left. The assured rates add up to no more than the link, so
+ * neighbour traffic keeps flowing while bulk transfers take the rest. Control and search traffic
+ * are assured a minimum rate of their own, so a slow upstream does not starve them.
+ * The rate controllers of the different threads ask it how much a class may transfer and
+ * report what was transferred. Locking: all functions lock m_pSection internally.
+ */
+class CTrafficShaper : public QObject
+{
+	Q_OBJECT
+
+protected:
+	QMutex			m_pSection;
+	QElapsedTimer	m_tClock;
+	qint64			m_tLast;	// m_tClock time of the last refill
+	CTokenBucket	m_aLink[2];
+	CTokenBucket	m_aAssured[2][tcClassCount];
+	CTokenBucket	m_aCeil[2][tcClassCount];
+
+public:
+	CTrafficShaper(QObject* parent = 0);
+
+	void start();
+	void setLinkRate(qint64 nIn, qint64 nOut);
+
+	qint64 available(TrafficClass nClass, TrafficDirection nDirection);
+	void consume(TrafficClass nClass, TrafficDirection nDirection, qint64 nBytes);
+	qint64 waitTime(TrafficClass nClass, TrafficDirection nDirection, qint64 nBytes);
+
+public slots:
+	void settingsChanged();
+
+protected:
+	void refill();
+	void setClassRates(TrafficDirection nDirection, qint64 nLink);
+};
+
+extern CTrafficShaper TrafficShaper;
+
+#endif // TRAFFICSHAPER_H
@@ -243,6 +243,7 @@ HEADERS += \
 		Discovery/discoveryservice.h \
 		Discovery/gwc.h \
 		Discovery/networktype.h \
+		FileFragments/ChunkedVector.hpp \
 		FileFragments/Compatibility.hpp \
 		FileFragments/Exception.hpp \
 		FileFragments/FileFragments.hpp \
@@ -278,6 +279,10 @@ HEADERS += \
 		NetworkCore/handshake.h \
 		NetworkCore/handshakes.h \
 		NetworkCore/Hashes/hash.h \
+		NetworkCore/Hashes/hashset.h \
+		NetworkCore/Hashes/sha1.h \
+		NetworkCore/Hashes/tiger.h \
+		NetworkCore/Hashes/tigertree.h \
 		NetworkCore/hubhorizon.h \
 		NetworkCore/managedsearch.h \
 		NetworkCore/neighbour.h \
@@ -299,6 +304,7 @@ HEADERS += \
 		NetworkCore/routetable.h \
 		NetworkCore/searchmanager.h \
 		NetworkCore/thread.h \
+		NetworkCore/trafficshaper.h \
 		NetworkCore/types.h \
 		NetworkCore/types.h \
 		NetworkCore/zlibutils.h \
@@ -309,16 +315,30 @@ HEADERS += \
 		Security/securitymanager.h \
 		ShareManager/file.h \
 		ShareManager/filehasher.h \
+		ShareManager/hashcache.h \
+		ShareManager/librarywatcher.h \
+		ShareManager/libraryindex.h \
+		ShareManager/localsearch.h \
 		ShareManager/sharedfile.h \
 		ShareManager/sharemanager.h \
+		ShareManager/sharewriter.h \
 		Skin/skinsettings.h \
 		systemlog.h \
+		Transfers/chunkselector.h \
+		Transfers/diskwriter.h \
 		Transfers/download.h \
+		Transfers/downloadjournal.h \
 		Transfers/downloads.h \
 		Transfers/downloadsource.h \
 		Transfers/downloadtransfer.h \
+		Transfers/downloadtransferhttp.h \
+		Transfers/sourcestore.h \
 		Transfers/transfer.h \
 		Transfers/transfers.h \
+		Transfers/transferstats.h \
+		Transfers/uploads.h \
+		Transfers/uploadtransfer.h \
+		Transfers/uploadtransferhttp.h \
 		UI/completerlineedit.h \
 		UI/dialogabout.h \
 		UI/dialogadddownload.h \
@@ -389,10 +409,12 @@ HEADERS += \
 		Models/ircuserlistmodel.h \
 		Security/iprule.h \
 		Security/iprangerule.h \
+		Security/iprangetable.h \
 		Security/hashrule.h \
 		Security/regexprule.h \
 		Security/useragentrule.h \
 		Security/contentrule.h \
+		Security/sanitycheck.h \
 		Models/securityfiltermodel.h \
 		UI/dialogimportsecurity.h \
 	UI/dialogmodifyrule.h \
@@ -443,6 +465,10 @@ SOURCES += \
 		NetworkCore/handshake.cpp \
 		NetworkCore/handshakes.cpp \
 		NetworkCore/Hashes/hash.cpp \
+		NetworkCore/Hashes/hashset.cpp \
+		NetworkCore/Hashes/sha1.cpp \
+		NetworkCore/Hashes/tiger.cpp \
+		NetworkCore/Hashes/tigertree.cpp \
 		NetworkCore/hubhorizon.cpp \
 		NetworkCore/managedsearch.cpp \
 		NetworkCore/neighbour.cpp \
@@ -464,6 +490,7 @@ SOURCES += \
 		NetworkCore/routetable.cpp \
 		NetworkCore/searchmanager.cpp \
 		NetworkCore/thread.cpp \
+		NetworkCore/trafficshaper.cpp \
 		NetworkCore/types.cpp \
 		NetworkCore/zlibutils.cpp \
 		quazaaglobals.cpp \
@@ -473,16 +500,30 @@ SOURCES += \
 		Security/securitymanager.cpp \
 		ShareManager/file.cpp \
 		ShareManager/filehasher.cpp \
+		ShareManager/hashcache.cpp \
+		ShareManager/librarywatcher.cpp \
+		ShareManager/libraryindex.cpp \
+		ShareManager/localsearch.cpp \
 		ShareManager/sharedfile.cpp \
 		ShareManager/sharemanager.cpp \
+		ShareManager/sharewriter.cpp \
 		Skin/skinsettings.cpp \
 		systemlog.cpp \
+		Transfers/chunkselector.cpp \
+		Transfers/diskwriter.cpp \
 		Transfers/download.cpp \
+		Transfers/downloadjournal.cpp \
 		Transfers/downloads.cpp \
 		Transfers/downloadsource.cpp \
 		Transfers/downloadtransfer.cpp \
+		Transfers/downloadtransferhttp.cpp \
+		Transfers/sourcestore.cpp \
 		Transfers/transfer.cpp \
 		Transfers/transfers.cpp \
+		Transfers/transferstats.cpp \
+		Transfers/uploads.cpp \
+		Transfers/uploadtransfer.cpp \
+		Transfers/uploadtransferhttp.cpp \
 		UI/completerlineedit.cpp \
 		UI/dialogabout.cpp \
 		UI/dialogadddownload.cpp \
@@ -552,10 +593,12 @@ SOURCES += \
 		Models/ircuserlistmodel.cpp \
 		Security/iprule.cpp \
 		Security/iprangerule.cpp \
+		Security/iprangetable.cpp \
 		Security/hashrule.cpp \
 		Security/regexprule.cpp \
 		Security/useragentrule.cpp \
 		Security/contentrule.cpp \
+		Security/sanitycheck.cpp \
 		Models/securityfiltermodel.cpp \
 		UI/dialogimportsecurity.cpp \
 	UI/dialogmodifyrule.cpp \
@@ -1,7 +1,8 @@
 #include "iprangerule.h"
 #include <QDebug>
 
-CIPRangeRule::CIPRangeRule()
+CIPRangeRule::CIPRangeRule() :
+	m_nTableIndex( -1 )
 {
 	m_nType = RuleType::IPAddressRange;
 }
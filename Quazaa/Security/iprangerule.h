@@ -9,6 +9,9 @@ private:
 	CEndPoint m_oStartIP;
 	CEndPoint m_oEndIP;
 
+public:
+	qint32 m_nTableIndex; // index within the Security Manager's range table or -1
+
 public:
 	CIPRangeRule();
 
@@ -0,0 +1,441 @@
+/*
+** $Id$
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QVector>
+
+#include "iprangetable.h"
+#include "systemlog.h"
+#include "commonfunctions.h"
+
+#include "debug_new.h"
+
+static const char   RANGE_TABLE_MAGIC[4] = { 'Q', 'S', 'R', 'T' };
+static const quint32 RANGE_TABLE_BOM     = 0x01020304; // detects files written on other platforms
+
+struct CIPRangeTable::Header
+{
+	char	szMagic[4];
+	quint32	nBOM;
+	quint32	nVersion;
+	quint32	nCount;
+	quint32	nCommentsLength;	// in QChars
+	quint32	nReserved[3];
+};
+
+struct CIPRangeTable::RuleInfo
+{
+	uchar	pUUID[16];
+	quint32	tExpire;
+	quint32	nCommentOffset;		// in QChars
+	quint16	nCommentLength;		// in QChars
+	quint8	bAutomatic;
+	quint8	nReserved;
+};
+
+// Size of the action array padded to keep the side table 4 byte aligned.
+static inline quint32 actionArraySize(quint32 nCount)
+{
+	return ( nCount + 3 ) & ~3u;
+}
+
+CIPRangeTable::CIPRangeTable() :
+	m_pMap( NULL ),
+	m_nCount( 0 ),
+	m_pStart( NULL ),
+	m_pEnd( NULL ),
+	m_pMaxEnd( NULL ),
+	m_pPriority( NULL ),
+	m_pAction( NULL ),
+	m_pInfo( NULL ),
+	m_pComments( NULL ),
+	m_nCommentsLength( 0 )
+{
+}
+
+CIPRangeTable::~CIPRangeTable()
+{
+	close();
+}
+
+/**
+  * Maps the table stored at sPath into memory. Returns false if the file does not exist or
+  * is not a valid table.
+  */
+bool CIPRangeTable::open(const QString& sPath)
+{
+	close();
+
+	m_oFile.setFileName( sPath );
+	if ( !m_oFile.exists() || !m_oFile.open( QIODevice::ReadOnly ) )
+		return false;
+
+	const qint64 nSize = m_oFile.size();
+	if ( nSize < (qint64)sizeof( Header ) )
+	{
+		m_oFile.close();
+		return false;
+	}
+
+	m_pMap = m_oFile.map( 0, nSize );
+	if ( !m_pMap )
+	{
+		m_oFile.close();
+		return false;
+	}
+
+	const Header* pHeader = (const Header*)m_pMap;
+
+	const quint32 nCount  = pHeader->nCount;
+	const qint64 nExpected = sizeof( Header ) + 4ll * nCount * sizeof( quint32 ) +
+							 actionArraySize( nCount ) + (qint64)nCount * sizeof( RuleInfo ) +
+							 (qint64)pHeader->nCommentsLength * sizeof( QChar );
+
+	if ( memcmp( pHeader->szMagic, RANGE_TABLE_MAGIC, 4 ) || pHeader->nBOM != RANGE_TABLE_BOM ||
+		 pHeader->nVersion != IPRANGE_TABLE_VERSION || nExpected != nSize )
+	{
+		systemLog.postLog( LogSeverity::Warning, Components::Security,
+						   QObject::tr( "Ignoring invalid address range table: %1" ).arg( sPath ) );
+		close();
+		return false;
+	}
+
+	const uchar* pData = m_pMap + sizeof( Header );
+
+	m_nCount          = nCount;
+	m_pStart          = (const quint32*)pData;
+	m_pEnd            = m_pStart + nCount;
+	m_pMaxEnd         = m_pEnd + nCount;
+	m_pPriority       = m_pMaxEnd + nCount;
+	m_pAction         = (const quint8*)( m_pPriority + nCount );
+	m_pInfo           = (const RuleInfo*)( m_pAction + actionArraySize( nCount ) );
+	m_pComments       = (const QChar*)( m_pInfo + nCount );
+	m_nCommentsLength = pHeader->nCommentsLength;
+
+	return true;
+}
+
+void CIPRangeTable::close()
+{
+	if ( m_pMap )
+	{
+		m_oFile.unmap( m_pMap );
+		m_pMap = NULL;
+	}
+
+	if ( m_oFile.isOpen() )
+		m_oFile.close();
+
+	m_nCount          = 0;
+	m_pStart          = NULL;
+	m_pEnd            = NULL;
+	m_pMaxEnd         = NULL;
+	m_pPriority       = NULL;
+	m_pAction         = NULL;
+	m_pInfo           = NULL;
+	m_pComments       = NULL;
+	m_nCommentsLength = 0;
+
+	m_lsRemoved.clear();
+}
+
+/**
+  * Returns the index of the live rule with the best priority containing nIP or -1 if there is none.
+  */
+int CIPRangeTable::find(quint32 nIP, quint32 tNow) const
+{
+	if ( !m_nCount )
+		return -1;
+
+	// Find the first range starting after nIP and walk back over all ranges that may still
+	// contain it; m_pMaxEnd tells when no earlier range can reach up to nIP anymore.
+	int i = qUpperBound( m_pStart, m_pStart + m_nCount, nIP ) - m_pStart - 1;
+
+	int nBest = -1;
+	quint32 nBestPriority = 0;
+
+	while ( i >= 0 && m_pMaxEnd[i] >= nIP )
+	{
+		if ( m_pEnd[i] >= nIP && m_pAction[i] != RuleAction::None &&
+			 ( nBest == -1 || priority( i ) < nBestPriority ) )
+		{
+			const quint32 tExpire = m_pInfo[i].tExpire;
+			if ( ( tExpire == (quint32)RuleTime::Special || tExpire >= tNow ) &&
+				 ( m_lsRemoved.isEmpty() || !m_lsRemoved.contains( i ) ) )
+			{
+				nBest = i;
+				nBestPriority = priority( i );
+			}
+		}
+		--i;
+	}
+
+	return nBest;
+}
+
+/**
+  * Returns the index of the live rule covering exactly [nStart, nEnd] with action nAction or -1.
+  */
+int CIPRangeTable::indexOf(quint32 nStart, quint32 nEnd, RuleAction::Action nAction) const
+{
+	for ( int i = qLowerBound( m_pStart, m_pStart + m_nCount, nStart ) - m_pStart;
+		  i < (int)m_nCount && m_pStart[i] == nStart; ++i )
+	{
+		if ( m_pEnd[i] == nEnd && m_pAction[i] == nAction && !isRemoved( i ) )
+			return i;
+	}
+
+	return -1;
+}
+
+RuleAction::Action CIPRangeTable::action(quint32 nIndex) const
+{
+	Q_ASSERT( nIndex < m_nCount );
+	return (RuleAction::Action)m_pAction[nIndex];
+}
+
+/**
+  * Marks a rule as removed. Removed rules are dropped the next time the table is written.
+  */
+void CIPRangeTable::remove(quint32 nIndex)
+{
+	Q_ASSERT( nIndex < m_nCount );
+	m_lsRemoved.insert( nIndex );
+}
+
+/**
+  * Creates a full CIPRangeRule for the rule at nIndex. The caller takes ownership.
+  */
+CIPRangeRule* CIPRangeTable::createRule(quint32 nIndex) const
+{
+	Q_ASSERT( nIndex < m_nCount );
+
+	const RuleInfo& oInfo = m_pInfo[nIndex];
+
+	CIPRangeRule* pRule = new CIPRangeRule();
+	pRule->parseContent( QString( "%1-%2" ).arg( CEndPoint( m_pStart[nIndex] ).toString(),
+												  CEndPoint( m_pEnd[nIndex] ).toString() ) );
+
+	QByteArray baUUID( (const char*)oInfo.pUUID, 16 );
+	pRule->m_oUUID       = QUuid::fromRfc4122( baUUID );
+	pRule->m_nAction     = (RuleAction::Action)m_pAction[nIndex];
+	pRule->m_bAutomatic  = oInfo.bAutomatic;
+	pRule->m_nTableIndex = nIndex;
+	pRule->setForever( oInfo.tExpire == (quint32)RuleTime::Special );
+	pRule->setExpiryTime( oInfo.tExpire );
+
+	if ( oInfo.nCommentLength &&
+		 (quint64)oInfo.nCommentOffset + oInfo.nCommentLength <= m_nCommentsLength )
+	{
+		pRule->m_sComment = QString( m_pComments + oInfo.nCommentOffset, oInfo.nCommentLength );
+	}
+
+	return pRule;
+}
+
+/**
+  * Returns true for rules that are stored within the range table instead of security.dat, that is
+  * for persistent IPv4 address range rules.
+  */
+bool CIPRangeTable::isTableRule(const CSecureRule* pRule)
+{
+	if ( pRule->type() != RuleType::IPAddressRange )
+		return false;
+
+	const CIPRangeRule* pRangeRule = (const CIPRangeRule*)pRule;
+
+	// Session rules are not persistent.
+	return pRangeRule->startIP().protocol() == QAbstractSocket::IPv4Protocol &&
+		   pRangeRule->endIP().protocol()   == QAbstractSocket::IPv4Protocol &&
+		   !pRangeRule->isExpired( 0, true );
+}
+
+struct CRangeTableEntry
+{
+	quint32				nStart;
+	quint32				nEnd;
+	quint32				nPriority;
+	qint32				nTableIndex;	// -1 if the entry is taken from pRule
+	const CIPRangeRule*	pRule;
+
+	inline bool operator<(const CRangeTableEntry& rhs) const
+	{
+		return nStart < rhs.nStart || ( nStart == rhs.nStart && nEnd < rhs.nEnd );
+	}
+};
+
+static inline bool rangeTableEntryPriorityLessThan(const CRangeTableEntry& lhs, const CRangeTableEntry& rhs)
+{
+	return lhs.nPriority < rhs.nPriority;
+}
+
+/**
+  * Writes a new table containing the live rules of pTable as well as all table rules from lRules.
+  * Expired rules and exact duplicates are dropped. Table rules keep their relative priority, rules
+  * from lRules rank behind them in list order; priorities are renumbered in that order.
+  * Returns the number of rules written.
+  */
+quint32 CIPRangeTable::write(QFile& oFile, const CIPRangeTable* pTable,
+							 const QList<CIPRangeRule*>& lRules, quint32 tNow)
+{
+	QVector<CRangeTableEntry> vEntries;
+	vEntries.reserve( ( pTable ? pTable->m_nCount : 0 ) + lRules.size() );
+
+	quint32 nNextPriority = 0;
+
+	if ( pTable )
+	{
+		for ( quint32 i = 0; i < pTable->m_nCount; ++i )
+		{
+			const quint32 tExpire = pTable->m_pInfo[i].tExpire;
+			if ( pTable->isRemoved( i ) ||
+				 ( tExpire != (quint32)RuleTime::Special && tExpire < tNow ) )
+				continue;
+
+			CRangeTableEntry oEntry = { pTable->m_pStart[i], pTable->m_pEnd[i],
+										pTable->priority( i ), (qint32)i, NULL };
+			vEntries.append( oEntry );
+			nNextPriority = qMax( nNextPriority, oEntry.nPriority + 1 );
+		}
+	}
+
+	foreach ( const CIPRangeRule* pRule, lRules )
+	{
+		// Rules created from the table are already covered above.
+		if ( pRule->m_nTableIndex >= 0 || !isTableRule( pRule ) || pRule->isExpired( tNow ) )
+			continue;
+
+		CRangeTableEntry oEntry = { pRule->startIP().toIPv4Address(),
+									pRule->endIP().toIPv4Address(), nNextPriority++, -1, pRule };
+		vEntries.append( oEntry );
+	}
+
+	// Renumber the priorities, then sort by range. Both sorts are stable, so among exact duplicates
+	// the entry with the better priority comes first and is the one that is kept.
+	qStableSort( vEntries.begin(), vEntries.end(), rangeTableEntryPriorityLessThan );
+	for ( int i = 0; i < vEntries.size(); ++i )
+		vEntries[i].nPriority = i;
+
+	qStableSort( vEntries.begin(), vEntries.end() );
+
+	const quint32 nMax = vEntries.size();
+	QVector<quint32> vStart, vEnd, vMaxEnd, vPriority;
+	QVector<quint8>  vAction;
+	QVector<RuleInfo> vInfo;
+	QVector<QChar>   vComments;
+
+	vStart.reserve( nMax );
+	vEnd.reserve( nMax );
+	vMaxEnd.reserve( nMax );
+	vPriority.reserve( nMax );
+	vAction.reserve( actionArraySize( nMax ) );
+	vInfo.reserve( nMax );
+
+	quint32 nMaxEnd = 0;
+
+	for ( quint32 i = 0; i < nMax; ++i )
+	{
+		const CRangeTableEntry& oEntry = vEntries.at( i );
+
+		quint8 nAction;
+		RuleInfo oInfo;
+		memset( &oInfo, 0, sizeof( RuleInfo ) );
+
+		const QChar* pComment;
+		quint16 nCommentLength;
+		QString sComment;
+
+		if ( oEntry.nTableIndex >= 0 )
+		{
+			const RuleInfo& oOld = pTable->m_pInfo[oEntry.nTableIndex];
+			nAction = pTable->m_pAction[oEntry.nTableIndex];
+			memcpy( oInfo.pUUID, oOld.pUUID, 16 );
+			oInfo.tExpire    = oOld.tExpire;
+			oInfo.bAutomatic = oOld.bAutomatic;
+
+			// Same check as in createRule(): never copy beyond the end of the mapped comments.
+			if ( (quint64)oOld.nCommentOffset + oOld.nCommentLength <= pTable->m_nCommentsLength )
+			{
+				pComment       = pTable->m_pComments + oOld.nCommentOffset;
+				nCommentLength = oOld.nCommentLength;
+			}
+			else
+			{
+				pComment       = NULL;
+				nCommentLength = 0;
+			}
+		}
+		else
+		{
+			nAction = oEntry.pRule->m_nAction;
+			QByteArray baUUID = oEntry.pRule->m_oUUID.toRfc4122();
+			memcpy( oInfo.pUUID, baUUID.constData(), 16 );
+			oInfo.tExpire    = oEntry.pRule->getExpiryTime();
+			oInfo.bAutomatic = oEntry.pRule->m_bAutomatic;
+			sComment         = oEntry.pRule->m_sComment.left( 0xFFFF );
+			pComment         = sComment.constData();
+			nCommentLength   = sComment.length();
+		}
+
+		// Skip exact duplicates, the first one wins.
+		if ( !vStart.isEmpty() && vStart.last() == oEntry.nStart && vEnd.last() == oEntry.nEnd &&
+			 vAction.last() == nAction )
+			continue;
+
+		oInfo.nCommentOffset = vComments.size();
+		oInfo.nCommentLength = nCommentLength;
+		for ( quint16 c = 0; c < nCommentLength; ++c )
+			vComments.append( pComment[c] );
+
+		nMaxEnd = qMax( nMaxEnd, oEntry.nEnd );
+
+		vStart.append( oEntry.nStart );
+		vEnd.append( oEntry.nEnd );
+		vMaxEnd.append( nMaxEnd );
+		vPriority.append( oEntry.nPriority );
+		vAction.append( nAction );
+		vInfo.append( oInfo );
+	}
+
+	const quint32 nCount = vStart.size();
+	vAction.resize( actionArraySize( nCount ) );
+
+	Header oHeader;
+	memset( &oHeader, 0, sizeof( Header ) );
+	memcpy( oHeader.szMagic, RANGE_TABLE_MAGIC, 4 );
+	oHeader.nBOM            = RANGE_TABLE_BOM;
+	oHeader.nVersion        = IPRANGE_TABLE_VERSION;
+	oHeader.nCount          = nCount;
+	oHeader.nCommentsLength = vComments.size();
+
+	oFile.write( (const char*)&oHeader, sizeof( Header ) );
+	oFile.write( (const char*)vStart.constData(),    nCount * sizeof( quint32 ) );
+	oFile.write( (const char*)vEnd.constData(),      nCount * sizeof( quint32 ) );
+	oFile.write( (const char*)vMaxEnd.constData(),   nCount * sizeof( quint32 ) );
+	oFile.write( (const char*)vPriority.constData(), nCount * sizeof( quint32 ) );
+	oFile.write( (const char*)vAction.constData(),   vAction.size() );
+	oFile.write( (const char*)vInfo.constData(),     nCount * sizeof( RuleInfo ) );
+	oFile.write( (const char*)vComments.constData(), vComments.size() * sizeof( QChar ) );
+
+	return nCount;
+}
@@ -0,0 +1,127 @@
+/*
+** $Id$
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef IPRANGETABLE_H
+#define IPRANGETABLE_H
+
+#include <QFile>
+#include <QSet>
+
+#include "iprangerule.h"
+
+// Increment this if there have been made changes to the binary range table layout.
+#define IPRANGE_TABLE_VERSION 2
+// History:
+// 1 - Initial implementation
+// 2 - Added rule priorities
+
+/**
+ * @brief CIPRangeTable is a read-only, memory mapped table of IPv4 address range rules. The file
+ * consists of a header followed by parallel arrays (start IPs, end IPs, running maximum of end IPs,
+ * priorities, actions) and a side table holding the remaining rule attributes. Opening the table only maps the
+ * file, so the cost of loading it does not depend on the number of rules. CIPRangeRule objects
+ * are created on request only.
+ * If several rules cover an address, the one that comes first in rule order (lowest priority
+ * value) wins, regardless of where it is stored in the start-sorted arrays.
+ * Note: Locking needs to be handled by the caller.
+ */
+class CIPRangeTable
+{
+private:
+	struct Header;
+	struct RuleInfo;
+
+	QFile				m_oFile;
+	uchar*				m_pMap;
+	quint32				m_nCount;
+
+	const quint32*		m_pStart;
+	const quint32*		m_pEnd;
+	const quint32*		m_pMaxEnd;
+	const quint32*		m_pPriority;
+	const quint8*		m_pAction;
+	const RuleInfo*		m_pInfo;
+	const QChar*		m_pComments;
+	quint32				m_nCommentsLength;
+
+	QSet<quint32>		m_lsRemoved;	// indexes of rules removed since the table has been written
+
+public:
+	CIPRangeTable();
+	~CIPRangeTable();
+
+	bool		open(const QString& sPath);
+	void		close();
+	inline bool	isOpen() const;
+
+	inline quint32 count() const;
+	inline quint32 liveCount() const;
+
+	int			find(quint32 nIP, quint32 tNow) const;
+	int			indexOf(quint32 nStart, quint32 nEnd, RuleAction::Action nAction) const;
+	RuleAction::Action action(quint32 nIndex) const;
+	inline quint32 priority(quint32 nIndex) const;
+
+	void		remove(quint32 nIndex);
+	inline bool	isRemoved(quint32 nIndex) const;
+
+	CIPRangeRule* createRule(quint32 nIndex) const;
+
+	// Writes all live rules of pTable (may be NULL) plus the IPv4 rules of lRules to a new table.
+	// The rules of lRules rank behind the ones of pTable, in list order.
+	static quint32 write(QFile& oFile, const CIPRangeTable* pTable,
+						 const QList<CIPRangeRule*>& lRules, quint32 tNow);
+	static bool	isTableRule(const CSecureRule* pRule);
+
+private:
+	Q_DISABLE_COPY(CIPRangeTable)
+};
+
+bool CIPRangeTable::isOpen() const
+{
+	return m_pMap;
+}
+
+quint32 CIPRangeTable::count() const
+{
+	return m_nCount;
+}
+
+quint32 CIPRangeTable::liveCount() const
+{
+	return m_nCount - m_lsRemoved.size();
+}
+
+quint32 CIPRangeTable::priority(quint32 nIndex) const
+{
+	Q_ASSERT( nIndex < m_nCount );
+	return m_pPriority[nIndex];
+}
+
+bool CIPRangeTable::isRemoved(quint32 nIndex) const
+{
+	return m_lsRemoved.contains( nIndex );
+}
+
+#endif // IPRANGETABLE_H
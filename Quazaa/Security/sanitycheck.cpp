@@ -0,0 +1,420 @@
+/*
+** $Id$
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QRunnable>
+#include <QThreadPool>
+
+#include "sanitycheck.h"
+#include "securitymanager.h"
+
+#include "debug_new.h"
+
+// Number of objects handled by a single thread pool task.
+#define SANITY_CHECK_CHUNK_SIZE 512
+
+/**
+  * Constructor. Creates the lookup structures from copies of the given rules.
+  * Locking: R (the caller must hold the Security Manager lock while the rules are copied)
+  */
+CSanityRuleSet::CSanityRuleSet(const QList<CSecureRule*>& lAddressRules,
+							   const QList<CSecureRule*>& lHitRules)
+{
+	m_vRanges.reserve( lAddressRules.size() );
+	m_vRuleIDs.reserve( lAddressRules.size() + lHitRules.size() );
+
+	for ( int i = 0; i < lAddressRules.size(); ++i )
+	{
+		const CSecureRule* pRule = lAddressRules.at(i);
+		m_vRuleIDs.append( pRule->m_oUUID );
+
+		// Rules without action never decide anything, so there is no need to check them.
+		if ( pRule->m_nAction == RuleAction::None )
+			continue;
+
+		IPv4Range oRange;
+		oRange.nPriority = i;
+		oRange.nAction   = pRule->m_nAction;
+
+		if ( pRule->type() == RuleType::IPAddress )
+		{
+			const CEndPoint oIP = ((CIPRule*)pRule)->IP();
+			if ( oIP.protocol() == QAbstractSocket::IPv4Protocol )
+			{
+				oRange.nStart = oRange.nEnd = oIP.toIPv4Address();
+				m_vRanges.append( oRange );
+				continue;
+			}
+		}
+		else if ( pRule->type() == RuleType::IPAddressRange )
+		{
+			const CIPRangeRule* pRangeRule = (CIPRangeRule*)pRule;
+			if ( pRangeRule->startIP().protocol() == QAbstractSocket::IPv4Protocol &&
+				 pRangeRule->endIP().protocol()   == QAbstractSocket::IPv4Protocol )
+			{
+				oRange.nStart = pRangeRule->startIP().toIPv4Address();
+				oRange.nEnd   = pRangeRule->endIP().toIPv4Address();
+				m_vRanges.append( oRange );
+				continue;
+			}
+		}
+
+		m_lOtherAddressRules.append( pRule->getCopy() );
+		m_lOtherAddressIndex.append( i );
+	}
+
+	qStableSort( m_vRanges.begin(), m_vRanges.end() );
+
+	// Allows to stop the backwards scan in match() as soon as no earlier range can reach the IP.
+	m_vMaxEnd.resize( m_vRanges.size() );
+	quint32 nMaxEnd = 0;
+	for ( int i = 0; i < m_vRanges.size(); ++i )
+	{
+		nMaxEnd = qMax( nMaxEnd, m_vRanges.at(i).nEnd );
+		m_vMaxEnd[i] = nMaxEnd;
+	}
+
+	for ( int i = 0; i < lHitRules.size(); ++i )
+	{
+		const CSecureRule* pRule = lHitRules.at(i);
+		m_vRuleIDs.append( pRule->m_oUUID );
+
+		if ( pRule->m_nAction != RuleAction::None )
+		{
+			m_lHitRules.append( pRule->getCopy() );
+			m_lHitIndex.append( lAddressRules.size() + i );
+		}
+	}
+}
+
+CSanityRuleSet::~CSanityRuleSet()
+{
+	qDeleteAll( m_lOtherAddressRules );
+	qDeleteAll( m_lHitRules );
+}
+
+/**
+  * Returns the action of the first rule (in order of loading) matching oAddress, or
+  * RuleAction::None if there is no such rule. The index of the matching rule is written to pRule,
+  * -1 if there is none.
+  * Locking: /
+  */
+RuleAction::Action CSanityRuleSet::match(const CEndPoint& oAddress, int* pRule) const
+{
+	if ( pRule )
+		*pRule = -1;
+
+	if ( oAddress.isNull() )
+		return RuleAction::None;
+
+	if ( oAddress.protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		const quint32 nIP = oAddress.toIPv4Address();
+
+		IPv4Range oKey;
+		oKey.nStart = nIP;
+
+		// Find the first range starting after nIP and walk back from there.
+		int i = qUpperBound( m_vRanges.begin(), m_vRanges.end(), oKey ) - m_vRanges.begin() - 1;
+
+		const IPv4Range* pBest = NULL;
+		while ( i >= 0 && m_vMaxEnd.at(i) >= nIP )
+		{
+			const IPv4Range& oRange = m_vRanges.at(i);
+			if ( oRange.nEnd >= nIP && ( !pBest || oRange.nPriority < pBest->nPriority ) )
+				pBest = &oRange;
+			--i;
+		}
+
+		if ( !pBest )
+			return RuleAction::None;
+
+		if ( pRule )
+			*pRule = pBest->nPriority;
+
+		return (RuleAction::Action)pBest->nAction;
+	}
+
+	for ( int i = 0; i < m_lOtherAddressRules.size(); ++i )
+	{
+		const CSecureRule* pOther = m_lOtherAddressRules.at(i);
+		bool bMatch;
+
+		if ( pOther->type() == RuleType::IPAddressRange )
+		{
+			const CIPRangeRule* pRangeRule = (CIPRangeRule*)pOther;
+			bMatch = oAddress >= pRangeRule->startIP() && oAddress <= pRangeRule->endIP();
+		}
+		else
+		{
+			bMatch = pOther->match( oAddress );
+		}
+
+		if ( bMatch )
+		{
+			if ( pRule )
+				*pRule = m_lOtherAddressIndex.at(i);
+
+			return pOther->m_nAction;
+		}
+	}
+
+	return RuleAction::None;
+}
+
+/**
+  * Returns the action of the first hit rule matching pHit, or RuleAction::None. The index of the
+  * matching rule is written to pRule, -1 if there is none.
+  * Locking: /
+  */
+RuleAction::Action CSanityRuleSet::match(const CQueryHit* const pHit,
+										 const QList<QString>& lQuery, int* pRule) const
+{
+	if ( pRule )
+		*pRule = -1;
+
+	if ( !pHit )
+		return RuleAction::None;
+
+	for ( int i = 0; i < m_lHitRules.size(); ++i )
+	{
+		const CSecureRule* pHitRule = m_lHitRules.at(i);
+
+		if ( pHitRule->match( pHit ) || pHitRule->match( pHit->m_sDescriptiveName ) ||
+			 pHitRule->match( lQuery, pHit->m_sDescriptiveName ) )
+		{
+			if ( pRule )
+				*pRule = m_lHitIndex.at(i);
+
+			return pHitRule->m_nAction;
+		}
+	}
+
+	return RuleAction::None;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CSanityCheckJob
+
+/**
+ * @brief CSanityCheckTask checks the objects [m_nBegin, m_nEnd) of a job in the thread pool.
+ */
+class CSanityCheckTask : public QRunnable
+{
+private:
+	CSanityCheckJob*	m_pJob;
+	int					m_nChunk;
+	int					m_nBegin;
+	int					m_nEnd;
+
+public:
+	CSanityCheckTask(CSanityCheckJob* pJob, int nChunk, int nBegin, int nEnd) :
+		m_pJob( pJob ),
+		m_nChunk( nChunk ),
+		m_nBegin( nBegin ),
+		m_nEnd( nEnd )
+	{
+		setAutoDelete( true );
+	}
+
+	void run()
+	{
+		m_pJob->checkChunk( m_nChunk, m_nBegin, m_nEnd );
+	}
+};
+
+CSanityCheckJob::CSanityCheckJob(CSanityRuleSetPtr pRules) :
+	m_pRules( pRules ),
+	m_nDone( 0 ),
+	m_nPending( 0 )
+{
+}
+
+/**
+  * Creates a job checking lAddresses against pRules. Connect to finished(), then call start().
+  * Locking: /
+  */
+CSanityCheckJob* CSanityCheckJob::checkAddresses(CSanityRuleSetPtr pRules,
+												 const QList<CEndPoint>& lAddresses)
+{
+	CSanityCheckJob* pJob = new CSanityCheckJob( pRules );
+	pJob->m_lAddresses = lAddresses;
+	return pJob;
+}
+
+/**
+  * Creates a job checking lHits and the addresses of the nodes that have sent them against pRules.
+  * The job keeps references to the hits until it is finished. Connect to finished(), then call
+  * start().
+  * Locking: /
+  */
+CSanityCheckJob* CSanityCheckJob::checkHits(CSanityRuleSetPtr pRules,
+											const QList<QueryHitSharedPtr>& lHits,
+											const QList<QString>& lQuery)
+{
+	CSanityCheckJob* pJob = new CSanityCheckJob( pRules );
+	pJob->m_lHits  = lHits;
+	pJob->m_lQuery = lQuery;
+	return pJob;
+}
+
+/**
+  * Distributes the chunks over the global thread pool and returns immediately.
+  * Locking: /
+  */
+void CSanityCheckJob::start()
+{
+	const int nCount = count();
+	const bool bRules = m_pRules && ( m_pRules->hasAddressRules() ||
+									  ( !m_lHits.isEmpty() && m_pRules->hasHitRules() ) );
+
+	if ( !nCount || !bRules )
+	{
+		// Nothing to do; finish from the event loop anyway, so callers get the same behaviour.
+		m_nPending = 1;
+		QMetaObject::invokeMethod( this, "chunkFinished", Qt::QueuedConnection );
+		return;
+	}
+
+	const int nChunks = ( nCount + SANITY_CHECK_CHUNK_SIZE - 1 ) / SANITY_CHECK_CHUNK_SIZE;
+
+	m_vResults.fill( false, nCount );
+	m_vChunkHits.resize( nChunks );
+	m_nPending = nChunks;
+
+	emit securityManager.updateLoadMax( nCount );
+
+	for ( int nChunk = 0; nChunk < nChunks; ++nChunk )
+	{
+		const int nBegin = nChunk * SANITY_CHECK_CHUNK_SIZE;
+		QThreadPool::globalInstance()->start(
+					new CSanityCheckTask( this, nChunk, nBegin, qMin( nCount, nBegin + SANITY_CHECK_CHUNK_SIZE ) ) );
+	}
+}
+
+/**
+  * Checks the objects [nBegin, nEnd) and counts the rule hits in the slot of the chunk. The task
+  * must not access the job after this returns: the job may be deleted right away.
+  * Locking: / (called from the thread pool)
+  */
+void CSanityCheckJob::checkChunk(int nChunk, int nBegin, int nEnd)
+{
+	QHash<int, quint32>& lHits = m_vChunkHits[nChunk];
+
+	for ( int i = nBegin; i < nEnd; ++i )
+	{
+		m_vResults[i] = isDenied( i, lHits );
+	}
+
+	m_nDone.fetchAndAddOrdered( nEnd - nBegin );
+
+	QMetaObject::invokeMethod( this, "chunkFinished", Qt::QueuedConnection );
+}
+
+/**
+  * Qt slot. Collects a finished chunk in the thread of the job. Progress is only reported from
+  * here, so the values emitted never decrease. Once the last chunk is in, the rule hits of all
+  * chunks are added to the rules, finished() is emitted, the Security Manager is told that the
+  * component has performed its sanity check and the job deletes itself. The latter happens even
+  * if the receiver of finished() has been deleted while the job was running.
+  * Locking: /
+  */
+void CSanityCheckJob::chunkFinished()
+{
+	Q_ASSERT( m_nPending > 0 );
+
+	if ( !m_vResults.isEmpty() )
+		emit securityManager.updateLoadProgress( m_nDone.loadAcquire() );
+
+	if ( --m_nPending )
+		return;
+
+	QHash<int, quint32> lHitCounts;
+	for ( int i = 0; i < m_vChunkHits.size(); ++i )
+	{
+		for ( QHash<int, quint32>::const_iterator it = m_vChunkHits.at(i).constBegin();
+			  it != m_vChunkHits.at(i).constEnd(); ++it )
+		{
+			lHitCounts[it.key()] += it.value();
+		}
+	}
+
+	if ( !lHitCounts.isEmpty() )
+		securityManager.countSanityHits( m_pRules, lHitCounts );
+
+	QList<int> lDenied;
+	for ( int i = 0; i < m_vResults.size(); ++i )
+	{
+		if ( m_vResults.at(i) )
+			lDenied.append( i );
+	}
+
+	emit finished( lDenied );
+
+	QMetaObject::invokeMethod( &securityManager, "sanityCheckPerformed", Qt::QueuedConnection );
+
+	deleteLater();
+}
+
+int CSanityCheckJob::count() const
+{
+	return m_lHits.isEmpty() ? m_lAddresses.size() : m_lHits.size();
+}
+
+/**
+  * Checks object nIndex and counts the hit of each rule that decided about it in lHits.
+  * Locking: /
+  */
+bool CSanityCheckJob::isDenied(int nIndex, QHash<int, quint32>& lHits) const
+{
+	int nRule = -1;
+	bool bDenied = false;
+
+	if ( m_lHits.isEmpty() )
+	{
+		bDenied = m_pRules->match( m_lAddresses.at( nIndex ), &nRule ) == RuleAction::Deny;
+		if ( nRule >= 0 )
+			++lHits[nRule];
+
+		return bDenied;
+	}
+
+	const CQueryHit* pHit = m_lHits.at( nIndex ).data();
+
+	if ( m_pRules->hasHitRules() )
+	{
+		bDenied = m_pRules->match( pHit, m_lQuery, &nRule ) == RuleAction::Deny;
+		if ( nRule >= 0 )
+			++lHits[nRule];
+	}
+
+	if ( m_pRules->hasAddressRules() && pHit && pHit->m_pHitInfo )
+	{
+		if ( m_pRules->match( pHit->m_pHitInfo->m_oNodeAddress, &nRule ) == RuleAction::Deny )
+			bDenied = true;
+		if ( nRule >= 0 )
+			++lHits[nRule];
+	}
+
+	return bDenied;
+}
@@ -0,0 +1,153 @@
+/*
+** $Id$
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SANITYCHECK_H
+#define SANITYCHECK_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QVector>
+#include <QSharedPointer>
+
+#include "securerule.h"
+
+class CSecurity;
+
+/**
+ * @brief CSanityRuleSet is an immutable snapshot of the rules loaded for a sanity check. Once
+ * created, it may be queried from any number of threads at the same time without holding the
+ * Security Manager lock. It owns copies of all rules it has been created from. Each rule is known
+ * by its index: address rules by their position in the list they were loaded from, hit rules
+ * after them.
+ */
+class CSanityRuleSet
+{
+private:
+	struct IPv4Range
+	{
+		quint32 nStart;
+		quint32 nEnd;
+		quint32 nPriority;  // position of the rule in the original list; lower wins
+		quint8  nAction;
+
+		inline bool operator<(const IPv4Range& rhs) const
+		{
+			return nStart < rhs.nStart;
+		}
+	};
+
+	QVector<IPv4Range>		m_vRanges;		// IPv4 single IP and range rules, sorted by start IP
+	QVector<quint32>		m_vMaxEnd;		// m_vMaxEnd[i] = max( m_vRanges[0..i].nEnd )
+	QList<CSecureRule*>		m_lOtherAddressRules;	// IPv6 rules, checked linearly
+	QList<int>				m_lOtherAddressIndex;	// rule index of each of m_lOtherAddressRules
+	QList<CSecureRule*>		m_lHitRules;
+	QList<int>				m_lHitIndex;			// rule index of each of m_lHitRules
+	QVector<QUuid>			m_vRuleIDs;				// UUID of the original rule by rule index
+
+public:
+	CSanityRuleSet(const QList<CSecureRule*>& lAddressRules, const QList<CSecureRule*>& lHitRules);
+	~CSanityRuleSet();
+
+	inline bool hasAddressRules() const;
+	inline bool hasHitRules() const;
+	inline QUuid ruleID(int nRule) const;
+
+	RuleAction::Action match(const CEndPoint& oAddress, int* pRule = NULL) const;
+	RuleAction::Action match(const CQueryHit* const pHit, const QList<QString>& lQuery,
+							 int* pRule = NULL) const;
+
+private:
+	Q_DISABLE_COPY(CSanityRuleSet)
+};
+
+typedef QSharedPointer<const CSanityRuleSet> CSanityRuleSetPtr;
+
+bool CSanityRuleSet::hasAddressRules() const
+{
+	return !m_vRanges.isEmpty() || !m_lOtherAddressRules.isEmpty();
+}
+
+bool CSanityRuleSet::hasHitRules() const
+{
+	return !m_lHitRules.isEmpty();
+}
+
+QUuid CSanityRuleSet::ruleID(int nRule) const
+{
+	return m_vRuleIDs.value( nRule );
+}
+
+/**
+ * @brief CSanityCheckJob checks a list of addresses or query hits against a rule set without
+ * blocking the thread it has been started from. The work is split into chunks that are processed
+ * in parallel by the global thread pool. Chunk completions are collected in the thread the job
+ * has been created in; that thread needs a running event loop. It reports the progress through
+ * CSecurity::updateLoadProgress(), merges the rule hit counters of all chunks into the rules of
+ * the Security Manager, emits finished(), calls CSecurity::sanityCheckPerformed() on behalf of the
+ * component that has started it and deletes itself.
+ */
+class CSanityCheckJob : public QObject
+{
+	Q_OBJECT
+
+private:
+	CSanityRuleSetPtr				m_pRules;
+	QList<CEndPoint>				m_lAddresses;
+	QList<QueryHitSharedPtr>		m_lHits;
+	QList<QString>					m_lQuery;
+
+	QVector<bool>					m_vResults;		// written by the chunk tasks, one slot per object
+	QVector< QHash<int, quint32> >	m_vChunkHits;	// rule hit counters, written by the chunk tasks, one slot per chunk
+	QAtomicInt						m_nDone;		// objects checked by all chunks so far
+	int								m_nPending;		// chunks not yet collected, accessed by the job thread only
+
+public:
+	static CSanityCheckJob* checkAddresses(CSanityRuleSetPtr pRules, const QList<CEndPoint>& lAddresses);
+	static CSanityCheckJob* checkHits(CSanityRuleSetPtr pRules, const QList<QueryHitSharedPtr>& lHits,
+									  const QList<QString>& lQuery = QList<QString>());
+
+	void start();
+
+	// Used by the chunk tasks.
+	void checkChunk(int nChunk, int nBegin, int nEnd);
+
+signals:
+	/**
+	 * @brief finished is emitted once all objects have been checked.
+	 * @param lDenied the indexes of all addresses or hits that are denied by the rule set.
+	 */
+	void finished(QList<int> lDenied);
+
+private slots:
+	void chunkFinished();
+
+private:
+	explicit CSanityCheckJob(CSanityRuleSetPtr pRules);
+	int count() const;
+	bool isDenied(int nIndex, QHash<int, quint32>& lHits) const;
+};
+
+#endif // SANITYCHECK_H
@@ -532,13 +532,13 @@ bool CSecureRule::isBeingRemoved()
 }
 
 /**
- * @brief CSecureRule::count increases the total and today hit counters by one each.
+ * @brief CSecureRule::count increases the total and today hit counters by nHits each.
  * Requires Locking: /
  */
-void CSecureRule::count()
+void CSecureRule::count(quint32 nHits)
 {
-	m_nToday.fetchAndAddOrdered(1);
-	m_nTotal.fetchAndAddOrdered(1);
+	m_nToday.fetchAndAddOrdered(nHits);
+	m_nTotal.fetchAndAddOrdered(nHits);
 }
 
 /**
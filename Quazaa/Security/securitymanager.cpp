@@ -39,6 +39,9 @@
 
 #include "debug_new.h"
 
+// Number of range table rules created per event loop iteration when the GUI requests all rules.
+#define SECURITY_TABLE_RULE_PAGE 512u
+
 CSecurity securityManager;
 
 bool IPRangeLessThan(const CIPRangeRule *rule1, const CIPRangeRule *rule2)
@@ -61,6 +64,9 @@ bool IPLessThan(const CIPRule *rule1, const CIPRule *rule2)
 CSecurity::CSecurity() :
 	m_pSection(QMutex::Recursive),
 	m_bIsLoading( false ),
+	m_bTableRulesCreated( false ),
+	m_nTableGeneration( 0 ),
+	m_bRangeTableChanged( false ),
 	m_bLogIPCheckHits( false ),
 	m_bUseMissCache( false ),
 	m_bNewRulesLoaded( false ),
@@ -159,6 +165,17 @@ bool CSecurity::add(CSecureRule* pRule)
 	case RuleType::IPAddressRange:
 	{
 		CIPRangeRule* pNewRule = ((CIPRangeRule*)pRule);
+
+		if ( CIPRangeTable::isTableRule( pNewRule ) && pNewRule->m_nTableIndex < 0 &&
+			 m_oRangeTable.indexOf( pNewRule->startIP().toIPv4Address(),
+									pNewRule->endIP().toIPv4Address(), pNewRule->m_nAction ) != -1 )
+		{
+			// The range table already contains this rule.
+			delete pRule;
+			pRule = NULL;
+			return false;
+		}
+
 		CIPRangeRule* pOldRule = isInAddressRangeRules(pNewRule->startIP());
 
 		if(!pOldRule)
@@ -232,6 +249,9 @@ bool CSecurity::add(CSecureRule* pRule)
 
 		m_lIPRanges.prepend( pNewRule );
 
+		if ( CIPRangeTable::isTableRule( pNewRule ) )
+			m_bRangeTableChanged = true;
+
 		bNewAddress = true;
 
 		if ( !m_bUseMissCache )
@@ -466,6 +486,12 @@ void CSecurity::clear()
 	m_lContents.clear();
 	m_lmUserAgents.clear();
 
+	m_oRangeTable.close();
+	m_lhTableRules.clear();
+	m_bTableRulesCreated = false;
+	++m_nTableGeneration;
+	m_bRangeTableChanged = false;
+
 	qDeleteAll( m_lRules );
 	m_lRules.clear();
 
@@ -779,6 +805,46 @@ bool CSecurity::isNewlyDenied(const CQueryHit* pHit, const QList<QString>& lQuer
 	return false;
 }
 
+/**
+  * Returns an immutable snapshot of the rules loaded for the currently running sanity check. The
+  * snapshot can be used by listeners to performSanityCheck() to check their objects in parallel
+  * using CSanityCheckJob::checkAddresses() and CSanityCheckJob::checkHits() without blocking the Security
+  * Manager. Returns a null pointer if no sanity check is running.
+  * Locking: R
+  */
+CSanityRuleSetPtr CSecurity::sanityRules()
+{
+	QMutexLocker locker(&m_pSection);
+	return m_pSanityRules;
+}
+
+/**
+  * Adds the rule hits a sanity check job has counted on the snapshot pRules to the rules the
+  * snapshot has been created from. lHits maps rule indexes of pRules to hit counts. Rules that
+  * have been removed in the meantime are skipped.
+  * Locking: RW
+  */
+void CSecurity::countSanityHits(CSanityRuleSetPtr pRules, const QHash<int, quint32>& lHits)
+{
+	QMutexLocker locker(&m_pSection);
+
+	bool bHit = false;
+
+	for ( QHash<int, quint32>::const_iterator it = lHits.constBegin(); it != lHits.constEnd(); ++it )
+	{
+		CSecureRule* pRule = getUUID( pRules->ruleID( it.key() ) );
+
+		if ( pRule && !pRule->isBeingRemoved() )
+		{
+			pRule->count( it.value() );
+			bHit = true;
+		}
+	}
+
+	if ( bHit )
+		emit securityHit();
+}
+
 /**
   * Checks an IP against the security database. Writes a message to the system log if LogIPCheckHits
   * is true.
@@ -846,6 +912,26 @@ bool CSecurity::isDenied(const CEndPoint &oAddress)
 			Q_ASSERT( pIPRangeRule->m_nAction == RuleAction::None );
 	}
 
+	// Also check the range rules stored within the range table.
+	if ( oAddress.protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		int nIndex = m_oRangeTable.find( oAddress.toIPv4Address(), tNow );
+
+		if ( nIndex != -1 )
+		{
+			CIPRangeRule* pTableRule = m_lhTableRules.value( nIndex );
+			if ( pTableRule )
+				hit( pTableRule );
+			else
+				emit securityHit();
+
+			if ( m_oRangeTable.action( nIndex ) == RuleAction::Accept )
+				return false;
+			else if ( m_oRangeTable.action( nIndex ) == RuleAction::Deny )
+				return true;
+		}
+	}
+
 	// Fourth, check whether the IP is contained within one of the single IP rules
 	CIPRule* pIPRule = isInAddressRules( oAddress );
 
@@ -1232,16 +1318,26 @@ bool CSecurity::load()
 {
 	QString sPath = CQuazaaGlobals::DATA_PATH() + "security.dat";
 
-	if ( load( sPath ) )
-	{
-		return true;
-	}
-	else
+	bool bReturn = load( sPath );
+	if ( !bReturn )
 	{
 		sPath = QDir::toNativeSeparators(QString("%1/DefaultSecurity.dat").arg(qApp->applicationDirPath()));
 		qDebug() << "Default security file path: " << sPath;
-		return load(sPath);
+		bReturn = load(sPath);
 	}
+
+	// The range table is only mapped, rules are created once the GUI requests them.
+	QMutexLocker locker(&m_pSection);
+	if ( m_oRangeTable.open( CQuazaaGlobals::DATA_PATH() + "securityranges.dat" ) )
+	{
+		systemLog.postLog( LogSeverity::Debug, Components::Security,
+						   tr( "Mapped %1 address range rules." ).arg( m_oRangeTable.liveCount() ) );
+
+		evaluateCacheUsage();
+		return true;
+	}
+
+	return bReturn;
 }
 
 /**
@@ -1338,13 +1434,21 @@ quint32 CSecurity::writeToFile(const void * const pManager, QFile& oFile)
 	QDataStream oStream( &oFile );
 	CSecurity* pSManager = (CSecurity*)pManager;
 
+	// Persistent IPv4 range rules are stored within the range table.
+	QList<const CSecureRule*> lRules;
+	for ( int i = 0; i != pSManager->m_lRules.size(); ++i )
+	{
+		const CSecureRule* pRule = pSManager->m_lRules.at(i);
+		if ( !CIPRangeTable::isTableRule( pRule ) )
+			lRules.append( pRule );
+	}
+
 	oStream << nVersion;
 	oStream << pSManager->m_bDenyPolicy;
-	oStream << pSManager->getCount();
+	oStream << (quint32)lRules.size();
 
-	for ( int i = 0; i != pSManager->m_lRules.size(); ++i )
+	foreach ( const CSecureRule* pRule, lRules )
 	{
-		const CSecureRule* pRule = pSManager->m_lRules.at(i);
 		CSecureRule::save( pRule, oStream );
 	}
 
@@ -1356,7 +1460,7 @@ quint32 CSecurity::writeToFile(const void * const pManager, QFile& oFile)
   * been any important changes and bForceSaving is not set to true.
   * Locking: R
   */
-bool CSecurity::save(bool bForceSaving) const
+bool CSecurity::save(bool bForceSaving)
 {
 	if ( m_nUnsaved.loadAcquire() < m_nMaxUnsavedRules && !bForceSaving )
 	{
@@ -1376,6 +1480,11 @@ bool CSecurity::save(bool bForceSaving) const
 		bReturn = true;
 	}
 
+	if ( m_bRangeTableChanged && !saveRangeTable() )
+	{
+		bReturn = false;
+	}
+
 	return bReturn;
 }
 
@@ -1387,15 +1496,18 @@ bool CSecurity::save(bool bForceSaving) const
 const QString CSecurity::xmlns = "http://www.shareaza.com/schemas/Security.xsd";
 
 /**
-  * Exports all rules to an XML file.
+  * Exports all rules to an XML file. Table rules without a rule object are exported through a
+  * temporary object, so exporting does not keep objects for the whole range table around.
   * Locking: R
   */
-bool CSecurity::toXML(const QString& sPath) const
+bool CSecurity::toXML(const QString& sPath)
 {
 	QFile oFile( sPath );
 	if( !oFile.open( QIODevice::ReadWrite ) )
 		return false;
 
+	QMutexLocker locker(&m_pSection);
+
 	QXmlStreamWriter xmlDocument( &oFile );
 
 	xmlDocument.writeStartElement( xmlns, "security" );
@@ -1406,6 +1518,16 @@ bool CSecurity::toXML(const QString& sPath) const
 		m_lRules.at(i)->toXML( xmlDocument );
 	}
 
+	for ( quint32 i = 0; i < m_oRangeTable.count(); ++i )
+	{
+		if ( !m_oRangeTable.isRemoved( i ) && !m_lhTableRules.contains( i ) )
+		{
+			CIPRangeRule* pRule = m_oRangeTable.createRule( i );
+			pRule->toXML( xmlDocument );
+			delete pRule;
+		}
+	}
+
 	xmlDocument.writeEndElement();
 
 	return true;
@@ -1587,14 +1709,64 @@ int CSecurity::receivers(const char* signal) const
 // Qt slots
 /**
   * Qt slot. Triggers the Security Manager to emit all rules using the ruleInfo() signal.
+  * Rules from the range table that do not have an object yet are created and emitted page by page
+  * from the event loop afterwards, see emitTableRules().
   * Locking: R
   */
 void CSecurity::requestRuleList()
 {
+	QMutexLocker locker(&m_pSection);
+
 	for ( int i = 0; i < m_lRules.size(); ++i )
 	{
 		emit ruleInfo( m_lRules.at(i) );
 	}
+
+	if ( !m_bTableRulesCreated )
+	{
+		QMetaObject::invokeMethod( this, "emitTableRules", Qt::QueuedConnection,
+								   Q_ARG( int, 0 ), Q_ARG( int, m_nTableGeneration ) );
+	}
+}
+
+/**
+  * Qt slot. Creates CIPRangeRule objects for the next SECURITY_TABLE_RULE_PAGE table rules that do
+  * not have one yet, emits them using ruleInfo() and queues itself for the next page. If the
+  * table has been remapped in the meantime, indexes have changed and the scan restarts from the
+  * beginning; rules that already have an object are not emitted twice.
+  * Locking: RW
+  */
+void CSecurity::emitTableRules(int nFirst, int nGeneration)
+{
+	QMutexLocker locker(&m_pSection);
+
+	if ( m_bTableRulesCreated )
+		return;
+
+	quint32 i = ( nGeneration == m_nTableGeneration ) ? (quint32)nFirst : 0;
+	const quint32 nEnd = qMin( m_oRangeTable.count(), i + SECURITY_TABLE_RULE_PAGE );
+
+	for ( ; i < nEnd; ++i )
+	{
+		if ( !m_oRangeTable.isRemoved( i ) && !m_lhTableRules.contains( i ) )
+		{
+			CIPRangeRule* pRule = m_oRangeTable.createRule( i );
+			m_lhTableRules.insert( i, pRule );
+			m_lRules.append( pRule );
+
+			emit ruleInfo( pRule );
+		}
+	}
+
+	if ( i < m_oRangeTable.count() )
+	{
+		QMetaObject::invokeMethod( this, "emitTableRules", Qt::QueuedConnection,
+								   Q_ARG( int, (int)i ), Q_ARG( int, m_nTableGeneration ) );
+	}
+	else
+	{
+		m_bTableRulesCreated = true;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1625,10 +1797,8 @@ void CSecurity::sanityCheck()
 			// if there is anyone listening, start the sanity check
 			if ( m_nPendingOperations )
 			{
-#ifdef _DEBUG
 				// Failsafe mechanism in case there are massive problems somewhere else.
 				m_idForceEoSC = signalQueue.push( this, "forceEndOfSanityCheck", 120 );
-#endif
 
 				// Inform all other modules about the necessity of a sanity check.
 				emit performSanityCheck();
@@ -1657,8 +1827,9 @@ void CSecurity::sanityCheck()
   */
 void CSecurity::sanityCheckPerformed()
 {
-	Q_ASSERT( m_bNewRulesLoaded );        // TODO: remove after testing
-	Q_ASSERT( m_nPendingOperations > 0 );
+	// A component that has been too slow reports after forceEndOfSanityCheck().
+	if ( !m_bNewRulesLoaded || !m_nPendingOperations )
+		return;
 
 	if ( --m_nPendingOperations == 0 )
 	{
@@ -1666,13 +1837,14 @@ void CSecurity::sanityCheckPerformed()
 				 Components::Security, QString( "Sanity Check finished successfully. " ) +
 				 QString( "Starting cleanup now." ) );
 
+		signalQueue.pop( m_idForceEoSC );
 		clearNewRules();
 	}
 	else
 	{
 		systemLog.postLog( LogSeverity::Security,
 				 Components::Security, QString( "A component finished with sanity checking. " ) +
-				 QString( "Still waiting for %s other components to finish."
+				 QString( "Still waiting for %1 other components to finish."
 						  ).arg( m_nPendingOperations ) );
 	}
 }
@@ -1683,7 +1855,9 @@ void CSecurity::sanityCheckPerformed()
   */
 void CSecurity::forceEndOfSanityCheck()
 {
-#ifdef _DEBUG
+	if ( !m_bNewRulesLoaded )
+		return;
+
 	if ( m_nPendingOperations )
 	{
 		QString sTmp = QString( "Sanity check aborted. Most probable reason: It took some " ) +
@@ -1692,8 +1866,9 @@ void CSecurity::forceEndOfSanityCheck()
 		systemLog.postLog( LogSeverity::Security,
 				 Components::Security, sTmp );
 		Q_ASSERT( false );
+
+		m_nPendingOperations = 0;
 	}
-#endif //_DEBUG
 
 	clearNewRules();
 }
@@ -1793,6 +1968,9 @@ void CSecurity::loadNewRules()
 		pRule = NULL;
 	}
 
+	QMutexLocker locker(&m_pSection);
+	m_pSanityRules = CSanityRuleSetPtr( new CSanityRuleSet( m_lLoadedAddressRules, m_lLoadedHitRules ) );
+
 	m_bNewRulesLoaded = true;
 }
 
@@ -1829,9 +2007,116 @@ void CSecurity::clearNewRules()
 		pRule = NULL;
 	}
 
+	QMutexLocker locker(&m_pSection);
+	m_pSanityRules.clear();	// Tasks still holding a reference keep the snapshot alive.
+
 	m_bNewRulesLoaded = false;
 }
 
+/**
+  * Writes the range table to disk, maps the new table and relinks all existing range rule objects.
+  * Locking: RW
+  */
+bool CSecurity::saveRangeTable()
+{
+	QMutexLocker locker(&m_pSection);
+
+	const QString sPath          = CQuazaaGlobals::DATA_PATH() + "securityranges.dat";
+	const QString sTemporaryPath = sPath + "_tmp";
+	const quint32 tNow           = common::getTNowUTC();
+
+	QDir().mkpath( CQuazaaGlobals::DATA_PATH() );
+	QFile::remove( sTemporaryPath );
+
+	QFile oFile( sTemporaryPath );
+	if ( !oFile.open( QIODevice::WriteOnly ) )
+	{
+		systemLog.postLog( LogSeverity::Error, Components::Security,
+						   tr( "Could not open address range table for write: %1" ).arg( sTemporaryPath ) );
+		return false;
+	}
+
+	// m_lIPRanges is sorted by address; pass the new table rules in rule order instead, as that
+	// order determines their priority within the table.
+	QList<CIPRangeRule*> lNewRules;
+	foreach ( CSecureRule* pRule, m_lRules )
+	{
+		if ( pRule->type() == RuleType::IPAddressRange && ((CIPRangeRule*)pRule)->m_nTableIndex < 0 )
+			lNewRules.append( (CIPRangeRule*)pRule );
+	}
+
+	const quint32 nCount = CIPRangeTable::write( oFile, &m_oRangeTable, lNewRules, tNow );
+	oFile.close();
+
+	// The old table needs to be unmapped before it can be replaced.
+	m_oRangeTable.close();
+	++m_nTableGeneration;
+
+	if ( ( QFile::exists( sPath ) && !QFile::remove( sPath ) ) || !QFile::rename( sTemporaryPath, sPath ) )
+	{
+		systemLog.postLog( LogSeverity::Error, Components::Security,
+						   tr( "Could not replace address range table: %1" ).arg( sPath ) );
+		m_oRangeTable.open( sPath );
+		linkTableRules();
+		return false;
+	}
+
+	m_oRangeTable.open( sPath );
+	linkTableRules();
+
+	m_bRangeTableChanged = false;
+
+	systemLog.postLog( LogSeverity::Debug, Components::Security,
+					   tr( "Saved %1 address range rules." ).arg( nCount ) );
+
+	return true;
+}
+
+/**
+  * Updates the table indexes of all existing range rule objects after the table has been
+  * (re)mapped. Rules that have been written to the table are removed from m_lIPRanges, as the table
+  * takes care of matching them from now on.
+  * Locking: RW
+  */
+void CSecurity::linkTableRules()
+{
+	QList<CIPRangeRule*> lRules = m_lhTableRules.values();
+	m_lhTableRules.clear();
+
+	foreach ( CIPRangeRule* pRule, m_lIPRanges )
+	{
+		if ( CIPRangeTable::isTableRule( pRule ) )
+			lRules.append( pRule );
+	}
+
+	foreach ( CIPRangeRule* pRule, lRules )
+	{
+		int nIndex = m_oRangeTable.indexOf( pRule->startIP().toIPv4Address(),
+											pRule->endIP().toIPv4Address(), pRule->m_nAction );
+
+		if ( nIndex != -1 && !m_lhTableRules.contains( nIndex ) )
+		{
+			if ( pRule->m_nTableIndex < 0 )
+				m_lIPRanges.removeOne( pRule );
+
+			pRule->m_nTableIndex = nIndex;
+			m_lhTableRules.insert( nIndex, pRule );
+		}
+		else if ( pRule->m_nTableIndex >= 0 )
+		{
+			// Should not happen; keep the rule working as a normal range rule.
+			pRule->m_nTableIndex = -1;
+			m_lIPRanges.append( pRule );
+			m_bRangeTableChanged = true;
+		}
+	}
+
+	qSort( m_lIPRanges.begin(), m_lIPRanges.end(), IPRangeLessThan );
+
+	// Rule objects for all table entries only exist if they have been created before.
+	m_bTableRulesCreated = m_bTableRulesCreated && (quint32)m_lhTableRules.size() == m_oRangeTable.liveCount();
+}
+
 CHashRule* CSecurity::getHash(const QList<CHash>& hashes) const
 {
 	// We are not searching for any hash. :)
@@ -1885,11 +2170,25 @@ void CSecurity::remove(CSecureRule* pRule)
 
 		case RuleType::IPAddressRange:
 		{
-			for (int i = 0; i < m_lIPRanges.size(); ++i) {
-			if ( m_lIPRanges.at(i)->m_oUUID == pRule->m_oUUID ) {
-					m_lIPRanges.removeAt(i);
-					break;
+			CIPRangeRule* pRangeRule = (CIPRangeRule*)pRule;
+			if ( pRangeRule->m_nTableIndex >= 0 )
+			{
+				m_oRangeTable.remove( pRangeRule->m_nTableIndex );
+				m_lhTableRules.remove( pRangeRule->m_nTableIndex );
+				pRangeRule->m_nTableIndex = -1;
+				m_bRangeTableChanged = true;
+			}
+			else
+			{
+				for (int i = 0; i < m_lIPRanges.size(); ++i) {
+					if ( m_lIPRanges.at(i)->m_oUUID == pRule->m_oUUID ) {
+						m_lIPRanges.removeAt(i);
+						break;
+					}
 				}
+
+				if ( CIPRangeTable::isTableRule( pRangeRule ) )
+					m_bRangeTableChanged = true;
 			}
 
 			if ( m_bUseMissCache )
@@ -2056,7 +2355,8 @@ void CSecurity::evaluateCacheUsage()
 		s_nLogMult	= log( nIPMap );
 	}
 
-	m_bUseMissCache = ( s_nLogCache < s_nLogMult + m_lIPRanges.size() * log2 );
+	m_bUseMissCache = ( s_nLogCache < s_nLogMult +
+						( m_lIPRanges.size() + m_oRangeTable.liveCount() ) * log2 );
 }
 
 bool CSecurity::isDenied(const QString& sContent)
@@ -25,22 +25,26 @@
 #ifndef SECURITYMANAGER_H
 #define SECURITYMANAGER_H
 
+#include <QHash>
 #include <QList>
 #include <QQueue>
 #include <QTimer>
 
 // Increment this if there have been made changes to the way of storing security rules.
-#define SECURITY_CODE_VERSION 1
+#define SECURITY_CODE_VERSION 2
 // History:
 // 0 - Initial implementation
+// 2 - Persistent IPv4 range rules are stored in the binary range table (securityranges.dat)
 
 #include "securerule.h"
 #include "contentrule.h"
 #include "hashrule.h"
 #include "iprangerule.h"
+#include "iprangetable.h"
 #include "iprule.h"
 #include "regexprule.h"
 #include "useragentrule.h"
+#include "sanitycheck.h"
 #include "commonfunctions.h"
 
 // DODO: Add quint16 GUI ID to rules and update GUI only when there is a change to the rule.
@@ -67,9 +71,15 @@ private:
 	QQueue<CSecureRule*>			m_lqNewAddressRules;
 	QList<CSecureRule*>				m_lLoadedHitRules;
 	QQueue<CSecureRule*>			m_lqNewHitRules;
+	CSanityRuleSetPtr				m_pSanityRules;			// immutable snapshot of the loaded rules for parallel checks
 	QSet<uint>						m_lsCache;				// IP rule miss cache
 	QList<CIPRule*>					m_lIPs;					// single IP blocking rules
 	QList<CIPRangeRule*>			m_lIPRanges;			// multiple IP blocking rules
+	CIPRangeTable					m_oRangeTable;			// persistent IPv4 range rules (memory mapped)
+	QHash<quint32, CIPRangeRule*>	m_lhTableRules;			// rules created from m_oRangeTable by table index
+	bool							m_bTableRulesCreated;	// true once all table rules have been created
+	int								m_nTableGeneration;		// incremented each time m_oRangeTable is remapped
+	bool							m_bRangeTableChanged;	// true if the range table needs to be rewritten
 	QMultiMap<uint, CHashRule*>		m_lmmHashes;				// hash rules
 	// Note: Using a multimap eliminates eventual problems of hash
 	// collisions caused by weaker hashes like MD5 for example.
@@ -79,9 +89,7 @@ private:
 	// Security manager settings
 	bool							m_bLogIPCheckHits;		// Post log message on IsDenied( QHostAdress ) call
 	QTimer*							m_tMaintenance;			// This timer runs the maintenance tasks every second
-#ifdef _DEBUG // use failsafe to abort sanity check only in debug version
 	QUuid							m_idForceEoSC;			// The signalQueue ID (force end of sanity check)
-#endif
 	bool							m_bUseMissCache;
 	bool							m_bNewRulesLoaded;		// true if new rules for sanity check have been loaded.
 	unsigned short					m_nPendingOperations;	// Counts the number of program modules that still need to call back after having finished a requested sanity check operation.
@@ -108,6 +116,8 @@ public:
 	// Methods used during sanity check
 	bool			isNewlyDenied(const CEndPoint& oAddress);
 	bool			isNewlyDenied(const CQueryHit* pHit, const QList<QString>& lQuery);
+	CSanityRuleSetPtr sanityRules();	// Returns the rule snapshot of the currently running sanity check.
+	void			countSanityHits(CSanityRuleSetPtr pRules, const QHash<int, quint32>& lHits);
 	bool			isDenied(const CEndPoint& oAddress);
 	bool			isDenied(const CQueryHit* const pHit, const QList<QString>& lQuery);	// This does not check for the hit IP to avoid double checking.
 	bool			isPrivate(const CEndPoint &oAddress);
@@ -125,10 +135,10 @@ public:
 	bool			start();																// connects signals etc.
 	bool			stop();																	// makes the Security Manager ready for destruction
 	bool			load();
-	bool			save(bool bForceSaving = false) const;
+	bool			save(bool bForceSaving = false);
 	static quint32	writeToFile(const void* const pManager, QFile& oFile); // used by save()
 	bool			import(const QString& sPath);
-	bool			toXML(const QString& sPath) const;
+	bool			toXML(const QString& sPath);
 	bool			fromXML(const QString& sPath);
 	bool			fromP2P(const QString& sFile);
 	int				receivers(const char* signal) const;	// Allows for external callers to find out about how many listeners there are to the Security Manager Signals.
@@ -151,8 +161,13 @@ public slots:
 	void			missCacheClear();
 	void			settingsChanged();			// Trigger this slot to inform the security manager about changes in the security settings.
 
+private slots:
+	void			emitTableRules(int nFirst, int nGeneration);	// Emits the next page of table rules for requestRuleList()
+
 private:	// Sanity check helper methods
 	void			loadNewRules();
+	bool			saveRangeTable();
+	void			linkTableRules();
 	void			clearNewRules();
 	bool			load(QString sPath);
 	CHashRule		*getHash(const QList< CHash >& hashes) const;	// this returns the first rule found. Note that there might be others, too.
@@ -168,7 +183,8 @@ private:	// Sanity check helper methods
 
 quint32 CSecurity::getCount() const
 {
-	return (quint32)m_lRules.size();
+	// Table rules that have an object are part of m_lRules.
+	return (quint32)( m_lRules.size() + m_oRangeTable.liveCount() - m_lhTableRules.size() );
 }
 
 bool CSecurity::denyPolicy() const
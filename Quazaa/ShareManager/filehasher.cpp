@@ -26,14 +26,168 @@
 #include "Hashes/hash.h"
 #include <QFile>
 #include <QByteArray>
+#include <QAtomicInt>
+#include <QSemaphore>
 #include "sharemanager.h"
+#include "hashcache.h"
 #include "quazaasettings.h"
 #include <QElapsedTimer>
 
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/stat.h>
+#endif
+
 #include "debug_new.h"
 
+static const int HASH_BLOCK_SIZE = 1024 * 1024;
+static const int HASH_RING_SIZE  = 4;
+static const int HASH_WORKERS    = 4; // SHA1, MD5, ED2K, TigerTree
+
+#if defined(Q_OS_LINUX)
+// see linux/ioprio.h, not exported by glibc
+static const int HASH_IOPRIO_WHO_PROCESS = 1;
+static const int HASH_IOPRIO_CLASS_IDLE  = 3 << 13;
+#endif
+
+/**
+ * @brief CHashDevice holds the files queued on one storage device and the hashers reading them.
+ */
+struct CHashDevice
+{
+	QQueue<CSharedFilePtr>	lQueue;
+	quint32					nReaders;		// hashers reading from the device
+	quint32					nMaxReaders;
+	qint64					nBytes;			// read since tRate was started
+	QElapsedTimer			tRate;
+	qint64					nRate;			// bytes per second over all readers
+
+	CHashDevice(quint32 nMax) :
+		nReaders( 0 ),
+		nMaxReaders( nMax ),
+		nBytes( 0 ),
+		nRate( 0 )
+	{
+		tRate.start();
+	}
+};
+
+// Pacing of all hashers to the configured hashing speed: time (ms) the next block may be read.
+static QElapsedTimer s_tThrottle;
+static qint64 s_nThrottleNext = 0;
+
+/**
+ * @brief CHashRing is the ring of read buffers shared by a hasher thread and its workers. A slot
+ * is handed back to the reader once every worker has hashed it, so the reader can run up to
+ * HASH_RING_SIZE blocks ahead of the slowest algorithm.
+ */
+struct CHashRing
+{
+	QByteArray	pBuffers[HASH_RING_SIZE];
+	qint64		pLength[HASH_RING_SIZE];	// valid bytes; -1 tells the workers to exit
+	QAtomicInt	pPending[HASH_RING_SIZE];	// workers that have not finished the slot yet
+	QSemaphore	oFree;						// slots the reader may fill
+	QSemaphore	pFilled[HASH_WORKERS];		// slots published to each worker
+	int			nWrite;
+
+	CHashRing() :
+		oFree( HASH_RING_SIZE ),
+		nWrite( 0 )
+	{
+		for ( int i = 0; i < HASH_RING_SIZE; ++i )
+		{
+			pBuffers[i].resize( HASH_BLOCK_SIZE );
+			pLength[i] = 0;
+		}
+	}
+
+	// Waits for a free slot and returns its buffer.
+	char* acquire()
+	{
+		oFree.acquire();
+		return pBuffers[nWrite].data();
+	}
+
+	// Hands the acquired slot to all workers.
+	void publish(qint64 nLength)
+	{
+		pLength[nWrite] = nLength;
+		pPending[nWrite].store( HASH_WORKERS );
+		nWrite = ( nWrite + 1 ) % HASH_RING_SIZE;
+
+		for ( int i = 0; i < HASH_WORKERS; ++i )
+		{
+			pFilled[i].release();
+		}
+	}
+
+	// Returns the acquired slot unused.
+	void cancel()
+	{
+		oFree.release();
+	}
+
+	// Blocks until the workers are done with all published slots.
+	void drain()
+	{
+		oFree.acquire( HASH_RING_SIZE );
+		oFree.release( HASH_RING_SIZE );
+	}
+};
+
+/**
+ * @brief CHashWorker feeds every block published to the ring into one hash object. The hash is
+ * swapped by the reader between files, while the ring is drained.
+ */
+class CHashWorker : public QThread
+{
+public:
+	CHashRing*	m_pRing;
+	int			m_nWorker;
+	CHash*		m_pHash;
+
+public:
+	CHashWorker(CHashRing* pRing, int nWorker) :
+		m_pRing( pRing ),
+		m_nWorker( nWorker ),
+		m_pHash( 0 )
+	{
+	}
+
+protected:
+	void run()
+	{
+		for ( int nSlot = 0; ; nSlot = ( nSlot + 1 ) % HASH_RING_SIZE )
+		{
+			m_pRing->pFilled[m_nWorker].acquire();
+
+			const qint64 nLength = m_pRing->pLength[nSlot];
+
+			if ( nLength > 0 && m_pHash )
+			{
+				m_pHash->addData( m_pRing->pBuffers[nSlot].constData(), nLength );
+			}
+
+			if ( !m_pRing->pPending[nSlot].deref() )
+			{
+				m_pRing->oFree.release();
+			}
+
+			if ( nLength < 0 )
+			{
+				break;
+			}
+		}
+	}
+};
+
 QMutex CFileHasher::m_pSection;
-QQueue<CSharedFilePtr> CFileHasher::m_lQueue;
+QHash<quint64, CHashDevice*> CFileHasher::m_lhDevices;
 CFileHasher** CFileHasher::m_pHashers = 0;
 quint32  CFileHasher::m_nMaxHashers = 1;
 quint32  CFileHasher::m_nRunningHashers = 0;
@@ -43,6 +197,8 @@ CFileHasher::CFileHasher(QObject* parent) : QThread(parent)
 {
 	m_bActive = true;
 	m_nId = -1;
+	m_nDevice = 0;
+	m_pRing = 0;
 }
 
 CFileHasher::~CFileHasher()
@@ -50,6 +206,7 @@ CFileHasher::~CFileHasher()
 	m_bActive = false;
 	if(isRunning())
 	{
+		CFileHasher::m_oWaitCond.wakeAll();
 		wait();
 	}
 }
@@ -60,7 +217,8 @@ CFileHasher* CFileHasher::hashFile(CSharedFilePtr pFile)
 
 	if(m_pHashers == 0)
 	{
-		m_nMaxHashers = qMin<quint32>(4, qMax<quint32>(2, QThread::idealThreadCount()));
+		// an upper limit for all devices together, every hasher keeps one worker per algorithm busy
+		m_nMaxHashers = qMax<quint32>(2, QThread::idealThreadCount() / 2);
 		m_pHashers = new CFileHasher*[m_nMaxHashers];
 		for(uint i = 0; i < m_nMaxHashers; i++)
 		{
@@ -68,12 +226,16 @@ CFileHasher* CFileHasher::hashFile(CSharedFilePtr pFile)
 		}
 	}
 
+	quint64 nDevice = 0;
+	CHashDevice* pDevice = device(pFile->absoluteFilePath(), nDevice);
+
 	//qDebug() << "File" << pFile->m_sFilename << "queued for hashing";
-	m_lQueue.enqueue(pFile);
+	pDevice->lQueue.enqueue(pFile);
 
 	CFileHasher* pHasher = 0;
 
-	if(m_nRunningHashers < (uint)m_lQueue.size() && m_nRunningHashers < m_nMaxHashers)
+	if(pDevice->nReaders < (uint)pDevice->lQueue.size() && pDevice->nReaders < pDevice->nMaxReaders &&
+	   m_nRunningHashers < m_nMaxHashers)
 	{
 		for(uint i = 0; i < m_nMaxHashers; i++)
 		{
@@ -83,11 +245,13 @@ CFileHasher* CFileHasher::hashFile(CSharedFilePtr pFile)
 				m_pHashers[i] = new CFileHasher();
 				pHasher = m_pHashers[i];
 				pHasher->m_nId = i;
-				connect(pHasher, SIGNAL(queueEmpty()), &ShareManager, SLOT(RunHashing()), Qt::UniqueConnection);
-				connect(pHasher, SIGNAL(fileHashed(CSharedFilePtr)), &ShareManager, SLOT(OnFileHashed(CSharedFilePtr)), Qt::UniqueConnection);
+				pHasher->m_nDevice = nDevice;
+				pDevice->nReaders++;
+				connect(pHasher, SIGNAL(queueEmpty()), &ShareManager, SLOT(runHashing()), Qt::UniqueConnection);
+				connect(pHasher, SIGNAL(fileHashed(CSharedFilePtr)), &ShareManager, SLOT(onFileHashed(CSharedFilePtr)), Qt::UniqueConnection);
 				connect(pHasher, SIGNAL(hasherStarted(int)), &ShareManager, SIGNAL(hasherStarted(int)));
 				connect(pHasher, SIGNAL(hasherFinished(int)), &ShareManager, SIGNAL(hasherFinished(int)));
-				connect(pHasher, SIGNAL(hashingProgress(int,QString,double,int)), &ShareManager, SIGNAL(hashingProgress(int,QString,double,int)));
+				connect(pHasher, SIGNAL(hashingProgress(int,QString,double,qint64)), &ShareManager, SIGNAL(hashingProgress(int,QString,double,qint64)));
 				m_pHashers[i]->start((quazaaSettings.Library.HighPriorityHashing ? QThread::NormalPriority : QThread::LowestPriority));
 				m_nRunningHashers++;
 				break;
@@ -97,98 +261,107 @@ CFileHasher* CFileHasher::hashFile(CSharedFilePtr pFile)
 
 	m_pSection.unlock();
 
-	CFileHasher::m_oWaitCond.wakeOne();
+	// waiting hashers of other devices may take over the file
+	CFileHasher::m_oWaitCond.wakeAll();
 
 	return pHasher;
 }
 
-void CFileHasher::run()
+/**
+  * Stops all hashers, including idle ones, and waits for them to finish. Files still queued are
+  * left in the queues.
+  */
+void CFileHasher::stopAll()
 {
-	QElapsedTimer tTimer;
-	QByteArray baBuffer;
-
-	static const int nBufferSize = 2 * 1024 * 1024;
-
-	emit hasherStarted(m_nId);
+	QList<CFileHasher*> lHashers;
 
 	m_pSection.lock();
-
-	while(!m_lQueue.isEmpty())
+	if(m_pHashers)
 	{
-		CSharedFilePtr pFile = m_lQueue.dequeue();
-		systemLog.postLog(LogSeverity::Debug, QString("Hashing %1").arg(pFile->fileName()));
+		for(uint i = 0; i < m_nMaxHashers; i++)
+		{
+			if(m_pHashers[i])
+			{
+				m_pHashers[i]->m_bActive = false;
+				lHashers.append(m_pHashers[i]);
+			}
+		}
+	}
+	m_pSection.unlock();
 
-		m_pSection.unlock();
+	CFileHasher::m_oWaitCond.wakeAll();
 
-		emit hashingProgress(m_nId, pFile->fileName(), 0, 0);
+	foreach(CFileHasher* pHasher, lHashers)
+	{
+		pHasher->wait();
+	}
+}
 
-		bool bHashed = true;
+void CFileHasher::run()
+{
+	emit hasherStarted(m_nId);
 
-		QList<CHash*> lHashes;
+#if defined(Q_OS_LINUX)
+	if(!quazaaSettings.Library.HighPriorityHashing)
+	{
+		// only read while nobody else is using the disk
+		syscall(SYS_ioprio_set, HASH_IOPRIO_WHO_PROCESS, 0, HASH_IOPRIO_CLASS_IDLE);
+	}
+#endif
 
-		if(pFile->exists() && pFile->open(QFile::ReadOnly))
-		{
-			baBuffer.resize(nBufferSize);
+	startWorkers();
 
-			lHashes.append( new CHash( CHash::SHA1 ) );
-			lHashes.append( new CHash( CHash::MD5 ) );
+	m_pSection.lock();
 
-			tTimer.start();
-//			double nLastPercent = 0;
-			quint64 nFileSize = pFile->size();
-			quint64 nTotalRead = 0, nLastTotalRead = 0;
+	bool bIdle = false;
+
+	forever
+	{
+		if(!m_bActive)
+		{
+			break;
+		}
 
-			emit hashingProgress(m_nId, pFile->fileName(), 0, 0);
+		CSharedFilePtr pFile = takeFile();
 
-			while(!pFile->atEnd())
+		if(!pFile)
+		{
+			// stay available for new files; hashFile() and stopAll() wake us up
+			if(!bIdle)
 			{
-				if(!m_bActive)
-				{
-					systemLog.postLog(LogSeverity::Debug, QString("CFileHasher aborting..."));
-					//qDebug() << "CFileHasher aborting...";
-					bHashed = false;
-					break;
-				}
-				qint64 nRead = pFile->read(baBuffer.data(), nBufferSize);
+				emit queueEmpty();
+				systemLog.postLog(LogSeverity::Debug, QString("Hasher waiting..."));
+				bIdle = true;
+			}
 
-				if(nRead < 0)
-				{
-					bHashed = false;
-					systemLog.postLog(LogSeverity::Debug, QString("File read error: %1").arg(pFile->error()));
-					//qDebug() << "File read error:" << f.error();
-					break;
-				}
-				else if(nRead < nBufferSize)
-				{
-					baBuffer.resize(nRead);
-				}
+			CFileHasher::m_oWaitCond.wait(&m_pSection);
+			continue;
+		}
 
-				nTotalRead += nRead;
+		bIdle = false;
+		systemLog.postLog(LogSeverity::Debug, QString("Hashing %1").arg(pFile->fileName()));
 
-				for(int i = 0; i < lHashes.size(); i++)
-				{
-					lHashes[i]->addData(baBuffer);
-				}
+		m_pSection.unlock();
 
-				if( tTimer.elapsed() >= 1000 )
-				{
-					double nPercent = 100.0f * nTotalRead / float(nFileSize);
-					int nRate = (tTimer.elapsed() * (nTotalRead - nLastTotalRead)) / 1000;
-//					nLastPercent = nPercent;
-					nLastTotalRead = nTotalRead;
-					tTimer.start();
-					emit hashingProgress(m_nId, pFile->fileName(), nPercent, nRate);
-				}
-			}
+		emit hashingProgress(m_nId, pFile->fileName(), 0, 0);
 
-			emit hashingProgress(m_nId, pFile->fileName(), 100, (tTimer.elapsed() * (nTotalRead - nLastTotalRead)) / 1000);
-			pFile->close();
+		QList<CHash*> lHashes;
+		const qint64 nHashStarted = CHashCache::now();
+		bool bHashed = hashCache.lookup(pFile->absoluteFilePath(), lHashes);
+		const bool bCached = bHashed;
+
+		if(bCached)
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("Hashes of %1 found in hash cache").arg(pFile->fileName()));
 		}
 		else
 		{
-			systemLog.postLog(LogSeverity::Debug, QString("File open error: %1").arg(pFile->error()));
-			//qDebug() << "File open error: " << f.error();
-			bHashed = false;
+			lHashes.append( new CHash( CHash::SHA1 ) );
+			lHashes.append( new CHash( CHash::MD5 ) );
+			lHashes.append( new CHash( CHash::ED2K ) );
+			lHashes.append( new CHash( CHash::TIGERTREE ) );
+
+			bHashed = readFile(pFile, lHashes);
 		}
 
 		if(bHashed)
@@ -200,28 +373,24 @@ void CFileHasher::run()
 				//qDebug() << pFile->m_lHashes[i]->ToURN();
 			}
 
+			if(!bCached)
+			{
+				hashCache.insert(pFile->absoluteFilePath(), lHashes, nHashStarted);
+			}
+
 			pFile->setHashes( lHashes );
 			emit fileHashed(pFile);
 		}
 
 		qDeleteAll(lHashes);
 
-		msleep(150);
-
 		m_pSection.lock();
+	}
 
-		if(!m_bActive)
-		{
-			break;
-		}
-
-		if(bHashed && m_lQueue.isEmpty())
-		{
-			emit queueEmpty();
-			systemLog.postLog(LogSeverity::Debug, QString("Hasher waiting..."));
-			//qDebug() << "Hasher " << this << "waiting...";
-			CFileHasher::m_oWaitCond.wait(&m_pSection, 10000);
-		}
+	CHashDevice* pDevice = m_lhDevices.value(m_nDevice);
+	if(pDevice)
+	{
+		pDevice->nReaders--;
 	}
 
 	for(uint i = 0; i < m_nMaxHashers; i++)
@@ -236,6 +405,18 @@ void CFileHasher::run()
 			{
 				delete [] m_pHashers;
 				m_pHashers = 0;
+
+				// forget the devices, unless files have been queued meanwhile
+				bool bIdle = true;
+				foreach(CHashDevice* pIdle, m_lhDevices)
+				{
+					bIdle = bIdle && pIdle->lQueue.isEmpty();
+				}
+				if(bIdle)
+				{
+					qDeleteAll(m_lhDevices);
+					m_lhDevices.clear();
+				}
 			}
 			break;
 		}
@@ -243,8 +424,295 @@ void CFileHasher::run()
 
 	m_pSection.unlock();
 
+	stopWorkers();
+
 	systemLog.postLog(LogSeverity::Debug, QString("CFileHasher done. %1").arg(m_nRunningHashers));
 
 	emit hasherFinished(m_nId);
 }
 
+/**
+  * Returns the next file from the hasher's device. If that queue is empty, the hasher moves on to
+  * another device that may use one more reader. Returns a null pointer if there is nothing to do.
+  * Locking: m_pSection
+  */
+CSharedFilePtr CFileHasher::takeFile()
+{
+	CHashDevice* pDevice = m_lhDevices.value(m_nDevice);
+
+	if(pDevice && !pDevice->lQueue.isEmpty())
+	{
+		return pDevice->lQueue.dequeue();
+	}
+
+	for(QHash<quint64, CHashDevice*>::iterator it = m_lhDevices.begin(); it != m_lhDevices.end(); ++it)
+	{
+		CHashDevice* pOther = it.value();
+
+		if(pOther != pDevice && !pOther->lQueue.isEmpty() && pOther->nReaders < pOther->nMaxReaders)
+		{
+			if(pDevice)
+			{
+				pDevice->nReaders--;
+			}
+
+			pOther->nReaders++;
+			m_nDevice = it.key();
+			return pOther->lQueue.dequeue();
+		}
+	}
+
+	return CSharedFilePtr();
+}
+
+/**
+  * Adds nBytes to the throughput of the hasher's device and returns its current rate in bytes/s.
+  */
+qint64 CFileHasher::account(qint64 nBytes)
+{
+	QMutexLocker l(&m_pSection);
+
+	CHashDevice* pDevice = m_lhDevices.value(m_nDevice);
+	if(!pDevice)
+	{
+		return 0;
+	}
+
+	pDevice->nBytes += nBytes;
+
+	const qint64 nElapsed = pDevice->tRate.elapsed();
+	if(nElapsed >= 1000)
+	{
+		pDevice->nRate = pDevice->nBytes * 1000 / nElapsed;
+		pDevice->nBytes = 0;
+		pDevice->tRate.start();
+	}
+
+	return pDevice->nRate;
+}
+
+/**
+  * Returns the queue of the device sPath is stored on, creating it if needed.
+  * Locking: m_pSection
+  */
+CHashDevice* CFileHasher::device(const QString& sPath, quint64& nDevice)
+{
+	nDevice = 0;
+
+#if defined(Q_OS_UNIX)
+	struct stat oStat;
+	if(::stat(QFile::encodeName(sPath).constData(), &oStat) == 0)
+	{
+		nDevice = oStat.st_dev;
+	}
+#else
+	Q_UNUSED(sPath);
+#endif
+
+	CHashDevice* pDevice = m_lhDevices.value(nDevice);
+	if(pDevice)
+	{
+		return pDevice;
+	}
+
+	// unknown devices get the two hashers every device used to get
+	quint32 nMaxReaders = 2;
+	QString sType("unknown");
+
+#if defined(Q_OS_LINUX)
+	if(nDevice)
+	{
+		const QString sBase = QString("/sys/dev/block/%1:%2/").arg(major(nDevice)).arg(minor(nDevice));
+
+		QFile oRotational(sBase + "queue/rotational");
+		if(!oRotational.exists())
+		{
+			// partitions share the queue of their disk
+			oRotational.setFileName(sBase + "../queue/rotational");
+		}
+
+		if(oRotational.open(QFile::ReadOnly))
+		{
+			if(oRotational.readAll().trimmed() == "0")
+			{
+				nMaxReaders = m_nMaxHashers;
+				sType = "solid state";
+			}
+			else
+			{
+				nMaxReaders = 1;
+				sType = "rotational";
+			}
+		}
+	}
+#endif
+
+	systemLog.postLog(LogSeverity::Debug, QString("Hashing device %1 (%2): %3 hashers").arg(nDevice).arg(sType).arg(nMaxReaders));
+
+	pDevice = new CHashDevice(nMaxReaders);
+	m_lhDevices.insert(nDevice, pDevice);
+	return pDevice;
+}
+
+/**
+  * Blocks until nBytes more may be read under the configured hashing speed (MB/s, 0 = no limit).
+  * The limit applies to all hashers together.
+  */
+void CFileHasher::throttle(qint64 nBytes)
+{
+	const int nLimit = quazaaSettings.Library.HighPriorityHashing ? quazaaSettings.Library.HighPriorityHashingSpeed
+																   : quazaaSettings.Library.LowPriorityHashingSpeed;
+	if(nLimit <= 0)
+	{
+		return;
+	}
+
+	qint64 nWait = 0;
+
+	m_pSection.lock();
+
+	if(!s_tThrottle.isValid())
+	{
+		s_tThrottle.start();
+	}
+
+	const qint64 tNow = s_tThrottle.elapsed();
+	if(s_nThrottleNext < tNow)
+	{
+		s_nThrottleNext = tNow;
+	}
+
+	nWait = s_nThrottleNext - tNow;
+	s_nThrottleNext += nBytes * 1000 / (qint64(nLimit) * 1048576);
+
+	m_pSection.unlock();
+
+	if(nWait > 0)
+	{
+		msleep(nWait);
+	}
+}
+
+void CFileHasher::startWorkers()
+{
+	m_pRing = new CHashRing();
+
+	for(int i = 0; i < HASH_WORKERS; i++)
+	{
+		CHashWorker* pWorker = new CHashWorker(m_pRing, i);
+		pWorker->start(quazaaSettings.Library.HighPriorityHashing ? QThread::NormalPriority : QThread::LowestPriority);
+		m_lWorkers.append(pWorker);
+	}
+}
+
+void CFileHasher::stopWorkers()
+{
+	m_pRing->acquire();
+	m_pRing->publish(-1);
+
+	foreach(CHashWorker* pWorker, m_lWorkers)
+	{
+		pWorker->wait();
+	}
+
+	qDeleteAll(m_lWorkers);
+	m_lWorkers.clear();
+
+	delete m_pRing;
+	m_pRing = 0;
+}
+
+/**
+  * Streams pFile through the ring, while the workers feed the blocks into lHashes (one hash per
+  * worker). Returns false if the file could not be read completely.
+  */
+bool CFileHasher::readFile(CSharedFilePtr pFile, const QList<CHash*>& lHashes)
+{
+	Q_ASSERT(lHashes.size() == HASH_WORKERS);
+
+	if(!pFile->exists() || !pFile->open(QFile::ReadOnly))
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("File open error: %1").arg(pFile->error()));
+		return false;
+	}
+
+#if defined(Q_OS_LINUX)
+	posix_fadvise(pFile->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	// the ring is drained, so the workers are idle
+	for(int i = 0; i < HASH_WORKERS; i++)
+	{
+		m_lWorkers[i]->m_pHash = lHashes[i];
+	}
+
+	QElapsedTimer tTimer, tTotal;
+	tTimer.start();
+	tTotal.start();
+
+	bool bHashed = true;
+	const quint64 nFileSize = pFile->size();
+	quint64 nTotalRead = 0;
+
+	while(!pFile->atEnd())
+	{
+		if(!m_bActive)
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("CFileHasher aborting..."));
+			bHashed = false;
+			break;
+		}
+
+		char* pBuffer = m_pRing->acquire();
+		qint64 nRead = pFile->read(pBuffer, HASH_BLOCK_SIZE);
+
+		if(nRead < 0)
+		{
+			m_pRing->cancel();
+			bHashed = false;
+			systemLog.postLog(LogSeverity::Debug, QString("File read error: %1").arg(pFile->error()));
+			break;
+		}
+
+		m_pRing->publish(nRead);
+		nTotalRead += nRead;
+
+		const qint64 nRate = account(nRead);
+		throttle(nRead);
+
+		if( tTimer.elapsed() >= 1000 )
+		{
+			double nPercent = 100.0f * nTotalRead / float(nFileSize);
+			tTimer.start();
+			emit hashingProgress(m_nId, pFile->fileName(), nPercent, nRate);
+		}
+	}
+
+	m_pRing->drain();
+
+	for(int i = 0; i < HASH_WORKERS; i++)
+	{
+		m_lWorkers[i]->m_pHash = 0;
+	}
+
+#if defined(Q_OS_LINUX)
+	// the file has been read once, don't let the library push everything else out of the cache
+	posix_fadvise(pFile->handle(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+	pFile->close();
+
+	const qint64 nElapsed = qMax<qint64>(1, tTotal.elapsed());
+	emit hashingProgress(m_nId, pFile->fileName(), 100, account(0));
+
+	if(bHashed)
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Hashed %1: %2 MB in %3 ms (%4 MB/s, sha1 md5 ed2k tree:tiger)")
+						  .arg(pFile->fileName())
+						  .arg(nTotalRead / 1048576.0, 0, 'f', 1)
+						  .arg(nElapsed)
+						  .arg(nTotalRead * 1000.0 / nElapsed / 1048576.0, 0, 'f', 1));
+	}
+
+	return bHashed;
+}
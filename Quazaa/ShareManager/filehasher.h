@@ -30,15 +30,30 @@
 #include <QThread>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QHash>
 #include <QQueue>
 #include "ShareManager/sharedfile.h"
 
+class CHash;
+class CHashWorker;
+struct CHashRing;
+struct CHashDevice;
+
+/**
+ * @brief CFileHasher reads queued files once and computes all hashes of a file in parallel: the
+ * hasher thread streams the file through a small ring of buffers and every hash algorithm consumes
+ * those buffers on a worker thread of its own.
+ * Files are queued per storage device. A rotational disk gets a single hasher, so its heads don't
+ * seek between files; solid state and unknown devices are read by several hashers at once. The
+ * total read rate is limited to the configured hashing speed.
+ * Hashers stay around while the queues are empty, waiting for new work, until stopAll() is called.
+ */
 class CFileHasher: public QThread
 {
 	Q_OBJECT
 public:
 	static QMutex   m_pSection;
-	static QQueue<CSharedFilePtr> m_lQueue;
+	static QHash<quint64, CHashDevice*> m_lhDevices; // device ID -> queue
 	static CFileHasher** m_pHashers;
 	static quint32  m_nMaxHashers;
 	static quint32  m_nRunningHashers;
@@ -47,18 +62,35 @@ public:
 
 	bool m_bActive;
 	int	 m_nId;
+	quint64 m_nDevice; // device the hasher is reading from
+
+private:
+	CHashRing*			m_pRing;
+	QList<CHashWorker*>	m_lWorkers;
+
 public:
 	CFileHasher(QObject* parent = 0);
 	~CFileHasher();
 	static CFileHasher* hashFile(CSharedFilePtr pFile);
+	static void stopAll();
 	void run();
 
+private:
+	void startWorkers();
+	void stopWorkers();
+	bool readFile(CSharedFilePtr pFile, const QList<CHash*>& lHashes);
+	CSharedFilePtr takeFile();
+	qint64 account(qint64 nBytes);
+
+	static CHashDevice* device(const QString& sPath, quint64& nDevice);
+	static void throttle(qint64 nBytes);
+
 signals:
 	void fileHashed(CSharedFilePtr);
 	void queueEmpty();
 	void hasherStarted(int); // int - hasher id
 	void hasherFinished(int); // int - hasher id
-	void hashingProgress(int, QString, double, int); // hasher id, filename, percent, rate
+	void hashingProgress(int, QString, double, qint64); // hasher id, filename, percent, rate of the device
 };
 
 #endif // FILEHASHER_H
@@ -0,0 +1,410 @@
+/*
+** hashcache.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "hashcache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QVector>
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "Hashes/hash.h"
+#include "quazaaglobals.h"
+#include "commonfunctions.h"
+#include "systemlog.h"
+
+#include "debug_new.h"
+
+// Bytes read from either end of a file for its fingerprint.
+static const qint64 HASH_CACHE_FINGERPRINT_BYTES = 64 * 1024;
+
+// Files modified more recently than this (ns) are not trusted to be unchanged.
+static const qint64 HASH_CACHE_RACY_NS = Q_INT64_C(1000000000);
+
+CHashCache hashCache;
+
+uint qHash(const CHashCacheKey& oKey)
+{
+	return qHash( oKey.nInode ) ^ qHash( oKey.nSize ) ^ qHash( oKey.nModified );
+}
+
+// Position of each algorithm in CHashCacheEntry::pHashes.
+static int entryOffset(CHash::Algorithm nAlgorithm)
+{
+	switch ( nAlgorithm )
+	{
+	case CHash::SHA1:
+		return CHashCacheEntry::SHA1;
+	case CHash::MD5:
+		return CHashCacheEntry::MD5;
+	case CHash::ED2K:
+		return CHashCacheEntry::ED2K;
+	case CHash::TIGERTREE:
+		return CHashCacheEntry::TIGERTREE;
+	default:
+		return -1;
+	}
+}
+
+static const CHash::Algorithm s_pCachedAlgorithms[] = { CHash::SHA1, CHash::MD5, CHash::ED2K, CHash::TIGERTREE };
+
+CHashCache::CHashCache() :
+	m_bModified( false )
+{
+	m_sMessage = QObject::tr( "[Hash Cache] " );
+}
+
+void CHashCache::load()
+{
+	QMutexLocker l( &m_pSection );
+
+	m_lhEntries.clear();
+	m_bModified = false;
+
+	QFile oFile( CQuazaaGlobals::DATA_PATH() + "hashcache.dat" );
+
+	if ( !oFile.exists() || !oFile.open( QIODevice::ReadOnly ) )
+		return;
+
+	QDataStream oStream( &oFile );
+
+	quint16 nVersion;
+	quint32 nCount;
+
+	oStream >> nVersion;
+	oStream >> nCount;
+
+	if ( nVersion == HASH_CACHE_CODE_VERSION )
+	{
+		m_lhEntries.reserve( nCount );
+
+		CHashCacheKey oKey;
+		CHashCacheEntry oEntry;
+
+		while ( nCount-- && oStream.status() == QDataStream::Ok )
+		{
+			oStream >> oKey.nInode >> oKey.nSize >> oKey.nModified;
+			oStream >> oEntry.nDevice >> oEntry.nFingerprint >> oEntry.tLastSeen;
+
+			if ( oStream.readRawData( (char*)oEntry.pHashes, CHashCacheEntry::Size ) != CHashCacheEntry::Size )
+				break;
+
+			m_lhEntries.insertMulti( oKey, oEntry );
+		}
+	}
+
+	oFile.close();
+
+	systemLog.postLog( LogSeverity::Debug,
+					   m_sMessage + QObject::tr( "Loaded %1 files." ).arg( m_lhEntries.size() ) );
+}
+
+/**
+  * Writes the cache to disk if it has been modified since the last call. Drops the least
+  * recently seen entries beyond HASH_CACHE_MAX_ENTRIES first.
+  */
+bool CHashCache::save()
+{
+	QMutexLocker l( &m_pSection );
+
+	if ( !m_bModified )
+		return true;
+
+	if ( m_lhEntries.size() > HASH_CACHE_MAX_ENTRIES )
+	{
+		QVector<quint32> vLastSeen;
+		vLastSeen.reserve( m_lhEntries.size() );
+
+		for ( CHashCacheMap::const_iterator it = m_lhEntries.constBegin(); it != m_lhEntries.constEnd(); ++it )
+		{
+			vLastSeen.append( it.value().tLastSeen );
+		}
+
+		const int nDrop = m_lhEntries.size() - HASH_CACHE_MAX_ENTRIES;
+		std::nth_element( vLastSeen.begin(), vLastSeen.begin() + nDrop, vLastSeen.end() );
+		const quint32 tOldest = vLastSeen.at( nDrop );
+
+		for ( CHashCacheMap::iterator it = m_lhEntries.begin(); it != m_lhEntries.end(); )
+		{
+			if ( it.value().tLastSeen < tOldest )
+				it = m_lhEntries.erase( it );
+			else
+				++it;
+		}
+	}
+
+	const quint32 nCount = common::securedSaveFile( CQuazaaGlobals::DATA_PATH(), "hashcache.dat",
+													m_sMessage, this, &CHashCache::writeToFile );
+	if ( !nCount )
+		return false;
+
+	m_bModified = false;
+
+	systemLog.postLog( LogSeverity::Debug,
+					   m_sMessage + QObject::tr( "Saved %1 files." ).arg( nCount ) );
+	return true;
+}
+
+/**
+  * Looks up the file at sPath. On success, finalized hashes for all cached algorithms are appended
+  * to lHashes (the caller takes ownership) and true is returned.
+  */
+bool CHashCache::lookup(const QString& sPath, QList<CHash*>& lHashes)
+{
+	CHashCacheKey oKey;
+	quint64 nDevice;
+
+	if ( !identify( sPath, oKey, nDevice ) || isRacy( oKey, now() ) )
+		return false;
+
+	QMutexLocker l( &m_pSection );
+
+	CHashCacheMap::iterator itEntry;
+	bool bFound = false, bCandidates = false;
+
+	for ( CHashCacheMap::iterator it = m_lhEntries.find( oKey ); it != m_lhEntries.end() && it.key() == oKey; ++it )
+	{
+		bCandidates = true;
+		if ( oKey.nInode && it.value().nDevice == nDevice )
+		{
+			itEntry = it;
+			bFound = true;
+			break;
+		}
+	}
+
+	if ( !bFound )
+	{
+		if ( !bCandidates )
+			return false;
+
+		// Same inode, size and time on another device, or no inodes at all: compare contents.
+		l.unlock();
+		const quint64 nFingerprint = fingerprint( sPath, oKey.nSize );
+		l.relock();
+
+		if ( !nFingerprint )
+			return false;
+
+		for ( CHashCacheMap::iterator it = m_lhEntries.find( oKey ); it != m_lhEntries.end() && it.key() == oKey; ++it )
+		{
+			if ( it.value().nFingerprint == nFingerprint )
+			{
+				itEntry = it;
+				bFound = true;
+				break;
+			}
+		}
+
+		if ( !bFound )
+			return false;
+
+		itEntry.value().nDevice = nDevice;
+	}
+
+	CHashCacheEntry& oEntry = itEntry.value();
+	oEntry.tLastSeen = common::getTNowUTC();
+	m_bModified = true;
+
+	for ( uint i = 0; i < sizeof( s_pCachedAlgorithms ) / sizeof( s_pCachedAlgorithms[0] ); ++i )
+	{
+		const CHash::Algorithm nAlgorithm = s_pCachedAlgorithms[i];
+		lHashes.append( new CHash( QByteArray( (const char*)oEntry.pHashes + entryOffset( nAlgorithm ),
+											   CHash::byteCount( nAlgorithm ) ), nAlgorithm ) );
+	}
+
+	return true;
+}
+
+/**
+  * Stores the finalized hashes of the file at sPath. nHashStarted is the time (see now()) reading
+  * the file started; files modified after or shortly before that are not stored, as the hashes
+  * may not match their current contents. Files missing any of the cached algorithms are ignored.
+  */
+void CHashCache::insert(const QString& sPath, const QList<CHash*>& lHashes, qint64 nHashStarted)
+{
+	CHashCacheKey oKey;
+	CHashCacheEntry oEntry;
+
+	if ( !identify( sPath, oKey, oEntry.nDevice ) || isRacy( oKey, nHashStarted ) )
+		return;
+
+	int nFound = 0;
+	foreach ( CHash* pHash, lHashes )
+	{
+		const int nOffset = entryOffset( pHash->getAlgorithm() );
+		const QByteArray baRaw = pHash->rawValue();
+
+		if ( nOffset >= 0 && baRaw.size() == CHash::byteCount( pHash->getAlgorithm() ) )
+		{
+			memcpy( oEntry.pHashes + nOffset, baRaw.constData(), baRaw.size() );
+			++nFound;
+		}
+	}
+
+	if ( nFound != (int)( sizeof( s_pCachedAlgorithms ) / sizeof( s_pCachedAlgorithms[0] ) ) )
+		return;
+
+	oEntry.nFingerprint = fingerprint( sPath, oKey.nSize );
+	oEntry.tLastSeen = common::getTNowUTC();
+
+	if ( !oEntry.nFingerprint )
+		return;
+
+	QMutexLocker l( &m_pSection );
+
+	// replace stale entries of the same file
+	for ( CHashCacheMap::iterator it = m_lhEntries.find( oKey ); it != m_lhEntries.end() && it.key() == oKey; )
+	{
+		if ( ( oKey.nInode && it.value().nDevice == oEntry.nDevice ) || it.value().nFingerprint == oEntry.nFingerprint )
+			it = m_lhEntries.erase( it );
+		else
+			++it;
+	}
+
+	m_lhEntries.insertMulti( oKey, oEntry );
+	m_bModified = true;
+}
+
+int CHashCache::count() const
+{
+	QMutexLocker l( &m_pSection );
+	return m_lhEntries.size();
+}
+
+/**
+  * Collects the identity of the file at sPath with a single stat() call.
+  */
+bool CHashCache::identify(const QString& sPath, CHashCacheKey& oKey, quint64& nDevice)
+{
+#ifdef Q_OS_UNIX
+	struct stat oStat;
+	if ( ::stat( QFile::encodeName( sPath ).constData(), &oStat ) || !S_ISREG( oStat.st_mode ) )
+		return false;
+
+#if defined(Q_OS_MAC)
+	const struct timespec& oModified = oStat.st_mtimespec;
+#else
+	const struct timespec& oModified = oStat.st_mtim;
+#endif
+
+	oKey.nInode    = oStat.st_ino;
+	oKey.nSize     = oStat.st_size;
+	oKey.nModified = (qint64)oModified.tv_sec * Q_INT64_C(1000000000) + oModified.tv_nsec;
+	nDevice        = oStat.st_dev;
+#else
+	QFileInfo oInfo( sPath );
+	if ( !oInfo.isFile() )
+		return false;
+
+	oKey.nInode    = 0;
+	oKey.nSize     = oInfo.size();
+	oKey.nModified = oInfo.lastModified().toMSecsSinceEpoch() * 1000000;
+	nDevice        = 0;
+#endif
+
+	return true;
+}
+
+/**
+  * Returns the current time in ns since 1.1.1970, as used for modification times.
+  */
+qint64 CHashCache::now()
+{
+	return QDateTime::currentMSecsSinceEpoch() * 1000000;
+}
+
+/**
+  * Returns true if the file has been modified less than HASH_CACHE_RACY_NS before nReference or
+  * later, so its contents may differ from what was (or is about to be) hashed without the key
+  * changing.
+  */
+bool CHashCache::isRacy(const CHashCacheKey& oKey, qint64 nReference)
+{
+	return oKey.nModified > nReference - HASH_CACHE_RACY_NS;
+}
+
+/**
+  * Returns a non-zero fingerprint of the file size and its first and last
+  * HASH_CACHE_FINGERPRINT_BYTES bytes, or 0 if the file cannot be read.
+  */
+quint64 CHashCache::fingerprint(const QString& sPath, quint64 nSize)
+{
+	QFile oFile( sPath );
+	if ( !oFile.open( QIODevice::ReadOnly ) )
+		return 0;
+
+	QCryptographicHash oHash( QCryptographicHash::Md5 );
+	oHash.addData( (const char*)&nSize, sizeof( nSize ) );
+	oHash.addData( oFile.read( HASH_CACHE_FINGERPRINT_BYTES ) );
+
+	if ( (qint64)nSize > HASH_CACHE_FINGERPRINT_BYTES )
+	{
+		oFile.seek( qMax<qint64>( HASH_CACHE_FINGERPRINT_BYTES, nSize - HASH_CACHE_FINGERPRINT_BYTES ) );
+		oHash.addData( oFile.read( HASH_CACHE_FINGERPRINT_BYTES ) );
+	}
+
+	quint64 nFingerprint;
+	memcpy( &nFingerprint, oHash.result().constData(), sizeof( nFingerprint ) );
+
+	return nFingerprint ? nFingerprint : 1;
+}
+
+/**
+  * Helper method for save()
+  * Requires Locking: R
+  */
+quint32 CHashCache::writeToFile(const void* const pManager, QFile& oFile)
+{
+	QDataStream oStream( &oFile );
+	CHashCache* pHashCache = (CHashCache*)pManager;
+
+	const quint16 nVersion = HASH_CACHE_CODE_VERSION;
+	const quint32 nCount   = (quint32)pHashCache->m_lhEntries.size();
+
+	oStream << nVersion;
+	oStream << nCount;
+
+	for ( CHashCacheMap::const_iterator it = pHashCache->m_lhEntries.constBegin();
+		  it != pHashCache->m_lhEntries.constEnd(); ++it )
+	{
+		const CHashCacheKey& oKey = it.key();
+		const CHashCacheEntry& oEntry = it.value();
+
+		oStream << oKey.nInode << oKey.nSize << oKey.nModified;
+		oStream << oEntry.nDevice << oEntry.nFingerprint << oEntry.tLastSeen;
+		oStream.writeRawData( (const char*)oEntry.pHashes, CHashCacheEntry::Size );
+	}
+
+	return nCount;
+}
@@ -0,0 +1,113 @@
+/*
+** hashcache.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef HASHCACHE_H
+#define HASHCACHE_H
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+
+class CHash;
+
+// Increment this if there have been made changes to the hash cache file layout.
+#define HASH_CACHE_CODE_VERSION 2
+// History:
+// 1 - Initial implementation
+// 2 - Modification times with nanosecond resolution
+
+// Upper limit of cached files; the least recently seen entries are dropped when saving.
+#define HASH_CACHE_MAX_ENTRIES 500000
+
+struct CHashCacheKey
+{
+	quint64	nInode;		// 0 where the file system offers no file IDs
+	quint64	nSize;
+	qint64	nModified;	// ns since 1.1.1970, in the resolution the file system offers
+
+	inline bool operator==(const CHashCacheKey& oOther) const
+	{
+		return nInode == oOther.nInode && nSize == oOther.nSize && nModified == oOther.nModified;
+	}
+};
+
+uint qHash(const CHashCacheKey& oKey);
+
+struct CHashCacheEntry
+{
+	enum { SHA1 = 0, MD5 = 20, ED2K = 36, TIGERTREE = 52, Size = 76 };
+
+	quint64	nDevice;
+	quint64	nFingerprint;	// hash of the first and last bytes of the file
+	quint32	tLastSeen;
+	uchar	pHashes[Size];	// SHA1, MD5, ED2K and Tiger tree root, at the offsets above
+};
+
+/**
+ * @brief CHashCache remembers the hashes of every file the hashers have read, keyed by the file
+ * identity the file system reports (inode, size and modification time), independent of the file
+ * path and of the share database. Moved or renamed files and a rebuilt share database are thus
+ * resolved with a stat() instead of a full read. A cached entry is used if the device matches as
+ * well; otherwise (e.g. after a remount) or where no inodes are available, a fingerprint over the
+ * beginning and the end of the file has to match.
+ * Files modified less than HASH_CACHE_RACY_NS before they are looked up, or before hashing them
+ * started, are never taken from or put into the cache: on file systems with coarse timestamps, a
+ * write right after hashing could leave size and modification time unchanged.
+ * Locking: handled internally.
+ */
+class CHashCache
+{
+private:
+	typedef QHash<CHashCacheKey, CHashCacheEntry> CHashCacheMap; // multi hash
+
+	mutable QMutex	m_pSection;
+	CHashCacheMap	m_lhEntries;
+	bool			m_bModified;
+	QString			m_sMessage;
+
+public:
+	CHashCache();
+
+	void load();
+	bool save();
+
+	bool lookup(const QString& sPath, QList<CHash*>& lHashes);
+	void insert(const QString& sPath, const QList<CHash*>& lHashes, qint64 nHashStarted);
+	static qint64 now();
+
+	int count() const;
+
+private:
+	static bool identify(const QString& sPath, CHashCacheKey& oKey, quint64& nDevice);
+	static bool isRacy(const CHashCacheKey& oKey, qint64 nReference);
+	static quint64 fingerprint(const QString& sPath, quint64 nSize);
+	static quint32 writeToFile(const void* const pManager, QFile& oFile);
+
+	Q_DISABLE_COPY(CHashCache)
+};
+
+extern CHashCache hashCache;
+
+#endif // HASHCACHE_H
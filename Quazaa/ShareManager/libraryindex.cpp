@@ -0,0 +1,574 @@
+/*
+** libraryindex.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "libraryindex.h"
+
+#include <QRegExp>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+#include <QtEndian>
+
+#include <string.h>
+
+#include "query.h"
+#include "queryhashtable.h"
+#include "Hashes/hash.h"
+#include "systemlog.h"
+
+#include "debug_new.h"
+
+CLibraryIndex libraryIndex;
+
+// Orders posting lists by length, so intersections start with the most selective keyword.
+static bool postingListLessThan(const QVector<quint32>* pLeft, const QVector<quint32>* pRight)
+{
+	return pLeft->size() < pRight->size();
+}
+
+CLibraryIndex::CLibraryIndex() :
+	m_nRemoved( 0 )
+{
+}
+
+void CLibraryIndex::clear()
+{
+	QWriteLocker l( &m_oRWLock );
+	clearUnlocked();
+}
+
+/**
+  * Rebuilds the index from all shared and hashed files in the share database.
+  * Must be called from the thread owning oDatabase.
+  */
+bool CLibraryIndex::load(QSqlDatabase& oDatabase)
+{
+	QSqlQuery query( oDatabase );
+	query.setForwardOnly( true );
+
+	// sorted by directory, so paths are interned in one go
+	if ( !query.exec( "SELECT f.file_id, f.dir_id, d.path, f.name, f.size, h.sha1, h.md5 FROM files f "
+					  "JOIN hashes h ON(f.file_id = h.file_id) JOIN dirs d ON(f.dir_id = d.id) "
+					  "WHERE f.shared = 1 ORDER BY f.dir_id" ) )
+	{
+		systemLog.postLog( LogSeverity::Debug,
+						   QString( "SQL Query failed: %1" ).arg( query.lastError().text() ) );
+		return false;
+	}
+
+	QWriteLocker l( &m_oRWLock );
+
+	clearUnlocked();
+
+	while ( query.next() )
+	{
+		addUnlocked( query.value( 0 ).toULongLong(), query.value( 1 ).toULongLong(),
+					 query.value( 2 ).toString(), query.value( 3 ).toString(),
+					 query.value( 4 ).toULongLong(), query.value( 5 ).toByteArray(),
+					 query.value( 6 ).toByteArray() );
+	}
+
+	m_vFileIDs.squeeze();
+	m_vSizes.squeeze();
+	m_vDirs.squeeze();
+	m_vNames.squeeze();
+	m_vNameLengths.squeeze();
+	m_sNames.squeeze();
+	m_baSHA1.squeeze();
+	m_baMD5.squeeze();
+
+	systemLog.postLog( LogSeverity::Debug, QString( "Library index contains %1 files in %2 directories and %3 keywords"
+													).arg( m_lhSlots.size() ).arg( m_lDirPaths.size() )
+										   .arg( m_lhKeywords.size() ) );
+	return true;
+}
+
+void CLibraryIndex::add(quint64 nFileID, quint64 nDirectoryID, const QString& sPath, const QString& sName,
+						quint64 nSize, const QByteArray& baSHA1, const QByteArray& baMD5)
+{
+	QWriteLocker l( &m_oRWLock );
+	addUnlocked( nFileID, nDirectoryID, sPath, sName, nSize, baSHA1, baMD5 );
+}
+
+void CLibraryIndex::remove(quint64 nFileID)
+{
+	QWriteLocker l( &m_oRWLock );
+
+	QHash<quint64, quint32>::iterator itSlot = m_lhSlots.find( nFileID );
+	if ( itSlot == m_lhSlots.end() )
+		return;
+
+	const quint32 nSlot = itSlot.value();
+	m_lhSlots.erase( itSlot );
+
+	QStringList lKeywords;
+	CQueryHashTable::makeKeywords( name( nSlot ), lKeywords );
+	lKeywords.removeDuplicates();
+
+	foreach ( const QString& sKeyword, lKeywords )
+	{
+		QHash<QString, PostingList>::iterator itKeyword = m_lhKeywords.find( sKeyword );
+		if ( itKeyword == m_lhKeywords.end() )
+			continue;
+
+		PostingList& vPostings = itKeyword.value();
+		PostingList::iterator it = qBinaryFind( vPostings.begin(), vPostings.end(), nSlot );
+		if ( it != vPostings.end() )
+			vPostings.erase( it );
+
+		if ( vPostings.isEmpty() )
+			m_lhKeywords.erase( itKeyword );
+	}
+
+	const QByteArray baSHA1 = digest( m_baSHA1, nSlot, 20 );
+	if ( !baSHA1.isEmpty() )
+		m_lhSHA1.remove( qFromLittleEndian<quint32>( (const uchar*)baSHA1.constData() ), nSlot );
+
+	const QByteArray baMD5 = digest( m_baMD5, nSlot, 16 );
+	if ( !baMD5.isEmpty() )
+		m_lhMD5.remove( qFromLittleEndian<quint32>( (const uchar*)baMD5.constData() ), nSlot );
+
+	// The slot stays allocated so posting lists of other files remain valid; once most slots
+	// are unused, the catalogue is rebuilt.
+	m_vFileIDs[nSlot] = 0;
+	++m_nRemoved;
+
+	if ( m_nRemoved > 1024 && m_nRemoved > (quint32)m_vFileIDs.size() / 2 )
+		compact();
+}
+
+int CLibraryIndex::count() const
+{
+	QReadLocker l( &m_oRWLock );
+	return m_lhSlots.size();
+}
+
+/**
+  * Copies the catalogue entry of nFileID to oFile. Returns false if the file is not indexed.
+  */
+bool CLibraryIndex::file(quint64 nFileID, LibraryFile& oFile) const
+{
+	QReadLocker l( &m_oRWLock );
+
+	QHash<quint64, quint32>::const_iterator it = m_lhSlots.constFind( nFileID );
+	if ( it == m_lhSlots.constEnd() )
+		return false;
+
+	oFile = materialize( it.value() );
+	return true;
+}
+
+/**
+  * Copies the catalogue entry of the file with the SHA1 or MD5 oHash to oFile. Returns false if no
+  * such file is indexed or the hash type is not kept in the catalogue.
+  */
+bool CLibraryIndex::find(const CHash& oHash, LibraryFile& oFile) const
+{
+	QReadLocker l( &m_oRWLock );
+
+	int nSlot = -1;
+
+	if ( oHash.getAlgorithm() == CHash::SHA1 )
+		nSlot = findDigest( m_lhSHA1, m_baSHA1, oHash.rawValue() );
+	else if ( oHash.getAlgorithm() == CHash::MD5 )
+		nSlot = findDigest( m_lhMD5, m_baMD5, oHash.rawValue() );
+
+	if ( nSlot < 0 )
+		return false;
+
+	oFile = materialize( nSlot );
+	return true;
+}
+
+/**
+  * Creates a CSharedFile for nFileID, carrying its IDs and known hashes. Returns a null pointer if
+  * the file is not indexed.
+  */
+CSharedFilePtr CLibraryIndex::sharedFile(quint64 nFileID) const
+{
+	LibraryFile oFile;
+	if ( !file( nFileID, oFile ) )
+		return CSharedFilePtr();
+
+	CSharedFilePtr pFile( new CSharedFile( oFile.sPath + '/' + oFile.sName ) );
+	pFile->setFileID( oFile.nFileID );
+	pFile->setDirectoryID( oFile.nDirectoryID );
+	pFile->m_bShared = true;
+
+	if ( !oFile.baSHA1.isEmpty() )
+	{
+		CHash* pHash = CHash::fromRaw( oFile.baSHA1, CHash::SHA1 );
+		if ( pHash )
+		{
+			pFile->setHash( *pHash );
+			delete pHash;
+		}
+	}
+
+	if ( !oFile.baMD5.isEmpty() )
+	{
+		CHash* pHash = CHash::fromRaw( oFile.baMD5, CHash::MD5 );
+		if ( pHash )
+		{
+			pFile->setHash( *pHash );
+			delete pHash;
+		}
+	}
+
+	return pFile;
+}
+
+/**
+  * Returns up to nMaximum files matching pQuery. Queries carrying URNs are answered by hash only;
+  * otherwise all positive words must be keywords of the file name, no negative word may be, quoted
+  * phrases must appear in the name and the size must be within the requested limits.
+  */
+QList<LibraryFile> CLibraryIndex::search(const CQuery* pQuery, int nMaximum) const
+{
+	QList<LibraryFile> lResults;
+
+	QReadLocker l( &m_oRWLock );
+
+	if ( !pQuery->m_lHashes.isEmpty() )
+	{
+		foreach ( const CHash& oHash, pQuery->m_lHashes )
+		{
+			int nSlot = -1;
+
+			if ( oHash.getAlgorithm() == CHash::SHA1 )
+				nSlot = findDigest( m_lhSHA1, m_baSHA1, oHash.rawValue() );
+			else if ( oHash.getAlgorithm() == CHash::MD5 )
+				nSlot = findDigest( m_lhMD5, m_baMD5, oHash.rawValue() );
+
+			if ( nSlot >= 0 )
+			{
+				const quint64 nSize = m_vSizes.at( nSlot );
+				if ( nSize >= pQuery->m_nMinimumSize && nSize <= pQuery->m_nMaximumSize )
+				{
+					lResults.append( materialize( nSlot ) );
+					break;
+				}
+			}
+		}
+
+		return lResults;
+	}
+
+	QStringList lPositive, lPhrases, lNegative, lNegativePhrases;
+	parseWords( pQuery->m_sG2PositiveWords, lPositive, lPhrases );
+	parseWords( pQuery->m_sG2NegativeWords, lNegative, lNegativePhrases, false );
+
+	if ( lPositive.isEmpty() )
+		return lResults;
+
+	QList<const PostingList*> lPostings;
+	foreach ( const QString& sWord, lPositive )
+	{
+		QHash<QString, PostingList>::const_iterator it = m_lhKeywords.constFind( sWord );
+		if ( it == m_lhKeywords.constEnd() )
+			return lResults; // a required word is not in the library at all
+
+		lPostings.append( &it.value() );
+	}
+
+	qSort( lPostings.begin(), lPostings.end(), postingListLessThan );
+
+	QList<const PostingList*> lExcluded;
+	foreach ( const QString& sWord, lNegative )
+	{
+		QHash<QString, PostingList>::const_iterator it = m_lhKeywords.constFind( sWord );
+		if ( it != m_lhKeywords.constEnd() )
+			lExcluded.append( &it.value() );
+	}
+
+	// Walk the shortest posting list and probe the others.
+	const PostingList& vCandidates = *lPostings.first();
+	for ( int i = 0; i < vCandidates.size() && lResults.size() < nMaximum; ++i )
+	{
+		const quint32 nSlot = vCandidates.at( i );
+		bool bMatch = true;
+
+		for ( int j = 1; bMatch && j < lPostings.size(); ++j )
+		{
+			const PostingList& vOther = *lPostings.at( j );
+			bMatch = qBinaryFind( vOther.constBegin(), vOther.constEnd(), nSlot ) != vOther.constEnd();
+		}
+
+		for ( int j = 0; bMatch && j < lExcluded.size(); ++j )
+		{
+			const PostingList& vOther = *lExcluded.at( j );
+			bMatch = qBinaryFind( vOther.constBegin(), vOther.constEnd(), nSlot ) == vOther.constEnd();
+		}
+
+		if ( bMatch && matches( nSlot, pQuery, lPhrases, lNegativePhrases ) )
+		{
+			lResults.append( materialize( nSlot ) );
+		}
+	}
+
+	return lResults;
+}
+
+/**
+  * Requires Locking: RW
+  */
+void CLibraryIndex::clearUnlocked()
+{
+	m_vFileIDs.clear();
+	m_vSizes.clear();
+	m_vDirs.clear();
+	m_vNames.clear();
+	m_vNameLengths.clear();
+	m_sNames.clear();
+	m_baSHA1.clear();
+	m_baMD5.clear();
+	m_nRemoved = 0;
+
+	m_vDirIDs.clear();
+	m_lDirPaths.clear();
+	m_lhDirs.clear();
+
+	m_lhSlots.clear();
+	m_lhKeywords.clear();
+	m_lhSHA1.clear();
+	m_lhMD5.clear();
+}
+
+/**
+  * Helper method for load() and add()
+  * Requires Locking: RW
+  */
+void CLibraryIndex::addUnlocked(quint64 nFileID, quint64 nDirectoryID, const QString& sPath, const QString& sName,
+								quint64 nSize, const QByteArray& baSHA1, const QByteArray& baMD5)
+{
+	if ( !nFileID || m_lhSlots.contains( nFileID ) )
+		return;
+
+	const quint32 nSlot = m_vFileIDs.size();
+
+	QHash<quint64, quint32>::const_iterator itDir = m_lhDirs.constFind( nDirectoryID );
+	if ( itDir == m_lhDirs.constEnd() )
+	{
+		itDir = m_lhDirs.insert( nDirectoryID, m_vDirIDs.size() );
+		m_vDirIDs.append( nDirectoryID );
+		m_lDirPaths.append( sPath );
+	}
+
+	const int nNameLength = qMin( sName.length(), 0xFFFF );
+
+	m_vFileIDs.append( nFileID );
+	m_vSizes.append( nSize );
+	m_vDirs.append( itDir.value() );
+	m_vNames.append( m_sNames.length() );
+	m_vNameLengths.append( nNameLength );
+	m_sNames.append( sName.constData(), nNameLength );
+
+	if ( baSHA1.size() == CHash::byteCount( CHash::SHA1 ) )
+	{
+		m_baSHA1.append( baSHA1 );
+		m_lhSHA1.insert( qFromLittleEndian<quint32>( (const uchar*)baSHA1.constData() ), nSlot );
+	}
+	else
+	{
+		m_baSHA1.append( QByteArray( 20, '\0' ) );
+	}
+
+	if ( baMD5.size() == CHash::byteCount( CHash::MD5 ) )
+	{
+		m_baMD5.append( baMD5 );
+		m_lhMD5.insert( qFromLittleEndian<quint32>( (const uchar*)baMD5.constData() ), nSlot );
+	}
+	else
+	{
+		m_baMD5.append( QByteArray( 16, '\0' ) );
+	}
+
+	m_lhSlots.insert( nFileID, nSlot );
+
+	QStringList lKeywords;
+	CQueryHashTable::makeKeywords( sName, lKeywords );
+	lKeywords.removeDuplicates();
+
+	// Slots are handed out in increasing order, so appending keeps the posting lists sorted.
+	foreach ( const QString& sKeyword, lKeywords )
+	{
+		m_lhKeywords[sKeyword].append( nSlot );
+	}
+}
+
+/**
+  * Rebuilds the catalogue without the slots of removed files.
+  * Requires Locking: RW
+  */
+void CLibraryIndex::compact()
+{
+	QList<LibraryFile> lFiles;
+	for ( int nSlot = 0; nSlot < m_vFileIDs.size(); ++nSlot )
+	{
+		if ( m_vFileIDs.at( nSlot ) )
+			lFiles.append( materialize( nSlot ) );
+	}
+
+	clearUnlocked();
+
+	foreach ( const LibraryFile& oFile, lFiles )
+	{
+		addUnlocked( oFile.nFileID, oFile.nDirectoryID, oFile.sPath, oFile.sName,
+					 oFile.nSize, oFile.baSHA1, oFile.baMD5 );
+	}
+}
+
+/**
+  * Returns the nLength bytes digest of nSlot from baDigests, or an empty array if it is unknown.
+  * Requires Locking: R
+  */
+QByteArray CLibraryIndex::digest(const QByteArray& baDigests, quint32 nSlot, int nLength) const
+{
+	const char* pDigest = baDigests.constData() + nSlot * nLength;
+
+	for ( int i = 0; i < nLength; ++i )
+	{
+		if ( pDigest[i] )
+			return QByteArray( pDigest, nLength );
+	}
+
+	return QByteArray();
+}
+
+/**
+  * Returns the slot of the file with digest baDigest, or -1.
+  * Requires Locking: R
+  */
+int CLibraryIndex::findDigest(const QMultiHash<quint32, quint32>& lhMap, const QByteArray& baDigests,
+							  const QByteArray& baDigest) const
+{
+	if ( baDigest.size() < 4 )
+		return -1;
+
+	const int nLength = baDigest.size();
+	QMultiHash<quint32, quint32>::const_iterator it =
+			lhMap.constFind( qFromLittleEndian<quint32>( (const uchar*)baDigest.constData() ) );
+
+	for ( ; it != lhMap.constEnd() &&
+			it.key() == qFromLittleEndian<quint32>( (const uchar*)baDigest.constData() ); ++it )
+	{
+		if ( ( it.value() + 1 ) * nLength <= (quint32)baDigests.size() &&
+			 memcmp( baDigests.constData() + it.value() * nLength, baDigest.constData(), nLength ) == 0 )
+		{
+			return it.value();
+		}
+	}
+
+	return -1;
+}
+
+/**
+  * Requires Locking: R
+  */
+LibraryFile CLibraryIndex::materialize(quint32 nSlot) const
+{
+	LibraryFile oFile;
+	oFile.nFileID      = m_vFileIDs.at( nSlot );
+	oFile.nDirectoryID = m_vDirIDs.at( m_vDirs.at( nSlot ) );
+	oFile.nSize        = m_vSizes.at( nSlot );
+	oFile.sPath        = m_lDirPaths.at( m_vDirs.at( nSlot ) );
+	oFile.sName        = name( nSlot );
+	oFile.baSHA1       = digest( m_baSHA1, nSlot, 20 );
+	oFile.baMD5        = digest( m_baMD5, nSlot, 16 );
+	return oFile;
+}
+
+/**
+  * Checks the conditions the inverted index cannot answer.
+  * Requires Locking: R
+  */
+bool CLibraryIndex::matches(quint32 nSlot, const CQuery* pQuery,
+							const QStringList& lPhrases, const QStringList& lNegativePhrases) const
+{
+	const quint64 nSize = m_vSizes.at( nSlot );
+	if ( nSize < pQuery->m_nMinimumSize || nSize > pQuery->m_nMaximumSize )
+		return false;
+
+	if ( lPhrases.isEmpty() && lNegativePhrases.isEmpty() )
+		return true;
+
+	const QString sName = " " + name( nSlot ).toLower().replace( QRegExp( "[\\W_]+" ), " " ) + " ";
+
+	foreach ( const QString& sPhrase, lPhrases )
+	{
+		if ( !sName.contains( sPhrase ) )
+			return false;
+	}
+
+	foreach ( const QString& sPhrase, lNegativePhrases )
+	{
+		if ( sName.contains( sPhrase ) )
+			return false;
+	}
+
+	return true;
+}
+
+/**
+  * Splits the comma separated word list built by CQuery into plain keywords (filtered the same
+  * way CQueryHashTable::makeKeywords() filters file names) and quoted phrases. Phrases are
+  * returned padded with blanks, ready to be matched against a normalized file name. The words of
+  * a phrase are added to lWords as well if bPhraseWords is set; leave it unset for negative words,
+  * as excluding a phrase must not exclude every file containing one of its words.
+  */
+void CLibraryIndex::parseWords(const QString& sWords, QStringList& lWords, QStringList& lPhrases,
+							   bool bPhraseWords)
+{
+	const QRegExp rxNumber( "^\\d+$" );
+
+	foreach ( QString sWord, sWords.split( ",", QString::SkipEmptyParts ) )
+	{
+		QStringList lParts;
+
+		if ( sWord.startsWith( '-' ) )
+			sWord.remove( 0, 1 );
+
+		if ( sWord.startsWith( '"' ) )
+		{
+			lParts = sWord.split( QRegExp( "[\\W_]+" ), QString::SkipEmptyParts );
+			if ( !lParts.isEmpty() )
+				lPhrases.append( " " + lParts.join( " " ) + " " );
+
+			if ( !bPhraseWords )
+				continue;
+		}
+		else
+		{
+			lParts.append( sWord );
+		}
+
+		foreach ( const QString& sPart, lParts )
+		{
+			if ( sPart.length() >= 4 && rxNumber.indexIn( sPart ) == -1 && !lWords.contains( sPart ) )
+				lWords.append( sPart );
+		}
+	}
+}
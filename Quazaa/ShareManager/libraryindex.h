@@ -0,0 +1,139 @@
+/*
+** libraryindex.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QReadWriteLock>
+#include <QStringList>
+#include <QVector>
+
+#include "sharedfile.h"
+
+class CHash;
+class CQuery;
+class QSqlDatabase;
+
+/**
+ * @brief LibraryFile is a copy of one catalogue entry, materialized for the caller.
+ */
+struct LibraryFile
+{
+	quint64		nFileID;
+	quint64		nDirectoryID;
+	quint64		nSize;
+	QString		sPath;			// directory
+	QString		sName;
+	QByteArray	baSHA1;			// empty if unknown
+	QByteArray	baMD5;
+};
+
+/**
+ * @brief CLibraryIndex is the in-memory catalogue of the shared files together with an inverted
+ * index over it. Files are stored as a structure of arrays: names back to back in one string
+ * arena, hashes as fixed size blocks, directory paths interned once per directory. An entry costs
+ * a few dozen bytes instead of a CSharedFile object; CSharedFile handles are created on demand.
+ * Every keyword produced by CQueryHashTable::makeKeywords() maps to a sorted posting list of file
+ * slots, SHA1 and MD5 lookups go through small hashes of the first bytes of each digest, so
+ * incoming queries can be matched without touching the database.
+ * The index is filled from the share database by the Share Manager thread and may be searched
+ * from any thread.
+ * Locking: handled internally (RW lock).
+ */
+class CLibraryIndex
+{
+private:
+	typedef QVector<quint32> PostingList;
+
+	mutable QReadWriteLock			m_oRWLock;
+
+	// catalogue, indexed by slot
+	QVector<quint64>				m_vFileIDs;		// 0 for removed entries
+	QVector<quint64>				m_vSizes;
+	QVector<quint32>				m_vDirs;		// index into m_vDirIDs/m_lDirPaths
+	QVector<quint32>				m_vNames;		// offset of the name in m_sNames
+	QVector<quint16>				m_vNameLengths;
+	QString							m_sNames;		// string arena
+	QByteArray						m_baSHA1;		// 20 bytes per slot, all zero if unknown
+	QByteArray						m_baMD5;		// 16 bytes per slot, all zero if unknown
+	quint32							m_nRemoved;		// slots of removed entries
+
+	// interned directories
+	QVector<quint64>				m_vDirIDs;
+	QStringList						m_lDirPaths;
+	QHash<quint64, quint32>			m_lhDirs;		// directory ID -> index
+
+	QHash<quint64, quint32>			m_lhSlots;		// file ID -> slot
+	QHash<QString, PostingList>		m_lhKeywords;	// keyword -> sorted slots
+	QMultiHash<quint32, quint32>	m_lhSHA1;		// leading SHA1 bytes -> slot
+	QMultiHash<quint32, quint32>	m_lhMD5;		// leading MD5 bytes -> slot
+
+public:
+	CLibraryIndex();
+
+	void clear();
+	bool load(QSqlDatabase& oDatabase);
+
+	void add(quint64 nFileID, quint64 nDirectoryID, const QString& sPath, const QString& sName,
+			 quint64 nSize, const QByteArray& baSHA1, const QByteArray& baMD5);
+	void remove(quint64 nFileID);
+
+	int count() const;
+
+	bool file(quint64 nFileID, LibraryFile& oFile) const;
+	bool find(const CHash& oHash, LibraryFile& oFile) const;
+	CSharedFilePtr sharedFile(quint64 nFileID) const;
+
+	QList<LibraryFile> search(const CQuery* pQuery, int nMaximum) const;
+
+	static void parseWords(const QString& sWords, QStringList& lWords, QStringList& lPhrases,
+						   bool bPhraseWords = true);
+
+private:
+	void clearUnlocked();
+	void addUnlocked(quint64 nFileID, quint64 nDirectoryID, const QString& sPath, const QString& sName,
+					 quint64 nSize, const QByteArray& baSHA1, const QByteArray& baMD5);
+	void compact();
+
+	inline QString name(quint32 nSlot) const
+	{
+		return m_sNames.mid( m_vNames.at( nSlot ), m_vNameLengths.at( nSlot ) );
+	}
+
+	QByteArray digest(const QByteArray& baDigests, quint32 nSlot, int nLength) const;
+	int findDigest(const QMultiHash<quint32, quint32>& lhMap, const QByteArray& baDigests,
+				   const QByteArray& baDigest) const;
+	LibraryFile materialize(quint32 nSlot) const;
+	bool matches(quint32 nSlot, const CQuery* pQuery,
+				 const QStringList& lPhrases, const QStringList& lNegativePhrases) const;
+
+	Q_DISABLE_COPY(CLibraryIndex)
+};
+
+extern CLibraryIndex libraryIndex;
+
+#endif // LIBRARYINDEX_H
@@ -0,0 +1,276 @@
+/*
+** librarywatcher.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "librarywatcher.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#include "systemlog.h"
+
+#include "debug_new.h"
+
+// Time in ms changes are collected before they are reported.
+static const int LIBRARY_WATCHER_DELAY = 3000;
+
+#ifdef Q_OS_LINUX
+static const quint32 LIBRARY_WATCHER_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+											  IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF |
+											  IN_ONLYDIR | IN_DONT_FOLLOW;
+#endif
+
+CLibraryWatcher::CLibraryWatcher(QObject* parent) :
+	QObject( parent ),
+	m_nInotify( -1 ),
+	m_pNotifier( NULL ),
+	m_pFallback( NULL )
+{
+	m_oFlushTimer.setSingleShot( true );
+	connect( &m_oFlushTimer, SIGNAL(timeout()), this, SLOT(flush()) );
+
+#ifdef Q_OS_LINUX
+	m_nInotify = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	if ( m_nInotify >= 0 )
+	{
+		m_pNotifier = new QSocketNotifier( m_nInotify, QSocketNotifier::Read, this );
+		connect( m_pNotifier, SIGNAL(activated(int)), this, SLOT(onInotifyEvent()) );
+	}
+	else
+	{
+		systemLog.postLog( LogSeverity::Debug, QString( "inotify unavailable (%1), using QFileSystemWatcher"
+														).arg( strerror( errno ) ) );
+	}
+#endif
+
+	if ( m_nInotify < 0 )
+	{
+		m_pFallback = new QFileSystemWatcher( this );
+		connect( m_pFallback, SIGNAL(directoryChanged(QString)), this, SLOT(onDirectoryChanged(QString)) );
+	}
+}
+
+CLibraryWatcher::~CLibraryWatcher()
+{
+	clear();
+
+#ifdef Q_OS_LINUX
+	if ( m_nInotify >= 0 )
+	{
+		delete m_pNotifier;
+		::close( m_nInotify );
+	}
+#endif
+}
+
+/**
+  * Starts watching the directory sPath (not its subdirectories). Returns false if the system
+  * refused to add a watch, usually because the per user watch limit has been reached.
+  */
+bool CLibraryWatcher::addPath(const QString& sPath)
+{
+	if ( m_lhPaths.contains( sPath ) )
+		return true;
+
+#ifdef Q_OS_LINUX
+	if ( m_nInotify >= 0 )
+	{
+		const int nWatch = inotify_add_watch( m_nInotify, QFile::encodeName( sPath ).constData(),
+											  LIBRARY_WATCHER_EVENTS );
+		if ( nWatch < 0 )
+		{
+			systemLog.postLog( LogSeverity::Debug, QString( "Cannot watch %1: %2"
+															).arg( sPath ).arg( strerror( errno ) ) );
+			return false;
+		}
+
+		m_lhWatches.insert( nWatch, sPath );
+		m_lhPaths.insert( sPath, nWatch );
+		return true;
+	}
+#endif
+
+	if ( !m_pFallback->addPath( sPath ) )
+		return false;
+
+	m_lhPaths.insert( sPath, 0 );
+	return true;
+}
+
+void CLibraryWatcher::removePath(const QString& sPath)
+{
+	QHash<QString, int>::iterator it = m_lhPaths.find( sPath );
+	if ( it == m_lhPaths.end() )
+		return;
+
+#ifdef Q_OS_LINUX
+	if ( m_nInotify >= 0 )
+	{
+		inotify_rm_watch( m_nInotify, it.value() );
+		m_lhWatches.remove( it.value() );
+	}
+#endif
+
+	if ( m_pFallback )
+		m_pFallback->removePath( sPath );
+
+	m_lhPaths.erase( it );
+	m_lsDirty.remove( sPath );
+}
+
+void CLibraryWatcher::clear()
+{
+	foreach ( const QString& sPath, m_lhPaths.keys() )
+	{
+		removePath( sPath );
+	}
+
+	m_lsDirty.clear();
+	m_oFlushTimer.stop();
+}
+
+bool CLibraryWatcher::isNative() const
+{
+	return m_nInotify >= 0;
+}
+
+int CLibraryWatcher::count() const
+{
+	return m_lhPaths.size();
+}
+
+void CLibraryWatcher::onInotifyEvent()
+{
+#ifdef Q_OS_LINUX
+	char pBuffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	forever
+	{
+		const ssize_t nLength = ::read( m_nInotify, pBuffer, sizeof( pBuffer ) );
+		if ( nLength <= 0 )
+			break;
+
+		for ( const char* pPos = pBuffer; pPos < pBuffer + nLength; )
+		{
+			const struct inotify_event* pEvent = (const struct inotify_event*)pPos;
+			pPos += sizeof( struct inotify_event ) + pEvent->len;
+
+			if ( pEvent->mask & IN_Q_OVERFLOW )
+			{
+				systemLog.postLog( LogSeverity::Debug, QString( "inotify queue overflow" ) );
+				m_lsDirty.clear();
+				m_oFlushTimer.stop();
+				emit overflow();
+				continue;
+			}
+
+			QHash<int, QString>::iterator it = m_lhWatches.find( pEvent->wd );
+			if ( it == m_lhWatches.end() )
+				continue;
+
+			const QString sPath = it.value();
+
+			if ( pEvent->mask & IN_IGNORED )
+			{
+				// the watch is gone (directory deleted or unmounted)
+				m_lhWatches.erase( it );
+				m_lhPaths.remove( sPath );
+			}
+			else if ( pEvent->mask & IN_MOVE_SELF )
+			{
+				// The watches of the directory and its subdirectories follow it to a location we
+				// don't know, so they would report changes under the old paths. Drop them; if the
+				// new location is part of the library, its parent's rescan adds it again.
+				removeTree( sPath );
+			}
+
+			if ( pEvent->mask & ( IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED ) )
+			{
+				// the old path is gone; its parent may be outside the library (shared root)
+				markDirty( sPath );
+				markDirty( QFileInfo( sPath ).path() );
+			}
+			else
+			{
+				markDirty( sPath );
+			}
+		}
+	}
+#endif
+}
+
+void CLibraryWatcher::onDirectoryChanged(const QString& sPath)
+{
+	if ( !QFileInfo( sPath ).isDir() )
+	{
+		removeTree( sPath );
+		markDirty( sPath );
+		markDirty( QFileInfo( sPath ).path() );
+	}
+	else
+	{
+		markDirty( sPath );
+	}
+}
+
+void CLibraryWatcher::flush()
+{
+	const QSet<QString> lsDirty = m_lsDirty;
+	m_lsDirty.clear();
+
+	foreach ( const QString& sPath, lsDirty )
+	{
+		emit directoryChanged( sPath );
+	}
+}
+
+/**
+  * Stops watching sPath and all directories below it.
+  */
+void CLibraryWatcher::removeTree(const QString& sPath)
+{
+	const QString sPrefix = sPath + '/';
+
+	foreach ( const QString& sWatched, m_lhPaths.keys() )
+	{
+		if ( sWatched == sPath || sWatched.startsWith( sPrefix ) )
+			removePath( sWatched );
+	}
+}
+
+void CLibraryWatcher::markDirty(const QString& sPath)
+{
+	m_lsDirty.insert( sPath );
+
+	if ( !m_oFlushTimer.isActive() )
+		m_oFlushTimer.start( LIBRARY_WATCHER_DELAY );
+}
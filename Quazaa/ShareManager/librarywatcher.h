@@ -0,0 +1,86 @@
+/*
+** librarywatcher.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef LIBRARYWATCHER_H
+#define LIBRARYWATCHER_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+/**
+ * @brief CLibraryWatcher reports changes in the shared directories. On Linux it reads inotify
+ * events directly; elsewhere, or if inotify is unavailable, QFileSystemWatcher is used instead.
+ * Changes are collected for a few seconds and reported once per directory, so a file being
+ * written produces one notification instead of thousands.
+ * Must be used from a single thread.
+ */
+class CLibraryWatcher : public QObject
+{
+	Q_OBJECT
+
+private:
+	int					m_nInotify;		// inotify descriptor, -1 if not used
+	QSocketNotifier*	m_pNotifier;
+	QHash<int, QString>	m_lhWatches;	// watch descriptor -> directory
+	QHash<QString, int>	m_lhPaths;		// directory -> watch descriptor
+
+	QFileSystemWatcher*	m_pFallback;
+
+	QSet<QString>		m_lsDirty;		// directories with pending changes
+	QTimer				m_oFlushTimer;
+
+public:
+	explicit CLibraryWatcher(QObject* parent = 0);
+	~CLibraryWatcher();
+
+	bool addPath(const QString& sPath);
+	void removePath(const QString& sPath);
+	void clear();
+
+	bool isNative() const;
+	int count() const;
+
+signals:
+	// All files and subdirectories of sPath have to be compared with the database.
+	void directoryChanged(const QString& sPath);
+	// Events have been lost, the whole library has to be synchronized.
+	void overflow();
+
+private slots:
+	void onInotifyEvent();
+	void onDirectoryChanged(const QString& sPath);
+	void flush();
+
+private:
+	void markDirty(const QString& sPath);
+	void removeTree(const QString& sPath);
+};
+
+#endif // LIBRARYWATCHER_H
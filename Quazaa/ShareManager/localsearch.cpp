@@ -0,0 +1,101 @@
+/*
+** localsearch.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "localsearch.h"
+#include "g2packet.h"
+#include "network.h"
+#include "quazaasettings.h"
+#include "quazaaglobals.h"
+#include "Hashes/hash.h"
+
+#include "debug_new.h"
+
+QList<G2Packet*> CLocalSearch::search(CQueryPtr pQuery)
+{
+	QList<G2Packet*> lPackets;
+
+	if ( pQuery.isNull() || !quazaaSettings.Gnutella.MaxHits )
+		return lPackets;
+
+	const QList<LibraryFile> lFiles = libraryIndex.search( pQuery.data(), quazaaSettings.Gnutella.MaxHits );
+	const int nPerPacket = qMax( 1, quazaaSettings.Gnutella.HitsPerPacket );
+
+	for ( int i = 0; i < lFiles.size(); i += nPerPacket )
+	{
+		lPackets.append( createQueryHit( pQuery->m_oGUID, lFiles, i,
+										 qMin( nPerPacket, lFiles.size() - i ) ) );
+	}
+
+	return lPackets;
+}
+
+/**
+  * Builds a QH2 packet: the node descriptor children (GU, NA, V) followed by one compound H child
+  * per file, then the hop count and the search GUID as payload.
+  */
+G2Packet* CLocalSearch::createQueryHit(const QUuid& oGUID, const QList<LibraryFile>& lFiles,
+									   int nFirst, int nCount)
+{
+	G2Packet* pPacket = G2Packet::newPacket( "QH2", true );
+
+	pPacket->writePacket( "GU", 16 )->writeGUID( quazaaSettings.Profile.GUID );
+	pPacket->writePacket( "NA", ( Network.m_oAddress.protocol() == QAbstractSocket::IPv4Protocol ? 6 : 18 )
+						  )->writeHostAddress( &Network.m_oAddress );
+	pPacket->writePacket( "V", 4 )->writeString( CQuazaaGlobals::VENDOR_CODE(), false );
+
+	for ( int i = nFirst; i < nFirst + nCount; ++i )
+	{
+		const LibraryFile& oFile = lFiles.at( i );
+
+		G2Packet* pHit = G2Packet::newPacket( "H", true );
+
+		if ( !oFile.baSHA1.isEmpty() )
+		{
+			pHit->writePacket( "URN", 5 + oFile.baSHA1.size() );
+			pHit->writeString( "sha1", true );
+			pHit->write( (void*)oFile.baSHA1.constData(), oFile.baSHA1.size() );
+		}
+
+		if ( !oFile.baMD5.isEmpty() )
+		{
+			pHit->writePacket( "URN", 4 + oFile.baMD5.size() );
+			pHit->writeString( "md5", true );
+			pHit->write( (void*)oFile.baMD5.constData(), oFile.baMD5.size() );
+		}
+
+		pHit->writePacket( "SZ", 8 )->writeIntLE<quint64>( oFile.nSize );
+		pHit->writePacket( "DN", oFile.sName.toUtf8().size() )->writeString( oFile.sName, false );
+		pHit->writePacket( "URL", 0 ); // empty URL: use the uri-res resolver
+
+		pPacket->writePacket( pHit );
+		pHit->release();
+	}
+
+	pPacket->writeByte( 0 ); // end of children
+	pPacket->writeByte( 0 ); // hops
+	QUuid oSearchGUID = oGUID;
+	pPacket->writeGUID( oSearchGUID );
+
+	return pPacket;
+}
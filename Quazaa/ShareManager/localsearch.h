@@ -0,0 +1,50 @@
+/*
+** localsearch.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef LOCALSEARCH_H
+#define LOCALSEARCH_H
+
+#include <QList>
+
+#include "libraryindex.h"
+#include "query.h"
+
+class G2Packet;
+
+/**
+ * @brief CLocalSearch answers queries against our own library. Matching is done by the library
+ * index; the results are returned as ready to send QH2 packets, each holding at most
+ * Gnutella.HitsPerPacket hits. The caller is responsible for releasing the packets.
+ */
+class CLocalSearch
+{
+public:
+	static QList<G2Packet*> search(CQueryPtr pQuery);
+
+private:
+	static G2Packet* createQueryHit(const QUuid& oGUID, const QList<LibraryFile>& lFiles,
+									int nFirst, int nCount);
+};
+
+#endif // LOCALSEARCH_H
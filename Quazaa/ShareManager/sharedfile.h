@@ -29,8 +29,6 @@
 
 #include "file.h"
 
-class QSqlDatabase;
-
 class CSharedFile : public CFile
 {
 
@@ -46,8 +44,6 @@ public:
 
 	~CSharedFile() {}
 
-	void serialize(QSqlDatabase* pDatabase);
-
 private:
 	void setup();
 };
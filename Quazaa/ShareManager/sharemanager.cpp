@@ -26,22 +26,33 @@
 
 #include <QTimer>
 #include <QSqlError>
+#include <QSqlRecord>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QVariant>
 #include <QList>
 
 #include "quazaaglobals.h"
 #include "quazaasettings.h"
 #include "queryhashmaster.h"
+#include "queryhashtable.h"
 #include "sharedfile.h"
 #include "filehasher.h"
+#include "libraryindex.h"
+#include "hashcache.h"
+#include "librarywatcher.h"
+#include "Hashes/hash.h"
 #include "types.h"
 
 #include "debug_new.h"
 
+// Time in ms verifyFiles() may hold the lock per run, and the pause between runs.
+static const int SHARE_VERIFY_SLICE    = 50;
+static const int SHARE_VERIFY_INTERVAL = 200;
+
 CThread ShareManagerThread;
 CShareManager ShareManager;
 
@@ -53,6 +64,11 @@ CShareManager::CShareManager(QObject* parent) :
 	m_bTableReady = false;
 	m_pTable = 0;
 	m_nRemainingFiles = 0;
+	m_nSearchMaximum = 0;
+	m_pWatcher = 0;
+	m_bWatchComplete = false;
+	m_tCheckpoint = 0;
+	m_bCleanShutdown = false;
 }
 
 void CShareManager::start()
@@ -83,6 +99,18 @@ void CShareManager::setupThread()
 	systemLog.postLog(LogSeverity::Debug, QString("Database opened successfully"));
 
 	QSqlQuery query(m_oDatabase);
+	bool bIndexKeywords = false;
+
+	// Readers no longer block the writer and a commit does not have to wait for an fsync.
+	if(query.exec("PRAGMA journal_mode = WAL") && query.next() && query.value(0).toString().compare("wal", Qt::CaseInsensitive) == 0)
+	{
+		query.exec("PRAGMA synchronous = 1");
+	}
+	else
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Cannot switch database to WAL mode"));
+	}
+	query.finish();
 
 	systemLog.postLog(LogSeverity::Debug, QString("Checking tables..."));
 
@@ -102,9 +130,11 @@ void CShareManager::setupThread()
 		// tables
 		query.exec("CREATE TABLE 'dirs' ('id' INTEGER PRIMARY KEY  AUTOINCREMENT  NOT NULL  UNIQUE , 'path' TEXT NOT NULL, 'parent' INTEGER NOT NULL );");
 		query.exec("CREATE TABLE 'files' ('file_id' INTEGER PRIMARY KEY  AUTOINCREMENT  NOT NULL  UNIQUE , 'dir_id' INTEGER NOT NULL , 'name' VARCHAR(255) NOT NULL , 'size' INTEGER NOT NULL , 'last_modified' INTEGER NOT NULL , 'shared' BOOL NOT NULL  DEFAULT 1);");
-		query.exec("CREATE TABLE 'hashes' ('file_id' INTEGER PRIMARY KEY NOT NULL  UNIQUE , 'sha1' BLOB(20) NOT NULL, 'md5' BLOB(16) NOT NULL);");
+		query.exec("CREATE TABLE 'hashes' ('file_id' INTEGER PRIMARY KEY NOT NULL  UNIQUE , 'sha1' BLOB(20) NOT NULL, 'md5' BLOB(16) NOT NULL, 'ed2k' BLOB(16), 'tiger' BLOB(24));");
 		query.exec("CREATE TABLE 'hash_queue' ('dir_id' INTEGER NOT NULL, 'filename' VARCHAR(255) NOT NULL);");
 		query.exec("CREATE TABLE 'keywords' ('id' INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, 'keyword' TEXT NOT NULL);");
+		query.exec("CREATE TABLE 'file_keywords' ('keyword_id' INTEGER NOT NULL, 'file_id' INTEGER NOT NULL);");
+		query.exec("CREATE TABLE 'journal' ('key' TEXT PRIMARY KEY NOT NULL, 'value' INTEGER NOT NULL);");
 
 		// indexes
 		query.exec("CREATE INDEX 'dir_id' ON 'files' ('dir_id' ASC);");
@@ -113,36 +143,96 @@ void CShareManager::setupThread()
 		query.exec("CREATE INDEX 'parent' ON 'dirs' ('parent' ASC)");
 		query.exec("CREATE UNIQUE INDEX 'keyword' ON 'keywords' ('keyword' ASC);");
 		query.exec("CREATE INDEX 'sha1' ON 'hashes' ('sha1' ASC);");
+		query.exec("CREATE UNIQUE INDEX 'keyword_file' ON 'file_keywords' ('keyword_id' ASC, 'file_id' ASC);");
+		query.exec("CREATE INDEX 'keyword_file_id' ON 'file_keywords' ('file_id' ASC);");
 
 		systemLog.postLog(LogSeverity::Debug, QString("Database recreated."));
 	}
 	else
 	{
+		// columns added after the initial schema
+		if(!m_oDatabase.record("hashes").contains("ed2k"))
+		{
+			query.exec("ALTER TABLE 'hashes' ADD COLUMN 'ed2k' BLOB(16);");
+		}
+		if(!m_oDatabase.record("hashes").contains("tiger"))
+		{
+			query.exec("ALTER TABLE 'hashes' ADD COLUMN 'tiger' BLOB(24);");
+		}
+		if(!m_oDatabase.tables().contains("journal"))
+		{
+			query.exec("CREATE TABLE 'journal' ('key' TEXT PRIMARY KEY NOT NULL, 'value' INTEGER NOT NULL);");
+		}
+		if(!m_oDatabase.tables().contains("file_keywords"))
+		{
+			query.exec("CREATE TABLE 'file_keywords' ('keyword_id' INTEGER NOT NULL, 'file_id' INTEGER NOT NULL);");
+			query.exec("CREATE UNIQUE INDEX 'keyword_file' ON 'file_keywords' ('keyword_id' ASC, 'file_id' ASC);");
+			query.exec("CREATE INDEX 'keyword_file_id' ON 'file_keywords' ('file_id' ASC);");
+			bIndexKeywords = true;
+		}
+
 		systemLog.postLog(LogSeverity::Debug, QString("Tables OK"));
 	}
 
+	m_oWriter.open(m_oDatabase);
+
+	if(bIndexKeywords)
+	{
+		indexKeywords();
+	}
+
+	hashCache.load();
+
 	systemLog.postLog(LogSeverity::Debug, QString("Destroying hash queue."));
 	query.exec("DELETE FROM `hash_queue`;");
 
+	// The checkpoint is only valid for one start; should we crash, the next start does a full sync.
+	m_tCheckpoint = 0;
+	if(query.exec("SELECT value FROM journal WHERE key = 'checkpoint'") && query.next())
+	{
+		m_tCheckpoint = query.value(0).toUInt();
+	}
+	query.exec("DELETE FROM journal WHERE key = 'checkpoint'");
+
+	m_pWatcher = new CLibraryWatcher();
+	connect(m_pWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(rescanDirectory(QString)));
+	connect(m_pWatcher, SIGNAL(overflow()), this, SLOT(fullSync()));
+
 	m_bActive = true;
 
 	QTimer::singleShot(30000, this, SLOT(syncShares()));
 
 	connect(this, SIGNAL(executeQuery(const QString&)), this, SLOT(execQuery(const QString&)), Qt::QueuedConnection);
+	connect(this, SIGNAL(executeSearch()), this, SLOT(execSearch()), Qt::QueuedConnection);
 }
 
 void CShareManager::stop()
 {
 	QMutexLocker l(&m_oSection);
+	// Everything on disk has been seen and hashed, so the next start only has to look at what
+	// changed while we were not running.
+	m_bCleanShutdown = m_bReady && m_bWatchComplete && m_nRemainingFiles == 0 && m_lsHashing.isEmpty() &&
+					   m_lVerifyDirs.isEmpty();
 	m_bActive = false;
 	m_bReady = false;
 	m_bTableReady = false;
+	m_oWriter.setHashTable(0);
 	if(m_pTable)
 	{
 		delete m_pTable;
 		m_pTable = 0;
 	}
 	disconnect(SIGNAL(executeQuery(const QString&)), this, SLOT(execQuery(const QString&)));
+	disconnect(SIGNAL(executeSearch()), this, SLOT(execSearch()));
+
+	// execSearch() will not run any more, release the waiting callers with empty results
+	foreach(CShareSearchRequest* pSearch, m_lSearches)
+	{
+		pSearch->bDone = true;
+	}
+	m_lSearches.clear();
+	m_oSearchCond.wakeAll();
+
 	ShareManagerThread.exit(0);
 }
 
@@ -150,6 +240,24 @@ void CShareManager::cleanupThread()
 {
 	systemLog.postLog(LogSeverity::Debug, QString("ShareManager: cleaning up."));
 
+	CFileHasher::stopAll();
+
+	hashCache.save();
+
+	m_oWriter.close();
+
+	delete m_pWatcher;
+	m_pWatcher = 0;
+
+	if(m_oDatabase.isOpen() && m_bCleanShutdown)
+	{
+		// leave a margin for changes still waiting in the watcher
+		QSqlQuery query(m_oDatabase);
+		query.prepare("INSERT OR REPLACE INTO journal (key, value) VALUES('checkpoint', ?)");
+		query.bindValue(0, common::getTNowUTC() - 60);
+		query.exec();
+	}
+
 	if(m_oDatabase.isOpen())
 	{
 		systemLog.postLog(LogSeverity::Debug, QString("Closing Database connection."));
@@ -166,11 +274,9 @@ void CShareManager::addDir(QString sPath)
 
 void CShareManager::removeDir(QString sPath)
 {
-	Q_UNUSED(sPath);
-
 	QSqlQuery query(m_oDatabase);
 
-	query.prepare("SELECT id FROM dirs WHERE path = '?'");
+	query.prepare("SELECT id FROM dirs WHERE path = ?");
 	query.addBindValue(QVariant(sPath));
 	query.exec();
 
@@ -184,35 +290,98 @@ void CShareManager::removeDir(quint64 nId)
 {
 	QSqlQuery delq(m_oDatabase);
 
-	delq.exec(QString("SELECT id FROM dirs WHERE parent = %1").arg(nId));
-	while(delq.next())
+	delq.prepare("SELECT path FROM dirs WHERE id = ?");
+	delq.bindValue(0, nId);
+	if(delq.exec() && delq.next() && m_pWatcher)
 	{
-		removeDir(delq.record().value(0).toUInt());
+		m_pWatcher->removePath(delq.record().value(0).toString());
 	}
 
-	delq.exec(QString("DELETE FROM hashes WHERE file_id IN (SELECT dir_id FROM files WHERE dir_id = %1)").arg(nId));
-	delq.exec(QString("DELETE FROM files WHERE dir_id = %1").arg(nId));
-	delq.exec(QString("DELETE FROM dirs WHERE id = %1").arg(nId));
+	QList<quint64> lSubdirs;
+	delq.prepare("SELECT id FROM dirs WHERE parent = ?");
+	delq.bindValue(0, nId);
+	if(delq.exec())
+	{
+		while(delq.next())
+		{
+			lSubdirs.append(delq.record().value(0).toULongLong());
+		}
+	}
+
+	foreach(quint64 nSubdir, lSubdirs)
+	{
+		removeDir(nSubdir);
+	}
+
+	delq.prepare("SELECT file_id FROM files WHERE dir_id = ?");
+	delq.bindValue(0, nId);
+	if(delq.exec())
+	{
+		while(delq.next())
+		{
+			libraryIndex.remove(delq.record().value(0).toULongLong());
+		}
+	}
+
+	removeFromHashTable(nId, true);
+
+	delq.prepare("DELETE FROM file_keywords WHERE file_id IN (SELECT file_id FROM files WHERE dir_id = ?)");
+	delq.bindValue(0, nId);
+	delq.exec();
+
+	delq.prepare("DELETE FROM hashes WHERE file_id IN (SELECT file_id FROM files WHERE dir_id = ?)");
+	delq.bindValue(0, nId);
+	delq.exec();
+
+	delq.prepare("DELETE FROM files WHERE dir_id = ?");
+	delq.bindValue(0, nId);
+	delq.exec();
+
+	delq.prepare("DELETE FROM dirs WHERE id = ?");
+	delq.bindValue(0, nId);
+	delq.exec();
 }
 
 void CShareManager::removeFile(QString sPath)
 {
-	Q_UNUSED(sPath);
+	QFileInfo fi(sPath);
+
+	QSqlQuery query(m_oDatabase);
+	query.prepare("SELECT f.file_id FROM files f JOIN dirs d ON(f.dir_id = d.id) WHERE d.path = ? AND f.name = ?");
+	query.bindValue(0, fi.absolutePath());
+	query.bindValue(1, fi.fileName());
+	if(!query.exec())
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(query.lastError().text()));
+		return;
+	}
 
+	while(query.next())
+	{
+		removeFile(query.record().value(0).toULongLong());
+	}
 }
 
 void CShareManager::removeFile(quint64 nFileId)
 {
-	QSqlQuery delq(m_oDatabase);
-	delq.exec(QString("DELETE FROM hashes WHERE file_id = %1").arg(nFileId));
-	delq.exec(QString("DELETE FROM files WHERE file_id = %1").arg(nFileId));
+	libraryIndex.remove(nFileId);
+	removeFromHashTable(nFileId, false);
+	m_oWriter.removeFile(nFileId);
 }
 
 void CShareManager::syncShares()
 {
 	QMutexLocker l(&m_oSection);
 
-	systemLog.postLog(LogSeverity::Debug, QString("Syncing Shares..."));
+	// After a clean shutdown only directories modified since then have to be listed again.
+	const quint32 tCheckpoint = m_tCheckpoint;
+	m_tCheckpoint = 0;
+	m_lVerifyDirs.clear();
+
+	m_oWriter.flush();
+
+	systemLog.postLog(LogSeverity::Debug, tCheckpoint ? QString("Syncing Shares (changes since %1)...").arg(tCheckpoint)
+													  : QString("Syncing Shares..."));
 
 	QSqlQuery query(m_oDatabase);
 
@@ -222,6 +391,7 @@ void CShareManager::syncShares()
 	query.setForwardOnly(true);
 
 	int nMissingDirs = 0, nMissingFiles = 0, nModifiedFiles = 0;
+	QStringList lChangedDirs, lNewRoots;
 
 	// 1. Check for missing dirs
 	if(!query.exec("SELECT id, path FROM dirs"))
@@ -230,71 +400,39 @@ void CShareManager::syncShares()
 		return;
 	}
 
+	QList<QPair<qint64, QString> > lDirs;
+
 	while(query.next())
 	{
-		QDir d(query.record().value(1).toString());
-		if(!d.exists())
+		QFileInfo d(query.record().value(1).toString());
+		if(!d.isDir())
 		{
 			// delete all file entries that refer to the missing dir
-			systemLog.postLog(LogSeverity::Debug, QString("Directory %1 does not exist").arg(d.path()));
+			systemLog.postLog(LogSeverity::Debug, QString("Directory %1 does not exist").arg(d.filePath()));
 			removeDir(query.record().value(0).toInt());
 			nMissingDirs++;
 		}
+		else if(tCheckpoint && d.lastModified().toTime_t() >= tCheckpoint)
+		{
+			// entries have been added, removed or renamed; rescanDirectory() compares every file
+			lChangedDirs.append(d.filePath());
+		}
+		else if(tCheckpoint)
+		{
+			// files may still have been modified in place, which the directory mtime doesn't show
+			m_lVerifyDirs.append(query.record().value(0).toLongLong());
+		}
+		else
+		{
+			lDirs.append(qMakePair(query.record().value(0).toLongLong(), d.filePath()));
+		}
 	}
 
-	// 2. Check for missing or modified files
-	query.setForwardOnly(true);
-	if(!query.exec("SELECT id, path FROM dirs"))
-	{
-		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: ").arg(query.lastError().text()));
-		return;
-	}
-
-	while(query.next())
+	// 2. Check for missing or modified files. After a clean shutdown this is left to verifyFiles(),
+	// which runs in the background once the library is ready.
+	for(int i = 0; i < lDirs.size(); ++i)
 	{
-		QSqlQuery fquery(m_oDatabase);
-
-		if(fquery.exec(QString("SELECT file_id,name,size,last_modified FROM files WHERE dir_id = %1").arg(query.record().value(0).toInt())))
-		{
-			while(fquery.next())
-			{
-				QString sPath;
-				sPath = query.record().value(1).toString().append("/");
-				sPath.append(fquery.record().value(1).toString());
-
-				QFileInfo fi(sPath);
-				if(!fi.exists())
-				{
-					systemLog.postLog(LogSeverity::Debug, QString("File: %1 is missing").arg(sPath));
-					removeFile(fquery.record().value(0).toInt());
-					nMissingFiles++;
-				}
-				else
-				{
-					// check if modified
-
-					bool bModified = false;
-
-					if(fi.size() != fquery.record().value(2).toLongLong())
-					{
-						systemLog.postLog(LogSeverity::Debug, QString("Size mismatch"));
-						bModified = true;
-					}
-					else if(fi.lastModified().toTime_t() != fquery.record().value(3).toUInt())
-					{
-						systemLog.postLog(LogSeverity::Debug, QString("Modified recently"));
-						bModified = true;
-					}
-
-					if(bModified)
-					{
-						systemLog.postLog(LogSeverity::Debug, QString("File: %1 is midified, rehashing").arg(sPath));
-						removeFile(fquery.record().value(0).toInt());
-						nModifiedFiles++;
-					}
-				}
-			}
-		}
+		checkFiles(lDirs.at(i).first, lDirs.at(i).second, false, nMissingFiles, nModifiedFiles);
 	}
 
 	// fix slashes
@@ -393,14 +531,19 @@ void CShareManager::syncShares()
 			{
 				systemLog.postLog(LogSeverity::Debug, QString("Cannot insert new directory entry: %1").arg(insq.lastError().text()));
 			}
+			else
+			{
+				lNewRoots.append(sPath);
+			}
 		}
 	}
 
 	systemLog.postLog(LogSeverity::Debug, QString("Missing dirs: %1 missing files: %2 modified files %3").arg(nMissingDirs).arg(nMissingFiles).arg(nModifiedFiles));
 
-	// 5. Now we can start scanning shared dirs
+	// 5. Now we can start scanning shared dirs (only new and changed ones after a clean shutdown)
 
-	foreach(QString sPath, quazaaSettings.Library.Shares)
+	const QStringList lScan = tCheckpoint ? lNewRoots : quazaaSettings.Library.Shares;
+	foreach(QString sPath, lScan)
 	{
 		if(!m_bActive)
 		{
@@ -412,10 +555,38 @@ void CShareManager::syncShares()
 		l.relock();
 	}
 
+	if(tCheckpoint)
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("%1 directories changed since last run").arg(lChangedDirs.size()));
+
+		foreach(QString sPath, lChangedDirs)
+		{
+			if(!m_bActive)
+			{
+				break;
+			}
+
+			l.unlock();
+			rescanDirectory(sPath, false);
+			l.relock();
+		}
+	}
+
+	watchAll();
+
 	query.exec("PRAGMA synchronous = 1");
+
+	libraryIndex.load(m_oDatabase);
+
 	m_bReady = true;
 	if(m_bActive)
 	{
+		if(!m_lVerifyDirs.isEmpty())
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("Verifying files of %1 unchanged directories in the background").arg(m_lVerifyDirs.size()));
+			QTimer::singleShot(SHARE_VERIFY_INTERVAL, this, SLOT(verifyFiles()));
+		}
+
 		emit sharesReady();
 		l.unlock();
 		runHashing();
@@ -510,6 +681,11 @@ void CShareManager::scanFolder(QString sPath, qint64 nParentID)
 		lFilesInDB.append(query.record().value(0).toString());
 	}
 
+	if(m_pWatcher && !m_pWatcher->addPath(d.absolutePath()))
+	{
+		m_bWatchComplete = false;
+	}
+
 	lFilesInFS = d.entryList(QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
 
 	foreach(QString sFile, lFilesInDB)
@@ -520,19 +696,7 @@ void CShareManager::scanFolder(QString sPath, qint64 nParentID)
 	m_oDatabase.transaction();
 	foreach(QString sFile, lFilesInFS)
 	{
-		QSqlQuery insq(m_oDatabase);
-		insq.prepare("INSERT INTO hash_queue (dir_id, filename) VALUES(?,?)");
-		insq.bindValue(0, QVariant(nDirID));
-		insq.bindValue(1, QVariant(sFile));
-		if(!insq.exec())
-		{
-			systemLog.postLog(LogSeverity::Debug, QString("Cannot queue file for hashing: %1").arg(insq.lastError().text()));
-		}
-		else
-		{
-			m_nRemainingFiles++;
-			emit remainingFilesChanged(m_nRemainingFiles);
-		}
+		queueFile(nDirID, sFile);
 	}
 	m_oDatabase.commit();
 
@@ -570,6 +734,311 @@ void CShareManager::scanFolder(QString sPath, qint64 nParentID)
 	}
 }
 
+/**
+  * Compares the library directory sPath with its records and applies the differences: records of
+  * missing files and directories are removed, new and modified files are queued for hashing and
+  * new subdirectories are scanned. Called for every directory the watcher reports as changed and,
+  * with bSync set, by syncShares().
+  */
+void CShareManager::rescanDirectory(const QString& sPath, bool bSync)
+{
+	QMutexLocker l(&m_oSection);
+
+	// changes arriving during a sync are found by the sync itself
+	if(!m_bActive || (!bSync && !m_bReady))
+	{
+		return;
+	}
+
+	// the database has to know every file already hashed
+	m_oWriter.flush();
+
+	QSqlQuery query(m_oDatabase);
+	query.prepare("SELECT id FROM dirs WHERE path = ?");
+	query.bindValue(0, QVariant(sPath));
+	if(!query.exec() || !query.next())
+	{
+		// not part of the library; new directories are found through their parent
+		return;
+	}
+
+	const qint64 nDirID = query.record().value(0).toLongLong();
+	query.finish();
+
+	QDir d(sPath);
+	if(!d.exists())
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Directory %1 has been removed").arg(sPath));
+		removeDir(nDirID);
+		return;
+	}
+
+	systemLog.postLog(LogSeverity::Debug, QString("Rescanning %1").arg(sPath));
+
+	QHash<QString, QFileInfo> lhFiles;
+	foreach(const QFileInfo& fi, d.entryInfoList(QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
+	{
+		lhFiles.insert(fi.fileName(), fi);
+	}
+
+	// 1. known files
+	query.prepare("SELECT file_id, name, size, last_modified FROM files WHERE dir_id = ?");
+	query.bindValue(0, QVariant(nDirID));
+	if(!query.exec())
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(query.lastError().text()));
+		return;
+	}
+
+	QList<quint64> lRemoved;
+	while(query.next())
+	{
+		QHash<QString, QFileInfo>::iterator it = lhFiles.find(query.record().value(1).toString());
+
+		if(it == lhFiles.end())
+		{
+			lRemoved.append(query.record().value(0).toULongLong());
+		}
+		else if(it.value().size() != query.record().value(2).toLongLong() ||
+				it.value().lastModified().toTime_t() != query.record().value(3).toUInt())
+		{
+			// modified, remove the record and hash it again
+			lRemoved.append(query.record().value(0).toULongLong());
+		}
+		else
+		{
+			lhFiles.erase(it);
+		}
+	}
+
+	m_oDatabase.transaction();
+	foreach(quint64 nFileID, lRemoved)
+	{
+		removeFile(nFileID);
+	}
+	m_oDatabase.commit();
+
+	// 2. new or modified files not waiting for the hashers yet
+	query.prepare("SELECT filename FROM hash_queue WHERE dir_id = ?");
+	query.bindValue(0, QVariant(nDirID));
+	if(query.exec())
+	{
+		while(query.next())
+		{
+			lhFiles.remove(query.record().value(0).toString());
+		}
+	}
+
+	int nQueued = 0;
+
+	m_oDatabase.transaction();
+	foreach(const QFileInfo& fi, lhFiles)
+	{
+		if(!m_lsHashing.contains(fi.absoluteFilePath()) && queueFile(nDirID, fi.fileName()))
+		{
+			nQueued++;
+		}
+	}
+	m_oDatabase.commit();
+
+	// 3. subdirectories
+	QStringList lSubdirs = d.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+
+	query.prepare("SELECT id, path FROM dirs WHERE parent = ?");
+	query.bindValue(0, QVariant(nDirID));
+	if(query.exec())
+	{
+		QList<quint64> lRemovedDirs;
+		while(query.next())
+		{
+			if(!lSubdirs.removeOne(QFileInfo(query.record().value(1).toString()).fileName()))
+			{
+				lRemovedDirs.append(query.record().value(0).toULongLong());
+			}
+		}
+
+		foreach(quint64 nId, lRemovedDirs)
+		{
+			removeDir(nId);
+		}
+	}
+
+	l.unlock();
+
+	foreach(QString sDir, lSubdirs)
+	{
+		scanFolder(d.absolutePath() + "/" + sDir, nDirID);
+	}
+
+	if(!bSync && (nQueued || !lSubdirs.isEmpty()))
+	{
+		runHashing();
+	}
+}
+
+/**
+  * Compares the files of the directory nDirID with the database: missing files are removed,
+  * modified ones are removed and, with bQueueModified set, queued for hashing again (a full scan
+  * finds them anyway).
+  * Requires Locking: RW
+  */
+void CShareManager::checkFiles(qint64 nDirID, const QString& sDirPath, bool bQueueModified, int& nMissing, int& nModified)
+{
+	QSqlQuery fquery(m_oDatabase);
+	fquery.prepare("SELECT file_id,name,size,last_modified FROM files WHERE dir_id = ?");
+	fquery.addBindValue(nDirID);
+
+	if(!fquery.exec())
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(fquery.lastError().text()));
+		return;
+	}
+
+	while(fquery.next())
+	{
+		const QString sPath = sDirPath + "/" + fquery.record().value(1).toString();
+
+		QFileInfo fi(sPath);
+		if(!fi.exists())
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("File: %1 is missing").arg(sPath));
+			removeFile(fquery.record().value(0).toULongLong());
+			nMissing++;
+		}
+		else if(fi.size() != fquery.record().value(2).toLongLong() ||
+				fi.lastModified().toTime_t() != fquery.record().value(3).toUInt())
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("File: %1 is modified, rehashing").arg(sPath));
+			removeFile(fquery.record().value(0).toULongLong());
+			nModified++;
+
+			if(bQueueModified)
+			{
+				queueFile(nDirID, fi.fileName());
+			}
+		}
+	}
+}
+
+/**
+  * Checks the files of the directories syncShares() left unverified after a clean shutdown, a few
+  * directories at a time so searches and watcher events are not held up.
+  */
+void CShareManager::verifyFiles()
+{
+	QMutexLocker l(&m_oSection);
+
+	if(!m_bActive || !m_bReady)
+	{
+		return;
+	}
+
+	QElapsedTimer tSlice;
+	tSlice.start();
+
+	int nMissing = 0, nModified = 0;
+
+	while(!m_lVerifyDirs.isEmpty() && tSlice.elapsed() < SHARE_VERIFY_SLICE)
+	{
+		const qint64 nDirID = m_lVerifyDirs.takeFirst();
+
+		QSqlQuery query(m_oDatabase);
+		query.prepare("SELECT path FROM dirs WHERE id = ?");
+		query.addBindValue(nDirID);
+
+		// removed meanwhile
+		if(!query.exec() || !query.next())
+		{
+			continue;
+		}
+
+		const QString sPath = query.record().value(0).toString();
+		query.finish();
+
+		m_oDatabase.transaction();
+		checkFiles(nDirID, sPath, true, nMissing, nModified);
+		m_oDatabase.commit();
+	}
+
+	if(!m_lVerifyDirs.isEmpty())
+	{
+		QTimer::singleShot(SHARE_VERIFY_INTERVAL, this, SLOT(verifyFiles()));
+	}
+	else
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Library files verified"));
+	}
+
+	if(nModified)
+	{
+		l.unlock();
+		runHashing();
+	}
+}
+
+void CShareManager::fullSync()
+{
+	m_oSection.lock();
+	m_tCheckpoint = 0;
+	m_oSection.unlock();
+
+	syncShares();
+}
+
+/**
+  * Watches all library directories for changes.
+  * Requires Locking: RW
+  */
+void CShareManager::watchAll()
+{
+	if(!m_pWatcher)
+	{
+		return;
+	}
+
+	m_bWatchComplete = true;
+
+	QSqlQuery query(m_oDatabase);
+	query.setForwardOnly(true);
+	if(!query.exec("SELECT path FROM dirs"))
+	{
+		m_bWatchComplete = false;
+		return;
+	}
+
+	while(query.next())
+	{
+		if(!m_pWatcher->addPath(query.record().value(0).toString()))
+		{
+			m_bWatchComplete = false;
+		}
+	}
+
+	systemLog.postLog(LogSeverity::Debug, QString("Watching %1 directories (%2)").arg(m_pWatcher->count())
+					  .arg(m_pWatcher->isNative() ? "inotify" : "QFileSystemWatcher"));
+}
+
+/**
+  * Adds a file to the hash queue.
+  * Requires Locking: RW
+  */
+bool CShareManager::queueFile(qint64 nDirID, const QString& sFileName)
+{
+	QSqlQuery insq(m_oDatabase);
+	insq.prepare("INSERT INTO hash_queue (dir_id, filename) VALUES(?,?)");
+	insq.bindValue(0, QVariant(nDirID));
+	insq.bindValue(1, QVariant(sFileName));
+	if(!insq.exec())
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Cannot queue file for hashing: %1").arg(insq.lastError().text()));
+		return false;
+	}
+
+	m_nRemainingFiles++;
+	emit remainingFilesChanged(m_nRemainingFiles);
+	return true;
+}
+
 // meant to be called from other threads
 // Don't call it from ShareManager thread or it will deadlock
 QList<QSqlRecord> CShareManager::query(const QString sQuery)
@@ -586,10 +1055,180 @@ QList<QSqlRecord> CShareManager::query(const QString sQuery)
 	return lRecs;
 }
 
+// meant to be called from other threads
+// Don't call it from ShareManager thread or it will deadlock
+QList<quint64> CShareManager::search(CQueryPtr pQuery, int nMaximum)
+{
+	QMutexLocker l(&m_oSection);
+
+	if(!m_bActive)
+	{
+		return QList<quint64>();
+	}
+
+	CShareSearchRequest oSearch;
+	oSearch.pQuery = pQuery;
+	oSearch.nMaximum = nMaximum;
+	oSearch.bDone = false;
+
+	m_lSearches.append(&oSearch);
+	emit executeSearch();
+
+	while(!oSearch.bDone)
+	{
+		m_oSearchCond.wait(&m_oSection);
+	}
+
+	return oSearch.lResults;
+}
+
+void CShareManager::execSearch()
+{
+	QMutexLocker l(&m_oSection);
+
+	if(m_lSearches.isEmpty())
+	{
+		return;
+	}
+
+	m_oWriter.flush();
+
+	// one call serves every search queued so far, the signals of the others find the list empty
+	while(!m_lSearches.isEmpty())
+	{
+		CShareSearchRequest* pSearch = m_lSearches.takeFirst();
+		pSearch->lResults = searchDatabase(pSearch->pQuery.data(), pSearch->nMaximum);
+		pSearch->bDone = true;
+	}
+
+	m_oSearchCond.wakeAll();
+}
+
+/**
+  * Returns the IDs of at most nMaximum shared files matching pQuery. Hash queries return the files
+  * with any of the given hashes. Keyword queries return all files that contain every positive and
+  * none of the negative words, shorter names first.
+  * Requires Locking: RW
+  */
+QList<quint64> CShareManager::searchDatabase(const CQuery* pQuery, int nMaximum)
+{
+	QList<quint64> lResults;
+	QSqlQuery query(m_oDatabase);
+	query.setForwardOnly(true);
+
+	if(!pQuery->m_lHashes.isEmpty())
+	{
+		foreach(const CHash& oHash, pQuery->m_lHashes)
+		{
+			if(!m_oDatabase.record("hashes").contains(oHash.getFamilyName()))
+			{
+				continue;
+			}
+
+			query.prepare(QString("SELECT f.file_id FROM hashes h JOIN files f ON(h.file_id = f.file_id) "
+								  "WHERE h.%1 = ? AND f.shared = 1 AND f.size BETWEEN ? AND ?").arg(oHash.getFamilyName()));
+			query.bindValue(0, oHash.rawValue());
+			query.bindValue(1, pQuery->m_nMinimumSize);
+			query.bindValue(2, pQuery->m_nMaximumSize);
+			if(query.exec() && query.next())
+			{
+				lResults.append(query.value(0).toULongLong());
+				break;
+			}
+		}
+
+		return lResults;
+	}
+
+	QStringList lPositive, lNegative, lPhrases;
+	CLibraryIndex::parseWords(pQuery->m_sG2PositiveWords, lPositive, lPhrases);
+	CLibraryIndex::parseWords(pQuery->m_sG2NegativeWords, lNegative, lPhrases, false);
+
+	if(lPositive.isEmpty() || nMaximum <= 0)
+	{
+		return lResults;
+	}
+
+	QString sPositive = QString("?,").repeated(lPositive.size());
+	sPositive.chop(1);
+
+	QString sSQL = QString("SELECT fk.file_id FROM file_keywords fk JOIN keywords k ON(fk.keyword_id = k.id) "
+						   "JOIN files f ON(fk.file_id = f.file_id) "
+						   "WHERE k.keyword IN(%1) AND f.shared = 1 AND f.size BETWEEN ? AND ? ").arg(sPositive);
+
+	if(!lNegative.isEmpty())
+	{
+		QString sNegative = QString("?,").repeated(lNegative.size());
+		sNegative.chop(1);
+
+		sSQL += QString("AND fk.file_id NOT IN(SELECT nfk.file_id FROM file_keywords nfk JOIN keywords nk ON(nfk.keyword_id = nk.id) "
+						"WHERE nk.keyword IN(%1)) ").arg(sNegative);
+	}
+
+	// parseWords() drops duplicate words, so a file matching all of them matches lPositive.size()
+	sSQL += "GROUP BY fk.file_id HAVING COUNT(DISTINCT fk.keyword_id) = ? ORDER BY LENGTH(f.name) ASC LIMIT ?";
+
+	query.prepare(sSQL);
+	foreach(const QString& sWord, lPositive)
+	{
+		query.addBindValue(sWord);
+	}
+	query.addBindValue(pQuery->m_nMinimumSize);
+	query.addBindValue(pQuery->m_nMaximumSize);
+	foreach(const QString& sWord, lNegative)
+	{
+		query.addBindValue(sWord);
+	}
+	query.addBindValue(lPositive.size());
+	query.addBindValue(nMaximum);
+
+	if(!query.exec())
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(query.lastError().text()));
+		return lResults;
+	}
+
+	while(query.next())
+	{
+		lResults.append(query.value(0).toULongLong());
+	}
+
+	return lResults;
+}
+
+/**
+  * Links all files to their keywords; needed once for databases created before the file_keywords
+  * table existed.
+  * Requires Locking: RW
+  */
+void CShareManager::indexKeywords()
+{
+	systemLog.postLog(LogSeverity::Debug, QString("Indexing keywords..."));
+
+	QSqlQuery query(m_oDatabase);
+	query.setForwardOnly(true);
+	if(!query.exec("SELECT file_id, name FROM files"))
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(query.lastError().text()));
+		return;
+	}
+
+	m_oDatabase.transaction();
+	while(query.next())
+	{
+		QStringList lKeywords;
+		CQueryHashTable::makeKeywords(query.value(1).toString(), lKeywords);
+		m_oWriter.writeKeywords(query.value(0).toULongLong(), lKeywords);
+	}
+	m_oDatabase.commit();
+}
+
 void CShareManager::execQuery(const QString& sQuery)
 {
 	m_oSection.lock();
 
+	m_oWriter.flush();
+
 	QSqlQuery query(m_oDatabase);
 	if(!query.exec(sQuery))
 	{
@@ -623,29 +1262,43 @@ void CShareManager::runHashing()
 		return;
 	}
 
-	QString sRowIDs;
+	QVariantList lRowIDs;
 
 	bool bFinished = true;
 
 	while(query.next())
 	{
-		sRowIDs.append(query.record().value(0).toString()).append(",");
+		lRowIDs.append(query.record().value(0));
 
 		CSharedFilePtr pFile( new CSharedFile( query.record().value(3).toString() + '/' + query.record().value(1).toString() ) );
 		pFile->setDirectoryID( query.record().value(2).toLongLong() );
+		m_lsHashing.insert( pFile->absoluteFilePath() );
 
 		CFileHasher::hashFile(pFile);
 
 		bFinished = false;
 	}
 
-	sRowIDs.truncate(sRowIDs.size() - 1);
-
-	query.exec(QString("DELETE FROM hash_queue WHERE rowid IN(%1)").arg(sRowIDs));
+	if(!lRowIDs.isEmpty())
+	{
+		query.prepare("DELETE FROM hash_queue WHERE rowid = ?");
+		query.addBindValue(lRowIDs);
+		if(!query.execBatch())
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(query.lastError().text()));
+		}
+	}
 
 	if(bFinished)
 	{
-		buildHashTable();
+		m_oWriter.flush();
+		hashCache.save();
+
+		// afterwards the table is kept up to date as files are added and removed
+		if(!m_bTableReady)
+		{
+			buildHashTable();
+		}
 		emit sharesReady();
 	}
 }
@@ -657,14 +1310,32 @@ void CShareManager::onFileHashed(CSharedFilePtr pFile)
 	systemLog.postLog(LogSeverity::Debug, QString( "OnFileHashed" ) );
 	//qDebug() << "OnFileHashed";
 
+	m_lsHashing.remove( pFile->absoluteFilePath() );
+
 	pFile->refresh();
 	pFile->m_bShared = true;
-	pFile->serialize( &m_oDatabase );
+
+	// written together with the files hashed next, see flushWrites()
+	const int nPending = m_oWriter.enqueue( pFile );
+	if ( nPending >= SHARE_WRITER_BATCH )
+	{
+		m_oWriter.flush();
+	}
+	else if ( nPending == 1 )
+	{
+		QTimer::singleShot( SHARE_WRITER_DELAY, this, SLOT(flushWrites()) );
+	}
 
 	m_nRemainingFiles--;
 	emit remainingFilesChanged(m_nRemainingFiles);
 }
 
+void CShareManager::flushWrites()
+{
+	QMutexLocker l( &m_oSection );
+	m_oWriter.flush();
+}
+
 CQueryHashTable* CShareManager::getHashTable()
 {
 	ASSUME_LOCK(m_oSection);
@@ -676,6 +1347,12 @@ CQueryHashTable* CShareManager::getHashTable()
 	return m_pTable;
 }
 
+/**
+  * Fills the local query hash table from the database. The table counts the files behind every
+  * slot; from then on CShareWriter adds new files and removeFromHashTable() removes the entries of
+  * deleted files, so the table never has to be rebuilt.
+  * Requires Locking: RW
+  */
 void CShareManager::buildHashTable()
 {
 	ASSUME_LOCK(m_oSection);
@@ -686,15 +1363,18 @@ void CShareManager::buildHashTable()
 		{
 			return;
 		}
+		m_pTable->setCounted(true);
 		m_pTable->create();
 	}
 
 	m_pTable->clear();
-
-	// TODO: Optimize it
+	m_oWriter.setHashTable(0);
 
 	QSqlQuery q(m_oDatabase);
-	q.prepare("SELECT keyword FROM keywords");
+	q.setForwardOnly(true);
+	// one entry per file and keyword
+	q.prepare("SELECT k.keyword FROM file_keywords fk JOIN keywords k ON(fk.keyword_id = k.id) "
+			  "JOIN files f ON(fk.file_id = f.file_id) WHERE f.shared = 1");
 	if(!q.exec())
 	{
 		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(q.lastError().text()));
@@ -707,7 +1387,7 @@ void CShareManager::buildHashTable()
 			m_pTable->addExactString(q.record().value(0).toString());
 		}
 
-		q.prepare("SELECT sha1 FROM hashes");
+		q.prepare("SELECT h.sha1 FROM hashes h JOIN files f ON(h.file_id = f.file_id) WHERE f.shared = 1");
 		if(!q.exec())
 		{
 			systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(q.lastError().text()));
@@ -727,6 +1407,63 @@ void CShareManager::buildHashTable()
 			}
 		}
 		m_bTableReady = true;
+		m_oWriter.setHashTable(m_pTable);
+	}
+}
+
+/**
+  * Removes the query hash table entries of the file nId, or of all files in the directory nId if
+  * bDirectory is set. Must be called before the records are deleted.
+  * Requires Locking: RW
+  */
+void CShareManager::removeFromHashTable(quint64 nId, bool bDirectory)
+{
+	if(!m_bTableReady || !m_pTable)
+	{
+		return;
+	}
+
+	QSqlQuery q(m_oDatabase);
+	q.setForwardOnly(true);
+	q.prepare(bDirectory ? "SELECT k.keyword FROM file_keywords fk JOIN keywords k ON(fk.keyword_id = k.id) "
+						   "JOIN files f ON(fk.file_id = f.file_id) WHERE f.shared = 1 AND f.dir_id = ?"
+						 : "SELECT k.keyword FROM file_keywords fk JOIN keywords k ON(fk.keyword_id = k.id) "
+						   "JOIN files f ON(fk.file_id = f.file_id) WHERE f.shared = 1 AND f.file_id = ?");
+	q.addBindValue(nId);
+	if(!q.exec())
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("SQL Query failed: %1").arg(q.lastError().text()));
+		return;
+	}
+
+	bool bChanged = false;
+	while(q.next())
+	{
+		m_pTable->removeExactString(q.value(0).toString());
+		bChanged = true;
+	}
+
+	q.prepare(bDirectory ? "SELECT h.sha1 FROM hashes h JOIN files f ON(h.file_id = f.file_id) WHERE f.shared = 1 AND f.dir_id = ?"
+						 : "SELECT h.sha1 FROM hashes h JOIN files f ON(h.file_id = f.file_id) WHERE f.shared = 1 AND f.file_id = ?");
+	q.addBindValue(nId);
+	if(q.exec())
+	{
+		while(q.next())
+		{
+			QByteArray baSHA1 = q.value(0).toByteArray();
+			CHash* pHash = CHash::fromRaw(baSHA1, CHash::SHA1);
+			if(pHash)
+			{
+				m_pTable->removeExactString(pHash->toURN());
+				delete pHash;
+				bChanged = true;
+			}
+		}
+	}
+
+	if(bChanged)
+	{
+		QueryHashMaster.invalidate();
 	}
 }
 
@@ -27,14 +27,27 @@
 
 #include <QList>
 #include <QObject>
+#include <QSet>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlRecord>
 
 #include "thread.h"
+#include "query.h"
 #include "sharedfile.h"
+#include "sharewriter.h"
 
 class CQueryHashTable;
+class CLibraryWatcher;
+
+// A search() call waiting for execSearch(); lives on the caller's stack.
+struct CShareSearchRequest
+{
+	CQueryPtr		pQuery;
+	int				nMaximum;
+	QList<quint64>	lResults;
+	bool			bDone;
+};
 
 class CShareManager : public QObject
 {
@@ -50,10 +63,22 @@ protected:
 
 	QList<QSqlRecord> m_lQueryResults;
 
+	QWaitCondition				m_oSearchCond;
+	QList<CShareSearchRequest*>	m_lSearches;	// searches waiting for execSearch()
+
 	CQueryHashTable* 	m_pTable;
 	bool				m_bTableReady;
 
+	CShareWriter		m_oWriter;			// batches the records of hashed files
+
 	qint32				m_nRemainingFiles;
+	QSet<QString>		m_lsHashing;		// files handed to the hashers but not yet serialized
+
+	CLibraryWatcher*	m_pWatcher;
+	bool				m_bWatchComplete;	// every library directory is being watched
+	quint32				m_tCheckpoint;		// time of the last clean shutdown, 0 if unknown
+	bool				m_bCleanShutdown;
+	QList<qint64>		m_lVerifyDirs;		// unchanged directories whose files still need a stat()
 public:
 	explicit CShareManager(QObject* parent = 0);
 
@@ -77,17 +102,25 @@ public:
 	}
 
 	QList<QSqlRecord> query(const QString sQuery);
+	QList<quint64> search(CQueryPtr pQuery, int nMaximum);
 
 protected:
 	void buildHashTable();
+	void removeFromHashTable(quint64 nId, bool bDirectory);
+	void watchAll();
+	bool queueFile(qint64 nDirID, const QString& sFileName);
+	void checkFiles(qint64 nDirID, const QString& sDirPath, bool bQueueModified, int& nMissing, int& nModified);
+	void indexKeywords();
+	QList<quint64> searchDatabase(const CQuery* pQuery, int nMaximum);
 signals:
 	void sharesReady();
 	void executeQuery(const QString& sQuery);
+	void executeSearch();
 
 signals:
 	void hasherStarted(int); // int - hasher id
 	void hasherFinished(int); // int - hasher id
-	void hashingProgress(int, QString, double, int); // hasher id, filename, percent, rate
+	void hashingProgress(int, QString, double, qint64); // hasher id, filename, percent, rate
 	void remainingFilesChanged(qint32);
 
 public slots:
@@ -96,10 +129,15 @@ public slots:
 
 	void runHashing();
 	void onFileHashed(CSharedFilePtr pFile);
+	void flushWrites();
 
 protected slots:
 	void syncShares();
+	void fullSync();
+	void rescanDirectory(const QString& sPath, bool bSync = false);
+	void verifyFiles();
 	void execQuery(const QString& sQuery);
+	void execSearch();
 };
 
 
@@ -0,0 +1,301 @@
+/*
+** sharewriter.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "sharewriter.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVariant>
+
+#include "libraryindex.h"
+#include "queryhashmaster.h"
+#include "queryhashtable.h"
+#include "Hashes/hash.h"
+#include "systemlog.h"
+
+#include "debug_new.h"
+
+CShareWriter::CShareWriter() :
+	m_pDatabase( NULL ),
+	m_pInsertFile( NULL ),
+	m_pInsertHashes( NULL ),
+	m_pInsertKeyword( NULL ),
+	m_pLinkKeyword( NULL ),
+	m_pDeleteKeywords( NULL ),
+	m_pDeleteHashes( NULL ),
+	m_pDeleteFile( NULL ),
+	m_pTable( NULL )
+{
+}
+
+CShareWriter::~CShareWriter()
+{
+	close();
+}
+
+/**
+ * Prepares the statements used for writing to oDatabase. oDatabase must stay open until close()
+ * has been called.
+ */
+bool CShareWriter::open(QSqlDatabase& oDatabase)
+{
+	close();
+
+	m_pDatabase       = &oDatabase;
+	m_pInsertFile     = new QSqlQuery( oDatabase );
+	m_pInsertHashes   = new QSqlQuery( oDatabase );
+	m_pInsertKeyword  = new QSqlQuery( oDatabase );
+	m_pLinkKeyword    = new QSqlQuery( oDatabase );
+	m_pDeleteKeywords = new QSqlQuery( oDatabase );
+	m_pDeleteHashes   = new QSqlQuery( oDatabase );
+	m_pDeleteFile     = new QSqlQuery( oDatabase );
+
+	if ( !m_pInsertFile->prepare( "INSERT INTO files (dir_id, name, size, last_modified, shared) VALUES (?,?,?,?,?)" ) ||
+		 !m_pInsertHashes->prepare( "INSERT OR REPLACE INTO hashes (file_id, sha1, md5, ed2k, tiger) VALUES (?,?,?,?,?)" ) ||
+		 !m_pInsertKeyword->prepare( "INSERT OR IGNORE INTO keywords (keyword) VALUES (?)" ) ||
+		 !m_pLinkKeyword->prepare( "INSERT OR IGNORE INTO file_keywords (keyword_id, file_id) "
+								   "SELECT id, ? FROM keywords WHERE keyword = ?" ) ||
+		 !m_pDeleteKeywords->prepare( "DELETE FROM file_keywords WHERE file_id = ?" ) ||
+		 !m_pDeleteHashes->prepare( "DELETE FROM hashes WHERE file_id = ?" ) ||
+		 !m_pDeleteFile->prepare( "DELETE FROM files WHERE file_id = ?" ) )
+	{
+		systemLog.postLog( LogSeverity::Debug, QString( "Cannot prepare share database statements: %1"
+														).arg( oDatabase.lastError().text() ) );
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Writes all pending records and releases the prepared statements.
+ */
+void CShareWriter::close()
+{
+	if ( m_pDatabase )
+		flush();
+
+	delete m_pInsertFile;
+	delete m_pInsertHashes;
+	delete m_pInsertKeyword;
+	delete m_pLinkKeyword;
+	delete m_pDeleteKeywords;
+	delete m_pDeleteHashes;
+	delete m_pDeleteFile;
+
+	m_pInsertFile = m_pInsertHashes = m_pInsertKeyword = m_pLinkKeyword = NULL;
+	m_pDeleteKeywords = m_pDeleteHashes = m_pDeleteFile = NULL;
+	m_pDatabase = NULL;
+	m_lPending.clear();
+}
+
+/**
+ * Queues the record of pFile for writing and returns the number of pending records, so the
+ * caller may decide to flush().
+ */
+int CShareWriter::enqueue(CSharedFilePtr pFile)
+{
+	m_lPending.append( pFile );
+	return m_lPending.size();
+}
+
+/**
+ * Writes all pending records in a single transaction. Returns the number of files written.
+ */
+int CShareWriter::flush()
+{
+	if ( m_lPending.isEmpty() || !m_pDatabase )
+		return 0;
+
+	const QList<CSharedFilePtr> lPending = m_lPending;
+	m_lPending.clear();
+
+	const bool bTransaction = m_pDatabase->transaction();
+
+	QList<CSharedFilePtr> lWritten;
+	foreach ( CSharedFilePtr pFile, lPending )
+	{
+		if ( write( pFile ) )
+			lWritten.append( pFile );
+	}
+
+	if ( bTransaction && !m_pDatabase->commit() )
+	{
+		// The files are found again by the next sync.
+		systemLog.postLog( LogSeverity::Debug, QString( "Cannot commit %1 file records: %2"
+														).arg( lWritten.size() ).arg( m_pDatabase->lastError().text() ) );
+		m_pDatabase->rollback();
+		return 0;
+	}
+
+	foreach ( CSharedFilePtr pFile, lWritten )
+	{
+		QByteArray baSHA1, baMD5;
+		foreach ( const CHash& oHash, pFile->getHashes() )
+		{
+			if ( oHash.getAlgorithm() == CHash::SHA1 )
+				baSHA1 = oHash.rawValue();
+			else if ( oHash.getAlgorithm() == CHash::MD5 )
+				baMD5 = oHash.rawValue();
+		}
+
+		libraryIndex.add( pFile->getFileID(), pFile->getDirectoryID(), pFile->absolutePath(),
+						  pFile->fileName(), pFile->size(), baSHA1, baMD5 );
+
+		if ( m_pTable )
+		{
+			// the same entries CShareManager::buildHashTable() adds for a file
+			QStringList lKeywords;
+			CQueryHashTable::makeKeywords( pFile->fileName(), lKeywords );
+			lKeywords.removeDuplicates();
+
+			foreach ( const QString& sKeyword, lKeywords )
+			{
+				m_pTable->addExactString( sKeyword );
+			}
+
+			CHash* pHash = baSHA1.isEmpty() ? NULL : CHash::fromRaw( baSHA1, CHash::SHA1 );
+			if ( pHash )
+			{
+				m_pTable->addExactString( pHash->toURN() );
+				delete pHash;
+			}
+		}
+	}
+
+	if ( m_pTable && !lWritten.isEmpty() )
+		QueryHashMaster.invalidate();
+
+	systemLog.postLog( LogSeverity::Debug, QString( "Wrote %1 file records" ).arg( lWritten.size() ) );
+
+	return lWritten.size();
+}
+
+/**
+ * Removes the records of file nFileID. Records still pending are not affected.
+ */
+void CShareWriter::removeFile(quint64 nFileID)
+{
+	if ( !m_pDatabase )
+		return;
+
+	m_pDeleteKeywords->bindValue( 0, nFileID );
+	m_pDeleteHashes->bindValue( 0, nFileID );
+	m_pDeleteFile->bindValue( 0, nFileID );
+
+	if ( !m_pDeleteKeywords->exec() || !m_pDeleteHashes->exec() || !m_pDeleteFile->exec() )
+	{
+		systemLog.postLog( LogSeverity::Debug, QString( "Cannot remove file %1: %2" ).arg( nFileID
+														).arg( m_pDeleteFile->lastError().text() ) );
+	}
+}
+
+/**
+ * Sets the table committed files are added to; NULL stops updating it.
+ */
+void CShareWriter::setHashTable(CQueryHashTable* pTable)
+{
+	m_pTable = pTable;
+}
+
+bool CShareWriter::write(CSharedFilePtr pFile)
+{
+	if ( !pFile->getDirectoryID() )
+	{
+		systemLog.postLog( LogSeverity::Debug, QString( "No directory for %1" ).arg( pFile->absoluteFilePath() ) );
+		return false;
+	}
+
+	m_pInsertFile->bindValue( 0, pFile->getDirectoryID() );
+	m_pInsertFile->bindValue( 1, pFile->fileName() );
+	m_pInsertFile->bindValue( 2, pFile->size() );
+	m_pInsertFile->bindValue( 3, pFile->lastModified().toTime_t() );
+	m_pInsertFile->bindValue( 4, pFile->m_bShared );
+	if ( !m_pInsertFile->exec() )
+	{
+		systemLog.postLog( LogSeverity::Debug, QString( "Cannot insert new record: %1"
+														).arg( m_pInsertFile->lastError().text() ) );
+		return false;
+	}
+
+	pFile->setFileID( m_pInsertFile->lastInsertId().toULongLong() );
+
+	// column order of the prepared statement
+	static const int nColumns[] = { CHash::SHA1, CHash::MD5, CHash::ED2K, CHash::TIGERTREE };
+
+	QVariant vHashes[4];
+	for ( int i = 0; i < 4; ++i )
+		vHashes[i] = QVariant( QVariant::ByteArray );
+
+	foreach ( const CHash& oHash, pFile->getHashes() )
+	{
+		for ( int i = 0; i < 4; ++i )
+		{
+			if ( oHash.getAlgorithm() == nColumns[i] )
+				vHashes[i] = oHash.rawValue();
+		}
+	}
+
+	m_pInsertHashes->bindValue( 0, pFile->getFileID() );
+	for ( int i = 0; i < 4; ++i )
+		m_pInsertHashes->bindValue( i + 1, vHashes[i] );
+
+	if ( !m_pInsertHashes->exec() )
+	{
+		systemLog.postLog( LogSeverity::Debug, QString( "Cannot insert hashes: %1"
+														).arg( m_pInsertHashes->lastError().text() ) );
+	}
+
+	QStringList lKeywords;
+	CQueryHashTable::makeKeywords( pFile->fileName(), lKeywords );
+	lKeywords.removeDuplicates();
+
+	writeKeywords( pFile->getFileID(), lKeywords );
+
+	return true;
+}
+
+/**
+ * Links file nFileID to lKeywords, adding keywords not known yet.
+ */
+void CShareWriter::writeKeywords(quint64 nFileID, const QStringList& lKeywords)
+{
+	foreach ( const QString& sKeyword, lKeywords )
+	{
+		m_pInsertKeyword->bindValue( 0, sKeyword );
+		m_pInsertKeyword->exec();
+
+		m_pLinkKeyword->bindValue( 0, nFileID );
+		m_pLinkKeyword->bindValue( 1, sKeyword );
+		if ( !m_pLinkKeyword->exec() )
+		{
+			systemLog.postLog( LogSeverity::Debug, QString( "Cannot link keyword: %1"
+															).arg( m_pLinkKeyword->lastError().text() ) );
+		}
+	}
+}
@@ -0,0 +1,91 @@
+/*
+** sharewriter.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef SHAREWRITER_H
+#define SHAREWRITER_H
+
+#include <QList>
+#include <QStringList>
+
+#include "sharedfile.h"
+
+class QSqlDatabase;
+class QSqlQuery;
+class CQueryHashTable;
+
+// Number of pending file records that causes an immediate flush.
+#define SHARE_WRITER_BATCH 64
+// Time in ms a file record may wait for more records before it is written.
+#define SHARE_WRITER_DELAY 1000
+
+/**
+ * @brief CShareWriter collects the records of freshly hashed files and writes them to the share
+ * database in batches, one transaction per batch, using statements that are prepared only once.
+ * Committed files are added to the library index and, once set, to the local query hash table.
+ * Locking: ShareManager.m_oSection (used from the Share Manager thread only).
+ */
+class CShareWriter
+{
+private:
+	QSqlDatabase*			m_pDatabase;
+
+	QSqlQuery*				m_pInsertFile;
+	QSqlQuery*				m_pInsertHashes;
+	QSqlQuery*				m_pInsertKeyword;
+	QSqlQuery*				m_pLinkKeyword;
+	QSqlQuery*				m_pDeleteKeywords;
+	QSqlQuery*				m_pDeleteHashes;
+	QSqlQuery*				m_pDeleteFile;
+
+	QList<CSharedFilePtr>	m_lPending;
+
+	CQueryHashTable*		m_pTable;		// local query hash table, updated on commit
+
+public:
+	CShareWriter();
+	~CShareWriter();
+
+	bool open(QSqlDatabase& oDatabase);
+	void close();
+
+	int enqueue(CSharedFilePtr pFile);
+	int flush();
+
+	void removeFile(quint64 nFileID);
+	void setHashTable(CQueryHashTable* pTable);
+	void writeKeywords(quint64 nFileID, const QStringList& lKeywords);
+
+	inline int pending() const
+	{
+		return m_lPending.size();
+	}
+
+private:
+	bool write(CSharedFilePtr pFile);
+
+	Q_DISABLE_COPY(CShareWriter)
+};
+
+#endif // SHAREWRITER_H
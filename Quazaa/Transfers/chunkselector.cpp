@@ -0,0 +1,103 @@
+/*
+** chunkselector.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "chunkselector.h"
+
+#include "debug_new.h"
+
+/**
+  * Counts the chunks of one source in vAvailability, which has an entry per chunk of the file.
+  * An empty oAvailable means the source has the complete file. Chunks touched by two of its
+  * ranges are counted once.
+  */
+void CChunkSelector::addSource(QVector<quint16>& vAvailability, const Fragments::List& oAvailable, quint64 nChunkSize)
+{
+	if( oAvailable.empty() )
+	{
+		for( int i = 0; i < vAvailability.size(); ++i )
+			vAvailability[i]++;
+
+		return;
+	}
+
+	qint64 nLast = -1;
+	for( Fragments::List::const_iterator itRange = oAvailable.begin(); itRange != oAvailable.end(); ++itRange )
+	{
+		for( qint64 nChunk = qMax<qint64>(nLast + 1, itRange->begin() / nChunkSize); (quint64)nChunk * nChunkSize < itRange->end(); ++nChunk )
+		{
+			vAvailability[nChunk]++;
+			nLast = nChunk;
+		}
+	}
+}
+
+/**
+  * Chooses the block to request from a source, at most nMaxSize bytes. oPossible are the ranges
+  * the source can deliver that are wanted and not requested yet; its limit is the file size.
+  * Returns false if there are none.
+  */
+bool CChunkSelector::nextBlock(const Fragments::List& oPossible, const QVector<quint16>& vAvailability,
+							   quint64 nChunkSize, quint64 nMaxSize, Fragments::Fragment& oBlock)
+{
+	if( oPossible.empty() )
+		return false;
+
+	const quint64 nSize = oPossible.limit();
+
+	bool bFound = false;
+	quint64 nBest = 0;
+	bool bBestPartial = false;
+	quint16 nBestCount = 0;
+
+	for( Fragments::List::const_iterator itRange = oPossible.begin(); itRange != oPossible.end(); ++itRange )
+	{
+		for( quint64 nChunk = itRange->begin() / nChunkSize; nChunk * nChunkSize < itRange->end(); ++nChunk )
+		{
+			if( bFound && nChunk == nBest )
+				continue;
+
+			const Fragments::Fragment oChunk(nChunk * nChunkSize, qMin(nSize, (nChunk + 1) * nChunkSize));
+			const bool bPartial = oPossible.overlapping_sum(oChunk) < oChunk.size();
+			const quint16 nCount = vAvailability.value(nChunk);
+
+			if( !bFound || (bPartial && !bBestPartial)
+				|| (bPartial == bBestPartial && nCount < nBestCount) )
+			{
+				bFound = true;
+				nBest = nChunk;
+				bBestPartial = bPartial;
+				nBestCount = nCount;
+			}
+		}
+	}
+
+	const Fragments::Fragment oChunk(nBest * nChunkSize, qMin(nSize, (nBest + 1) * nChunkSize));
+	Fragments::List::const_iterator itFirst = oPossible.equal_range(oChunk).first;
+
+	const quint64 nBegin = qMax(itFirst->begin(), oChunk.begin());
+	const quint64 nEnd = qMin(qMin(itFirst->end(), oChunk.end()), nBegin + nMaxSize);
+
+	oBlock = Fragments::Fragment(nBegin, nEnd);
+	return true;
+}
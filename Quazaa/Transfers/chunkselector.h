@@ -0,0 +1,47 @@
+/*
+** chunkselector.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef CHUNKSELECTOR_H
+#define CHUNKSELECTOR_H
+
+#include <QVector>
+
+#include "FileFragments.hpp"
+
+/**
+ * @brief CChunkSelector is the block choice of the download scheduler, kept apart from CDownload
+ * so it can be run against synthetic sources. Files are scheduled in chunks, usually the blocks
+ * of their hash set. Chunks that are already partially downloaded come first, so they can be
+ * verified soon, then the chunks the fewest sources have: those are the ones lost when their
+ * sources leave. Blocks never cross a chunk boundary.
+ */
+class CChunkSelector
+{
+public:
+	static void addSource(QVector<quint16>& vAvailability, const Fragments::List& oAvailable, quint64 nChunkSize);
+	static bool nextBlock(const Fragments::List& oPossible, const QVector<quint16>& vAvailability,
+						  quint64 nChunkSize, quint64 nMaxSize, Fragments::Fragment& oBlock);
+};
+
+#endif // CHUNKSELECTOR_H
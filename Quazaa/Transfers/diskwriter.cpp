@@ -0,0 +1,717 @@
+/*
+** diskwriter.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "diskwriter.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QMutexLocker>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#endif
+
+#include "quazaasettings.h"
+#include "systemlog.h"
+
+#include "debug_new.h"
+
+CDiskWriter DiskWriter;
+
+CDiskWriter::CDiskWriter(QObject* parent) :
+	QThread( parent ),
+	m_nCached( 0 ),
+	m_bCongested( false ),
+	m_bStop( false )
+{
+}
+
+CDiskWriter::~CDiskWriter()
+{
+	stop();
+
+	foreach ( void* pOwner, m_lhFiles.keys() )
+	{
+		close( pOwner );
+	}
+}
+
+void CDiskWriter::start()
+{
+	QMutexLocker l( &m_pSection );
+
+	m_bStop = false;
+	QThread::start();
+}
+
+/**
+  * Writes out all cached data and stops the thread. Open files stay registered,
+  * later writes are stored when the file is closed.
+  */
+void CDiskWriter::stop()
+{
+	if ( !isRunning() )
+		return;
+
+	m_pSection.lock();
+	m_bStop = true;
+	m_oWakeUp.wakeAll();
+	m_pSection.unlock();
+
+	wait();
+}
+
+/**
+  * Queues baData for offset nOffset of the file owned by pOwner. The file is created at sPath
+  * with the size nSize on the first write. Returns false if earlier data of this file could not
+  * be written.
+  */
+bool CDiskWriter::write(void* pOwner, const QString& sPath, quint64 nSize, quint64 nOffset, const QByteArray& baData)
+{
+	bool bCongested = false;
+
+	{
+		QMutexLocker l( &m_pSection );
+
+		CDiskWriterFile* pFile = file( pOwner, sPath, nSize );
+
+		if ( pFile->bError )
+			return false;
+
+		if ( pFile->lBlocks.isEmpty() )
+			pFile->tFirst = QDateTime::currentMSecsSinceEpoch();
+
+		// append to the block ending at nOffset, or start a new one
+		QMap<quint64, QByteArray>::iterator itBlock = pFile->lBlocks.lowerBound( nOffset );
+		QMap<quint64, QByteArray>::iterator itPrevious = itBlock;
+
+		if ( itBlock != pFile->lBlocks.begin() && ( --itPrevious ).key() + itPrevious.value().size() == nOffset )
+		{
+			itPrevious.value().append( baData );
+			itBlock = itPrevious;
+		}
+		else
+		{
+			itBlock = pFile->lBlocks.insert( nOffset, baData );
+		}
+
+		// and join the following block if the gap is closed now
+		QMap<quint64, QByteArray>::iterator itNext = itBlock + 1;
+
+		if ( itNext != pFile->lBlocks.end() && itBlock.key() + itBlock.value().size() == itNext.key() )
+		{
+			itBlock.value().append( itNext.value() );
+			pFile->lBlocks.erase( itNext );
+		}
+
+		pFile->nCached += baData.size();
+		m_nCached += baData.size();
+
+		if ( pFile->nCached >= DISK_WRITER_FLUSH )
+			m_oWakeUp.wakeAll();
+
+		if ( !m_bCongested && m_nCached >= DISK_WRITER_CACHE )
+		{
+			systemLog.postLog( LogSeverity::Debug, QString( "Disk writes fall behind, %1 bytes cached" ).arg( m_nCached ) );
+			m_bCongested = bCongested = true;
+			m_oWakeUp.wakeAll();
+		}
+	}
+
+	if ( bCongested )
+		emit congested( true );
+
+	return true;
+}
+
+/**
+  * Asks for the cached data of pOwner to be written out soon, for example because a fragment has
+  * been completed. Does not wait.
+  */
+void CDiskWriter::flush(void* pOwner)
+{
+	QMutexLocker l( &m_pSection );
+
+	CDiskWriterFile* pFile = m_lhFiles.value( pOwner );
+
+	if ( pFile && !pFile->lBlocks.isEmpty() )
+	{
+		pFile->bFlush = true;
+		m_oWakeUp.wakeAll();
+	}
+}
+
+/**
+  * Queues the range nOffset, nLength of the file owned by pOwner to be read back and hashed with
+  * nAlgorithm once its data is written. verified() is emitted with the result. Pending checks are
+  * dropped when the file is closed.
+  */
+void CDiskWriter::verify(void* pOwner, const QString& sPath, quint64 nSize, quint64 nOffset, quint64 nLength,
+						 CHash::Algorithm nAlgorithm, const QByteArray& baHash)
+{
+	QMutexLocker l( &m_pSection );
+
+	CDiskWriterVerify oVerify;
+	oVerify.nOffset = nOffset;
+	oVerify.nLength = nLength;
+	oVerify.nAlgorithm = nAlgorithm;
+	oVerify.baHash = baHash;
+
+	file( pOwner, sPath, nSize )->lVerify.append( oVerify );
+	m_oWakeUp.wakeAll();
+}
+
+/**
+  * Writes the remaining data of pOwner and closes its file. Waits until the data is on disk.
+  * Returns false if any data of the file could not be written.
+  */
+bool CDiskWriter::close(void* pOwner)
+{
+	QMutexLocker l( &m_pSection );
+
+	CDiskWriterFile* pFile = m_lhFiles.value( pOwner );
+
+	if ( !pFile )
+		return true;
+
+	while ( pFile->bBusy )
+		m_oWritten.wait( &m_pSection );
+
+	if ( !pFile->lBlocks.isEmpty() )
+		writeFile( pFile, l );
+
+	if ( !pFile->baState.isEmpty() )
+		writeState( pFile, l );
+
+	if ( !pFile->baJournal.isEmpty() )
+		syncJournal( pFile, l );
+
+	m_lhFiles.remove( pOwner );
+
+	const bool bOK = !pFile->bError;
+	delete pFile->pJournal;
+	delete pFile->pFile;
+	delete pFile;
+
+	return bOK;
+}
+
+/**
+  * Queues a journal record for the file owned by pOwner. It is written with the completions of
+  * the data cached so far, in the order it was queued.
+  */
+void CDiskWriter::journal(void* pOwner, const QString& sPath, quint64 nSize, CDownloadJournal::RecordType nType,
+						  quint64 nBegin, quint64 nEnd)
+{
+	QMutexLocker l( &m_pSection );
+
+	queueRecords( file( pOwner, sPath, nSize ), CDownloadJournal::record( nType, nBegin, nEnd ) );
+}
+
+/**
+  * Queues the snapshot baState of pOwner to be saved as the .!qd file next to sPath. Its cached
+  * data is written and synced first, so the snapshot never claims more than the disk has, then the
+  * journal is started over. stateSaved() reports the result. Does not wait; a later snapshot
+  * replaces one that is still waiting.
+  */
+void CDiskWriter::saveState(void* pOwner, const QString& sPath, quint64 nSize, const QByteArray& baState)
+{
+	QMutexLocker l( &m_pSection );
+
+	CDiskWriterFile* pFile = file( pOwner, sPath, nSize );
+
+	// records queued so far are covered by the snapshot
+	pFile->baState = baState;
+	pFile->nStateRecords = pFile->baJournal.size();
+
+	m_oWakeUp.wakeAll();
+}
+
+// Bytes in the journal of pOwner, including the records still waiting to be written.
+qint64 CDiskWriter::journalLength(void* pOwner)
+{
+	QMutexLocker l( &m_pSection );
+
+	CDiskWriterFile* pFile = m_lhFiles.value( pOwner );
+
+	if ( !pFile )
+		return 0;
+
+	// the journal starts over once a waiting snapshot is saved
+	if ( !pFile->baState.isEmpty() )
+		return pFile->baJournal.size() - pFile->nStateRecords;
+
+	return pFile->nJournal + pFile->baJournal.size();
+}
+
+quint64 CDiskWriter::cached()
+{
+	QMutexLocker l( &m_pSection );
+
+	return m_nCached;
+}
+
+// Flushes the data of pFile from the operating system to the disk.
+bool CDiskWriter::syncFile(QFile* pFile)
+{
+#if defined( Q_OS_LINUX )
+	return ::fdatasync( pFile->handle() ) == 0;
+#elif defined( Q_OS_UNIX )
+	return ::fsync( pFile->handle() ) == 0;
+#elif defined( Q_OS_WIN )
+	return ::_commit( pFile->handle() ) == 0;
+#else
+	return pFile->flush();
+#endif
+}
+
+void CDiskWriter::run()
+{
+	QMutexLocker l( &m_pSection );
+
+	forever
+	{
+		CDiskWriterFile* pFile = nextFile();
+
+		if ( pFile )
+		{
+			if ( !pFile->lBlocks.isEmpty() )
+				writeFile( pFile, l );
+
+			verifyFile( pFile, l );
+
+			if ( !pFile->baState.isEmpty() )
+				writeState( pFile, l );
+
+			if ( journalDue( pFile, QDateTime::currentMSecsSinceEpoch() ) )
+				syncJournal( pFile, l );
+		}
+		else if ( m_bStop )
+		{
+			break;
+		}
+		else
+		{
+			m_oWakeUp.wait( &m_pSection, DISK_WRITER_DELAY / 2 );
+		}
+	}
+}
+
+/**
+  * Returns the entry of pOwner, created for the file sPath of nSize bytes if there is none yet.
+  * Requires Locking: m_pSection
+  */
+CDiskWriterFile* CDiskWriter::file(void* pOwner, const QString& sPath, quint64 nSize)
+{
+	CDiskWriterFile* pFile = m_lhFiles.value( pOwner );
+
+	if ( !pFile )
+	{
+		pFile = new CDiskWriterFile();
+		pFile->pOwner = pOwner;
+		pFile->sPath = sPath;
+		pFile->nSize = nSize;
+		pFile->pFile = NULL;
+		pFile->nCached = 0;
+		pFile->tFirst = 0;
+		pFile->bFlush = false;
+		pFile->bBusy = false;
+		pFile->bError = false;
+		pFile->pJournal = new CDownloadJournal( CDownloadJournal::path( sPath ), nSize );
+		pFile->tJournal = 0;
+		pFile->nJournal = 0;
+		pFile->nStateRecords = 0;
+		m_lhFiles.insert( pOwner, pFile );
+	}
+
+	return pFile;
+}
+
+/**
+  * Returns the file to write next: the one with most cached data among those that are due,
+  * or all files with data while the cache is congested or the writer stops. Files with ranges
+  * to verify or a snapshot to save are always due, so are files whose journal records have
+  * waited long enough.
+  * Requires Locking: m_pSection
+  */
+CDiskWriterFile* CDiskWriter::nextFile()
+{
+	const qint64 tNow = QDateTime::currentMSecsSinceEpoch();
+	const bool bAll = m_bStop || m_nCached >= DISK_WRITER_CACHE / 2;
+
+	CDiskWriterFile* pNext = NULL;
+
+	foreach ( CDiskWriterFile* pFile, m_lhFiles )
+	{
+		if ( pFile->bBusy )
+			continue;
+
+		const bool bWrite = !pFile->lBlocks.isEmpty()
+							&& ( bAll || pFile->bFlush || pFile->nCached >= DISK_WRITER_FLUSH || tNow - pFile->tFirst >= DISK_WRITER_DELAY );
+
+		if ( bWrite || !pFile->lVerify.isEmpty() || !pFile->baState.isEmpty() || journalDue( pFile, tNow ) )
+		{
+			if ( !pNext || pFile->nCached > pNext->nCached )
+				pNext = pFile;
+		}
+	}
+
+	return pNext;
+}
+
+/**
+  * Writes all cached blocks of pFile. The lock is released while writing.
+  * Requires Locking: m_pSection
+  */
+bool CDiskWriter::writeFile(CDiskWriterFile* pFile, QMutexLocker& oLock)
+{
+	QMap<quint64, QByteArray> lBlocks;
+	lBlocks.swap( pFile->lBlocks );
+
+	const quint64 nBytes = pFile->nCached;
+	pFile->nCached = 0;
+	pFile->bFlush = false;
+	pFile->bBusy = true;
+
+	oLock.unlock();
+
+	bool bOK = !pFile->bError && openFile( pFile );
+	QByteArray baWritten; // journal records of the blocks written
+
+	for ( QMap<quint64, QByteArray>::const_iterator itBlock = lBlocks.constBegin(); bOK && itBlock != lBlocks.constEnd(); ++itBlock )
+	{
+		const char* pData = itBlock.value().constData();
+		qint64 nOffset = itBlock.key();
+		qint64 nLength = itBlock.value().size();
+
+#ifdef Q_OS_UNIX
+		while ( nLength > 0 )
+		{
+			const ssize_t nWritten = ::pwrite( pFile->pFile->handle(), pData, nLength, nOffset );
+
+			if ( nWritten < 0 && errno == EINTR )
+				continue;
+
+			if ( nWritten <= 0 )
+			{
+				systemLog.postLog( LogSeverity::Error, QString( "Cannot write to %1: %2" ).arg( pFile->sPath ).arg( strerror( errno ) ) );
+				bOK = false;
+				break;
+			}
+
+			pData += nWritten;
+			nOffset += nWritten;
+			nLength -= nWritten;
+		}
+#else
+		if ( !pFile->pFile->seek( nOffset ) || pFile->pFile->write( pData, nLength ) != nLength )
+		{
+			systemLog.postLog( LogSeverity::Error, QString( "Cannot write to %1: %2" ).arg( pFile->sPath ).arg( pFile->pFile->errorString() ) );
+			bOK = false;
+		}
+#endif
+
+		if ( bOK )
+			baWritten += CDownloadJournal::record( CDownloadJournal::jrCompleted, itBlock.key(), itBlock.key() + itBlock.value().size() );
+	}
+
+	oLock.relock();
+
+	pFile->bBusy = false;
+	if ( !bOK )
+		pFile->bError = true;
+
+	queueRecords( pFile, baWritten );
+
+	m_nCached -= nBytes;
+	m_oWritten.wakeAll();
+
+	if ( m_bCongested && m_nCached < DISK_WRITER_CACHE / 2 )
+	{
+		m_bCongested = false;
+		emit congested( false );
+	}
+
+	return bOK;
+}
+
+/**
+  * Verifies the queued ranges of pFile whose data has been written. Ranges that still overlap
+  * cached data wait for the next round. The lock is released while reading.
+  * Requires Locking: m_pSection
+  */
+void CDiskWriter::verifyFile(CDiskWriterFile* pFile, QMutexLocker& oLock)
+{
+	QList<CDiskWriterVerify> lReady;
+
+	for ( QList<CDiskWriterVerify>::iterator itVerify = pFile->lVerify.begin(); itVerify != pFile->lVerify.end(); )
+	{
+		bool bCached = false;
+
+		for ( QMap<quint64, QByteArray>::const_iterator itBlock = pFile->lBlocks.constBegin(); itBlock != pFile->lBlocks.constEnd(); ++itBlock )
+		{
+			if ( itBlock.key() < itVerify->nOffset + itVerify->nLength && itBlock.key() + itBlock.value().size() > itVerify->nOffset )
+			{
+				bCached = true;
+				break;
+			}
+		}
+
+		if ( bCached )
+		{
+			++itVerify;
+		}
+		else
+		{
+			lReady.append( *itVerify );
+			itVerify = pFile->lVerify.erase( itVerify );
+		}
+	}
+
+	if ( lReady.isEmpty() )
+		return;
+
+	pFile->bBusy = true;
+	oLock.unlock();
+
+	QList<bool> lResults;
+	foreach ( const CDiskWriterVerify& oVerify, lReady )
+	{
+		lResults.append( !pFile->bError && openFile( pFile ) && hashRange( pFile, oVerify ) );
+	}
+
+	oLock.relock();
+
+	pFile->bBusy = false;
+	m_oWritten.wakeAll();
+
+	for ( int i = 0; i < lReady.size(); ++i )
+	{
+		emit verified( pFile->pOwner, lReady[i].nOffset, lReady[i].nLength, lResults[i] );
+	}
+}
+
+/**
+  * Syncs the data of pFile, then appends its waiting records to the journal and syncs that.
+  * Records that cannot be written are dropped, the next snapshot of the download covers them.
+  * The lock is released while writing.
+  * Requires Locking: m_pSection
+  */
+void CDiskWriter::syncJournal(CDiskWriterFile* pFile, QMutexLocker& oLock)
+{
+	QByteArray baRecords;
+	baRecords.swap( pFile->baJournal );
+	pFile->bBusy = true;
+
+	oLock.unlock();
+
+	// the records must not reach the disk before the data they describe
+	bool bOK = !pFile->pFile || syncFile( pFile->pFile );
+
+	if ( bOK )
+		bOK = pFile->pJournal->write( baRecords );
+	else
+		systemLog.postLog( LogSeverity::Error, QString( "Cannot sync %1, journal records dropped" ).arg( pFile->sPath ) );
+
+	oLock.relock();
+
+	pFile->bBusy = false;
+	pFile->nJournal = pFile->pJournal->length();
+	m_oWritten.wakeAll();
+}
+
+/**
+  * Saves the waiting snapshot of pFile: the remaining cached data is written and synced, then the
+  * snapshot is written to a .bak file, synced and renamed over the .!qd file. The journal records
+  * the snapshot covers are dropped and the journal started over. The lock is released while
+  * writing.
+  * Requires Locking: m_pSection
+  */
+void CDiskWriter::writeState(CDiskWriterFile* pFile, QMutexLocker& oLock)
+{
+	if ( !pFile->lBlocks.isEmpty() )
+		writeFile( pFile, oLock );
+
+	QByteArray baState;
+	baState.swap( pFile->baState );
+	const int nRecords = pFile->nStateRecords;
+	pFile->nStateRecords = 0;
+	pFile->bBusy = true;
+
+	oLock.unlock();
+
+	bool bOK = !pFile->bError && ( !pFile->pFile || syncFile( pFile->pFile ) );
+
+	if ( bOK )
+	{
+		const QString sState = pFile->sPath + ".!qd";
+		QFile oBackup( pFile->sPath + ".bak" );
+
+		bOK = oBackup.open( QFile::WriteOnly | QFile::Truncate )
+			  && oBackup.write( baState ) == baState.size()
+			  && oBackup.flush() && syncFile( &oBackup );
+		oBackup.close();
+
+		// a .bak without .!qd is taken over by CDownloads::start()
+		if ( bOK )
+		{
+			QFile::remove( sState );
+			bOK = QFile::rename( oBackup.fileName(), sState );
+		}
+	}
+
+	if ( bOK )
+		pFile->pJournal->reset();
+
+	oLock.relock();
+
+	if ( bOK )
+	{
+		pFile->baJournal.remove( 0, nRecords );
+		if ( !pFile->baJournal.isEmpty() )
+			pFile->tJournal = QDateTime::currentMSecsSinceEpoch();
+		pFile->nJournal = pFile->pJournal->length();
+	}
+	else
+	{
+		systemLog.postLog( LogSeverity::Error, QString( "Cannot save the state of %1" ).arg( pFile->sPath ) );
+	}
+
+	pFile->bBusy = false;
+	m_oWritten.wakeAll();
+
+	emit stateSaved( pFile->pOwner, bOK );
+}
+
+// Requires Locking: m_pSection
+void CDiskWriter::queueRecords(CDiskWriterFile* pFile, const QByteArray& baRecords)
+{
+	if ( baRecords.isEmpty() )
+		return;
+
+	if ( pFile->baJournal.isEmpty() )
+		pFile->tJournal = QDateTime::currentMSecsSinceEpoch();
+
+	pFile->baJournal += baRecords;
+}
+
+/**
+  * Whether the journal records of pFile are to be written: after DISK_WRITER_SYNC, or at once
+  * when the writer stops. Not while a snapshot waits, it starts the journal over anyway.
+  * Requires Locking: m_pSection
+  */
+bool CDiskWriter::journalDue(CDiskWriterFile* pFile, qint64 tNow) const
+{
+	return !pFile->baJournal.isEmpty() && pFile->baState.isEmpty() && ( m_bStop || tNow - pFile->tJournal >= DISK_WRITER_SYNC );
+}
+
+/**
+  * Reads the range of oVerify back from disk and compares its hash. Mostly served from the page
+  * cache, as the data has just been written.
+  */
+bool CDiskWriter::hashRange(CDiskWriterFile* pFile, const CDiskWriterVerify& oVerify)
+{
+	CHash oHash( oVerify.nAlgorithm );
+	QByteArray baBuffer( DISK_WRITER_FLUSH, 0 );
+
+	quint64 nOffset = oVerify.nOffset;
+	quint64 nLength = oVerify.nLength;
+
+	while ( nLength > 0 )
+	{
+		const qint64 nChunk = qMin<quint64>( nLength, baBuffer.size() );
+
+#ifdef Q_OS_UNIX
+		const ssize_t nRead = ::pread( pFile->pFile->handle(), baBuffer.data(), nChunk, nOffset );
+
+		if ( nRead < 0 && errno == EINTR )
+			continue;
+#else
+		const qint64 nRead = pFile->pFile->seek( nOffset ) ? pFile->pFile->read( baBuffer.data(), nChunk ) : -1;
+#endif
+
+		if ( nRead <= 0 )
+		{
+			systemLog.postLog( LogSeverity::Error, QString( "Cannot read %1 for verification" ).arg( pFile->sPath ) );
+			return false;
+		}
+
+		oHash.addData( baBuffer.constData(), nRead );
+		nOffset += nRead;
+		nLength -= nRead;
+	}
+
+	oHash.finalize();
+
+	return oHash.rawValue() == oVerify.baHash;
+}
+
+/**
+  * Opens the file of pFile and sets it to its full size. The file is sparse unless
+  * Downloads.Preallocate is set; then its blocks are reserved at once, so the disk does not have
+  * to allocate them with every write and a full disk shows up before the download starts. Where
+  * the file system can not reserve space the file is made sparse anyway.
+  */
+bool CDiskWriter::openFile(CDiskWriterFile* pFile)
+{
+	if ( pFile->pFile )
+		return true;
+
+	QFile* pHandle = new QFile( pFile->sPath );
+
+	if ( !pHandle->open( QFile::ReadWrite | QFile::Unbuffered ) )
+	{
+		systemLog.postLog( LogSeverity::Error, QString( "Cannot open %1 for writing: %2" ).arg( pFile->sPath ).arg( pHandle->errorString() ) );
+		delete pHandle;
+		return false;
+	}
+
+	if ( (quint64)pHandle->size() < pFile->nSize )
+	{
+#ifdef Q_OS_LINUX
+		if ( quazaaSettings.Downloads.Preallocate && ::fallocate( pHandle->handle(), 0, 0, pFile->nSize ) != 0 && errno == ENOSPC )
+		{
+			systemLog.postLog( LogSeverity::Error, QString( "Not enough disk space for %1" ).arg( pFile->sPath ) );
+			delete pHandle;
+			return false;
+		}
+#endif
+		if ( (quint64)pHandle->size() < pFile->nSize && !pHandle->resize( pFile->nSize ) )
+		{
+			systemLog.postLog( LogSeverity::Error, QString( "Cannot resize %1: %2" ).arg( pFile->sPath ).arg( pHandle->errorString() ) );
+			delete pHandle;
+			return false;
+		}
+	}
+
+	pFile->pFile = pHandle;
+	return true;
+}
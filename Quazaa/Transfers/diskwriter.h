@@ -0,0 +1,146 @@
+/*
+** diskwriter.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "Hashes/hash.h"
+#include "downloadjournal.h"
+
+class QFile;
+
+#define DISK_WRITER_FLUSH	1048576		// cached bytes of one file that are written out at once
+#define DISK_WRITER_CACHE	33554432	// total cached bytes at which downloads stop reading
+#define DISK_WRITER_DELAY	2000		// ms data may stay in the cache
+#define DISK_WRITER_SYNC	5000		// ms journal records may wait for their data to be synced
+
+struct CDiskWriterVerify
+{
+	quint64				nOffset;
+	quint64				nLength;
+	CHash::Algorithm	nAlgorithm;
+	QByteArray			baHash;		// expected
+};
+
+struct CDiskWriterFile
+{
+	void*		pOwner;
+	QString		sPath;
+	quint64		nSize;
+	QFile*		pFile;		// opened by the first write
+	QMap<quint64, QByteArray> lBlocks; // offset -> adjacent received data
+	QList<CDiskWriterVerify> lVerify; // ranges to check once their data is written
+	CDownloadJournal* pJournal;
+	QByteArray	baJournal;	// records waiting for the data they describe to be synced
+	qint64		tJournal;	// when the oldest of them was queued
+	qint64		nJournal;	// length of the journal on disk
+	QByteArray	baState;	// snapshot of the owner waiting to be saved
+	int			nStateRecords; // bytes of baJournal the snapshot covers
+	quint64		nCached;
+	qint64		tFirst;		// when the oldest cached block arrived
+	bool		bFlush;		// write out as soon as possible
+	bool		bBusy;		// blocks are being written outside the lock
+	bool		bError;
+};
+
+/**
+ * @brief CDiskWriter stores received download data on a thread of its own. Data is cached per
+ * file and adjacent blocks are merged, so many slow transfers end up as few large writes instead
+ * of one small write per network read. Files are created at full size on the first write.
+ * When the disk falls behind and the cache grows past DISK_WRITER_CACHE, congested(true) is
+ * emitted and downloads stop reading from the network until half of it has been written.
+ * Completed ranges can be queued for verification; they are read back after their data has been
+ * written and verified() reports whether they match the expected hash.
+ * Every file has a CDownloadJournal. Written ranges and the records queued with journal() are
+ * collected for DISK_WRITER_SYNC, then the file is synced and the records appended to the journal
+ * with a single sync of their own, so the journal never claims data the disk does not have.
+ * Snapshots queued with saveState() are saved on the writer thread as well, after the data they
+ * count as completed has been synced; the journal is started over then and stateSaved() emitted.
+ * Files are identified by their owner, usually a CDownload.
+ */
+class CDiskWriter : public QThread
+{
+	Q_OBJECT
+
+protected:
+	QMutex			m_pSection;
+	QWaitCondition	m_oWakeUp;		// new data, a flush request or stop
+	QWaitCondition	m_oWritten;		// a file is no longer busy
+	QHash<void*, CDiskWriterFile*> m_lhFiles;
+	quint64			m_nCached;
+	bool			m_bCongested;
+	bool			m_bStop;
+
+public:
+	CDiskWriter(QObject* parent = 0);
+	~CDiskWriter();
+
+	void start();
+	void stop();
+
+	bool write(void* pOwner, const QString& sPath, quint64 nSize, quint64 nOffset, const QByteArray& baData);
+	void flush(void* pOwner);
+	void verify(void* pOwner, const QString& sPath, quint64 nSize, quint64 nOffset, quint64 nLength,
+				CHash::Algorithm nAlgorithm, const QByteArray& baHash);
+	bool close(void* pOwner);
+
+	void journal(void* pOwner, const QString& sPath, quint64 nSize, CDownloadJournal::RecordType nType,
+				 quint64 nBegin, quint64 nEnd);
+	void saveState(void* pOwner, const QString& sPath, quint64 nSize, const QByteArray& baState);
+	qint64 journalLength(void* pOwner);
+
+	quint64 cached();
+
+	static bool syncFile(QFile* pFile);
+
+signals:
+	void congested(bool bCongested);
+	void verified(void* pOwner, quint64 nOffset, quint64 nLength, bool bMatch);
+	void stateSaved(void* pOwner, bool bOK);
+
+protected:
+	void run();
+
+	CDiskWriterFile* file(void* pOwner, const QString& sPath, quint64 nSize);
+	CDiskWriterFile* nextFile();
+	bool writeFile(CDiskWriterFile* pFile, QMutexLocker& oLock);
+	void verifyFile(CDiskWriterFile* pFile, QMutexLocker& oLock);
+	void syncJournal(CDiskWriterFile* pFile, QMutexLocker& oLock);
+	void writeState(CDiskWriterFile* pFile, QMutexLocker& oLock);
+	void queueRecords(CDiskWriterFile* pFile, const QByteArray& baRecords);
+	bool journalDue(CDiskWriterFile* pFile, qint64 tNow) const;
+	bool hashRange(CDiskWriterFile* pFile, const CDiskWriterVerify& oVerify);
+	bool openFile(CDiskWriterFile* pFile);
+};
+
+extern CDiskWriter DiskWriter;
+
+#endif // DISKWRITER_H
@@ -28,6 +28,10 @@
 #include "downloads.h"
 #include "transfers.h"
 #include "downloadtransfer.h"
+#include "chunkselector.h"
+#include "diskwriter.h"
+#include "downloadjournal.h"
+#include "Hashes/tigertree.h"
 
 #include "commonfunctions.h"
 #include "quazaasettings.h"
@@ -38,6 +42,11 @@
 
 using namespace common;
 
+// ED2K hashes whole parts of this size, blocks never cross a part boundary
+static const quint64 DOWNLOAD_ED2K_PART = 9728000;
+// a tiger tree is verified in blocks of 1 KB * 2^n, chosen so the file has at most this many
+static const quint64 DOWNLOAD_TIGER_BLOCKS = 512;
+
 QDataStream& operator<<(QDataStream& s, const CDownload& rhs)
 {
 	// basic info
@@ -75,7 +84,7 @@ QDataStream& operator<<(QDataStream& s, const CDownload& rhs)
 	s << "completed-frags";
 	Fragments::SerializeOut(s, rhs.m_lCompleted);
 	s << "verified-frags";
-	Fragments::SerializeOut(s, rhs.m_lCompleted);
+	Fragments::SerializeOut(s, rhs.m_lVerified);
 
 	s << "eof";
 	return s;
@@ -201,6 +210,7 @@ QDataStream& operator>>(QDataStream& s, CDownload& rhs)
 	}
 
 	Q_ASSERT(rhs.m_lActive.size() == rhs.m_lCompleted.size() && rhs.m_lCompleted.size() == rhs.m_lVerified.size());
+	rhs.m_bVerifyCheck = true;
 	return s;
 }
 
@@ -212,7 +222,11 @@ CDownload::CDownload(CQueryHit* pHit, QObject *parent) :
 	m_bSignalSources(false),
 	m_nPriority(125),
 	m_bModified(true),
-	m_nTransfers(0)
+	m_nTransfers(0),
+	m_nChunkSize(0),
+	m_bAvailabilityDirty(true),
+	m_bEndgame(false),
+	m_bVerifyCheck(true)
 {
 	Q_ASSERT(pHit != NULL);
 
@@ -245,6 +259,8 @@ CDownload::~CDownload()
 	ASSUME_LOCK(Downloads.m_pSection);
 
 	qDeleteAll(m_lSources);
+
+	DiskWriter.close(this);
 }
 
 void CDownload::start()
@@ -253,23 +269,28 @@ void CDownload::start()
 	setState(dsPending);
 }
 
+/**
+  * Makes pSource an active source. Fails if a source with the same address or client GUID
+  * is active already, or the address was dropped as dead recently.
+  * Requires Locking: Downloads
+  */
 bool CDownload::addSource(CDownloadSource *pSource)
 {
 	ASSUME_LOCK(Downloads.m_pSection);
 
 	Q_ASSERT(pSource->m_pDownload == this);
 
-	foreach(CDownloadSource* pThis, m_lSources)
-	{
-		if( (!pThis->m_oGUID.isNull() && pThis->m_oGUID == pSource->m_oGUID)
-				|| (pThis->m_oAddress == pSource->m_oAddress)
-				|| (!pThis->m_sURL.isEmpty() && pThis->m_sURL == pSource->m_sURL))
-		{
-			return false;
-		}
-	}
+	if( !pSource->m_oGUID.isNull() && m_lSourceGUIDs.contains(pSource->m_oGUID) )
+		return false;
+
+	if( !m_oSourceStore.activate(pSource->m_oAddress, time(0), pSource->m_oGUID) )
+		return false;
+
+	if( !pSource->m_oGUID.isNull() )
+		m_lSourceGUIDs.insert(pSource->m_oGUID);
 
 	m_lSources.append(pSource);
+	m_bAvailabilityDirty = true;
 
 	if( m_bSignalSources )
 		emit sourceAdded(pSource);
@@ -302,14 +323,23 @@ int CDownload::addSource(CQueryHit *pHit)
 			}
 		}
 
-		CDownloadSource* pSource = new CDownloadSource(this, pThis);
-		if( addSource(pSource) )
+		if( m_lSources.size() >= quazaaSettings.Downloads.SourcesWanted )
 		{
-			nSources++;
+			// enough active sources, keep it as candidate for when one is dropped
+			if( m_oSourceStore.add(pThis->m_pHitInfo->m_oNodeAddress, time(0), pThis->m_pHitInfo->m_oNodeGUID) )
+				nSources++;
 		}
 		else
 		{
-			delete pSource;
+			CDownloadSource* pSource = new CDownloadSource(this, pThis);
+			if( addSource(pSource) )
+			{
+				nSources++;
+			}
+			else
+			{
+				delete pSource;
+			}
 		}
 		pThis = pThis->m_pNext;
 	}
@@ -326,21 +356,136 @@ void CDownload::removeSource(CDownloadSource *pSource)
 		if( m_lSources.at(i) == pSource )
 		{
 			m_lSources.removeAt(i);
+			m_bAvailabilityDirty = true;
+
+			m_oSourceStore.deactivate(pSource->m_oAddress);
+			m_lSourceGUIDs.remove(pSource->m_oGUID);
+		}
+	}
+}
+
+/**
+  * Drops active sources that failed too often or sent corrupt data, and refills the active
+  * sources from the best candidates in the source store.
+  * Requires Locking: Downloads
+  */
+void CDownload::manageSources()
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	const quint32 tNow = time(0);
+
+	m_oSourceStore.expire(tNow);
+
+	if( !quazaaSettings.Downloads.NeverDrop )
+	{
+		QList<CDownloadSource*> lDrop;
+
+		foreach(CDownloadSource* pSource, m_lSources)
+		{
+			if( !pSource->hasTransfer() && (pSource->m_nCorrupted >= DOWNLOAD_SOURCE_CORRUPT_MAX
+											|| pSource->m_nFailures >= (quint32)quazaaSettings.Downloads.MaxAllowedFailures) )
+			{
+				lDrop.append(pSource);
+			}
+		}
+
+		foreach(CDownloadSource* pSource, lDrop)
+		{
+			const CEndPoint oAddress = pSource->m_oAddress;
+			delete pSource; // removes itself from m_lSources
+			m_oSourceStore.setDead(oAddress, tNow);
 		}
 	}
+
+	const int nWanted = quazaaSettings.Downloads.SourcesWanted - m_lSources.size();
+
+	if( nWanted <= 0 )
+		return;
+
+	foreach(const CEndPoint& oAddress, m_oSourceStore.select(nWanted))
+	{
+		CDownloadSource* pSource = new CDownloadSource(this);
+		pSource->m_oAddress = oAddress;
+		pSource->m_oGUID = m_oSourceStore.guid(oAddress);
+		pSource->m_nProtocol = tpHTTP;
+		pSource->m_nNetwork = dpG2;
+
+		if( !addSource(pSource) )
+			delete pSource;
+	}
 }
 
-int CDownload::startTransfers(int /*nMaxTransfers*/)
+int CDownload::startTransfers(int nMaxTransfers)
 {
 	ASSUME_LOCK(Downloads.m_pSection);
 
-	return 0; // must return the number of just started transfers
+	if( nMaxTransfers < 0 )
+		nMaxTransfers = quazaaSettings.Downloads.MaxTransfersPerFile;
+
+	nMaxTransfers = qMin(nMaxTransfers, quazaaSettings.Downloads.MaxTransfersPerFile - m_nTransfers);
+
+	if( nMaxTransfers <= 0 || m_lCompleted.missing() == 0 )
+		return 0;
+
+	int nStarted = 0;
+
+	foreach(CDownloadSource* pSource, m_lSources)
+	{
+		if( nStarted >= nMaxTransfers )
+			break;
+
+		if( pSource->hasTransfer() || !pSource->canAccess() )
+			continue;
+
+		// skip sources known to have nothing we still need
+		Fragments::Fragment oLargest(SIZE_UNKNOWN, SIZE_UNKNOWN);
+		Transfers.m_pSection.lock();
+		Fragments::List oPossible = getPossibleFragments(pSource->m_lAvailableFrags, oLargest);
+		oPossible.erase(pSource->m_lCorruptFrags.begin(), pSource->m_lCorruptFrags.end());
+		const bool bUseful = !oPossible.empty();
+		Transfers.m_pSection.unlock();
+
+		if( !bUseful )
+			continue;
+
+		CDownloadTransfer* pTransfer = qobject_cast<CDownloadTransfer*>(pSource->createTransfer());
+
+		if( !pTransfer )
+			continue;
+
+		if( pTransfer->initiate() )
+		{
+			nStarted++;
+		}
+		else
+		{
+			pSource->m_nFailures++;
+			pSource->m_tNextAccess = time(0) + quazaaSettings.Downloads.RetryDelay / 1000;
+			pSource->closeTransfer();
+		}
+	}
+
+	if( nStarted > 0 && m_nState == dsPending )
+		setState(dsDownloading);
+
+	return nStarted; // must return the number of just started transfers
 }
 
 void CDownload::stopTransfers()
 {
 	ASSUME_LOCK(Downloads.m_pSection);
 
+	foreach(CDownloadSource* pSource, m_lSources)
+	{
+		pSource->closeTransfer();
+	}
+
+	DiskWriter.close(this);
+
+	// pending verifications were dropped with the file
+	m_lVerifying.clear();
+	m_bVerifyCheck = true;
 }
 
 bool CDownload::sourceExists(CDownloadSource *pSource)
@@ -365,17 +510,8 @@ Fragments::List CDownload::getWantedFragments()
 
 Fragments::List CDownload::getPossibleFragments(const Fragments::List &oAvailable, Fragments::Fragment &oLargest)
 {
-	Fragments::List oPossible(oAvailable);
-
-	if( oAvailable.empty() )
-	{
-		oPossible = getWantedFragments();
-	}
-	else
-	{
-		Fragments::List oTmp = inverse(getWantedFragments());
-		oPossible.erase(oTmp.begin(), oTmp.end());
-	}
+	// what the source has and we do not, without building the inverse of m_lCompleted first
+	Fragments::List oPossible = oAvailable.empty() ? getWantedFragments() : subtract(oAvailable, m_lCompleted);
 
 	if( oPossible.empty() )
 		return oPossible;
@@ -399,29 +535,456 @@ Fragments::List CDownload::getPossibleFragments(const Fragments::List &oAvailabl
 	return oPossible;
 }
 
-void CDownload::saveState()
+/**
+  * Hands received data to the disk writer and marks the range completed. Data is written
+  * to the incomplete file in the background, blocks completed by it are queued for verification.
+  * Returns false and puts the download in the file error state if earlier data could not be stored.
+  * Requires Locking: Downloads.m_pSection
+  */
+bool CDownload::writeData(quint64 nOffset, const QByteArray& baData)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	if( nOffset + baData.size() > m_nSize )
+		return false;
+
+	if( !DiskWriter.write(this, quazaaSettings.Downloads.IncompletePath + "/" + m_sTempName, m_nSize, nOffset, baData) )
+	{
+		setState(dsFileError);
+		return false;
+	}
+
+	// journaled by DiskWriter once the data is on disk
+	const Fragments::Fragment oRange(nOffset, nOffset + baData.size());
+	const quint64 nAdded = m_lCompleted.insert(oRange);
+	m_nCompletedSize += nAdded;
+
+	if( m_bEndgame && nAdded > 0 )
+		cancelDuplicates(oRange);
+
+	verifyBlocks(nOffset, nOffset + baData.size());
+	checkCompleted();
+
+	return m_nState != dsFileError;
+}
+
+// Called when a requested fragment is complete, its data should not wait in the cache.
+void CDownload::flushData()
+{
+	DiskWriter.flush(this);
+}
+
+/**
+  * Chooses the next block pTransfer should request, at most nMaxSize bytes, see CChunkSelector.
+  * When everything the source has is requested by other transfers, the download is in its
+  * endgame and the tail of another transfer's range is requested a second time.
+  * Blocks the source has sent corrupt before are never requested from it again.
+  * Requires Locking: Downloads.m_pSection, Transfers.m_pSection
+  */
+bool CDownload::getNextBlock(CDownloadTransfer* pTransfer, quint64 nMaxSize, Fragments::Fragment& oBlock)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+	ASSUME_LOCK(Transfers.m_pSection);
+
+	Fragments::Fragment oLargest(SIZE_UNKNOWN, SIZE_UNKNOWN);
+	CDownloadSource* pSource = pTransfer->source();
+	Fragments::List oPossible = getPossibleFragments(pSource->m_lAvailableFrags, oLargest);
+	oPossible.erase(pSource->m_lCorruptFrags.begin(), pSource->m_lCorruptFrags.end());
+
+	if( oPossible.empty() )
+		return getEndgameBlock(pTransfer, nMaxSize, oBlock);
+
+	if( m_bAvailabilityDirty )
+		updateAvailability();
+
+	return CChunkSelector::nextBlock(oPossible, m_vAvailability, m_nChunkSize, nMaxSize, oBlock);
+}
+
+/**
+  * Picks a block that is already requested by another transfer: the end of the largest
+  * outstanding range available from the source, so both transfers race towards each other.
+  * Requires Locking: Downloads.m_pSection, Transfers.m_pSection
+  */
+bool CDownload::getEndgameBlock(CDownloadTransfer* pTransfer, quint64 nMaxSize, Fragments::Fragment& oBlock)
 {
-	QString sFileName = quazaaSettings.Downloads.IncompletePath + "/" + m_sTempName;
-	QString sFileNameT = sFileName;
+	Fragments::List oWanted = getWantedFragments();
+	const Fragments::List& oAvailable = pTransfer->source()->m_lAvailableFrags;
+
+	if( !oAvailable.empty() )
+	{
+		Fragments::List oTmp = intersect(oWanted, oAvailable);
+		oWanted.swap(oTmp);
+	}
+
+	const Fragments::List& oCorrupt = pTransfer->source()->m_lCorruptFrags;
+	oWanted.erase(oCorrupt.begin(), oCorrupt.end());
+
+	pTransfer->subtractRequested(oWanted);
+
+	if( oWanted.empty() )
+		return false;
+
+	m_bEndgame = true;
 
-	sFileName.append(".!qd");
-	sFileNameT.append(".bak");
+	if( m_bAvailabilityDirty )
+		updateAvailability();
+
+	const Fragments::Fragment oRange = *oWanted.largest_range();
+
+	quint64 nBegin = oRange.end() > nMaxSize ? qMax(oRange.begin(), oRange.end() - nMaxSize) : oRange.begin();
+	nBegin = qMax(nBegin, ((oRange.end() - 1) / m_nChunkSize) * m_nChunkSize);
+
+	oBlock = Fragments::Fragment(nBegin, oRange.end());
+	return true;
+}
+
+/**
+  * In the endgame: asks the transfers that have requested a part of oRange, which has just been
+  * completed, to drop the requests that are not wanted any more. They do so from their own event
+  * loop, so none of them is closed while the caller is still reading.
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownload::cancelDuplicates(const Fragments::Fragment& oRange)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
 
-	QFile f(sFileNameT);
+	QMutexLocker l(&Transfers.m_pSection);
 
-	if( f.open(QFile::WriteOnly) )
+	foreach(CTransfer* pTransfer, getTransfers())
 	{
-		QDataStream s(&f);
+		CDownloadTransfer* pTr = qobject_cast<CDownloadTransfer*>(pTransfer);
 
-		s << *this;
+		if( !pTr )
+			continue;
 
-		f.close();
+		for( Fragments::Queue::const_iterator itRequest = pTr->m_lRequested.begin(); itRequest != pTr->m_lRequested.end(); ++itRequest )
+		{
+			if( itRequest->begin() < oRange.end() && itRequest->end() > oRange.begin() )
+			{
+				QMetaObject::invokeMethod(pTr, "cancelCompleted", Qt::QueuedConnection);
+				break;
+			}
+		}
+	}
+}
 
-		QFile::remove(sFileName);
-		QFile::rename(sFileNameT, sFileName);
+// Called when the ranges a source has to offer are known or have changed.
+void CDownload::sourceRangesChanged()
+{
+	m_bAvailabilityDirty = true;
+}
+
+quint64 CDownload::chunkSize() const
+{
+	if( m_oHashSet.blockCount() > 1 )
+		return m_oHashSet.m_nBlockSize;
 
-		m_bModified = false;
+	foreach(const CHash& oHash, m_lHashes)
+	{
+		if( oHash.getAlgorithm() == CHash::ED2K )
+			return DOWNLOAD_ED2K_PART;
 	}
+
+	quint64 nChunk = 1024;
+	while( m_nSize / nChunk >= DOWNLOAD_TIGER_BLOCKS )
+		nChunk *= 2;
+
+	return nChunk;
+}
+
+// Counts for every chunk how many sources have at least a part of it.
+void CDownload::updateAvailability()
+{
+	m_nChunkSize = chunkSize();
+	m_vAvailability.fill(0, (int)((m_nSize + m_nChunkSize - 1) / m_nChunkSize));
+
+	foreach(CDownloadSource* pSource, m_lSources)
+	{
+		CChunkSelector::addSource(m_vAvailability, pSource->m_lAvailableFrags, m_nChunkSize);
+	}
+
+	m_bAvailabilityDirty = false;
+}
+
+/**
+  * Chooses what completed blocks are verified against when nothing better is known yet:
+  * a whole file hash, checked once the file is complete. A Tiger tree replaces it when one
+  * is received, see setTigerTree().
+  */
+void CDownload::updateHashSet()
+{
+	static const CHash::Algorithm aPreferred[] = { CHash::TIGERTREE, CHash::SHA1, CHash::ED2K, CHash::MD5 };
+
+	for( uint i = 0; i < sizeof(aPreferred) / sizeof(aPreferred[0]); ++i )
+	{
+		foreach(const CHash& oHash, m_lHashes)
+		{
+			if( oHash.getAlgorithm() == aPreferred[i] && m_oHashSet.fromFileHash(oHash, m_nSize) )
+				return;
+		}
+	}
+}
+
+/**
+  * Queues the blocks overlapping nBegin - nEnd that are complete but not verified yet.
+  * Without any hash the completed data in nBegin - nEnd counts as verified.
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownload::verifyBlocks(quint64 nBegin, quint64 nEnd)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	if( nBegin >= nEnd )
+		return;
+
+	if( m_oHashSet.isEmpty() )
+		updateHashSet();
+
+	if( m_oHashSet.isEmpty() )
+	{
+		const Fragments::Fragment oRange(nBegin, nEnd);
+		Fragments::List::const_iterator_pair oCompleted = m_lCompleted.equal_range(oRange);
+
+		for( ; oCompleted.first != oCompleted.second; ++oCompleted.first )
+			m_lVerified.insert(Fragments::Fragment(qMax(oCompleted.first->begin(), oRange.begin()),
+												   qMin(oCompleted.first->end(), oRange.end())));
+		return;
+	}
+
+	const QString sPath = quazaaSettings.Downloads.IncompletePath + "/" + m_sTempName;
+	const quint64 nBlockSize = m_oHashSet.m_nBlockSize;
+
+	for( quint64 nBlock = nBegin / nBlockSize; nBlock * nBlockSize < nEnd; ++nBlock )
+	{
+		const Fragments::Fragment oBlock(nBlock * nBlockSize, qMin(m_nSize, (nBlock + 1) * nBlockSize));
+
+		if( m_lVerifying.contains(nBlock)
+			|| m_lCompleted.overlapping_sum(oBlock) < oBlock.size()
+			|| m_lVerified.overlapping_sum(oBlock) == oBlock.size() )
+			continue;
+
+		m_lVerifying.insert(nBlock);
+		DiskWriter.verify(this, sPath, m_nSize, oBlock.begin(), oBlock.size(), m_oHashSet.m_nAlgorithm, m_oHashSet.blockHash(nBlock));
+	}
+}
+
+// The download is finished once every byte is both completed and verified.
+void CDownload::checkCompleted()
+{
+	if( m_lCompleted.missing() != 0 || m_nState == dsCompleted || m_nState == dsFileError )
+		return;
+
+	if( m_lVerified.missing() != 0 )
+	{
+		if( m_nState != dsVerifying )
+			setState(dsVerifying);
+
+		return;
+	}
+
+	if( !DiskWriter.close(this) )
+	{
+		setState(dsFileError);
+		return;
+	}
+
+	systemLog.postLog(LogSeverity::Notice, QString(tr("Download completed: %1")).arg(m_sDisplayName));
+	setState(dsCompleted);
+}
+
+// True if a Tiger tree of the file would let blocks be verified before the file is complete.
+bool CDownload::needsTigerTree() const
+{
+	if( m_nSize <= CTigerTree::LeafSize || (m_oHashSet.m_nAlgorithm == CHash::TIGERTREE && m_oHashSet.blockCount() > 1) )
+		return false;
+
+	foreach(const CHash& oHash, m_lHashes)
+	{
+		if( oHash.getAlgorithm() == CHash::TIGERTREE )
+			return true;
+	}
+
+	return false;
+}
+
+/**
+  * Takes the THEX tree baTree, a DIME message as served by a source, checks it against the
+  * tiger tree root of the file and verifies blocks against it from now on.
+  * Returns false if the tree does not match or is no better than the hashes already known.
+  * Requires Locking: Downloads.m_pSection
+  */
+bool CDownload::setTigerTree(const QByteArray& baTree)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	const QByteArray baNodes = CHashSet::readDIME(baTree, "breadthfirst");
+
+	foreach(const CHash& oHash, m_lHashes)
+	{
+		if( oHash.getAlgorithm() != CHash::TIGERTREE )
+			continue;
+
+		CHashSet oHashSet;
+		if( !oHashSet.fromTigerTree(baNodes, oHash, m_nSize, DOWNLOAD_TIGER_BLOCKS)
+			|| oHashSet.blockCount() <= m_oHashSet.blockCount() )
+			continue;
+
+		m_oHashSet = oHashSet;
+		m_bAvailabilityDirty = true;
+		m_bVerifyCheck = true;
+
+		// results for the old blocks are ignored when they arrive
+		m_lVerifying.clear();
+
+		systemLog.postLog(LogSeverity::Debug, QString("Got tiger tree for %1, verifying %2 blocks").arg(m_sDisplayName).arg(m_oHashSet.blockCount()));
+		return true;
+	}
+
+	return false;
+}
+
+/**
+  * Queues completed blocks that are not verified yet, after the download was loaded,
+  * restarted or got a new hash set. Called periodically by Downloads.
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownload::checkVerification()
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	if( !m_bVerifyCheck )
+		return;
+
+	m_bVerifyCheck = false;
+
+	verifyBlocks(0, m_nSize);
+	checkCompleted();
+}
+
+/**
+  * Result of a block verification queued by verifyBlocks(). A matching block is marked verified.
+  * A corrupt one is downloaded again, and the sources that sent it are blamed: a single
+  * sender is dropped at once, several senders after repeated corrupt blocks. While other sources
+  * can still deliver the block, it is not requested from any of its senders again, so a bad
+  * source among them cannot corrupt it a second time.
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownload::onBlockVerified(quint64 nOffset, quint64 nLength, bool bMatch)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	const quint64 nBlockSize = m_oHashSet.m_nBlockSize;
+
+	if( nBlockSize == 0 || nOffset % nBlockSize != 0 || nLength != qMin(nBlockSize, m_nSize - nOffset) )
+	{
+		// verified against a hash set that was replaced since
+		m_bVerifyCheck = true;
+		return;
+	}
+
+	if( !m_lVerifying.remove(nOffset / nBlockSize) )
+		return;
+
+	const Fragments::Fragment oBlock(nOffset, nOffset + nLength);
+
+	if( m_lCompleted.overlapping_sum(oBlock) < nLength )
+		return;
+
+	const QString sPath = quazaaSettings.Downloads.IncompletePath + "/" + m_sTempName;
+
+	if( bMatch )
+	{
+		m_lVerified.insert(oBlock);
+		DiskWriter.journal(this, sPath, m_nSize, CDownloadJournal::jrVerified, oBlock.begin(), oBlock.end());
+		checkCompleted();
+		return;
+	}
+
+	systemLog.postLog(LogSeverity::Warning, QString(tr("Corrupt data in %1 at %2 - %3, downloading it again")).arg(m_sDisplayName).arg(nOffset).arg(nOffset + nLength));
+
+	m_nCompletedSize -= m_lCompleted.erase(oBlock);
+	DiskWriter.journal(this, sPath, m_nSize, CDownloadJournal::jrErased, oBlock.begin(), oBlock.end());
+
+	QList<CDownloadSource*> lSenders;
+	foreach(CDownloadSource* pSource, m_lSources)
+	{
+		if( pSource->m_lDownloadedFrags.overlapping_sum(oBlock) > 0 )
+		{
+			pSource->m_lDownloadedFrags.erase(oBlock);
+			lSenders.append(pSource);
+		}
+	}
+
+	// only exclude the senders if someone else is left to download the block from
+	if( lSenders.size() < m_lSources.size() )
+	{
+		foreach(CDownloadSource* pSource, lSenders)
+		{
+			pSource->m_lCorruptFrags.insert(oBlock);
+		}
+	}
+
+	foreach(CDownloadSource* pSource, lSenders)
+	{
+		pSource->m_nCorrupted += (lSenders.size() == 1) ? DOWNLOAD_SOURCE_CORRUPT_MAX : 1;
+
+		if( pSource->m_nCorrupted >= DOWNLOAD_SOURCE_CORRUPT_MAX && pSource->hasTransfer() )
+		{
+			systemLog.postLog(LogSeverity::Notice, QString(tr("Dropping source %1 of %2, it sent corrupt data")).arg(pSource->m_oAddress.toStringWithPort()).arg(m_sDisplayName));
+			pSource->closeTransfer();
+		}
+	}
+
+	if( m_nState == dsVerifying )
+		setState(dsDownloading);
+}
+
+/**
+  * Queues the full state of the download to be written to its .!qd file by DiskWriter, which
+  * syncs the data the state counts as completed first and then starts the journal over. Does
+  * not wait for the disk; a failed save is retried, see CDownloads::onStateSaved(). Called when
+  * the download changed other than by fragments, and to compact the journal.
+  * Requires Locking: Downloads
+  */
+void CDownload::saveState()
+{
+	QByteArray baState;
+	QDataStream s(&baState, QIODevice::WriteOnly);
+
+	s << *this;
+
+	DiskWriter.saveState(this, quazaaSettings.Downloads.IncompletePath + "/" + m_sTempName, m_nSize, baState);
+
+	m_bModified = false;
+}
+
+/**
+  * Applies the journal written since the last saveState() to the state just loaded.
+  * Returns true if there was one, it should be folded into the state then.
+  */
+bool CDownload::loadJournal()
+{
+	const QString sJournal = CDownloadJournal::path(quazaaSettings.Downloads.IncompletePath + "/" + m_sTempName);
+
+	if( !QFile::exists(sJournal) )
+		return false;
+
+	if( !CDownloadJournal::replay(sJournal, m_nSize, m_lCompleted, m_lVerified) )
+	{
+		systemLog.postLog(LogSeverity::Warning, QString("Ignoring download journal %1, it belongs to another file").arg(sJournal));
+		return false;
+	}
+
+	m_nCompletedSize = m_lCompleted.length_sum();
+	m_bVerifyCheck = true;
+
+	return true;
+}
+
+// Whether saveState() is due: something besides fragments changed, or the journal is long enough.
+bool CDownload::needsSave()
+{
+	return m_bModified || DiskWriter.journalLength(this) > DOWNLOAD_JOURNAL_COMPACT;
 }
 
 void CDownload::setState(CDownload::DownloadState state)
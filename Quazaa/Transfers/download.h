@@ -4,8 +4,15 @@
 #include "types.h"
 #include "FileFragments.hpp"
 #include "Hashes/hash.h"
+#include "Hashes/hashset.h"
+#include "transferstats.h"
+#include "sourcestore.h"
+
+#include <QSet>
+#include <QVector>
 
 class CDownloadSource;
+class CDownloadTransfer;
 class CQueryHit;
 class CTransfer;
 
@@ -41,25 +48,40 @@ public:
 	quint64					m_nSize;
 	quint64					m_nCompletedSize;
 	DownloadState			m_nState;
-	QList<CDownloadSource*> m_lSources;
+	QList<CDownloadSource*> m_lSources;	// active sources, at most Downloads.SourcesWanted
+	CSourceStore			m_oSourceStore;	// every known source, candidates are promoted to m_lSources
 	bool					m_bMultifile;
 	QList<FileListItem>		m_lFiles;	// for multifile downloads
 	Fragments::List			m_lCompleted;
 	Fragments::List			m_lVerified;
 	Fragments::List			m_lActive;
 	QList<CHash>			m_lHashes; // hashes for whole download
+	CHashSet				m_oHashSet; // hashes completed blocks are verified against
+	CTransferStats			m_oStats;	// receive telemetry over all sources
 
 	bool					m_bSignalSources;
 	quint8					m_nPriority; // 255: highest priority; 1: lowest priority; 0: temporary disabled
 	bool					m_bModified;
 	int						m_nTransfers;
 	QDateTime				m_tStarted;
+
+protected:
+	quint64					m_nChunkSize;		// scheduling unit, a hash chunk of the file
+	QVector<quint16>		m_vAvailability;	// number of sources having each chunk
+	bool					m_bAvailabilityDirty;
+	bool					m_bEndgame;			// ranges have been requested from more than one transfer
+	QSet<quint32>			m_lVerifying;		// blocks queued for verification
+	bool					m_bVerifyCheck;		// look for completed blocks not yet verified
+	QSet<QUuid>				m_lSourceGUIDs;		// GUIDs of m_lSources, to spot the same client twice
+
 public:
 	CDownload()
 		: m_lCompleted(0),
 		  m_lVerified(0),
 		  m_lActive(0),
-		  m_bSignalSources(false), m_bModified(false),m_nTransfers(0)
+		  m_bSignalSources(false), m_bModified(false),m_nTransfers(0),
+		  m_nChunkSize(0), m_bAvailabilityDirty(true), m_bEndgame(false),
+		  m_bVerifyCheck(true)
 	{}
 	CDownload(CQueryHit* pHit, QObject *parent = 0);
 	~CDownload();
@@ -70,6 +92,7 @@ public:
 	bool addSource(CDownloadSource* pSource);
 	int  addSource(CQueryHit* pHit);
 	void removeSource(CDownloadSource* pSource);
+	void manageSources();
 	int  startTransfers(int nMaxTransfers = -1);
 	void stopTransfers();
 	bool sourceExists(CDownloadSource* pSource);
@@ -78,8 +101,20 @@ public:
 
 	Fragments::List getPossibleFragments(const Fragments::List& oAvailable, Fragments::Fragment& oLargest);
 	Fragments::List getWantedFragments();
+	bool getNextBlock(CDownloadTransfer* pTransfer, quint64 nMaxSize, Fragments::Fragment& oBlock);
+	void sourceRangesChanged();
+
+	bool writeData(quint64 nOffset, const QByteArray& baData);
+	void flushData();
+
+	bool needsTigerTree() const;
+	bool setTigerTree(const QByteArray& baTree);
+	void checkVerification();
+	void onBlockVerified(quint64 nOffset, quint64 nLength, bool bMatch);
 
 	void saveState();
+	bool loadJournal();
+	bool needsSave();
 public:
 	inline bool isModified();
 	inline bool isCompleted();
@@ -89,6 +124,13 @@ public:
 	inline bool canDownload();
 protected:
 	void setState(CDownload::DownloadState state);
+	quint64 chunkSize() const;
+	void updateAvailability();
+	bool getEndgameBlock(CDownloadTransfer* pTransfer, quint64 nMaxSize, Fragments::Fragment& oBlock);
+	void updateHashSet();
+	void verifyBlocks(quint64 nBegin, quint64 nEnd);
+	void checkCompleted();
+	void cancelDuplicates(const Fragments::Fragment& oRange);
 signals:
 	void sourceAdded(CDownloadSource*);
 	void stateChanged(int);
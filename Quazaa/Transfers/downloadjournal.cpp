@@ -0,0 +1,237 @@
+/*
+** downloadjournal.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "downloadjournal.h"
+#include "diskwriter.h"
+
+#include <QFile>
+#include <QtEndian>
+
+#include "systemlog.h"
+#include "zlib.h"
+
+#include "debug_new.h"
+
+static const quint16 DOWNLOAD_JOURNAL_MAGIC = 0x4A51; // "QJ"
+
+// Record layout, little endian: magic 16, type 16, begin 64, end 64, CRC-32 of the above 32.
+
+static quint32 recordChecksum(const char* pData)
+{
+	return crc32(crc32(0L, Z_NULL, 0), (const Bytef*)pData, 20);
+}
+
+CDownloadJournal::CDownloadJournal(const QString& sPath, quint64 nFileSize) :
+	m_sPath(sPath),
+	m_nFileSize(nFileSize),
+	m_pFile(0),
+	m_nLength(0)
+{
+}
+
+CDownloadJournal::~CDownloadJournal()
+{
+	delete m_pFile;
+}
+
+/**
+  * Appends the encoded records baRecords and syncs the journal to disk.
+  * A failed write is overwritten by the next one.
+  */
+bool CDownloadJournal::write(const QByteArray& baRecords)
+{
+	if( baRecords.isEmpty() )
+		return true;
+
+	if( !open() )
+		return false;
+
+	if( !m_pFile->seek(m_nLength) || m_pFile->write(baRecords) != baRecords.size() || !CDiskWriter::syncFile(m_pFile) )
+	{
+		systemLog.postLog(LogSeverity::Error, QString("Cannot write download journal %1: %2").arg(m_sPath).arg(m_pFile->errorString()));
+		return false;
+	}
+
+	m_nLength += baRecords.size();
+	return true;
+}
+
+// Starts the journal over, after the state it describes has been saved in the snapshot.
+bool CDownloadJournal::reset()
+{
+	if( !m_pFile && !open() )
+		return false;
+
+	const QByteArray baHeader = record(jrHeader, m_nFileSize, DOWNLOAD_JOURNAL_VERSION);
+
+	m_nLength = 0;
+
+	if( !m_pFile->resize(0) || !m_pFile->seek(0) || m_pFile->write(baHeader) != baHeader.size() || !CDiskWriter::syncFile(m_pFile) )
+	{
+		systemLog.postLog(LogSeverity::Error, QString("Cannot reset download journal %1: %2").arg(m_sPath).arg(m_pFile->errorString()));
+		return false;
+	}
+
+	m_nLength = baHeader.size();
+	return true;
+}
+
+// The journal of the incomplete file sFile.
+QString CDownloadJournal::path(const QString& sFile)
+{
+	return sFile + ".!qj";
+}
+
+QByteArray CDownloadJournal::record(RecordType nType, quint64 nBegin, quint64 nEnd)
+{
+	QByteArray baRecord(DOWNLOAD_JOURNAL_RECORD, 0);
+	uchar* pData = (uchar*)baRecord.data();
+
+	qToLittleEndian<quint16>(DOWNLOAD_JOURNAL_MAGIC, pData);
+	qToLittleEndian<quint16>(nType, pData + 2);
+	qToLittleEndian<quint64>(nBegin, pData + 4);
+	qToLittleEndian<quint64>(nEnd, pData + 12);
+	qToLittleEndian<quint32>(recordChecksum(baRecord.constData()), pData + 20);
+
+	return baRecord;
+}
+
+/**
+  * Applies the journal sPath of a file of nFileSize bytes to the fragments loaded from the
+  * snapshot. Stops at the first damaged record. Returns false if there is a journal, but it
+  * belongs to a different file.
+  */
+bool CDownloadJournal::replay(const QString& sPath, quint64 nFileSize, Fragments::List& lCompleted, Fragments::List& lVerified)
+{
+	QFile oFile(sPath);
+
+	if( !oFile.exists() )
+		return true;
+
+	if( !oFile.open(QFile::ReadOnly) )
+		return false;
+
+	const QByteArray baJournal = oFile.readAll();
+	const char* pData = baJournal.constData();
+
+	quint32 nType = 0;
+	quint64 nBegin = 0, nEnd = 0;
+
+	if( baJournal.size() < DOWNLOAD_JOURNAL_RECORD || !readRecord(pData, nType, nBegin, nEnd) )
+		return true; // torn before the header was complete, nothing to replay
+
+	if( nType != jrHeader || nBegin != nFileSize || nEnd != DOWNLOAD_JOURNAL_VERSION )
+		return false;
+
+	for( int nPos = DOWNLOAD_JOURNAL_RECORD; nPos + DOWNLOAD_JOURNAL_RECORD <= baJournal.size(); nPos += DOWNLOAD_JOURNAL_RECORD )
+	{
+		if( !readRecord(pData + nPos, nType, nBegin, nEnd) )
+			break;
+
+		if( nBegin >= nEnd || nEnd > nFileSize )
+			continue;
+
+		const Fragments::Fragment oRange(nBegin, nEnd);
+
+		switch( nType )
+		{
+			case jrCompleted:
+				lCompleted.insert(oRange);
+				break;
+			case jrVerified:
+				lVerified.insert(oRange);
+				break;
+			case jrErased:
+				lCompleted.erase(oRange);
+				lVerified.erase(oRange);
+				break;
+		}
+	}
+
+	// a verified record may have reached the disk before the completion it follows
+	Fragments::List oVerified = intersect(lVerified, lCompleted);
+	lVerified.swap(oVerified);
+
+	return true;
+}
+
+/**
+  * Opens the journal and keeps the valid records of an earlier run. A torn record at the end is
+  * cut off, a journal of another file is started over.
+  */
+bool CDownloadJournal::open()
+{
+	if( m_pFile )
+		return true;
+
+	QFile* pFile = new QFile(m_sPath);
+
+	if( !pFile->open(QFile::ReadWrite | QFile::Unbuffered) )
+	{
+		systemLog.postLog(LogSeverity::Error, QString("Cannot open download journal %1: %2").arg(m_sPath).arg(pFile->errorString()));
+		delete pFile;
+		return false;
+	}
+
+	const QByteArray baJournal = pFile->readAll();
+	qint64 nValid = 0;
+	quint32 nType = 0;
+	quint64 nBegin = 0, nEnd = 0;
+
+	while( nValid + DOWNLOAD_JOURNAL_RECORD <= baJournal.size() && readRecord(baJournal.constData() + nValid, nType, nBegin, nEnd) )
+	{
+		if( nValid == 0 && (nType != jrHeader || nBegin != m_nFileSize || nEnd != DOWNLOAD_JOURNAL_VERSION) )
+			break;
+
+		nValid += DOWNLOAD_JOURNAL_RECORD;
+	}
+
+	m_pFile = pFile;
+
+	if( nValid == 0 )
+		return reset();
+
+	m_nLength = nValid;
+
+	// new records overwrite the damaged part anyway, a failed resize is not fatal
+	if( nValid < pFile->size() && !pFile->resize(nValid) )
+		systemLog.postLog(LogSeverity::Warning, QString("Cannot repair download journal %1: %2").arg(m_sPath).arg(pFile->errorString()));
+
+	return true;
+}
+
+bool CDownloadJournal::readRecord(const char* pData, quint32& nType, quint64& nBegin, quint64& nEnd)
+{
+	const uchar* pRecord = (const uchar*)pData;
+
+	if( qFromLittleEndian<quint16>(pRecord) != DOWNLOAD_JOURNAL_MAGIC
+		|| qFromLittleEndian<quint32>(pRecord + 20) != recordChecksum(pData) )
+		return false;
+
+	nType = qFromLittleEndian<quint16>(pRecord + 2);
+	nBegin = qFromLittleEndian<quint64>(pRecord + 4);
+	nEnd = qFromLittleEndian<quint64>(pRecord + 12);
+
+	return true;
+}
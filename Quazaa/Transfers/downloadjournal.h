@@ -0,0 +1,88 @@
+/*
+** downloadjournal.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef DOWNLOADJOURNAL_H
+#define DOWNLOADJOURNAL_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "FileFragments.hpp"
+
+class QFile;
+
+#define DOWNLOAD_JOURNAL_RECORD		24		// bytes per record
+#define DOWNLOAD_JOURNAL_VERSION	2
+#define DOWNLOAD_JOURNAL_COMPACT	65536	// journal length at which the download state is rewritten
+
+/**
+ * @brief CDownloadJournal is the append-only log of the fragment changes of a download, kept next
+ * to its .!qd state file. The state file is the snapshot, the journal the changes since: ranges
+ * whose data is on disk, ranges that matched their hash and ranges found corrupt. Loading replays
+ * the journal on top of the snapshot; once it grows past DOWNLOAD_JOURNAL_COMPACT the snapshot is
+ * rewritten and the journal started over.
+ * Records have a fixed size and a CRC-32, so a record torn by a crash ends the replay instead of
+ * corrupting it. Replaying records that are in the snapshot already changes nothing.
+ * The journal is written by DiskWriter, only after the data a record describes is synced.
+ */
+class CDownloadJournal
+{
+public:
+	enum RecordType
+	{
+		jrHeader = 1,	// begin: file size, end: version
+		jrCompleted,	// the data of begin - end is on disk
+		jrVerified,		// begin - end matched its hash
+		jrErased		// begin - end was corrupt and is downloaded again
+	};
+
+protected:
+	QString	m_sPath;
+	quint64	m_nFileSize;
+	QFile*	m_pFile;
+	qint64	m_nLength;	// bytes of valid records
+
+public:
+	CDownloadJournal(const QString& sPath, quint64 nFileSize);
+	~CDownloadJournal();
+
+	bool write(const QByteArray& baRecords);
+	bool reset();
+	inline qint64 length() const;
+
+	static QString path(const QString& sFile);
+	static QByteArray record(RecordType nType, quint64 nBegin, quint64 nEnd);
+	static bool replay(const QString& sPath, quint64 nFileSize, Fragments::List& lCompleted, Fragments::List& lVerified);
+
+protected:
+	bool open();
+	static bool readRecord(const char* pData, quint32& nType, quint64& nBegin, quint64& nEnd);
+};
+
+qint64 CDownloadJournal::length() const
+{
+	return m_nLength;
+}
+
+#endif // DOWNLOADJOURNAL_H
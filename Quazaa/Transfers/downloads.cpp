@@ -31,13 +31,17 @@
 
 #include <QDir>
 #include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QDateTime>
 
 #include "debug_new.h"
 
 CDownloads Downloads;
 
 CDownloads::CDownloads(QObject *parent) :
-	QObject(parent)
+	QObject(parent),
+	m_tStatsDump(0)
 {
 	qRegisterMetaType<CDownload*>("CDownload*");
 	qRegisterMetaType<CDownloadSource*>("CDownloadSource*");
@@ -63,6 +67,135 @@ bool CDownloads::exists(CDownload *pDownload)
 	return (m_lDownloads.indexOf(pDownload) != -1);
 }
 
+/**
+  * Returns the telemetry of the remote host oAddress, shared by all downloads it is a source for.
+  * Creates it if needed, dropping the host that has been idle the longest if there are too many.
+  * Requires Locking: Downloads
+  */
+CTransferStats& CDownloads::hostStats(const QHostAddress& oAddress)
+{
+	ASSUME_LOCK( Downloads.m_pSection );
+
+	QHash<QHostAddress, CTransferStats>::iterator itHost = m_lHostStats.find(oAddress);
+
+	if( itHost != m_lHostStats.end() )
+		return itHost.value();
+
+	if( m_lHostStats.size() >= DOWNLOADS_HOST_STATS_MAX )
+	{
+		QHash<QHostAddress, CTransferStats>::iterator itOldest = m_lHostStats.begin();
+
+		for( QHash<QHostAddress, CTransferStats>::iterator it = m_lHostStats.begin(); it != m_lHostStats.end(); ++it )
+		{
+			if( it.value().m_tLast < itOldest.value().m_tLast )
+				itOldest = it;
+		}
+
+		m_lHostStats.erase(itOldest);
+	}
+
+	return m_lHostStats[oAddress];
+}
+
+/**
+  * Copies the telemetry of all downloads, their sources and the remote hosts, to be dumped once
+  * the lock is released.
+  * Requires Locking: Downloads
+  */
+CDownloadsStats CDownloads::statsSnapshot()
+{
+	ASSUME_LOCK( Downloads.m_pSection );
+
+	CDownloadsStats oStats;
+	oStats.tNow = CTransferStats::now();
+
+	foreach( CDownload* pDownload, m_lDownloads )
+	{
+		CDownloadStats oDownload;
+		oDownload.sName = pDownload->m_sDisplayName;
+		oDownload.nSize = pDownload->m_nSize;
+		oDownload.nCompleted = pDownload->m_nCompletedSize;
+		oDownload.oStats = pDownload->m_oStats;
+
+		foreach( CDownloadSource* pSource, pDownload->m_lSources )
+		{
+			CAddressStats oSource;
+			oSource.sAddress = pSource->m_oAddress.toStringWithPort();
+			oSource.oStats = pSource->m_oStats;
+			oDownload.lSources.append(oSource);
+		}
+
+		oStats.lDownloads.append(oDownload);
+	}
+
+	for( QHash<QHostAddress, CTransferStats>::const_iterator it = m_lHostStats.constBegin(); it != m_lHostStats.constEnd(); ++it )
+	{
+		CAddressStats oHost;
+		oHost.sAddress = it.key().toString();
+		oHost.oStats = it.value();
+		oStats.lHosts.append(oHost);
+	}
+
+	return oStats;
+}
+
+/**
+  * Returns a snapshot taken by statsSnapshot() as JSON. Needs no lock.
+  */
+QByteArray CDownloads::statsDump(const CDownloadsStats& oStats)
+{
+	QJsonArray lDownloads;
+
+	foreach( const CDownloadStats& oDl, oStats.lDownloads )
+	{
+		QJsonArray lSources;
+
+		foreach( const CAddressStats& oSrc, oDl.lSources )
+		{
+			QJsonObject oSource = oSrc.oStats.toJson(oStats.tNow);
+			oSource.insert("address", oSrc.sAddress);
+			lSources.append(oSource);
+		}
+
+		QJsonObject oDownload = oDl.oStats.toJson(oStats.tNow);
+		oDownload.insert("name", oDl.sName);
+		oDownload.insert("size", double(oDl.nSize));
+		oDownload.insert("completed", double(oDl.nCompleted));
+		oDownload.insert("sources", lSources);
+		lDownloads.append(oDownload);
+	}
+
+	QJsonArray lHosts;
+
+	foreach( const CAddressStats& oHst, oStats.lHosts )
+	{
+		QJsonObject oHost = oHst.oStats.toJson(oStats.tNow);
+		oHost.insert("address", oHst.sAddress);
+		lHosts.append(oHost);
+	}
+
+	QJsonObject oRoot;
+	oRoot.insert("time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+	oRoot.insert("downloads", lDownloads);
+	oRoot.insert("hosts", lHosts);
+
+	return QJsonDocument(oRoot).toJson();
+}
+
+/**
+  * Writes statsDump() of a snapshot to downloadstats.json in the incomplete folder, for offline
+  * analysis. Needs no lock.
+  */
+bool CDownloads::writeStats(const CDownloadsStats& oStats)
+{
+	QFile file(quazaaSettings.Downloads.IncompletePath + "/downloadstats.json");
+
+	if( !file.open(QFile::WriteOnly | QFile::Truncate) )
+		return false;
+
+	return file.write(statsDump(oStats)) != -1;
+}
+
 void CDownloads::start()
 {
 	QMutexLocker l(&m_pSection);
@@ -74,6 +207,16 @@ void CDownloads::start()
 
 	if( d.isReadable() )
 	{
+		// a crash between removing the old state and renaming the new one leaves only the .bak
+		foreach(QString f, d.entryList(QStringList() << "*.bak"))
+		{
+			const QString sBackup = quazaaSettings.Downloads.IncompletePath + "/" + f;
+			const QString sState = sBackup.left(sBackup.length() - 4) + ".!qd";
+
+			if( !QFile::exists(sState) )
+				QFile::rename(sBackup, sState);
+		}
+
 		QStringList files = d.entryList(QStringList() << "*.!qd");
 
 		foreach(QString f, files)
@@ -86,6 +229,11 @@ void CDownloads::start()
 				QDataStream stream(&file);
 
 				stream >> *pDownload;
+				file.close();
+
+				// fold the progress journaled since the state was saved into it
+				if( pDownload->loadJournal() )
+					pDownload->saveState();
 
 				pDownload->moveToThread(&TransfersThread);
 				m_lDownloads.append(pDownload);
@@ -102,12 +250,19 @@ void CDownloads::stop()
 {
 	QMutexLocker l(&m_pSection);
 
+	if( !m_lDownloads.isEmpty() )
+	{
+		const CDownloadsStats oStats = statsSnapshot();
+
+		l.unlock();
+		writeStats(oStats);
+		l.relock();
+	}
+
 	foreach( CDownload* pDownload, m_lDownloads )
 	{
-		if( pDownload->isModified() )
-		{
-			pDownload->saveState();
-		}
+		// leaves the state complete and the journal empty
+		pDownload->saveState();
 
 		delete pDownload;
 	}
@@ -132,6 +287,17 @@ void CDownloads::onTimer()
 
 	QMutexLocker l(&m_pSection);
 
+	if( ++m_tStatsDump >= DOWNLOADS_STATS_INTERVAL )
+	{
+		m_tStatsDump = 0;
+
+		const CDownloadsStats oStats = statsSnapshot();
+
+		l.unlock();
+		writeStats(oStats);
+		l.relock();
+	}
+
 	int nActive = 0, nQueued = 0, nTransfers = 0;
 
 	foreach(CDownload* pDownload, m_lDownloads)
@@ -183,6 +349,21 @@ void CDownloads::onTimer()
 			}
 		}
 
+		if( pDownload->canDownload() || pDownload->m_nState == CDownload::dsVerifying )
+		{
+			pDownload->checkVerification();
+		}
+
+		if( pDownload->canDownload() )
+		{
+			pDownload->manageSources();
+		}
+
+		if( pDownload->needsSave() )
+		{
+			pDownload->saveState();
+		}
+
 		if( pDownload->canDownload() && nTransfersLeft > 0 )
 		{
 			int nAllow = qMin(3, (nTransfersLeft / (nActive + 1)));
@@ -191,3 +372,42 @@ void CDownloads::onTimer()
 	}
 }
 
+/**
+  * Delivers the result of a block verification done by DiskWriter to the download it belongs to,
+  * unless the download was removed in the meantime.
+  */
+void CDownloads::onVerified(void* pOwner, quint64 nOffset, quint64 nLength, bool bMatch)
+{
+	QMutexLocker l(&m_pSection);
+
+	foreach(CDownload* pDownload, m_lDownloads)
+	{
+		if( pDownload == pOwner )
+		{
+			pDownload->onBlockVerified(nOffset, nLength, bMatch);
+			break;
+		}
+	}
+}
+
+/**
+  * Marks a download whose state DiskWriter could not save as modified, so the next timer tick
+  * saves it again.
+  */
+void CDownloads::onStateSaved(void* pOwner, bool bOK)
+{
+	if( bOK )
+		return;
+
+	QMutexLocker l(&m_pSection);
+
+	foreach(CDownload* pDownload, m_lDownloads)
+	{
+		if( pDownload == pOwner )
+		{
+			pDownload->m_bModified = true;
+			break;
+		}
+	}
+}
+
@@ -3,10 +3,40 @@
 
 #include <QObject>
 #include <QMutex>
+#include <QHash>
+#include <QHostAddress>
+
+#include "transferstats.h"
+
+#define DOWNLOADS_HOST_STATS_MAX	1024	// remote hosts telemetry is kept for
+#define DOWNLOADS_STATS_INTERVAL	60		// seconds between stats dumps
 
 class CQueryHit;
 class CDownload;
 
+struct CAddressStats
+{
+	QString			sAddress;
+	CTransferStats	oStats;
+};
+
+struct CDownloadStats
+{
+	QString			sName;
+	quint64			nSize;
+	quint64			nCompleted;
+	CTransferStats	oStats;
+	QList<CAddressStats> lSources;
+};
+
+// Copy of the telemetry of all downloads, so it can be written out without holding the lock.
+struct CDownloadsStats
+{
+	qint64			tNow;
+	QList<CDownloadStats> lDownloads;
+	QList<CAddressStats> lHosts;
+};
+
 class CDownloads : public QObject
 {
 	Q_OBJECT
@@ -14,6 +44,9 @@ public:
 	QMutex m_pSection;
 
 	QList<CDownload*> m_lDownloads;
+protected:
+	QHash<QHostAddress, CTransferStats> m_lHostStats;	// telemetry by source IP, over all downloads
+	quint32 m_tStatsDump;
 public:
 	CDownloads(QObject *parent = 0);
 
@@ -23,12 +56,19 @@ public:
 	void add(CQueryHit* pHit);
 
 	bool exists(CDownload* pDownload);
+
+	CTransferStats& hostStats(const QHostAddress& oAddress);
+	CDownloadsStats statsSnapshot();
+	static QByteArray statsDump(const CDownloadsStats& oStats);
+	static bool writeStats(const CDownloadsStats& oStats);
 signals:
 	void downloadAdded(CDownload*);
 	void downloadRemoved();
 public slots:
 	void emitDownloads();
 	void onTimer();
+	void onVerified(void* pOwner, quint64 nOffset, quint64 nLength, bool bMatch);
+	void onStateSaved(void* pOwner, bool bOK);
 };
 
 extern CDownloads Downloads;
@@ -27,7 +27,8 @@
 #include "downloads.h"
 #include "download.h"
 
-#include "transfer.h"
+#include "transfers.h"
+#include "downloadtransferhttp.h"
 
 #include "debug_new.h"
 
@@ -35,10 +36,12 @@ CDownloadSource::CDownloadSource(CDownload *pDownload, QObject *parent)
 	: QObject(parent),
 	  m_bPush(false),
 	  m_nFailures(0),
+	  m_nCorrupted(0),
 	  m_pDownload(pDownload),
 	  m_pTransfer(0),
 	  m_lAvailableFrags(pDownload->m_nSize),
-	  m_lDownloadedFrags(pDownload->m_nSize)
+	  m_lDownloadedFrags(pDownload->m_nSize),
+	  m_lCorruptFrags(pDownload->m_nSize)
 {
 	m_tNextAccess = time(0);
 }
@@ -48,7 +51,8 @@ CDownloadSource::CDownloadSource(CDownload *pDownload, CQueryHit *pHit, QObject
 	  m_pDownload(pDownload),
 	  m_pTransfer(0),
 	  m_lAvailableFrags(pDownload->m_nSize),
-	  m_lDownloadedFrags(pDownload->m_nSize)
+	  m_lDownloadedFrags(pDownload->m_nSize),
+	  m_lCorruptFrags(pDownload->m_nSize)
 {
 	m_oAddress = pHit->m_pHitInfo->m_oNodeAddress;
     m_bPush = false; // TODO: Push requests.
@@ -59,6 +63,7 @@ CDownloadSource::CDownloadSource(CDownload *pDownload, CQueryHit *pHit, QObject
 	m_lHashes << pHit->m_lHashes;
 	m_tNextAccess = time(0);
 	m_nFailures = 0;
+	m_nCorrupted = 0;
 	m_sURL = pHit->m_sURL;
 }
 
@@ -74,9 +79,15 @@ CTransfer *CDownloadSource::createTransfer()
 
 	CTransfer* pTransfer = 0;
 
+	if( m_pTransfer )
+		return m_pTransfer;
+
+	QMutexLocker l(&Transfers.m_pSection);
+
 	switch(m_nProtocol)
 	{
 		case tpHTTP:
+			pTransfer = new CDownloadTransferHTTP(m_pDownload, this);
 			break;
 		case tpBitTorrent:
 			break;
@@ -85,7 +96,11 @@ CTransfer *CDownloadSource::createTransfer()
 	}
 
 	if( pTransfer )
+	{
+		pTransfer->moveToThread(&TransfersThread);
+		m_pTransfer = pTransfer;
 		emit transferCreated();
+	}
 
 	return pTransfer;
 }
@@ -96,6 +111,7 @@ void CDownloadSource::closeTransfer()
 
 	if( m_pTransfer )
 	{
+		QMutexLocker l(&Transfers.m_pSection);
 		delete m_pTransfer;
 		m_pTransfer = 0;
 		emit transferClosed();
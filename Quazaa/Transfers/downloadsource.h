@@ -4,6 +4,9 @@
 #include "types.h"
 #include "Hashes/hash.h"
 #include "FileFragments.hpp"
+#include "transferstats.h"
+
+#define DOWNLOAD_SOURCE_CORRUPT_MAX 3 // corrupt blocks after which a source is no longer used
 
 class CQueryHit;
 class CDownload;
@@ -22,6 +25,7 @@ public:
 	QList<CHash>		m_lHashes;		// list of hashes
 	time_t				m_tNextAccess;	// seconds since 1970
 	quint32				m_nFailures;	// number of failures
+	quint32				m_nCorrupted;	// number of corrupt blocks received
 	QString				m_sURL;			// URL
 
 	CDownload*			m_pDownload;
@@ -29,6 +33,9 @@ public:
 
 	Fragments::List		m_lAvailableFrags;
 	Fragments::List		m_lDownloadedFrags;
+	Fragments::List		m_lCorruptFrags;	// blocks it sent corrupt, not requested from it again
+
+	CTransferStats		m_oStats;		// receive telemetry of this source
 public:
 	CDownloadSource(CDownload* pDownload, QObject* parent = 0);
 	CDownloadSource(CDownload* pDownload, CQueryHit* pHit, QObject* parent = 0);
@@ -52,7 +59,7 @@ Q_DECLARE_METATYPE(CDownloadSource*)
 
 bool CDownloadSource::canAccess()
 {
-	return time(0) > m_tNextAccess;
+	return time(0) > m_tNextAccess && m_nCorrupted < DOWNLOAD_SOURCE_CORRUPT_MAX;
 }
 bool CDownloadSource::hasTransfer()
 {
@@ -1,20 +1,41 @@
 #include "downloadtransfer.h"
 #include "downloadsource.h"
+#include "download.h"
+#include "downloads.h"
 
 #include "quazaasettings.h"
 
 CDownloadTransfer::CDownloadTransfer(CDownload *pOwner, CDownloadSource *pSource, QObject *parent) :
 	CTransfer(pOwner, parent),
+	m_pOwner(pOwner),
 	m_pSource(pSource),
 	m_nState(dtsNull),
+	m_tRequest(0),
 	m_tLastResponse(0),
 	m_nQueuePos(0),
 	m_nQueueLength(0)
 {
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	m_pOwner->m_nTransfers++;
 }
 
 CDownloadTransfer::~CDownloadTransfer()
 {
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	m_pOwner->m_nTransfers--;
+}
+
+// Opens the connection to the source. Returns false if the transfer can not be started.
+bool CDownloadTransfer::initiate()
+{
+	systemLog.postLog(LogSeverity::Debug, QString("Connecting to download host %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+
+	m_nState = dtsConnecting;
+	connectTo(m_pSource->m_oAddress);
+
+	return true;
 }
 
 void CDownloadTransfer::onTimer(quint32 tNow)
@@ -25,16 +46,22 @@ void CDownloadTransfer::onTimer(quint32 tNow)
 	switch(m_nState)
 	{
 		case CDownloadTransfer::dtsConnecting:
-		case CDownloadTransfer::dtsRequesting:
-		case CDownloadTransfer::dtsResponse:
 			if( tNow - m_tConnected > quazaaSettings.Connection.TimeoutConnect )
 			{
 				systemLog.postLog(LogSeverity::Error, QString(tr("Timed out connecting to download host %1.")).arg(m_pSource->m_oAddress.toStringWithPort()));
 				close();
 			}
 			break;
+		case CDownloadTransfer::dtsRequesting:
+		case CDownloadTransfer::dtsResponse:
+			if( tNow - qMax(m_tRequest, m_tLastResponse) > quazaaSettings.Connection.TimeoutTraffic )
+			{
+				systemLog.postLog(LogSeverity::Error, QString(tr("Timed out waiting for a response from download host %1.")).arg(m_pSource->m_oAddress.toStringWithPort()));
+				close();
+			}
+			break;
 		case CDownloadTransfer::dtsDownloading:
-			if( tNow - m_tConnected > quazaaSettings.Connection.TimeoutTraffic )
+			if( tNow - m_tLastResponse > quazaaSettings.Connection.TimeoutTraffic )
 			{
 				systemLog.postLog(LogSeverity::Error, QString(tr("Closing download connection to %1 due to lack of traffic.")).arg(m_pSource->m_oAddress.toStringWithPort()));
 				close();
@@ -48,6 +75,7 @@ void CDownloadTransfer::onTimer(quint32 tNow)
 void CDownloadTransfer::requestBlock(Fragments::Fragment oFragment)
 {
 	m_lRequested.push_back(oFragment);
+	m_lRequestSent.append(CTransferStats::now());
 }
 
 void CDownloadTransfer::subtractRequested(Fragments::List &oFragments)
@@ -57,3 +85,69 @@ void CDownloadTransfer::subtractRequested(Fragments::List &oFragments)
 
 	oFragments.erase(m_lRequested.begin(), m_lRequested.end());
 }
+
+/**
+  * Called in the endgame when another transfer has completed a part of the ranges requested here.
+  * Requests already sent cannot be taken back in general, protocols that can abandon them do so.
+  */
+void CDownloadTransfer::cancelCompleted()
+{
+}
+
+/**
+  * A response header to the oldest request has arrived: records the time to first byte
+  * for the source, its host and the download.
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownloadTransfer::recordFirstByte()
+{
+	if( m_lRequestSent.isEmpty() )
+		return;
+
+	const qint64 tNow = CTransferStats::now();
+	const qint64 nMsecs = tNow - m_lRequestSent.first();
+
+	m_pSource->m_oStats.addFirstByte(nMsecs, tNow);
+	m_pOwner->m_oStats.addFirstByte(nMsecs, tNow);
+	Downloads.hostStats(m_pSource->m_oAddress).addFirstByte(nMsecs, tNow);
+}
+
+// Requires Locking: Downloads.m_pSection
+void CDownloadTransfer::recordBytes(quint64 nBytes)
+{
+	const qint64 tNow = CTransferStats::now();
+
+	m_pSource->m_oStats.addBytes(nBytes, tNow);
+	m_pOwner->m_oStats.addBytes(nBytes, tNow);
+	Downloads.hostStats(m_pSource->m_oAddress).addBytes(nBytes, tNow);
+}
+
+/**
+  * Removes the oldest request once its response is over. If the block was received,
+  * the time since the request was sent is recorded as block latency and the source earns
+  * its rank in the source store.
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownloadTransfer::retireRequest(bool bCompleted)
+{
+	if( m_lRequested.empty() )
+		return;
+
+	m_lRequested.pop_front();
+
+	if( m_lRequestSent.isEmpty() )
+		return;
+
+	const qint64 tSent = m_lRequestSent.takeFirst();
+
+	if( bCompleted )
+	{
+		const qint64 tNow = CTransferStats::now();
+
+		m_pSource->m_oStats.addBlock(tNow - tSent, tNow);
+		m_pOwner->m_oStats.addBlock(tNow - tSent, tNow);
+		Downloads.hostStats(m_pSource->m_oAddress).addBlock(tNow - tSent, tNow);
+
+		m_pOwner->m_oSourceStore.addBlock(m_pSource->m_oAddress, time(0));
+	}
+}
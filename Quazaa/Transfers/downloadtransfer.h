@@ -28,26 +28,34 @@ public:
 	CDownloadSource*	m_pSource;
 
 	DownloadTransferState m_nState;
-	quint32				m_tLastResponse;
+	quint32				m_tRequest;			// when the last request was sent
+	quint32				m_tLastResponse;	// when data was last received, 0 if never
 
 	quint32				m_nQueuePos;
 	quint32				m_nQueueLength;
 	QString				m_sQueueName;
 
 	Fragments::Queue	m_lRequested;
+protected:
+	QList<qint64>		m_lRequestSent;		// CTransferStats::now() when each request of m_lRequested was sent
 public:
 	CDownloadTransfer(CDownload* pOwner, CDownloadSource* pSource, QObject *parent = 0);
 	virtual ~CDownloadTransfer();
 
+	virtual bool initiate();
 	virtual void onTimer(quint32 tNow = 0);
 	virtual void requestBlock(Fragments::Fragment oFragment);
 	virtual void subtractRequested(Fragments::List& oFragments);
+protected:
+	void recordFirstByte();
+	void recordBytes(quint64 nBytes);
+	void retireRequest(bool bCompleted);
 public:
 	inline CDownloadSource* source() const;
 signals:
 
 public slots:
-
+	virtual void cancelCompleted();
 };
 
 CDownloadSource* CDownloadTransfer::source() const
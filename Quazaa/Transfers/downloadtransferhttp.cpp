@@ -0,0 +1,769 @@
+/*
+** downloadtransferhttp.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "downloadtransferhttp.h"
+#include "downloadsource.h"
+#include "download.h"
+#include "downloads.h"
+#include "transfers.h"
+
+#include "parser.h"
+#include "quazaaglobals.h"
+#include "quazaasettings.h"
+
+#include <QMutexLocker>
+#include <QUrl>
+
+#include "debug_new.h"
+
+CDownloadTransferHTTP::CDownloadTransferHTTP(CDownload* pOwner, CDownloadSource* pSource, QObject* parent) :
+	CDownloadTransfer(pOwner, pSource, parent),
+	m_bKeepAlive(false),
+	m_bPipelining(false),
+	m_nBlockSize(qBound<quint64>(DOWNLOAD_HTTP_BLOCK_MIN, quazaaSettings.Downloads.ChunkStrap, DOWNLOAD_HTTP_BLOCK_MAX)),
+	m_nOffset(0),
+	m_nLength(0),
+	m_nPosition(0),
+	m_bDiscard(false),
+	m_tRetry(0),
+	m_bTreeRequested(false),
+	m_bTreeResponse(false),
+	m_bAltSent(false)
+{
+	m_sRequestURI = requestURI();
+}
+
+CDownloadTransferHTTP::~CDownloadTransferHTTP()
+{
+}
+
+bool CDownloadTransferHTTP::initiate()
+{
+	if( m_sRequestURI.isEmpty() )
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("No usable URN or URL for download source %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+		return false;
+	}
+
+	return CDownloadTransfer::initiate();
+}
+
+void CDownloadTransferHTTP::onTimer(quint32 tNow)
+{
+	if( tNow == 0 )
+		tNow = time(0);
+
+	// time to poll the remote queue again
+	if( m_nState == dtsQueued && m_lRequested.empty() && tNow >= m_tRetry )
+	{
+		m_nState = dtsRequesting;
+		m_tRequest = tNow;
+		QMetaObject::invokeMethod(this, "onRetry", Qt::QueuedConnection);
+		return;
+	}
+
+	CDownloadTransfer::onTimer(tNow);
+}
+
+/**
+  * Parses an X-Available-Ranges or Content-Range style list ("bytes 0-99,200-299") into oRanges.
+  * HTTP ranges include their last byte, fragments do not.
+  */
+bool CDownloadTransferHTTP::parseRanges(QString sRanges, Fragments::List& oRanges)
+{
+	sRanges = sRanges.trimmed();
+
+	if( !sRanges.startsWith("bytes", Qt::CaseInsensitive) )
+		return false;
+
+	sRanges = sRanges.mid(5).trimmed();
+	if( sRanges.startsWith('=') )
+		sRanges = sRanges.mid(1);
+
+	foreach(const QString& sRange, sRanges.split(',', QString::SkipEmptyParts))
+	{
+		const int nDash = sRange.indexOf('-');
+		if( nDash < 0 )
+			return false;
+
+		bool bBegin = false, bLast = false;
+		const quint64 nBegin = sRange.left(nDash).trimmed().toULongLong(&bBegin);
+		const quint64 nLast = sRange.mid(nDash + 1).trimmed().toULongLong(&bLast);
+
+		if( !bBegin || !bLast || nLast < nBegin || nLast >= oRanges.limit() )
+			return false;
+
+		oRanges.insert(Fragments::Fragment(nBegin, nLast + 1));
+	}
+
+	return !oRanges.empty();
+}
+
+void CDownloadTransferHTTP::onConnectNode()
+{
+	QMutexLocker l(&Downloads.m_pSection);
+
+	systemLog.postLog(LogSeverity::Debug, QString("Connected to download host %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+
+	if( !sendRequests(1) )
+		retryLater(quazaaSettings.Downloads.RetryDelay / 1000);
+}
+
+void CDownloadTransferHTTP::onDisconnectNode()
+{
+	QMutexLocker l(&Downloads.m_pSection);
+
+	if( m_nState != dtsNull )
+	{
+		// closed by the remote side, a timeout or a socket error
+		if( m_tLastResponse == 0 )
+		{
+			m_pSource->m_nFailures++;
+			m_pSource->m_tNextAccess = time(0) + quazaaSettings.Downloads.RetryDelay / 1000;
+		}
+		else
+		{
+			m_pSource->m_tNextAccess = time(0);
+		}
+	}
+
+	m_pSource->closeTransfer(); // deletes this
+}
+
+void CDownloadTransferHTTP::onError(QAbstractSocket::SocketError e)
+{
+	Q_UNUSED(e);
+
+	systemLog.postLog(LogSeverity::Debug, QString("Download connection to %1 failed: %2").arg(m_pSource->m_oAddress.toStringWithPort()).arg(m_pSocket->errorString()));
+
+	onDisconnectNode();
+}
+
+void CDownloadTransferHTTP::onRead()
+{
+	QMutexLocker l(&Downloads.m_pSection);
+
+	while( m_nState != dtsNull && bytesAvailable() > 0 )
+	{
+		const bool bContinue = (m_nPosition < m_nLength) ? readContent() : readResponse();
+
+		if( !bContinue )
+			break;
+	}
+}
+
+void CDownloadTransferHTTP::onRetry()
+{
+	QMutexLocker l(&Downloads.m_pSection);
+
+	if( m_nState != dtsRequesting || !m_lRequested.empty() )
+		return;
+
+	// only one request while waiting in a queue, the answer is most likely another queue position
+	if( !sendRequests(1) )
+		retryLater(quazaaSettings.Downloads.RetryDelay / 1000);
+}
+
+/**
+  * Closes the connection when everything still to come on it has been completed by other
+  * transfers in the meantime: the rest of the body being received and the pipelined requests.
+  * HTTP cannot take back a single request, so as long as one of them is still wanted the
+  * connection is kept. The source may be asked for another block at once.
+  */
+void CDownloadTransferHTTP::cancelCompleted()
+{
+	QMutexLocker l(&Downloads.m_pSection);
+
+	if( m_nState == dtsNull || m_bTreeResponse || m_lRequested.empty() )
+		return;
+
+	Fragments::Queue::const_iterator itRequest = m_lRequested.begin();
+
+	// the oldest request is the one being received
+	if( m_nState == dtsDownloading )
+	{
+		const Fragments::Fragment oRest(m_nOffset + m_nPosition, m_nOffset + m_nLength);
+
+		if( oRest.size() > 0 && m_pOwner->m_lCompleted.overlapping_sum(oRest) < oRest.size() )
+			return;
+
+		++itRequest;
+	}
+
+	for( ; itRequest != m_lRequested.end(); ++itRequest )
+	{
+		if( m_pOwner->m_lCompleted.overlapping_sum(*itRequest) < itRequest->size() )
+			return;
+	}
+
+	systemLog.postLog(LogSeverity::Debug, QString("Requests to %1 were completed by other sources, dropping them").arg(m_pSource->m_oAddress.toStringWithPort()));
+	retryLater(0);
+}
+
+/**
+  * Returns the path requested from the source: the URL of the hit if it has one,
+  * otherwise a /uri-res/N2R request for the best known hash.
+  */
+QString CDownloadTransferHTTP::requestURI() const
+{
+	if( m_pSource->m_sURL.startsWith("http://", Qt::CaseInsensitive) )
+	{
+		QUrl oURL(m_pSource->m_sURL);
+
+		if( oURL.isValid() )
+			return QString::fromLatin1(oURL.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority));
+	}
+
+	QList<CHash> lHashes = m_pSource->m_lHashes + m_pOwner->m_lHashes;
+
+	foreach(const CHash& oHash, lHashes)
+	{
+		if( oHash.getAlgorithm() == CHash::SHA1 )
+			return "/uri-res/N2R?" + oHash.toURN();
+	}
+
+	foreach(const CHash& oHash, lHashes)
+	{
+		const QString sURN = oHash.toURN();
+
+		if( !sURN.isEmpty() )
+			return "/uri-res/N2R?" + sURN;
+	}
+
+	return QString();
+}
+
+/**
+  * Requests new blocks until nMaxRequests are in flight. Returns false if nothing
+  * is in flight because the source has nothing left that is wanted.
+  * Requires Locking: Downloads.m_pSection
+  */
+bool CDownloadTransferHTTP::sendRequests(int nMaxRequests)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	const quint32 tNow = time(0);
+
+	while( (int)m_lRequested.size() < nMaxRequests )
+	{
+		Fragments::Fragment oBlock(0, 0);
+
+		Transfers.m_pSection.lock();
+		const bool bBlock = m_pOwner->getNextBlock(this, m_nBlockSize, oBlock);
+		Transfers.m_pSection.unlock();
+
+		if( !bBlock )
+			break;
+
+		QByteArray baRequest;
+		baRequest += "GET " + m_sRequestURI + (quazaaSettings.Downloads.RequestHTTP11 ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n");
+		baRequest += "Host: " + m_pSource->m_oAddress.toStringWithPort() + "\r\n";
+		baRequest += "User-Agent: " + CQuazaaGlobals::USER_AGENT_STRING() + "\r\n";
+		baRequest += "Connection: Keep-Alive\r\n";
+		baRequest += "Range: bytes=" + QString::number(oBlock.begin()) + "-" + QString::number(oBlock.end() - 1) + "\r\n";
+		baRequest += "X-Queue: 0.1\r\n";
+
+		if( !m_bAltSent )
+		{
+			baRequest += altHeaders();
+			m_bAltSent = true;
+		}
+
+		baRequest += "\r\n";
+
+		write(baRequest);
+		requestBlock(oBlock);
+		m_tRequest = tNow;
+	}
+
+	if( m_lRequested.empty() )
+		return false;
+
+	if( m_nState != dtsDownloading )
+		m_nState = dtsRequesting;
+
+	return true;
+}
+
+/**
+  * Reads and handles one response header. Returns false if the header is incomplete
+  * or the transfer has been closed.
+  * Requires Locking: Downloads.m_pSection
+  */
+bool CDownloadTransferHTTP::readResponse()
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	const qint32 nEnd = peek(bytesAvailable()).indexOf("\r\n\r\n");
+
+	if( nEnd < 0 )
+	{
+		if( bytesAvailable() > DOWNLOAD_HTTP_HEADER_MAX )
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("Oversized response header from %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+			sourceFailed();
+		}
+		return false;
+	}
+
+	QString sHeaders = read(nEnd + 4);
+	const quint32 tNow = time(0);
+
+	m_nState = dtsResponse;
+	m_tLastResponse = tNow;
+
+	const QStringList lStatus = sHeaders.left(sHeaders.indexOf("\r\n")).split(' ', QString::SkipEmptyParts);
+	if( lStatus.size() < 2 || !lStatus[0].startsWith("HTTP/1.", Qt::CaseInsensitive) )
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Invalid response from %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+		sourceFailed();
+		return false;
+	}
+
+	const bool bHTTP11 = (lStatus[0] != "HTTP/1.0");
+	const int nCode = lStatus[1].toInt();
+	const QString sConnection = Parser::getHeaderValue(sHeaders, "Connection").toLower();
+
+	// chunked bodies are not expected from file servers
+	const bool bChunked = !Parser::getHeaderValue(sHeaders, "Transfer-Encoding").isEmpty();
+
+	m_bKeepAlive = !bChunked && (bHTTP11 ? (sConnection != "close") : (sConnection == "keep-alive"));
+
+	bool bHaveLength = false;
+	const quint64 nContentLength = Parser::getHeaderValue(sHeaders, "Content-Length").toULongLong(&bHaveLength);
+
+	m_nOffset = 0;
+	m_nLength = bHaveLength ? nContentLength : 0;
+	m_nPosition = 0;
+	m_bDiscard = true;
+
+	if( m_bTreeResponse )
+	{
+		// the answer to requestTree(), it says nothing about the file ranges
+		if( !bHaveLength || bChunked )
+		{
+			retryLater(0);
+			return false;
+		}
+
+		if( nCode == 200 && nContentLength <= DOWNLOAD_HTTP_TREE_MAX )
+			m_bDiscard = false;
+		else
+			systemLog.postLog(LogSeverity::Debug, QString("Could not get the tiger tree from %1 (%2)").arg(m_pSource->m_oAddress.toStringWithPort()).arg(nCode));
+
+		if( m_nLength == 0 )
+			return finishResponse();
+
+		return true;
+	}
+
+	recordFirstByte();
+
+	// busy and queueing servers share their sources too
+	readAltHeader(Parser::getHeaderValue(sHeaders, "X-Alt"), false);
+	readAltHeader(Parser::getHeaderValue(sHeaders, "X-NAlt"), true);
+
+	if( !m_bTreeRequested && m_sTreeURI.isEmpty() && m_pOwner->needsTigerTree() )
+	{
+		// X-Thex-URI: /uri-res/N2X?urn:tree:tiger/:<root>;<root>
+		const QString sThex = Parser::getHeaderValue(sHeaders, "X-Thex-URI").section(';', 0, 0).trimmed();
+
+		if( sThex.startsWith('/') )
+			m_sTreeURI = sThex;
+	}
+
+	const QString sAvailable = Parser::getHeaderValue(sHeaders, "X-Available-Ranges");
+	if( !sAvailable.isEmpty() )
+	{
+		Fragments::List oAvailable(m_pOwner->m_nSize);
+
+		if( parseRanges(sAvailable, oAvailable) )
+		{
+			m_pSource->m_lAvailableFrags.swap(oAvailable);
+			m_pOwner->sourceRangesChanged();
+		}
+	}
+	else if( (nCode == 200 || nCode == 206) && !m_pSource->m_lAvailableFrags.empty() )
+	{
+		// no ranges advertised, the source has the complete file
+		m_pSource->m_lAvailableFrags.clear();
+		m_pOwner->sourceRangesChanged();
+	}
+
+	if( nCode == 200 || nCode == 206 )
+	{
+		if( !bHaveLength || bChunked )
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("Response without content length from %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+			sourceFailed();
+			return false;
+		}
+
+		const QString sRange = Parser::getHeaderValue(sHeaders, "Content-Range");
+
+		if( !sRange.isEmpty() )
+		{
+			// bytes <first>-<last>/<total>
+			const int nSlash = sRange.indexOf('/');
+			const QString sTotal = nSlash < 0 ? QString() : sRange.mid(nSlash + 1).trimmed();
+			Fragments::List oRange(m_pOwner->m_nSize);
+
+			if( nSlash < 0 || (sTotal != "*" && sTotal.toULongLong() != m_pOwner->m_nSize)
+				|| !parseRanges(sRange.left(nSlash), oRange) || oRange.size() != 1
+				|| oRange.begin()->size() != nContentLength )
+			{
+				systemLog.postLog(LogSeverity::Debug, QString("Invalid Content-Range \"%1\" from %2").arg(sRange).arg(m_pSource->m_oAddress.toStringWithPort()));
+				sourceFailed();
+				return false;
+			}
+
+			m_nOffset = oRange.begin()->begin();
+		}
+		else if( nCode == 206 || nContentLength != m_pOwner->m_nSize )
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("Missing Content-Range from %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+			sourceFailed();
+			return false;
+		}
+
+		m_bDiscard = false;
+		m_nState = dtsDownloading;
+		m_nQueuePos = m_nQueueLength = 0;
+		m_sQueueName.clear();
+
+		if( m_bKeepAlive && bHTTP11 && quazaaSettings.Downloads.RequestHTTP11 )
+			m_bPipelining = true;
+	}
+	else if( nCode == 503 && m_bKeepAlive && !Parser::getHeaderValue(sHeaders, "X-Queue").isEmpty() )
+	{
+		parseQueue(Parser::getHeaderValue(sHeaders, "X-Queue"));
+
+		if( quazaaSettings.Downloads.QueueLimit > 0 && m_nQueuePos > (quint32)quazaaSettings.Downloads.QueueLimit )
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("Queue position %1 at %2 is too long, trying later").arg(m_nQueuePos).arg(m_pSource->m_oAddress.toStringWithPort()));
+			retryLater(quazaaSettings.Downloads.RetryDelay / 1000);
+			return false;
+		}
+
+		m_nState = dtsQueued;
+	}
+	else if( nCode == 503 || nCode == 416 )
+	{
+		// busy, or the requested range is not available yet; a 416 with fresh
+		// X-Available-Ranges lets the connection continue with another block
+		if( nCode == 416 && !sAvailable.isEmpty() && m_bKeepAlive )
+		{
+			m_nState = dtsRequesting;
+		}
+		else
+		{
+			quint32 nRetry = Parser::getHeaderValue(sHeaders, "Retry-After").toUInt();
+			if( nRetry == 0 )
+				nRetry = quazaaSettings.Downloads.RetryDelay / 1000;
+
+			systemLog.postLog(LogSeverity::Debug, QString("Download host %1 is busy (%2)").arg(m_pSource->m_oAddress.toStringWithPort()).arg(nCode));
+			retryLater(nRetry);
+			return false;
+		}
+	}
+	else
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Download host %1 refused the request: %2").arg(m_pSource->m_oAddress.toStringWithPort()).arg(lStatus.mid(1).join(" ")));
+		sourceFailed();
+		return false;
+	}
+
+	if( m_nLength == 0 )
+		return finishResponse();
+
+	return true;
+}
+
+/**
+  * Reads response body bytes and stores them in the download.
+  * Requires Locking: Downloads.m_pSection
+  */
+bool CDownloadTransferHTTP::readContent()
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	QByteArray baData = read(qMin<quint64>(bytesAvailable(), m_nLength - m_nPosition));
+
+	if( baData.isEmpty() )
+		return false;
+
+	m_tLastResponse = time(0);
+
+	if( m_bTreeResponse )
+	{
+		if( !m_bDiscard )
+			m_baTree.append(baData);
+	}
+	else if( !m_bDiscard )
+	{
+		const quint64 nOffset = m_nOffset + m_nPosition;
+
+		if( !m_pOwner->writeData(nOffset, baData) )
+		{
+			m_nState = dtsNull;
+			close();
+			return false;
+		}
+
+		m_pSource->m_lDownloadedFrags.insert(Fragments::Fragment(nOffset, nOffset + baData.size()));
+		recordBytes(baData.size());
+		emit m_pSource->bytesReceived(nOffset, baData.size());
+	}
+
+	m_nPosition += baData.size();
+
+	if( m_nPosition == m_nLength )
+		return finishResponse();
+
+	return true;
+}
+
+/**
+  * Called after a complete response: retires its request and keeps the pipeline filled.
+  * Returns false if the transfer has been closed.
+  * Requires Locking: Downloads.m_pSection
+  */
+bool CDownloadTransferHTTP::finishResponse()
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	m_nOffset = m_nLength = m_nPosition = 0;
+	m_bDiscard = false;
+
+	if( m_bTreeResponse )
+	{
+		if( !m_baTree.isEmpty() && !m_pOwner->setTigerTree(m_baTree) )
+			systemLog.postLog(LogSeverity::Debug, QString("Tiger tree from %1 does not match").arg(m_pSource->m_oAddress.toStringWithPort()));
+
+		m_baTree.clear();
+		m_bTreeResponse = false;
+		m_nState = dtsRequesting;
+	}
+	else
+	{
+		retireRequest(m_nState == dtsDownloading);
+	}
+
+	if( m_nState == dtsDownloading )
+	{
+		m_pOwner->flushData();
+		updateBlockSize();
+		m_nState = dtsRequesting;
+	}
+
+	// everything is downloaded, what is left is verification
+	if( m_pOwner->m_lCompleted.missing() == 0 )
+	{
+		m_nState = dtsNull;
+		close();
+		return false;
+	}
+
+	if( !m_bKeepAlive )
+	{
+		retryLater(0);
+		return false;
+	}
+
+	if( m_nState == dtsQueued )
+		return true;
+
+	if( !m_sTreeURI.isEmpty() && !m_bTreeRequested && m_lRequested.empty() && m_pOwner->needsTigerTree() )
+	{
+		requestTree();
+		return true;
+	}
+
+	if( !sendRequests(m_bPipelining ? pipelineDepth() : 1) )
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Nothing more to download from %1").arg(m_pSource->m_oAddress.toStringWithPort()));
+		retryLater(quazaaSettings.Downloads.RetryDelay / 1000);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+  * Asks for the THEX tree advertised by the source. Sent only while no block request is
+  * in flight, so the response cannot be confused with file data.
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownloadTransferHTTP::requestTree()
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	QByteArray baRequest;
+	baRequest += "GET " + m_sTreeURI + (quazaaSettings.Downloads.RequestHTTP11 ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n");
+	baRequest += "Host: " + m_pSource->m_oAddress.toStringWithPort() + "\r\n";
+	baRequest += "User-Agent: " + CQuazaaGlobals::USER_AGENT_STRING() + "\r\n";
+	baRequest += "Connection: Keep-Alive\r\n";
+	baRequest += "\r\n";
+
+	write(baRequest);
+
+	m_bTreeRequested = true;
+	m_bTreeResponse = true;
+	m_tRequest = time(0);
+	m_nState = dtsRequesting;
+}
+
+/**
+  * Returns the X-Alt header with the sources blocks were received from, other than the one
+  * asked, and the X-NAlt header with the sources dropped recently. Empty if there are none.
+  * Requires Locking: Downloads.m_pSection
+  */
+QByteArray CDownloadTransferHTTP::altHeaders() const
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	QByteArray baHeaders;
+	QStringList lAlt, lNAlt;
+
+	foreach(const CEndPoint& oAddress, m_pOwner->m_oSourceStore.goodSources(m_pSource->m_oAddress, SOURCE_STORE_ALT_MAX))
+		lAlt.append(oAddress.toStringWithPort());
+
+	foreach(const CEndPoint& oAddress, m_pOwner->m_oSourceStore.deadSources(time(0), SOURCE_STORE_ALT_MAX))
+		lNAlt.append(oAddress.toStringWithPort());
+
+	if( !lAlt.isEmpty() )
+		baHeaders += "X-Alt: " + lAlt.join(",") + "\r\n";
+
+	if( !lNAlt.isEmpty() )
+		baHeaders += "X-NAlt: " + lNAlt.join(",") + "\r\n";
+
+	return baHeaders;
+}
+
+/**
+  * Passes the sources of an X-Alt header (bDead false) or X-NAlt header (bDead true) to the
+  * source store: 1.2.3.4:6346,5.6.7.8,tls=C0
+  * Requires Locking: Downloads.m_pSection
+  */
+void CDownloadTransferHTTP::readAltHeader(const QString& sHeader, bool bDead)
+{
+	ASSUME_LOCK(Downloads.m_pSection);
+
+	if( sHeader.isEmpty() )
+		return;
+
+	const quint32 tNow = time(0);
+	const QStringList lEntries = sHeader.split(',', QString::SkipEmptyParts);
+
+	for( int i = 0; i < lEntries.size() && i < DOWNLOAD_HTTP_ALT_MAX; ++i )
+	{
+		QString sEntry = lEntries[i].trimmed();
+
+		// tls= and other attributes
+		if( sEntry.contains('=') )
+			continue;
+
+		if( !sEntry.contains(':') )
+			sEntry += ":" + QString::number(DOWNLOAD_HTTP_ALT_PORT);
+
+		CEndPoint oAddress;
+		oAddress.setAddressWithPort(sEntry);
+
+		if( !oAddress.isValid() || oAddress.isFirewalled() || oAddress == m_pSource->m_oAddress )
+			continue;
+
+		if( bDead )
+			m_pOwner->m_oSourceStore.reportedDead(oAddress);
+		else
+			m_pOwner->m_oSourceStore.add(oAddress, tNow);
+	}
+}
+
+// Sizes the next blocks after the rate measured on this connection.
+void CDownloadTransferHTTP::updateBlockSize()
+{
+	const quint64 nRate = m_pSource->m_oStats.m_oRate.rate(CTransferStats::now());
+
+	if( nRate > 0 )
+		m_nBlockSize = qBound<quint64>(DOWNLOAD_HTTP_BLOCK_MIN, nRate * DOWNLOAD_HTTP_BLOCK_TIME, DOWNLOAD_HTTP_BLOCK_MAX);
+}
+
+int CDownloadTransferHTTP::pipelineDepth() const
+{
+	return (m_nBlockSize >= DOWNLOAD_HTTP_BLOCK_MAX) ? DOWNLOAD_HTTP_PIPELINE_MAX : DOWNLOAD_HTTP_PIPELINE_MIN;
+}
+
+// Parses X-Queue: position=2,length=5,limit=4,pollMin=45,pollMax=120,id="name"
+void CDownloadTransferHTTP::parseQueue(const QString& sQueue)
+{
+	quint32 nPollMin = 0, nPollMax = 0;
+
+	foreach(QString sPart, sQueue.split(',', QString::SkipEmptyParts))
+	{
+		sPart = sPart.trimmed();
+
+		const int nEquals = sPart.indexOf('=');
+		if( nEquals < 0 )
+			continue;
+
+		const QString sKey = sPart.left(nEquals).trimmed().toLower();
+		QString sValue = sPart.mid(nEquals + 1).trimmed();
+
+		if( sKey == "position" )
+			m_nQueuePos = sValue.toUInt();
+		else if( sKey == "length" )
+			m_nQueueLength = sValue.toUInt();
+		else if( sKey == "pollmin" )
+			nPollMin = sValue.toUInt();
+		else if( sKey == "pollmax" )
+			nPollMax = sValue.toUInt();
+		else if( sKey == "id" )
+			m_sQueueName = sValue.remove('"');
+	}
+
+	// poll a little after the earliest allowed time, well before the server drops us
+	quint32 nPoll = nPollMin;
+	if( nPollMax > nPollMin )
+		nPoll += (nPollMax - nPollMin) / 4;
+	if( nPoll == 0 )
+		nPoll = DOWNLOAD_HTTP_QUEUE_POLL;
+
+	m_tRetry = time(0) + nPoll;
+
+	systemLog.postLog(LogSeverity::Debug, QString("Queued at %1: position %2 of %3").arg(m_pSource->m_oAddress.toStringWithPort()).arg(m_nQueuePos).arg(m_nQueueLength));
+}
+
+// Closes the connection; the source may be tried again after nSeconds.
+void CDownloadTransferHTTP::retryLater(quint32 nSeconds)
+{
+	m_pSource->m_tNextAccess = time(0) + nSeconds;
+	m_nState = dtsNull;
+	close();
+}
+
+void CDownloadTransferHTTP::sourceFailed()
+{
+	m_pSource->m_nFailures++;
+	retryLater(quazaaSettings.Downloads.RetryDelay / 1000);
+}
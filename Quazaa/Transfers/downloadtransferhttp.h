@@ -0,0 +1,112 @@
+/*
+** downloadtransferhttp.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef DOWNLOADTRANSFERHTTP_H
+#define DOWNLOADTRANSFERHTTP_H
+
+#include "downloadtransfer.h"
+
+// Requests kept in flight on a keep-alive connection. The larger depth is used once blocks hit
+// the size cap, because then the round trip becomes a noticeable part of each request.
+#define DOWNLOAD_HTTP_PIPELINE_MIN	2
+#define DOWNLOAD_HTTP_PIPELINE_MAX	4
+
+// Blocks are sized to take about DOWNLOAD_HTTP_BLOCK_TIME seconds at the rate of the source.
+#define DOWNLOAD_HTTP_BLOCK_TIME	10
+#define DOWNLOAD_HTTP_BLOCK_MIN		65536
+#define DOWNLOAD_HTTP_BLOCK_MAX		4194304
+
+#define DOWNLOAD_HTTP_HEADER_MAX	65536	// longest response header accepted
+#define DOWNLOAD_HTTP_QUEUE_POLL	60		// seconds between queue polls if the server sets none
+#define DOWNLOAD_HTTP_TREE_MAX		1048576	// largest THEX tree accepted
+#define DOWNLOAD_HTTP_ALT_MAX		100		// entries read from one X-Alt or X-NAlt header
+#define DOWNLOAD_HTTP_ALT_PORT		6346	// port of X-Alt entries that have none
+
+/**
+ * @brief CDownloadTransferHTTP downloads from a Gnutella/G2 source with HTTP/1.1 range requests
+ * on /uri-res/N2R. Requests are pipelined on a keep-alive connection once the server has shown
+ * it supports it, available ranges are tracked from X-Available-Ranges and X-Queue answers put
+ * the transfer into the remote upload queue until the next poll. If the download has no Tiger
+ * tree yet, the one offered in X-Thex-URI is fetched on the same connection between two blocks.
+ * Sources are exchanged in X-Alt and X-NAlt headers: the first request of a connection carries
+ * the best and the dead sources of the download, those received go to its source store.
+ * Locking: Downloads.m_pSection is taken by the slots; Transfers.m_pSection is taken on its own
+ * where needed.
+ */
+class CDownloadTransferHTTP : public CDownloadTransfer
+{
+	Q_OBJECT
+
+protected:
+	QString		m_sRequestURI;
+	bool		m_bKeepAlive;	// server keeps the connection open after the current response
+	bool		m_bPipelining;	// server answered with HTTP/1.1 keep-alive, requests may be sent ahead
+	quint64		m_nBlockSize;	// size of the next block request
+	quint64		m_nOffset;		// file offset of the response body being received
+	quint64		m_nLength;		// length of that body
+	quint64		m_nPosition;	// bytes of that body received so far
+	bool		m_bDiscard;		// the body belongs to an error response and is thrown away
+	quint32		m_tRetry;		// when a queued request is repeated
+	QString		m_sTreeURI;		// THEX tree offered by the source
+	bool		m_bTreeRequested;	// the tree has been requested on this connection
+	bool		m_bTreeResponse;	// the current response answers the tree request
+	QByteArray	m_baTree;		// tree received so far
+	bool		m_bAltSent;		// sources have been sent on this connection
+
+public:
+	CDownloadTransferHTTP(CDownload* pOwner, CDownloadSource* pSource, QObject* parent = 0);
+	virtual ~CDownloadTransferHTTP();
+
+	virtual bool initiate();
+	virtual void onTimer(quint32 tNow = 0);
+
+	static bool parseRanges(QString sRanges, Fragments::List& oRanges);
+
+public slots:
+	void onConnectNode();
+	void onDisconnectNode();
+	void onRead();
+	void onError(QAbstractSocket::SocketError e);
+	virtual void cancelCompleted();
+
+protected slots:
+	void onRetry();
+
+protected:
+	QString requestURI() const;
+	bool sendRequests(int nMaxRequests);
+	bool readResponse();
+	bool readContent();
+	bool finishResponse();
+	void requestTree();
+	QByteArray altHeaders() const;
+	void readAltHeader(const QString& sHeader, bool bDead);
+	void updateBlockSize();
+	int  pipelineDepth() const;
+	void parseQueue(const QString& sQueue);
+	void retryLater(quint32 nSeconds);
+	void sourceFailed();
+};
+
+#endif // DOWNLOADTRANSFERHTTP_H
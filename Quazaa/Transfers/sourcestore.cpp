@@ -0,0 +1,285 @@
+/*
+** sourcestore.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "sourcestore.h"
+
+#include <QPair>
+#include <QtAlgorithms>
+
+#include "debug_new.h"
+
+typedef QPair<quint64, CEndPoint> RankedSource;
+
+/**
+  * Records that oAddress was reported as a source, with its GUID if it is known. Returns true if
+  * it is a new candidate, false if it was known already, is dead, or the store is full of more
+  * useful ones.
+  */
+bool CSourceStore::add(const CEndPoint& oAddress, quint32 tNow, const QUuid& oGUID)
+{
+	if( !oAddress.isValid() || isDead(oAddress, tNow) )
+		return false;
+
+	QHash<CEndPoint, Candidate>::iterator itCandidate = m_lCandidates.find(oAddress);
+
+	if( itCandidate != m_lCandidates.end() )
+	{
+		itCandidate->tSeen = tNow;
+
+		if( itCandidate->nReports < 0xFFFF )
+			itCandidate->nReports++;
+
+		if( !oGUID.isNull() )
+			itCandidate->oGUID = oGUID;
+
+		return false;
+	}
+
+	if( m_lCandidates.size() >= SOURCE_STORE_MAX && !evict() )
+		return false;
+
+	Candidate oCandidate = { tNow, 1, 0, false, oGUID };
+	m_lCandidates.insert(oAddress, oCandidate);
+
+	return true;
+}
+
+/**
+  * Marks oAddress as having a CDownloadSource. Returns false if it already has one or is dead.
+  * Active sources are never evicted, the download bounds their number.
+  */
+bool CSourceStore::activate(const CEndPoint& oAddress, quint32 tNow, const QUuid& oGUID)
+{
+	if( isDead(oAddress, tNow) )
+		return false;
+
+	QHash<CEndPoint, Candidate>::iterator itCandidate = m_lCandidates.find(oAddress);
+
+	if( itCandidate == m_lCandidates.end() )
+	{
+		if( m_lCandidates.size() >= SOURCE_STORE_MAX )
+			evict();
+
+		Candidate oCandidate = { tNow, 1, 0, true, oGUID };
+		m_lCandidates.insert(oAddress, oCandidate);
+		return true;
+	}
+
+	if( itCandidate->bActive )
+		return false;
+
+	itCandidate->bActive = true;
+	itCandidate->tSeen = tNow;
+
+	if( !oGUID.isNull() )
+		itCandidate->oGUID = oGUID;
+
+	return true;
+}
+
+void CSourceStore::deactivate(const CEndPoint& oAddress)
+{
+	QHash<CEndPoint, Candidate>::iterator itCandidate = m_lCandidates.find(oAddress);
+
+	if( itCandidate != m_lCandidates.end() )
+		itCandidate->bActive = false;
+}
+
+// A block was received from oAddress.
+void CSourceStore::addBlock(const CEndPoint& oAddress, quint32 tNow)
+{
+	QHash<CEndPoint, Candidate>::iterator itCandidate = m_lCandidates.find(oAddress);
+
+	if( itCandidate == m_lCandidates.end() )
+		return;
+
+	itCandidate->tSeen = tNow;
+
+	if( itCandidate->nBlocks < 0xFFFF )
+		itCandidate->nBlocks++;
+}
+
+// The source at oAddress was dropped: it is forgotten as candidate and refused for a while.
+void CSourceStore::setDead(const CEndPoint& oAddress, quint32 tNow)
+{
+	m_lCandidates.remove(oAddress);
+
+	if( m_lDead.size() >= SOURCE_STORE_DEAD_MAX && !m_lDead.contains(oAddress) )
+	{
+		QHash<CEndPoint, quint32>::iterator itOldest = m_lDead.begin();
+
+		for( QHash<CEndPoint, quint32>::iterator it = m_lDead.begin(); it != m_lDead.end(); ++it )
+		{
+			if( it.value() < itOldest.value() )
+				itOldest = it;
+		}
+
+		m_lDead.erase(itOldest);
+	}
+
+	m_lDead.insert(oAddress, tNow);
+}
+
+/**
+  * Another host says oAddress is dead. That is only believed for candidates that never
+  * sent us anything, nobody gets to drop a source that works for us.
+  */
+void CSourceStore::reportedDead(const CEndPoint& oAddress)
+{
+	QHash<CEndPoint, Candidate>::iterator itCandidate = m_lCandidates.find(oAddress);
+
+	if( itCandidate != m_lCandidates.end() && !itCandidate->bActive && itCandidate->nBlocks == 0 )
+		m_lCandidates.erase(itCandidate);
+}
+
+// Drops candidates nobody reported for SOURCE_STORE_EXPIRE and dead entries that have served their time.
+void CSourceStore::expire(quint32 tNow)
+{
+	QHash<CEndPoint, Candidate>::iterator itCandidate = m_lCandidates.begin();
+
+	while( itCandidate != m_lCandidates.end() )
+	{
+		if( !itCandidate->bActive && tNow - itCandidate->tSeen > SOURCE_STORE_EXPIRE )
+			itCandidate = m_lCandidates.erase(itCandidate);
+		else
+			++itCandidate;
+	}
+
+	QHash<CEndPoint, quint32>::iterator itDead = m_lDead.begin();
+
+	while( itDead != m_lDead.end() )
+	{
+		if( tNow - itDead.value() >= SOURCE_STORE_DEAD_TIME )
+			itDead = m_lDead.erase(itDead);
+		else
+			++itDead;
+	}
+}
+
+// Returns up to nCount of the best candidates without a CDownloadSource, best first.
+QList<CEndPoint> CSourceStore::select(int nCount) const
+{
+	QList<RankedSource> lRanked;
+
+	for( QHash<CEndPoint, Candidate>::const_iterator it = m_lCandidates.constBegin(); it != m_lCandidates.constEnd(); ++it )
+	{
+		if( !it->bActive )
+			lRanked.append(RankedSource(rank(it.value()), it.key()));
+	}
+
+	qSort(lRanked.begin(), lRanked.end(), qGreater<RankedSource>());
+
+	QList<CEndPoint> lResult;
+
+	for( int i = 0; i < lRanked.size() && i < nCount; ++i )
+		lResult.append(lRanked[i].second);
+
+	return lResult;
+}
+
+// Returns up to nMax sources blocks were received from, best first, to be passed on in X-Alt.
+QList<CEndPoint> CSourceStore::goodSources(const CEndPoint& oExclude, int nMax) const
+{
+	QList<RankedSource> lRanked;
+
+	for( QHash<CEndPoint, Candidate>::const_iterator it = m_lCandidates.constBegin(); it != m_lCandidates.constEnd(); ++it )
+	{
+		if( it->nBlocks > 0 && it.key() != oExclude )
+			lRanked.append(RankedSource(rank(it.value()), it.key()));
+	}
+
+	qSort(lRanked.begin(), lRanked.end(), qGreater<RankedSource>());
+
+	QList<CEndPoint> lResult;
+
+	for( int i = 0; i < lRanked.size() && i < nMax; ++i )
+		lResult.append(lRanked[i].second);
+
+	return lResult;
+}
+
+// Returns up to nMax of the most recently dropped sources, to be passed on in X-NAlt.
+QList<CEndPoint> CSourceStore::deadSources(quint32 tNow, int nMax) const
+{
+	QList<RankedSource> lRanked;
+
+	for( QHash<CEndPoint, quint32>::const_iterator it = m_lDead.constBegin(); it != m_lDead.constEnd(); ++it )
+	{
+		if( tNow - it.value() < SOURCE_STORE_DEAD_TIME )
+			lRanked.append(RankedSource(it.value(), it.key()));
+	}
+
+	qSort(lRanked.begin(), lRanked.end(), qGreater<RankedSource>());
+
+	QList<CEndPoint> lResult;
+
+	for( int i = 0; i < lRanked.size() && i < nMax; ++i )
+		lResult.append(lRanked[i].second);
+
+	return lResult;
+}
+
+// Returns the GUID oAddress was reported with, or a null GUID if it is not known.
+QUuid CSourceStore::guid(const CEndPoint& oAddress) const
+{
+	return m_lCandidates.value(oAddress).oGUID;
+}
+
+bool CSourceStore::isDead(const CEndPoint& oAddress, quint32 tNow)
+{
+	QHash<CEndPoint, quint32>::iterator itDead = m_lDead.find(oAddress);
+
+	if( itDead == m_lDead.end() )
+		return false;
+
+	if( tNow - itDead.value() < SOURCE_STORE_DEAD_TIME )
+		return true;
+
+	m_lDead.erase(itDead);
+	return false;
+}
+
+// Removes the least useful candidate without a CDownloadSource. Returns false if there is none.
+bool CSourceStore::evict()
+{
+	QHash<CEndPoint, Candidate>::iterator itWorst = m_lCandidates.end();
+
+	for( QHash<CEndPoint, Candidate>::iterator it = m_lCandidates.begin(); it != m_lCandidates.end(); ++it )
+	{
+		if( !it->bActive && (itWorst == m_lCandidates.end() || rank(it.value()) < rank(itWorst.value())) )
+			itWorst = it;
+	}
+
+	if( itWorst == m_lCandidates.end() )
+		return false;
+
+	m_lCandidates.erase(itWorst);
+	return true;
+}
+
+// Sources that sent blocks come first, then the most reported, then the most recently seen.
+quint64 CSourceStore::rank(const Candidate& oCandidate)
+{
+	return (quint64(oCandidate.nBlocks) << 48) | (quint64(oCandidate.nReports) << 32) | oCandidate.tSeen;
+}
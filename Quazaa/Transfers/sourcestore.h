@@ -0,0 +1,92 @@
+/*
+** sourcestore.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SOURCESTORE_H
+#define SOURCESTORE_H
+
+#include <QHash>
+#include <QList>
+#include <QUuid>
+
+#include "endpoint.h"
+
+#define SOURCE_STORE_MAX		4096	// candidate sources kept per download
+#define SOURCE_STORE_DEAD_MAX	1024	// dead sources remembered per download
+#define SOURCE_STORE_EXPIRE		7200	// seconds an unused candidate is kept after it was last reported
+#define SOURCE_STORE_DEAD_TIME	3600	// seconds a dead source is refused when it is reported again
+#define SOURCE_STORE_ALT_MAX	10		// sources sent in one X-Alt or X-NAlt header
+
+/**
+ * @brief CSourceStore knows every source of a download, indexed by endpoint. Query hits and
+ * X-Alt headers report candidates; only the best of them are turned into CDownloadSource objects,
+ * so a popular file can have thousands of candidates at a few dozen bytes each. Candidates are
+ * ranked by the blocks received from them, then by how often they were reported. Sources that
+ * were dropped are remembered as dead for a while: they are not added again and are passed on
+ * in X-NAlt. Both tables are bounded, when full the least useful entry makes room.
+ * Locking: Downloads.m_pSection, like the download it belongs to.
+ */
+class CSourceStore
+{
+public:
+	struct Candidate
+	{
+		quint32	tSeen;		// last time it was reported or sent a block
+		quint16	nReports;	// times it was reported by hits or other sources
+		quint16	nBlocks;	// blocks received from it
+		bool	bActive;	// a CDownloadSource exists for it
+		QUuid	oGUID;		// GUID of the source, null if not known
+	};
+
+protected:
+	QHash<CEndPoint, Candidate>	m_lCandidates;
+	QHash<CEndPoint, quint32>	m_lDead;		// dropped sources and when they were dropped
+
+public:
+	bool add(const CEndPoint& oAddress, quint32 tNow, const QUuid& oGUID = QUuid());
+	bool activate(const CEndPoint& oAddress, quint32 tNow, const QUuid& oGUID = QUuid());
+	void deactivate(const CEndPoint& oAddress);
+	void addBlock(const CEndPoint& oAddress, quint32 tNow);
+	void setDead(const CEndPoint& oAddress, quint32 tNow);
+	void reportedDead(const CEndPoint& oAddress);
+	void expire(quint32 tNow);
+
+	QList<CEndPoint> select(int nCount) const;
+	QList<CEndPoint> goodSources(const CEndPoint& oExclude, int nMax) const;
+	QList<CEndPoint> deadSources(quint32 tNow, int nMax) const;
+	QUuid guid(const CEndPoint& oAddress) const;
+
+	inline int count() const;
+
+protected:
+	bool isDead(const CEndPoint& oAddress, quint32 tNow);
+	bool evict();
+	static quint64 rank(const Candidate& oCandidate);
+};
+
+int CSourceStore::count() const
+{
+	return m_lCandidates.size();
+}
+
+#endif // SOURCESTORE_H
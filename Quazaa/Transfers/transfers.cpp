@@ -25,7 +25,10 @@
 #include "transfers.h"
 #include "ratecontroller.h"
 #include "transfer.h"
+#include "download.h"
 #include "downloads.h"
+#include "diskwriter.h"
+#include "uploads.h"
 
 #include <QMutexLocker>
 
@@ -56,6 +59,10 @@ void CTransfers::start()
 	m_bActive = true;
 	TransfersThread.start("Transfers", &m_pSection);
 	m_pController->moveToThread(&TransfersThread);
+	connect(&DiskWriter, SIGNAL(congested(bool)), m_pController, SLOT(setReadPaused(bool)));
+	connect(&DiskWriter, SIGNAL(verified(void*,quint64,quint64,bool)), &Downloads, SLOT(onVerified(void*,quint64,quint64,bool)), Qt::QueuedConnection);
+	connect(&DiskWriter, SIGNAL(stateSaved(void*,bool)), &Downloads, SLOT(onStateSaved(void*,bool)), Qt::QueuedConnection);
+	DiskWriter.start();
 	Downloads.start();
 	Downloads.moveToThread(&TransfersThread);
 
@@ -74,12 +81,14 @@ void CTransfers::stop()
 	m_bActive = false;
 
 	TransfersThread.exit(0);
+	Uploads.stop();
 	Downloads.stop();
+	DiskWriter.stop();
 }
 
 void CTransfers::add(CTransfer *pTransfer)
 {
-	QMutexLocker l(&m_pSection);
+	ASSUME_LOCK(m_pSection);
 
 	Q_ASSERT_X(m_bActive, "CTransfers::add()", "Adding transfer while thread is inactive");
 
@@ -91,13 +100,23 @@ void CTransfers::add(CTransfer *pTransfer)
 	}
 
 	m_lTransfers.insert(pTransfer->m_pOwner, pTransfer);
-	m_pController->addSocket(pTransfer);
+
+	if( pTransfer->m_pOwner == &Uploads )
+	{
+		m_pController->addSocket(pTransfer, tcUpload);
+	}
+	else
+	{
+		// transfers of higher priority downloads get a larger share of the download class
+		CDownload* pDownload = static_cast<CDownload*>(pTransfer->m_pOwner);
+		m_pController->addSocket(pTransfer, tcDownload, 1 + pDownload->m_nPriority / 64);
+	}
 	// start
 }
 
 void CTransfers::remove(CTransfer *pTransfer)
 {
-	QMutexLocker l(&m_pSection);
+	ASSUME_LOCK(m_pSection);
 
 	if(!m_lTransfers.contains(pTransfer->m_pOwner, pTransfer))
 	{
@@ -0,0 +1,218 @@
+/*
+** transferstats.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "transferstats.h"
+
+#include <QElapsedTimer>
+#include <math.h>
+#include <string.h>
+
+#include "debug_new.h"
+
+static const quint32 TRANSFER_STATS_SUB = 1 << TRANSFER_STATS_SUB_BITS;
+
+CRateEstimator::CRateEstimator() :
+	m_tSlot(-1),
+	m_nSlotBytes(0),
+	m_dRate(0)
+{
+}
+
+void CRateEstimator::add(quint64 nBytes, qint64 tNow)
+{
+	advance(tNow);
+	m_nSlotBytes += nBytes;
+}
+
+// Bytes per second, including the decay since the last bytes arrived.
+quint32 CRateEstimator::rate(qint64 tNow) const
+{
+	CRateEstimator oNow(*this);
+	oNow.advance(tNow);
+	return quint32(oNow.m_dRate);
+}
+
+void CRateEstimator::advance(qint64 tNow)
+{
+	if( m_tSlot < 0 )
+	{
+		m_tSlot = tNow;
+		return;
+	}
+
+	const qint64 nSlots = (tNow - m_tSlot) / TRANSFER_STATS_SLOT;
+
+	if( nSlots <= 0 )
+		return;
+
+	const double dSlotRate = m_nSlotBytes * 1000.0 / TRANSFER_STATS_SLOT;
+	m_dRate = TRANSFER_STATS_ALPHA * dSlotRate + (1 - TRANSFER_STATS_ALPHA) * m_dRate;
+
+	if( nSlots > 1 )
+		m_dRate *= pow(1 - TRANSFER_STATS_ALPHA, double(nSlots - 1));
+
+	m_nSlotBytes = 0;
+	m_tSlot += nSlots * TRANSFER_STATS_SLOT;
+}
+
+CLatencyHistogram::CLatencyHistogram() :
+	m_nCount(0),
+	m_nSum(0),
+	m_nMax(0)
+{
+	memset(m_aCounts, 0, sizeof(m_aCounts));
+}
+
+void CLatencyHistogram::record(qint64 nMsecs)
+{
+	const quint32 nValue = quint32(qBound<qint64>(0, nMsecs, TRANSFER_STATS_MAX_MS));
+
+	m_aCounts[bucket(nValue)]++;
+	m_nCount++;
+	m_nSum += nValue;
+	m_nMax = qMax(m_nMax, nValue);
+}
+
+void CLatencyHistogram::merge(const CLatencyHistogram& oOther)
+{
+	for( int i = 0; i < TRANSFER_STATS_BUCKETS; ++i )
+		m_aCounts[i] += oOther.m_aCounts[i];
+
+	m_nCount += oOther.m_nCount;
+	m_nSum += oOther.m_nSum;
+	m_nMax = qMax(m_nMax, oOther.m_nMax);
+}
+
+// The value below which dPercentile percent of the recorded values are, 0 if there are none.
+quint32 CLatencyHistogram::percentile(double dPercentile) const
+{
+	if( m_nCount == 0 )
+		return 0;
+
+	const quint64 nRank = qMax<quint64>(1, quint64(ceil(m_nCount * qBound(0.0, dPercentile, 100.0) / 100)));
+	quint64 nSeen = 0;
+
+	for( int i = 0; i < TRANSFER_STATS_BUCKETS; ++i )
+	{
+		nSeen += m_aCounts[i];
+
+		if( nSeen >= nRank )
+			return qMin(highestInBucket(i), m_nMax);
+	}
+
+	return m_nMax;
+}
+
+quint32 CLatencyHistogram::mean() const
+{
+	return m_nCount ? quint32(m_nSum / m_nCount) : 0;
+}
+
+QJsonObject CLatencyHistogram::toJson() const
+{
+	QJsonObject oJson;
+	oJson.insert("count", double(m_nCount));
+	oJson.insert("mean", double(mean()));
+	oJson.insert("p50", double(percentile(50)));
+	oJson.insert("p90", double(percentile(90)));
+	oJson.insert("p99", double(percentile(99)));
+	oJson.insert("max", double(m_nMax));
+	return oJson;
+}
+
+// Values below 2 * TRANSFER_STATS_SUB have a bucket each, then every power of two has TRANSFER_STATS_SUB.
+int CLatencyHistogram::bucket(quint32 nValue)
+{
+	if( nValue < 2 * TRANSFER_STATS_SUB )
+		return nValue;
+
+	int nShift = 0;
+	while( (nValue >> nShift) >= 2 * TRANSFER_STATS_SUB )
+		++nShift;
+
+	return nShift * TRANSFER_STATS_SUB + (nValue >> nShift);
+}
+
+quint32 CLatencyHistogram::highestInBucket(int nBucket)
+{
+	if( nBucket < int(2 * TRANSFER_STATS_SUB) )
+		return nBucket;
+
+	const int nShift = nBucket / TRANSFER_STATS_SUB - 1;
+	const quint32 nMantissa = nBucket % TRANSFER_STATS_SUB + TRANSFER_STATS_SUB;
+
+	return ((nMantissa + 1) << nShift) - 1;
+}
+
+CTransferStats::CTransferStats() :
+	m_nBytes(0),
+	m_tLast(-1)
+{
+}
+
+void CTransferStats::addBytes(quint64 nBytes, qint64 tNow)
+{
+	m_oRate.add(nBytes, tNow);
+	m_nBytes += nBytes;
+	m_tLast = tNow;
+}
+
+void CTransferStats::addFirstByte(qint64 nMsecs, qint64 tNow)
+{
+	m_oFirstByte.record(nMsecs);
+	m_tLast = tNow;
+}
+
+void CTransferStats::addBlock(qint64 nMsecs, qint64 tNow)
+{
+	m_oBlock.record(nMsecs);
+	m_tLast = tNow;
+}
+
+QJsonObject CTransferStats::toJson(qint64 tNow) const
+{
+	QJsonObject oJson;
+	oJson.insert("rate", double(m_oRate.rate(tNow)));
+	oJson.insert("bytes", double(m_nBytes));
+	oJson.insert("idle", m_tLast < 0 ? -1.0 : double((tNow - m_tLast) / 1000));
+	oJson.insert("firstByte", m_oFirstByte.toJson());
+	oJson.insert("block", m_oBlock.toJson());
+	return oJson;
+}
+
+static QElapsedTimer startedClock()
+{
+	QElapsedTimer tClock;
+	tClock.start();
+	return tClock;
+}
+
+// started during static initialisation, before any thread can ask for the time
+static const QElapsedTimer tTransferClock = startedClock();
+
+// Monotonic milliseconds, the time base of all transfer stats.
+qint64 CTransferStats::now()
+{
+	return tTransferClock.elapsed();
+}
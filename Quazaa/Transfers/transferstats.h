@@ -0,0 +1,126 @@
+/*
+** transferstats.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TRANSFERSTATS_H
+#define TRANSFERSTATS_H
+
+#include <QtGlobal>
+#include <QJsonObject>
+
+#define TRANSFER_STATS_SLOT		500			// ms, the rate estimate is updated once per slot
+#define TRANSFER_STATS_ALPHA	0.2			// weight of the latest slot in the rate estimate
+#define TRANSFER_STATS_SUB_BITS	3			// histogram precision: 2^3 buckets per power of two
+#define TRANSFER_STATS_MAX_MS	1048575		// latencies are capped at about 17 minutes
+#define TRANSFER_STATS_BUCKETS	144			// buckets needed for values up to TRANSFER_STATS_MAX_MS
+
+/**
+ * @brief CRateEstimator is an exponentially weighted moving average of a transfer rate. Bytes are
+ * summed per TRANSFER_STATS_SLOT, every finished slot is blended into the estimate, idle slots
+ * make it decay.
+ */
+class CRateEstimator
+{
+protected:
+	qint64	m_tSlot;		// start of the current slot, -1 before the first bytes
+	quint64	m_nSlotBytes;	// bytes in the current slot
+	double	m_dRate;		// bytes per second
+
+public:
+	CRateEstimator();
+
+	void add(quint64 nBytes, qint64 tNow);
+	quint32 rate(qint64 tNow) const;
+
+protected:
+	void advance(qint64 tNow);
+};
+
+/**
+ * @brief CLatencyHistogram records latencies in milliseconds in logarithmic buckets, like
+ * HdrHistogram: values below 16 are exact, above each power of two is split in 8 buckets, so
+ * every value is known within about 12%. Memory use is fixed however many values are recorded.
+ */
+class CLatencyHistogram
+{
+protected:
+	quint32	m_aCounts[TRANSFER_STATS_BUCKETS];
+	quint32	m_nCount;
+	quint64	m_nSum;
+	quint32	m_nMax;
+
+public:
+	CLatencyHistogram();
+
+	void record(qint64 nMsecs);
+	void merge(const CLatencyHistogram& oOther);
+
+	quint32 percentile(double dPercentile) const;
+	quint32 mean() const;
+	inline quint32 count() const;
+	inline quint32 maximum() const;
+
+	QJsonObject toJson() const;
+
+protected:
+	static int bucket(quint32 nValue);
+	static quint32 highestInBucket(int nBucket);
+};
+
+quint32 CLatencyHistogram::count() const
+{
+	return m_nCount;
+}
+quint32 CLatencyHistogram::maximum() const
+{
+	return m_nMax;
+}
+
+/**
+ * @brief CTransferStats is the telemetry kept for a download, a download source and a remote host:
+ * receive rate, bytes received, time from a request to the first byte of its response and time
+ * from a request to the last byte of the block.
+ * Locking: the stats of downloads, sources and hosts are guarded by Downloads.m_pSection.
+ */
+class CTransferStats
+{
+public:
+	CRateEstimator		m_oRate;
+	CLatencyHistogram	m_oFirstByte;	// request sent to response header received
+	CLatencyHistogram	m_oBlock;		// request sent to the block being complete
+	quint64				m_nBytes;		// bytes received
+	qint64				m_tLast;		// time of the last activity, -1 for none
+
+public:
+	CTransferStats();
+
+	void addBytes(quint64 nBytes, qint64 tNow);
+	void addFirstByte(qint64 nMsecs, qint64 tNow);
+	void addBlock(qint64 nMsecs, qint64 tNow);
+
+	QJsonObject toJson(qint64 tNow) const;
+
+	static qint64 now();
+};
+
+#endif // TRANSFERSTATS_H
@@ -0,0 +1,176 @@
+/*
+** uploads.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "uploads.h"
+#include "uploadtransferhttp.h"
+#include "transfers.h"
+
+#include "quazaasettings.h"
+
+#include <QMutexLocker>
+
+#include "debug_new.h"
+
+CUploads Uploads;
+
+CUploads::CUploads(QObject* parent) :
+	QObject(parent)
+{
+}
+
+CUploads::~CUploads()
+{
+}
+
+// Closes all upload connections. Called by Transfers after its thread has stopped.
+void CUploads::stop()
+{
+	QMutexLocker l(&m_pSection);
+	QMutexLocker l2(&Transfers.m_pSection);
+
+	while( !m_lUploads.isEmpty() )
+	{
+		delete m_lUploads.first(); // removes itself
+	}
+}
+
+/**
+  * Takes over an incoming HTTP connection that requests a file. Called from the Handshakes thread.
+  */
+bool CUploads::onAccept(CNetworkConnection* pConn)
+{
+	systemLog.postLog(LogSeverity::Debug, "CUploads::onAccept");
+
+	if( !Transfers.m_bActive )
+	{
+		pConn->close();
+		return false;
+	}
+
+	if( !m_pSection.tryLock(50) )
+	{
+		systemLog.postLog(LogSeverity::Debug, "Not accepting upload request. Uploads overloaded");
+		pConn->close();
+		return false;
+	}
+
+	if( !Transfers.m_pSection.tryLock(50) )
+	{
+		m_pSection.unlock();
+		systemLog.postLog(LogSeverity::Debug, "Not accepting upload request. Transfers overloaded");
+		pConn->close();
+		return false;
+	}
+
+	CUploadTransferHTTP* pUpload = new CUploadTransferHTTP();
+	pUpload->attachTo(pConn);
+	pUpload->moveToThread(&TransfersThread);
+
+	Transfers.m_pSection.unlock();
+	m_pSection.unlock();
+
+	return true;
+}
+
+void CUploads::add(CUploadTransfer* pUpload)
+{
+	ASSUME_LOCK(m_pSection);
+
+	m_lUploads.append(pUpload);
+}
+
+void CUploads::remove(CUploadTransfer* pUpload)
+{
+	ASSUME_LOCK(m_pSection);
+
+	releaseSlot(pUpload);
+	m_lUploads.removeAll(pUpload);
+}
+
+/**
+  * Asks for an upload slot. Returns 0 if pUpload may send now, its 1-based position if it has
+  * been queued, or -1 if the queue is full or its host already uses all it may.
+  * Free slots go to queued clients first: the first n entries of the queue have one reserved,
+  * n being the number of free slots.
+  * Requires Locking: m_pSection
+  */
+int CUploads::requestSlot(CUploadTransfer* pUpload)
+{
+	ASSUME_LOCK(m_pSection);
+
+	if( m_lActive.contains(pUpload) )
+		return 0;
+
+	int nIndex = m_lQueue.indexOf(pUpload);
+
+	if( nIndex < 0 )
+	{
+		int nFromHost = 0;
+
+		foreach(CUploadTransfer* pOther, m_lActive)
+		{
+			if( pOther->m_oAddress == static_cast<const QHostAddress&>(pUpload->m_oAddress) )
+				nFromHost++;
+		}
+		foreach(CUploadTransfer* pOther, m_lQueue)
+		{
+			if( pOther->m_oAddress == static_cast<const QHostAddress&>(pUpload->m_oAddress) )
+				nFromHost++;
+		}
+
+		if( nFromHost >= quazaaSettings.Uploads.MaxPerHost )
+			return -1;
+
+		nIndex = m_lQueue.size();
+	}
+
+	if( nIndex < quazaaSettings.Uploads.MaxTransfers - m_lActive.size() )
+	{
+		m_lQueue.removeAll(pUpload);
+		m_lActive.append(pUpload);
+		return 0;
+	}
+
+	if( nIndex == m_lQueue.size() )
+	{
+		if( m_lQueue.size() >= quazaaSettings.Uploads.QueueSize )
+			return -1;
+
+		m_lQueue.append(pUpload);
+	}
+
+	return nIndex + 1;
+}
+
+/**
+  * Gives up the slot or queue position of pUpload.
+  * Requires Locking: m_pSection
+  */
+void CUploads::releaseSlot(CUploadTransfer* pUpload)
+{
+	ASSUME_LOCK(m_pSection);
+
+	m_lActive.removeAll(pUpload);
+	m_lQueue.removeAll(pUpload);
+}
@@ -0,0 +1,83 @@
+/*
+** uploads.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef UPLOADS_H
+#define UPLOADS_H
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+
+class CNetworkConnection;
+class CUploadTransfer;
+
+/**
+ * @brief CUploads keeps the incoming upload connections and hands out upload slots.
+ * Up to Uploads.MaxTransfers clients are served at a time, the others wait in a queue of
+ * Uploads.QueueSize entries and poll for their turn. A slot that becomes free is reserved for
+ * the head of the queue until it polls again, so a newcomer can not overtake waiting clients.
+ * Lock order: Uploads.m_pSection before Transfers.m_pSection.
+ */
+class CUploads : public QObject
+{
+	Q_OBJECT
+public:
+	QMutex m_pSection;
+
+protected:
+	QList<CUploadTransfer*> m_lUploads;	// all upload connections
+	QList<CUploadTransfer*> m_lActive;	// connections holding a slot
+	QList<CUploadTransfer*> m_lQueue;	// waiting for a slot, in order of arrival
+
+public:
+	CUploads(QObject* parent = 0);
+	~CUploads();
+
+	void stop();
+
+	bool onAccept(CNetworkConnection* pConn);
+
+	void add(CUploadTransfer* pUpload);
+	void remove(CUploadTransfer* pUpload);
+
+	int  requestSlot(CUploadTransfer* pUpload);
+	void releaseSlot(CUploadTransfer* pUpload);
+
+	inline int activeCount() const;
+	inline int queueLength() const;
+};
+
+int CUploads::activeCount() const
+{
+	return m_lActive.size();
+}
+
+int CUploads::queueLength() const
+{
+	return m_lQueue.size();
+}
+
+extern CUploads Uploads;
+
+#endif // UPLOADS_H
@@ -0,0 +1,87 @@
+/*
+** uploadtransfer.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "uploadtransfer.h"
+#include "uploads.h"
+
+#include "quazaasettings.h"
+
+#include "debug_new.h"
+
+CUploadTransfer::CUploadTransfer(QObject* parent) :
+	CTransfer(&Uploads, parent),
+	m_nState(utsRequest),
+	m_nOffset(0),
+	m_nLength(0),
+	m_nPosition(0),
+	m_tLastSent(0),
+	m_nQueuePos(0)
+{
+	ASSUME_LOCK(Uploads.m_pSection);
+
+	m_tRequest = time(0);
+	m_oFile.nFileID = 0;
+
+	Uploads.add(this);
+}
+
+CUploadTransfer::~CUploadTransfer()
+{
+	ASSUME_LOCK(Uploads.m_pSection);
+
+	Uploads.remove(this);
+}
+
+void CUploadTransfer::onTimer(quint32 tNow)
+{
+	if( tNow == 0 )
+		tNow = time(0);
+
+	switch(m_nState)
+	{
+		case CUploadTransfer::utsRequest:
+			if( tNow - qMax(m_tRequest, m_tLastSent) > quazaaSettings.Connection.TimeoutTraffic )
+			{
+				systemLog.postLog(LogSeverity::Debug, QString("Closing idle upload connection to %1").arg(m_oAddress.toStringWithPort()));
+				close();
+			}
+			break;
+		case CUploadTransfer::utsQueued:
+			if( tNow - m_tRequest > (quint32)quazaaSettings.Uploads.QueuePollMax / 1000 )
+			{
+				systemLog.postLog(LogSeverity::Debug, QString("Dropping %1 from the upload queue, it stopped polling").arg(m_oAddress.toStringWithPort()));
+				close();
+			}
+			break;
+		case CUploadTransfer::utsUploading:
+			if( tNow - qMax(m_tRequest, m_tLastSent) > quazaaSettings.Connection.TimeoutTraffic )
+			{
+				systemLog.postLog(LogSeverity::Debug, QString("Closing upload connection to %1 due to lack of traffic").arg(m_oAddress.toStringWithPort()));
+				close();
+			}
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,65 @@
+/*
+** uploadtransfer.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef UPLOADTRANSFER_H
+#define UPLOADTRANSFER_H
+
+#include "transfer.h"
+#include "libraryindex.h"
+
+/**
+ * @brief CUploadTransfer is an incoming connection requesting shared files. It is owned by
+ * Uploads and registered with Transfers; the constructor and destructor require both locks.
+ */
+class CUploadTransfer : public CTransfer
+{
+	Q_OBJECT
+public:
+	enum UploadTransferState
+	{
+		utsNull,
+		utsRequest,		// waiting for the next request
+		utsQueued,		// waiting in the upload queue until the next poll
+		utsUploading
+	};
+
+public:
+	UploadTransferState m_nState;
+	QString				m_sUserAgent;
+	LibraryFile			m_oFile;			// file being served
+	quint64				m_nOffset;			// file offset of the requested range
+	quint64				m_nLength;			// length of that range
+	quint64				m_nPosition;		// bytes of that range sent so far
+	quint32				m_tRequest;			// when the last request arrived
+	quint32				m_tLastSent;		// when data was last sent
+	int					m_nQueuePos;		// position in the upload queue, 0 if not queued
+
+public:
+	CUploadTransfer(QObject* parent = 0);
+	virtual ~CUploadTransfer();
+
+	virtual void onTimer(quint32 tNow = 0);
+};
+
+#endif // UPLOADTRANSFER_H
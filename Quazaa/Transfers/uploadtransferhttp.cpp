@@ -0,0 +1,512 @@
+/*
+** uploadtransferhttp.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "uploadtransferhttp.h"
+#include "uploads.h"
+#include "transfers.h"
+
+#include "Hashes/hash.h"
+#include "parser.h"
+#include "quazaaglobals.h"
+#include "quazaasettings.h"
+#include "securitymanager.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QTcpSocket>
+#include <QUrl>
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#include "debug_new.h"
+
+CUploadTransferHTTP::CUploadTransferHTTP(QObject* parent) :
+	CUploadTransfer(parent),
+	m_pFile(0),
+	m_bKeepAlive(false),
+	m_bHead(false),
+	m_bReleaseSlot(false),
+#ifdef Q_OS_LINUX
+	m_bSendfile(true)
+#else
+	m_bSendfile(false)
+#endif
+{
+}
+
+CUploadTransferHTTP::~CUploadTransferHTTP()
+{
+	delete m_pFile;
+}
+
+bool CUploadTransferHTTP::hasData()
+{
+	// the body is not in the output buffer, keep the rate controller coming back for it
+	if( m_nState == utsUploading && m_pSocket )
+		return true;
+
+	return CNetworkConnection::hasData();
+}
+
+void CUploadTransferHTTP::onConnectNode()
+{
+}
+
+void CUploadTransferHTTP::onDisconnectNode()
+{
+	QMutexLocker l(&Uploads.m_pSection);
+	QMutexLocker l2(&Transfers.m_pSection);
+
+	delete this;
+}
+
+void CUploadTransferHTTP::onError(QAbstractSocket::SocketError e)
+{
+	Q_UNUSED(e);
+
+	systemLog.postLog(LogSeverity::Debug, QString("Upload connection to %1 failed: %2").arg(m_oAddress.toStringWithPort()).arg(m_pSocket->errorString()));
+
+	onDisconnectNode();
+}
+
+void CUploadTransferHTTP::onRead()
+{
+	QMutexLocker l(&Uploads.m_pSection);
+
+	// pipelined requests wait in the input buffer until the current body has been sent
+	while( (m_nState == utsRequest || m_nState == utsQueued) && !m_bReleaseSlot && bytesAvailable() > 0 )
+	{
+		if( !readRequest() )
+			break;
+	}
+}
+
+/**
+  * The body of the current response has been sent: gives the upload slot back, so a queued
+  * client gets it before the next request of this one, and goes on with that request.
+  */
+void CUploadTransferHTTP::onContentSent()
+{
+	QMutexLocker l(&Uploads.m_pSection);
+
+	m_bReleaseSlot = false;
+	Uploads.releaseSlot(this);
+
+	if( !finishResponse() )
+		return;
+
+	while( (m_nState == utsRequest || m_nState == utsQueued) && bytesAvailable() > 0 )
+	{
+		if( !readRequest() )
+			break;
+	}
+}
+
+/**
+  * Sends the pending response headers, then as much of the body as nBytes allows.
+  * Called by the rate controller.
+  */
+qint64 CUploadTransferHTTP::writeToNetwork(qint64 nBytes)
+{
+	qint64 nWritten = 0;
+
+	if( !m_pOutput->isEmpty() )
+	{
+		nWritten = CNetworkConnection::writeToNetwork(nBytes);
+
+		if( nWritten <= 0 || !m_pOutput->isEmpty() )
+			return nWritten;
+
+		nBytes -= nWritten;
+	}
+
+	if( m_nState == utsUploading && nBytes > 0 )
+	{
+		const qint64 nSent = sendContent(nBytes);
+
+		if( nSent < 0 )
+			return nWritten > 0 ? nWritten : nSent;
+
+		nWritten += nSent;
+	}
+
+	return nWritten;
+}
+
+/**
+  * Reads and answers one request. Returns true if the next request may be read right away.
+  * Requires Locking: Uploads.m_pSection
+  */
+bool CUploadTransferHTTP::readRequest()
+{
+	ASSUME_LOCK(Uploads.m_pSection);
+
+	const qint32 nEnd = peek(bytesAvailable()).indexOf("\r\n\r\n");
+
+	if( nEnd < 0 )
+	{
+		if( bytesAvailable() > UPLOAD_HTTP_HEADER_MAX )
+		{
+			systemLog.postLog(LogSeverity::Debug, QString("Oversized request header from %1").arg(m_oAddress.toStringWithPort()));
+			m_bKeepAlive = false;
+			sendResponse(400, "Bad Request");
+			return finishResponse();
+		}
+		return false;
+	}
+
+	QString sHeaders = read(nEnd + 4);
+	m_tRequest = time(0);
+
+	const QStringList lRequest = sHeaders.left(sHeaders.indexOf("\r\n")).split(' ', QString::SkipEmptyParts);
+	if( lRequest.size() != 3 || !lRequest[2].startsWith("HTTP/1.", Qt::CaseInsensitive) )
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Invalid upload request from %1").arg(m_oAddress.toStringWithPort()));
+		m_bKeepAlive = false;
+		sendResponse(400, "Bad Request");
+		return finishResponse();
+	}
+
+	const QString sConnection = Parser::getHeaderValue(sHeaders, "Connection").toLower();
+	m_bKeepAlive = (lRequest[2] != "HTTP/1.0") ? (sConnection != "close") : (sConnection == "keep-alive");
+	m_bHead = (lRequest[0] == "HEAD");
+
+	if( !m_bHead && lRequest[0] != "GET" )
+	{
+		m_bKeepAlive = false;
+		sendResponse(501, "Not Implemented");
+		return finishResponse();
+	}
+
+	m_sUserAgent = Parser::getHeaderValue(sHeaders, "User-Agent");
+
+	if( securityManager.isAgentBlocked(m_sUserAgent) )
+	{
+		systemLog.postLog(LogSeverity::Debug, QString("Refusing upload to blocked client %1 at %2").arg(m_sUserAgent).arg(m_oAddress.toStringWithPort()));
+		m_bKeepAlive = false;
+		sendResponse(403, "Forbidden");
+		return finishResponse();
+	}
+
+	LibraryFile oFile;
+	bool bFound = false;
+
+	if( lRequest[1].startsWith("/uri-res/N2R?", Qt::CaseInsensitive) )
+	{
+		CHash* pHash = CHash::fromURN(QUrl::fromPercentEncoding(lRequest[1].mid(13).toLatin1()));
+
+		if( pHash )
+		{
+			bFound = libraryIndex.find(*pHash, oFile);
+			delete pHash;
+		}
+	}
+
+	if( !bFound )
+	{
+		sendResponse(404, "Not Found");
+		return finishResponse();
+	}
+
+	const QString sRange = Parser::getHeaderValue(sHeaders, "Range");
+
+	if( !parseRange(sRange, oFile.nSize) )
+	{
+		sendResponse(416, "Requested Range Not Satisfiable", "Content-Range: bytes */" + QString::number(oFile.nSize) + "\r\n");
+		return finishResponse();
+	}
+
+	// only a body takes a slot, HEAD requests are answered right away
+	const bool bBody = !m_bHead && m_nLength > 0;
+
+	if( bBody )
+	{
+		const int nSlot = Uploads.requestSlot(this);
+
+		if( nSlot < 0 )
+		{
+			m_bKeepAlive = false;
+			sendResponse(503, "Busy", "Retry-After: " + QString::number(quazaaSettings.Uploads.QueuePollMax / 1000) + "\r\n");
+			return finishResponse();
+		}
+
+		if( nSlot > 0 )
+		{
+			m_nState = utsQueued;
+			m_nQueuePos = nSlot;
+
+			sendResponse(503, "Busy Queued", QString("X-Queue: position=%1,length=%2,limit=%3,pollMin=%4,pollMax=%5\r\n")
+						 .arg(nSlot).arg(Uploads.queueLength()).arg(quazaaSettings.Uploads.MaxTransfers)
+						 .arg(quazaaSettings.Uploads.QueuePollMin / 1000).arg(quazaaSettings.Uploads.QueuePollMax / 1000));
+			return finishResponse();
+		}
+
+		m_nQueuePos = 0;
+	}
+
+	if( !openFile(oFile) )
+	{
+		if( bBody )
+		{
+			Uploads.releaseSlot(this);
+			m_nState = utsRequest;
+		}
+
+		sendResponse(404, "Not Found");
+		return finishResponse();
+	}
+
+	QString sResponseHeaders = "Accept-Ranges: bytes\r\n";
+
+	if( !m_oFile.baSHA1.isEmpty() )
+	{
+		CHash* pHash = CHash::fromRaw(m_oFile.baSHA1, CHash::SHA1);
+		if( pHash )
+		{
+			sResponseHeaders += "X-Content-URN: " + pHash->toURN() + "\r\n";
+			delete pHash;
+		}
+	}
+
+	m_nPosition = 0;
+
+	if( sRange.isEmpty() )
+	{
+		sendResponse(200, "OK", sResponseHeaders, m_nLength);
+	}
+	else
+	{
+		sResponseHeaders += "Content-Range: bytes " + QString::number(m_nOffset) + "-" + QString::number(m_nOffset + m_nLength - 1) + "/" + QString::number(m_oFile.nSize) + "\r\n";
+		sendResponse(206, "Partial Content", sResponseHeaders, m_nLength);
+	}
+
+	if( !bBody )
+		return finishResponse();
+
+	systemLog.postLog(LogSeverity::Debug, QString("Uploading %1 (%2 bytes at %3) to %4").arg(m_oFile.sName).arg(m_nLength).arg(m_nOffset).arg(m_oAddress.toStringWithPort()));
+
+	m_nState = utsUploading;
+	return false;
+}
+
+/**
+  * Sets m_nOffset and m_nLength from the Range header sRange for a file of nSize bytes.
+  * Only the first range of a list is served. Returns false if it can not be satisfied.
+  */
+bool CUploadTransferHTTP::parseRange(QString sRange, quint64 nSize)
+{
+	m_nOffset = 0;
+	m_nLength = nSize;
+
+	sRange = sRange.trimmed();
+
+	if( sRange.isEmpty() )
+		return true;
+
+	if( !sRange.startsWith("bytes", Qt::CaseInsensitive) || nSize == 0 )
+		return false;
+
+	sRange = sRange.mid(5).trimmed();
+	if( sRange.startsWith('=') )
+		sRange = sRange.mid(1);
+
+	sRange = sRange.section(',', 0, 0);
+
+	const int nDash = sRange.indexOf('-');
+	if( nDash < 0 )
+		return false;
+
+	const QString sFirst = sRange.left(nDash).trimmed();
+	const QString sLast = sRange.mid(nDash + 1).trimmed();
+
+	bool bOK = true;
+	quint64 nFirst = 0, nLast = nSize - 1;
+
+	if( sFirst.isEmpty() )
+	{
+		// suffix range, the last n bytes
+		const quint64 nSuffix = sLast.toULongLong(&bOK);
+		if( !bOK || nSuffix == 0 )
+			return false;
+
+		nFirst = (nSuffix >= nSize) ? 0 : nSize - nSuffix;
+	}
+	else
+	{
+		nFirst = sFirst.toULongLong(&bOK);
+		if( bOK && !sLast.isEmpty() )
+			nLast = qMin(nLast, sLast.toULongLong(&bOK));
+	}
+
+	if( !bOK || nFirst > nLast )
+		return false;
+
+	m_nOffset = nFirst;
+	m_nLength = nLast - nFirst + 1;
+
+	return true;
+}
+
+/**
+  * Opens the file of oFile for reading, unless it is open already. Fails if the file on disk
+  * no longer matches the catalogue.
+  */
+bool CUploadTransferHTTP::openFile(const LibraryFile& oFile)
+{
+	if( m_pFile && m_oFile.nFileID == oFile.nFileID )
+		return true;
+
+	delete m_pFile;
+	m_pFile = new QFile(oFile.sPath + '/' + oFile.sName);
+	m_oFile = oFile;
+
+	if( !m_pFile->open(QFile::ReadOnly) || (quint64)m_pFile->size() != oFile.nSize )
+	{
+		systemLog.postLog(LogSeverity::Warning, QString("Cannot upload %1: the file is missing or has changed").arg(m_pFile->fileName()));
+		delete m_pFile;
+		m_pFile = 0;
+		m_oFile.nFileID = 0;
+		return false;
+	}
+
+	return true;
+}
+
+void CUploadTransferHTTP::sendResponse(int nCode, const QString& sMessage, const QString& sHeaders, quint64 nLength)
+{
+	QByteArray baResponse;
+	baResponse += "HTTP/1.1 " + QString::number(nCode) + " " + sMessage + "\r\n";
+	baResponse += "Server: " + CQuazaaGlobals::USER_AGENT_STRING() + "\r\n";
+	baResponse += (m_bKeepAlive ? "Connection: Keep-Alive\r\n" : "Connection: close\r\n");
+	baResponse += "Content-Length: " + QString::number(nLength) + "\r\n";
+	if( nLength > 0 )
+		baResponse += "Content-Type: application/binary\r\n";
+	baResponse += sHeaders;
+	baResponse += "\r\n";
+
+	write(baResponse);
+}
+
+// Called once a response is complete. Returns true if the connection stays open for the next request.
+bool CUploadTransferHTTP::finishResponse()
+{
+	if( m_bKeepAlive )
+		return true;
+
+	closeGracefully();
+	return false;
+}
+
+/**
+  * Sends up to nBytes of the requested range. Returns the number of bytes sent, 0 if the socket
+  * can not take more right now or -1 if the upload failed.
+  * Requires Locking: Transfers.m_pSection
+  */
+qint64 CUploadTransferHTTP::sendContent(qint64 nBytes)
+{
+	nBytes = qMin<quint64>(nBytes, m_nLength - m_nPosition);
+	const quint64 nOffset = m_nOffset + m_nPosition;
+	qint64 nSent = -1;
+
+#ifdef Q_OS_LINUX
+	if( m_bSendfile )
+	{
+		// data written by Qt must leave first, sendfile() bypasses its buffer
+		if( m_pSocket->bytesToWrite() > 0 )
+			m_pSocket->flush();
+		if( m_pSocket->bytesToWrite() > 0 )
+			return 0;
+
+		off_t nFileOffset = nOffset;
+		nSent = ::sendfile(m_pSocket->socketDescriptor(), m_pFile->handle(), &nFileOffset, nBytes);
+
+		if( nSent < 0 )
+		{
+			if( errno == EAGAIN || errno == EINTR )
+				return 0;
+
+			if( errno == EINVAL || errno == ENOSYS )
+			{
+				// the file system does not support it, read the file instead
+				m_bSendfile = false;
+			}
+			else
+			{
+				systemLog.postLog(LogSeverity::Debug, QString("Upload to %1 failed: %2").arg(m_oAddress.toStringWithPort()).arg(strerror(errno)));
+				close();
+				return -1;
+			}
+		}
+	}
+#endif
+
+	if( !m_bSendfile )
+	{
+		if( m_pSocket->bytesToWrite() >= UPLOAD_HTTP_BUFFERED )
+			return 0;
+
+		QByteArray baData;
+		if( m_pFile->seek(nOffset) )
+			baData = m_pFile->read(qMin<qint64>(nBytes, UPLOAD_HTTP_CHUNK));
+
+		nSent = baData.isEmpty() ? 0 : m_pSocket->write(baData);
+	}
+
+	if( nSent <= 0 )
+	{
+		// nothing could be read, the file has been truncated since it was opened
+		systemLog.postLog(LogSeverity::Warning, QString("Cannot read %1 for uploading").arg(m_pFile->fileName()));
+		close();
+		return -1;
+	}
+
+	m_nPosition += nSent;
+	m_tLastSent = time(0);
+	m_mOutput.Add(nSent);
+
+	if( m_nPosition == m_nLength )
+	{
+		// Uploads.m_pSection must not be taken under Transfers.m_pSection
+		m_nState = utsRequest;
+		m_bReleaseSlot = true;
+		QMetaObject::invokeMethod(this, "onContentSent", Qt::QueuedConnection);
+	}
+
+	return nSent;
+}
+
+// Closes the connection once the data queued for it has been sent.
+void CUploadTransferHTTP::closeGracefully()
+{
+	m_nState = utsNull;
+
+	if( !m_pOutput->isEmpty() )
+		CNetworkConnection::writeToNetwork(m_pOutput->size());
+
+	m_pSocket->disconnectFromHost();
+}
@@ -0,0 +1,85 @@
+/*
+** uploadtransferhttp.h
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef UPLOADTRANSFERHTTP_H
+#define UPLOADTRANSFERHTTP_H
+
+#include "uploadtransfer.h"
+
+class QFile;
+
+#define UPLOAD_HTTP_HEADER_MAX	16384	// longest request header accepted
+#define UPLOAD_HTTP_CHUNK		65536	// bytes read from the file at once where sendfile() is not used
+#define UPLOAD_HTTP_BUFFERED	262144	// data kept queued in the socket where sendfile() is not used
+
+/**
+ * @brief CUploadTransferHTTP serves shared files to Gnutella/G2 clients: GET and HEAD requests
+ * for /uri-res/N2R?<urn> with an optional byte range, answered with 200/206, or with
+ * 503 and an X-Queue header while the client waits for an upload slot. A slot is held only
+ * while a body is sent, HEAD requests need none. Connections are kept alive between requests,
+ * pipelined requests are answered once the current body has been sent.
+ * On Linux the body is passed from the file to the socket with sendfile(), so file data is
+ * never copied through the connection buffers; elsewhere it is read in chunks.
+ * Locking: the slots take Uploads.m_pSection, the body is sent by the rate controller under
+ * Transfers.m_pSection. Both run in the Transfers thread.
+ */
+class CUploadTransferHTTP : public CUploadTransfer
+{
+	Q_OBJECT
+
+protected:
+	QFile*		m_pFile;		// opened file of m_oFile
+	bool		m_bKeepAlive;	// client keeps the connection open after the current response
+	bool		m_bHead;		// the current request is a HEAD request
+	bool		m_bReleaseSlot;	// the body has been sent, onContentSent() gives the slot back
+	bool		m_bSendfile;	// the body is sent with sendfile()
+
+public:
+	CUploadTransferHTTP(QObject* parent = 0);
+	virtual ~CUploadTransferHTTP();
+
+	virtual bool hasData();
+
+public slots:
+	void onConnectNode();
+	void onDisconnectNode();
+	void onRead();
+	void onError(QAbstractSocket::SocketError e);
+
+protected slots:
+	void onContentSent();
+
+protected:
+	virtual qint64 writeToNetwork(qint64 nBytes);
+
+	bool readRequest();
+	bool parseRange(QString sRange, quint64 nSize);
+	bool openFile(const LibraryFile& oFile);
+	void sendResponse(int nCode, const QString& sMessage, const QString& sHeaders = QString(), quint64 nLength = 0);
+	bool finishResponse();
+	qint64 sendContent(qint64 nBytes);
+	void closeGracefully();
+};
+
+#endif // UPLOADTRANSFERHTTP_H
@@ -86,7 +86,7 @@ void CDialogHashProgress::onHasherFinished(int nId)
 		hide();
 }
 
-void CDialogHashProgress::onHashingProgress(int nId, QString sFilename, double nPercent, int nRate)
+void CDialogHashProgress::onHashingProgress(int nId, QString sFilename, double nPercent, qint64 nRate)
 {
 	if( !m_lProgress.contains(nId) )
 		return;
@@ -56,7 +56,7 @@ signals:
 public slots:
 	void onHasherStarted(int nId);
 	void onHasherFinished(int nId);
-	void onHashingProgress(int nId, QString sFilename, double nPercent, int nRate);
+	void onHashingProgress(int nId, QString sFilename, double nPercent, qint64 nRate);
 	void onRemainingFilesChanged(qint32 nRemaining);
 	void setSkin();
 };
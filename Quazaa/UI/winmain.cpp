@@ -931,7 +931,7 @@ void CWinMain::onHasherStarted(int nId)
 		pDialog = new CDialogHashProgress(this);
 		connect(&ShareManager, SIGNAL(hasherStarted(int)), pDialog, SLOT(onHasherStarted(int)));
 		connect(&ShareManager, SIGNAL(hasherFinished(int)), pDialog, SLOT(onHasherFinished(int)));
-		connect(&ShareManager, SIGNAL(hashingProgress(int,QString,double,int)), pDialog, SLOT(onHashingProgress(int,QString,double,int)));
+		connect(&ShareManager, SIGNAL(hashingProgress(int,QString,double,qint64)), pDialog, SLOT(onHashingProgress(int,QString,double,qint64)));
 		connect(&ShareManager, SIGNAL(remainingFilesChanged(qint32)), pDialog, SLOT(onRemainingFilesChanged(qint32)));
 	}
 	pDialog->onHasherStarted(nId);
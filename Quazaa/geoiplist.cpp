@@ -22,160 +22,342 @@
 ** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <string.h>
+
 #include <QApplication>
-#include <QFile>
 #include <QFileInfo>
+#include <QHash>
+#include <QStringList>
 #include <QTextStream>
+#include <QVector>
 #include "geoiplist.h"
 #include "types.h"
 #include "systemlog.h"
+#include "commonfunctions.h"
+#include "quazaaglobals.h"
 
 #include "debug_new.h"
 
 CGeoIPList geoIP;
 
-CGeoIPList::CGeoIPList()
+static const char    GEOIP_MAGIC[4] = { 'Q', 'G', 'I', 'P' };
+static const quint32 GEOIP_BOM      = 0x01020304; // detects files written on other platforms
+
+struct CGeoIPList::Header
+{
+	char		szMagic[4];
+	quint32		nBOM;
+	quint32		nVersion;
+	quint32		nCount;
+	CountryID	pCountries[256];
+};
+
+struct GeoIPRange
+{
+	quint32 nStart;
+	quint32 nEnd;
+	quint8  nCountry;
+
+	inline bool operator<(const GeoIPRange& rhs) const
+	{
+		return nStart < rhs.nStart;
+	}
+};
+
+struct GeoIPDatabase
+{
+	QVector<GeoIPRange> vRanges;     // 1-based Eytzinger layout, vRanges[0] is unused
+	QVector<CountryID>  vCountries;
+};
+
+// Size of the country index array padded to keep the file size a multiple of 4 bytes.
+static inline quint32 countryArraySize(quint32 nCount)
+{
+	return ( nCount + 3 ) & ~3u;
+}
+
+// Copies the sorted ranges into vOut in the order of an in-order traversal of an implicit binary
+// tree (node k has the children 2k and 2k + 1). Returns the next index to read from vIn.
+static int toEytzinger(const QVector<GeoIPRange>& vIn, QVector<GeoIPRange>& vOut, int i, int k)
+{
+	if ( k < vOut.size() )
+	{
+		i = toEytzinger( vIn, vOut, i, 2 * k );
+		vOut[k] = vIn.at( i++ );
+		i = toEytzinger( vIn, vOut, i, 2 * k + 1 );
+	}
+
+	return i;
+}
+
+CGeoIPList::CGeoIPList() :
+	m_pMap( NULL ),
+	m_nCount( 0 ),
+	m_pEnd( NULL ),
+	m_pStart( NULL ),
+	m_pCountry( NULL ),
+	m_pCountries( NULL )
 {
 	m_bListLoaded = false;
 }
 
-void CGeoIPList::loadGeoIP()
+CGeoIPList::~CGeoIPList()
 {
-	const QString sOriginalFile(qApp->applicationDirPath() + "/GeoIP/geoip.dat");
-	const QString sSerializedFile(qApp->applicationDirPath() + "/geoIP.ser");
+	close();
+}
 
-	bool readFromOriginalGeoIP = false;
-	//First trying to deserialize from ser file
+void CGeoIPList::loadGeoIP()
+{
+	const QString sOriginalFile( qApp->applicationDirPath() + "/GeoIP/geoip.dat" );
+	const QString sDatabaseFile( CQuazaaGlobals::DATA_PATH() + "geoip.bin" );
 
-	QFile iFile( sSerializedFile );
+	close();
 
-	if( QFile::exists(sSerializedFile) && QFile::exists(sOriginalFile) )
+	if ( QFile::exists( sDatabaseFile ) && QFile::exists( sOriginalFile ) )
 	{
-		QFileInfo iOriginal(sOriginalFile);
-		QFileInfo iSerialized(sSerializedFile);
+		QFileInfo iOriginal( sOriginalFile );
+		QFileInfo iDatabase( sDatabaseFile );
 
-		if( iOriginal.lastModified() > iSerialized.lastModified() )
+		if ( iOriginal.lastModified() > iDatabase.lastModified() )
 		{
-			systemLog.postLog(LogSeverity::Warning, QObject::tr("GeoIP data modified, refreshing..."));
-			iFile.remove();
+			systemLog.postLog( LogSeverity::Warning, QObject::tr( "GeoIP data modified, refreshing..." ) );
+			QFile::remove( sDatabaseFile );
 		}
 	}
 
-	if ( ! iFile.open( QIODevice::ReadOnly ))
+	if ( !open( sDatabaseFile ) )
 	{
-		systemLog.postLog(LogSeverity::Warning, QObject::tr("Unable to load GeoIP serialization file for loading"));
-		readFromOriginalGeoIP = true;
-	}
-	else
-	{
-		try
-		{
-			QDataStream iStream( &iFile );
-			iStream >> m_lDatabase;
-		}
-		catch(...)
+		if ( !build( sOriginalFile ) || !open( sDatabaseFile ) )
 		{
-			systemLog.postLog(LogSeverity::Warning, QObject::tr("Unable to deserialize GeoIP list"));
-			readFromOriginalGeoIP = true;
+			systemLog.postLog( LogSeverity::Warning, QObject::tr( "Unable to load GeoIP database" ) );
+			return;
 		}
-		iFile.close();
 	}
 
+	// The serialized list used by previous versions is not needed anymore.
+	QFile::remove( qApp->applicationDirPath() + "/geoIP.ser" );
+
+	m_bListLoaded = m_nCount;
+}
+
+QString CGeoIPList::findCountryCode(const quint32 nIp) const
+{
+	return countryCode( findCountryID( nIp ) );
+}
 
-	if(readFromOriginalGeoIP)
+CountryID CGeoIPList::findCountryID(const quint32 nIp) const
+{
+	if ( !m_bListLoaded )
 	{
-		QFile file(sOriginalFile);
-		if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
-		{
-			return;
-		}
+		return countryID( "ZZ" );
+	}
 
-		m_lDatabase.clear();
+	// Descend to the first range ending at or after nIp. The ranges do not overlap, so
+	// this is the only range that may contain nIp.
+	quint32 k = 1;
+	while ( k <= m_nCount )
+	{
+		k = 2 * k + ( m_pEnd[k] < nIp );
+	}
 
-		// TODO: optimize it
+	// Undo the right turns taken after the last left turn.
+	while ( k & 1 )
+	{
+		k >>= 1;
+	}
+	k >>= 1;
 
-		QTextStream in(&file);
-		while(!in.atEnd())
-		{
-			QStringList line = in.readLine().split(" ");
+	if ( k && m_pStart[k] <= nIp )
+	{
+		return m_pCountries[m_pCountry[k]];
+	}
 
-			if( line.size() != 3 )
-			{
-				systemLog.postLog(LogSeverity::Warning, "[GeoIP] Bad line, skippig");
-				continue;
-			}
-			CEndPoint rBegin(line[0] + ":0");
-			CEndPoint rEnd(line[1] + ":0");
-			QString sCountry = line[2];
+	return countryID( "ZZ" );
+}
 
-			GeoIPEntry item = QPair<quint32, QPair<quint32, QString> >(rBegin.toIPv4Address(), QPair<quint32, QString>(rEnd.toIPv4Address(), sCountry));
-			m_lDatabase.append(item);
-		}
+/**
+  * Maps the binary database stored at sPath into memory. Returns false if the file does not exist
+  * or is not valid.
+  */
+bool CGeoIPList::open(const QString& sPath)
+{
+	m_oFile.setFileName( sPath );
+	if ( !m_oFile.exists() || !m_oFile.open( QIODevice::ReadOnly ) )
+		return false;
 
-		QFile oFile( qApp->applicationDirPath() +  "/geoIP.ser" );
-		if ( ! oFile.open( QIODevice::WriteOnly ) )
-		{
-			systemLog.postLog(LogSeverity::Error, QObject::tr("Unable to open GeoIP serialization file for saving"));
-		}
-		else
-		{
-			try
-			{
-				QDataStream oStream( &oFile );
-				oStream << m_lDatabase;
-			}
-			catch(...)
-			{
-				systemLog.postLog(LogSeverity::Error, QObject::tr("Unable to serialize GeoIP list"));
-			}
-			oFile.close();
-		}
+	const qint64 nSize = m_oFile.size();
+	if ( nSize < (qint64)sizeof( Header ) )
+	{
+		m_oFile.close();
+		return false;
+	}
 
+	m_pMap = m_oFile.map( 0, nSize );
+	if ( !m_pMap )
+	{
+		m_oFile.close();
+		return false;
 	}
 
-	// sort the database so binary search can work
-	qSort(m_lDatabase);
+	const Header* pHeader = (const Header*)m_pMap;
 
-	m_bListLoaded = !m_lDatabase.isEmpty();
+	const quint32 nCount = pHeader->nCount;
+	const qint64 nExpected = sizeof( Header ) + 2ll * nCount * sizeof( quint32 ) +
+							 countryArraySize( nCount );
+
+	if ( memcmp( pHeader->szMagic, GEOIP_MAGIC, 4 ) || pHeader->nBOM != GEOIP_BOM ||
+		 pHeader->nVersion != GEOIP_DATABASE_VERSION || nExpected != nSize )
+	{
+		systemLog.postLog( LogSeverity::Warning,
+						   QObject::tr( "Ignoring invalid GeoIP database: %1" ).arg( sPath ) );
+		close();
+		return false;
+	}
+
+	const quint32* pData = (const quint32*)( m_pMap + sizeof( Header ) );
+
+	// The arrays are stored 0-based; shift the pointers so they can be indexed by tree node.
+	m_nCount     = nCount;
+	m_pEnd       = pData - 1;
+	m_pStart     = pData + nCount - 1;
+	m_pCountry   = (const quint8*)( pData + 2 * nCount ) - 1;
+	m_pCountries = pHeader->pCountries;
+
+	return true;
 }
 
-QString CGeoIPList::findCountryCode(const quint32 nIp) const
+void CGeoIPList::close()
 {
-	if ( !m_bListLoaded )
+	if ( m_pMap )
 	{
-		return "ZZ";
+		m_oFile.unmap( m_pMap );
+		m_pMap = NULL;
 	}
 
-	int nMiddle;
-	int nBegin = 0;
-	int nEnd = m_lDatabase.size();
-
-	int n = nEnd - nBegin;
+	if ( m_oFile.isOpen() )
+		m_oFile.close();
 
-	int nHalf;
+	m_nCount      = 0;
+	m_pEnd        = NULL;
+	m_pStart      = NULL;
+	m_pCountry    = NULL;
+	m_pCountries  = NULL;
+	m_bListLoaded = false;
+}
 
-	while (n > 0)
+/**
+  * Parses the GeoIP text file and writes the binary database to the data directory.
+  */
+bool CGeoIPList::build(const QString& sSource)
+{
+	QFile file( sSource );
+	if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
 	{
-		nHalf = n >> 1;
+		return false;
+	}
 
-		nMiddle = nBegin + nHalf;
+	QVector<GeoIPRange> vSorted;
+	QHash<CountryID, quint8> lhCountries;
+	GeoIPDatabase oDatabase;
+
+	// Index 0 is reserved for unknown countries.
+	oDatabase.vCountries.append( countryID( "ZZ" ) );
+	lhCountries.insert( countryID( "ZZ" ), 0 );
+
+	QTextStream in( &file );
+	while ( !in.atEnd() )
+	{
+		QStringList line = in.readLine().split( " " );
 
-		if (nIp < m_lDatabase.at(nMiddle).first )
+		if ( line.size() != 3 )
 		{
-			n = nHalf;
+			systemLog.postLog( LogSeverity::Warning, "[GeoIP] Bad line, skippig" );
+			continue;
 		}
-		else
+
+		const CountryID nCountry = countryID( line[2] );
+
+		if ( !lhCountries.contains( nCountry ) )
 		{
-			if( nIp <= m_lDatabase.at(nMiddle).second.first )
+			if ( oDatabase.vCountries.size() == 256 )
 			{
-				return m_lDatabase.at(nMiddle).second.second;
+				systemLog.postLog( LogSeverity::Warning, "[GeoIP] Too many countries, skipping" );
+				continue;
 			}
-			nBegin = nMiddle + 1;
-			n -= nHalf + 1;
+
+			lhCountries.insert( nCountry, (quint8)oDatabase.vCountries.size() );
+			oDatabase.vCountries.append( nCountry );
+		}
+
+		GeoIPRange oRange;
+		oRange.nStart   = CEndPoint( line[0] + ":0" ).toIPv4Address();
+		oRange.nEnd     = CEndPoint( line[1] + ":0" ).toIPv4Address();
+		oRange.nCountry = lhCountries.value( nCountry );
+
+		if ( oRange.nStart <= oRange.nEnd )
+		{
+			vSorted.append( oRange );
+		}
+	}
+
+	file.close();
+
+	qSort( vSorted );
+
+	// Drop overlapping ranges; the lookup relies on range ends being sorted as well.
+	int nCount = 0;
+	for ( int i = 0; i < vSorted.size(); ++i )
+	{
+		if ( !nCount || vSorted.at( i ).nStart > vSorted.at( nCount - 1 ).nEnd )
+		{
+			vSorted[nCount++] = vSorted.at( i );
 		}
 	}
+	vSorted.resize( nCount );
+
+	oDatabase.vRanges.resize( nCount + 1 );
+	toEytzinger( vSorted, oDatabase.vRanges, 0, 1 );
+
+	QString sMessage = QObject::tr( "[GeoIP] " );
+	return common::securedSaveFile( CQuazaaGlobals::DATA_PATH(), "geoip.bin", sMessage,
+									&oDatabase, &CGeoIPList::writeToFile );
+}
+
+/**
+  * Helper method for build()
+  */
+quint32 CGeoIPList::writeToFile(const void * const pDatabase, QFile& oFile)
+{
+	const GeoIPDatabase* pData = (const GeoIPDatabase*)pDatabase;
+	const quint32 nCount = pData->vRanges.size() - 1;
+
+	Header oHeader;
+	memset( &oHeader, 0, sizeof( Header ) );
+	memcpy( oHeader.szMagic, GEOIP_MAGIC, 4 );
+	oHeader.nBOM     = GEOIP_BOM;
+	oHeader.nVersion = GEOIP_DATABASE_VERSION;
+	oHeader.nCount   = nCount;
+	memcpy( oHeader.pCountries, pData->vCountries.constData(),
+			pData->vCountries.size() * sizeof( CountryID ) );
+
+	QVector<quint32> vEnd( nCount ), vStart( nCount );
+	QByteArray baCountry( countryArraySize( nCount ), '\0' );
+
+	for ( quint32 i = 0; i < nCount; ++i )
+	{
+		const GeoIPRange& oRange = pData->vRanges.at( i + 1 );
+		vEnd[i]      = oRange.nEnd;
+		vStart[i]    = oRange.nStart;
+		baCountry[i] = (char)oRange.nCountry;
+	}
+
+	oFile.write( (const char*)&oHeader, sizeof( Header ) );
+	oFile.write( (const char*)vEnd.constData(), nCount * sizeof( quint32 ) );
+	oFile.write( (const char*)vStart.constData(), nCount * sizeof( quint32 ) );
+	oFile.write( baCountry );
 
-	return "ZZ";
+	// securedSaveFile() treats 0 as failure; an empty database is still a valid one.
+	return nCount + 1;
 }
 
 QString CGeoIPList::countryNameFromCode(const QString& code) const
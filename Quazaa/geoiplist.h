@@ -27,16 +27,41 @@
 
 #include "types.h"
 
+#include <QFile>
 #include <QObject>
-#include <QList>
-#include <QPair>
 
-typedef QPair<quint32, QPair<quint32, QString> > GeoIPEntry;
+// Increment this if there have been made changes to the binary GeoIP database layout.
+#define GEOIP_DATABASE_VERSION 1
+// History:
+// 1 - Initial implementation, replacing the serialized QList of geoIP.ser
 
+// Compact country identifier: the two letters of the ISO country code packed into 16 bits.
+typedef quint16 CountryID;
+
+/**
+ * @brief CGeoIPList maps IPv4 addresses to countries. The ranges parsed from GeoIP/geoip.dat are
+ * stored in a packed binary file (parallel range end and range start arrays in Eytzinger order plus
+ * a one byte country index per range) which is memory mapped on startup, so lookups neither
+ * allocate nor copy strings. Callers that look up the same address repeatedly should cache the
+ * CountryID returned by findCountryID().
+ */
 class CGeoIPList
 {
 protected:
 	bool	m_bListLoaded;
+
+private:
+	struct Header;
+
+	QFile				m_oFile;
+	uchar*				m_pMap;
+	quint32				m_nCount;
+
+	const quint32*		m_pEnd;			// 1-based Eytzinger layout: m_pEnd[1] is the root
+	const quint32*		m_pStart;		// same layout as m_pEnd
+	const quint8*		m_pCountry;		// same layout as m_pEnd
+	const CountryID*	m_pCountries;	// country index -> CountryID
+
 public:
 	struct sGeoID
 	{
@@ -45,15 +70,29 @@ public:
 	};
 	sGeoID GeoID;
 
-	QList<GeoIPEntry> m_lDatabase;
-
 	CGeoIPList();
+	~CGeoIPList();
+
 	void loadGeoIP();
 	inline QString findCountryCode(const QString& IP) const;
 	inline QString findCountryCode(const QHostAddress& ip) const;
 
 	QString findCountryCode(const quint32 nIp) const;
 	QString countryNameFromCode(const QString& code) const;
+
+	inline CountryID findCountryID(const QHostAddress& ip) const;
+	CountryID findCountryID(const quint32 nIp) const;
+
+	static inline CountryID countryID(const QString& sCode);
+	static inline QString countryCode(const CountryID nID);
+
+private:
+	bool open(const QString& sPath);
+	void close();
+	static bool build(const QString& sSource);
+	static quint32 writeToFile(const void * const pDatabase, QFile& oFile);
+
+	Q_DISABLE_COPY(CGeoIPList)
 };
 
 QString CGeoIPList::findCountryCode(const QString& IP) const
@@ -63,14 +102,34 @@ QString CGeoIPList::findCountryCode(const QString& IP) const
 }
 
 QString CGeoIPList::findCountryCode(const QHostAddress& ip) const
+{
+	return countryCode( findCountryID( ip ) );
+}
+
+CountryID CGeoIPList::findCountryID(const QHostAddress& ip) const
 {
 	if ( ip.protocol() == 1 ) // IPv6
 	{
-		return "ZZ";
+		return countryID( "ZZ" );
 	}
 
-	const quint32 ip4 = ip.toIPv4Address();
-	return findCountryCode( ip4 );
+	return findCountryID( ip.toIPv4Address() );
+}
+
+CountryID CGeoIPList::countryID(const QString& sCode)
+{
+	if ( sCode.size() != 2 )
+	{
+		return countryID( "ZZ" );
+	}
+
+	return ( (CountryID)sCode.at( 0 ).toLatin1() << 8 ) | (quint8)sCode.at( 1 ).toLatin1();
+}
+
+QString CGeoIPList::countryCode(const CountryID nID)
+{
+	const char szCode[3] = { (char)( nID >> 8 ), (char)( nID & 0xFF ), 0 };
+	return QString::fromLatin1( szCode );
 }
 
 extern CGeoIPList geoIP;
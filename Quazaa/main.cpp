@@ -38,7 +38,9 @@
 #include "sharemanager.h"
 #include "commonfunctions.h"
 #include "transfers.h"
+#include "trafficshaper.h"
 #include "hostcache.h"
+#include "Hashes/hash.h"
 
 #include "Discovery/discovery.h"
 #include "securitymanager.h"
@@ -226,6 +228,9 @@ int main(int argc, char *argv[])
 		wzrdQuickStart->exec();
 	}
 
+	// Share the connection speeds between the traffic classes
+	TrafficShaper.start();
+
 	// Load Security Manager
 	dlgSplash->updateProgress( 15, QObject::tr( "Loading Security Manager..." ) );
 	qApp->processEvents();
@@ -243,6 +248,9 @@ int main(int argc, char *argv[])
 	qApp->processEvents();
 	quazaaSettings.loadProfile();
 
+	//initialize geoip list - required by the Host Cache to sort hosts by country
+	geoIP.loadGeoIP();
+
 	//Load Host Cache
 	dlgSplash->updateProgress( 30, QObject::tr( "Loading Host Cache..." ) );
 	qApp->processEvents();
@@ -250,13 +258,11 @@ int main(int argc, char *argv[])
 	hostCache.load();
 	hostCache.m_pSection.unlock();
 
-	//initialize geoip list
-	geoIP.loadGeoIP();
-
 	//Load the library
 	dlgSplash->updateProgress( 38, QObject::tr( "Loading Library..." ) );
 	qApp->processEvents();
 	QueryHashMaster.create();
+	CHash::selfTest();
 	ShareManager.start();
 
 	// Load Download Manager
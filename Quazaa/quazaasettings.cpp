@@ -155,6 +155,7 @@ void CQuazaaSettings::saveSettings()
 	m_qSettings.setValue("Metadata", quazaaSettings.Downloads.Metadata);
 	m_qSettings.setValue("MinSources", quazaaSettings.Downloads.MinSources);
 	m_qSettings.setValue("NeverDrop", quazaaSettings.Downloads.NeverDrop);
+	m_qSettings.setValue("Preallocate", quazaaSettings.Downloads.Preallocate);
 	m_qSettings.setValue("PushTimeout", quazaaSettings.Downloads.PushTimeout);
 	m_qSettings.setValue("QueueLimit", quazaaSettings.Downloads.QueueLimit);
 	m_qSettings.setValue("RequestHash", quazaaSettings.Downloads.RequestHash);
@@ -437,10 +438,12 @@ void CQuazaaSettings::saveSettings()
 	m_qSettings.setValue("FreeBandwidthValue", quazaaSettings.Uploads.FreeBandwidthValue);
 	m_qSettings.setValue("HubShareLimiting", quazaaSettings.Uploads.HubShareLimiting);
 	m_qSettings.setValue("MaxPerHost", quazaaSettings.Uploads.MaxPerHost);
+	m_qSettings.setValue("MaxTransfers", quazaaSettings.Uploads.MaxTransfers);
 	m_qSettings.setValue("PreviewQuality", quazaaSettings.Uploads.PreviewQuality);
 	m_qSettings.setValue("PreviewTransfers", quazaaSettings.Uploads.PreviewTransfers);
 	m_qSettings.setValue("QueuePollMax", quazaaSettings.Uploads.QueuePollMax);
 	m_qSettings.setValue("QueuePollMin", quazaaSettings.Uploads.QueuePollMin);
+	m_qSettings.setValue("QueueSize", quazaaSettings.Uploads.QueueSize);
 	m_qSettings.setValue("RewardQueuePercentage", quazaaSettings.Uploads.RewardQueuePercentage);
 	m_qSettings.setValue("RotateChunkLimit", quazaaSettings.Uploads.RotateChunkLimit);
 	m_qSettings.setValue("ShareHashset", quazaaSettings.Uploads.ShareHashset);
@@ -472,6 +475,8 @@ void CQuazaaSettings::saveSettings()
 	m_qSettings.setValue("ShareMonkeyOkay", quazaaSettings.WebServices.ShareMonkeyOkay);
 	m_qSettings.setValue("ShareMonkeySaveThumbnail", quazaaSettings.WebServices.ShareMonkeySaveThumbnail);
 	m_qSettings.endGroup();
+
+	emit connectionSettingsChanged();
 }
 
 /*!
@@ -571,6 +576,7 @@ void CQuazaaSettings::loadSettings()
 	quazaaSettings.Downloads.Metadata = m_qSettings.value("Metadata", true).toBool();
 	quazaaSettings.Downloads.MinSources = m_qSettings.value("MinSources", 1).toInt();
 	quazaaSettings.Downloads.NeverDrop = m_qSettings.value("NeverDrop", false).toBool();
+	quazaaSettings.Downloads.Preallocate = m_qSettings.value("Preallocate", false).toBool();
 	quazaaSettings.Downloads.PushTimeout = m_qSettings.value("PushTimeout", 45000).toInt();
 	quazaaSettings.Downloads.QueueLimit = m_qSettings.value("QueueLimit", 3).toInt();
 	quazaaSettings.Downloads.RequestHash = m_qSettings.value("RequestHash", true).toBool();
@@ -685,7 +691,7 @@ void CQuazaaSettings::loadSettings()
 	quazaaSettings.Library.GhostFiles = m_qSettings.value("GhostFiles", true).toBool();
 	quazaaSettings.Library.HashWindow = m_qSettings.value("HashWindow", true).toBool();
 	quazaaSettings.Library.HighPriorityHashing = m_qSettings.value("HighPriorityHashing", false).toInt();
-	quazaaSettings.Library.HighPriorityHashingSpeed = m_qSettings.value("HighPriorityHashingSpeed", 20).toBool();
+	quazaaSettings.Library.HighPriorityHashingSpeed = m_qSettings.value("HighPriorityHashingSpeed", 20).toInt();
 	quazaaSettings.Library.HistoryDays = m_qSettings.value("HistoryDays", 3).toInt();
 	quazaaSettings.Library.HistoryTotal = m_qSettings.value("HistoryTotal", 32).toInt();
 	quazaaSettings.Library.LowPriorityHashingSpeed = m_qSettings.value("LowPriorityHashingSpeed", 2).toInt();
@@ -867,10 +873,12 @@ void CQuazaaSettings::loadSettings()
 	quazaaSettings.Uploads.FreeBandwidthValue = m_qSettings.value("FreeBandwidthValue", 20).toInt();
 	quazaaSettings.Uploads.HubShareLimiting = m_qSettings.value("HubShareLimiting", true).toBool();
 	quazaaSettings.Uploads.MaxPerHost = m_qSettings.value("MaxPerHost", 2).toInt();
+	quazaaSettings.Uploads.MaxTransfers = m_qSettings.value("MaxTransfers", 4).toInt();
 	quazaaSettings.Uploads.PreviewQuality = m_qSettings.value("PreviewQuality", 70).toInt();
 	quazaaSettings.Uploads.PreviewTransfers = m_qSettings.value("PreviewTransfers", 3).toInt();
 	quazaaSettings.Uploads.QueuePollMax = m_qSettings.value("QueuePollMax", 120000).toInt();
 	quazaaSettings.Uploads.QueuePollMin = m_qSettings.value("QueuePollMin", 45000).toInt();
+	quazaaSettings.Uploads.QueueSize = m_qSettings.value("QueueSize", 32).toInt();
 	quazaaSettings.Uploads.RewardQueuePercentage = m_qSettings.value("RewardQueuePercentage", 10).toInt();
 	quazaaSettings.Uploads.RotateChunkLimit = m_qSettings.value("RotateChunkLimit", 1024).toInt();
 	quazaaSettings.Uploads.ShareHashset = m_qSettings.value("ShareHashset", true).toBool();
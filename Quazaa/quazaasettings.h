@@ -215,6 +215,7 @@ namespace Settings
 		bool		Metadata;								// Download metadata (ID3 tags, etc.)
 		int			MinSources;								// The minimum number of sources a download has before Quazaa regards it as having a problem
 		bool		NeverDrop;								// Do not drop bad sources (may pollute source list with many dead sources)
+		bool		Preallocate;							// Reserve the full size of incomplete files on disk when they are created (otherwise they are sparse)
 		int			PushTimeout;							// Lower transfer timeout for push sources
 		int			QueueLimit;								// Longest queue to wait in. (0 to disable. This should be >800 or 0 to get good performance from ed2k)
 		bool		RequestHash;							// Request unknown hashes from active download sources
@@ -590,10 +591,12 @@ namespace Settings
 		int			FreeBandwidthValue;						// Amount of bandwidth remaining for uploads
 		bool		HubShareLimiting;						// Limit sharing in hub mode
 		int			MaxPerHost;								// Max simultaneous uploads to one remote client
+		int			MaxTransfers;							// Max simultaneous uploads, further requests are queued
 		int			PreviewQuality;							// Quality of dynamically created previews
 		int			PreviewTransfers;						// Max simultaneous uploads of previews
 		int			QueuePollMax;
 		int			QueuePollMin;
+		int			QueueSize;								// Max clients waiting in the upload queue
 		int			RewardQueuePercentage;					// The percentage of each reward queue reserved for uploaders
 		int			RotateChunkLimit;						// Limit on the size of rotating chunks
 		bool		ShareHashset;							// Share the hashset for a particular file
@@ -763,6 +766,7 @@ public:
 
 signals:
 	void chatSettingsChanged();
+	void connectionSettingsChanged();
 	void securitySettingsChanged();
 };
 
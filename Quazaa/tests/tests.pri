@@ -0,0 +1,54 @@
+#
+# tests.pri
+#
+# Copyright © Quazaa Development Team, 2009-2013.
+# This file is part of QUAZAA (quazaa.sourceforge.net)
+#
+# Quazaa is free software; this file may be used under the terms of the GNU
+# General Public License version 3.0 or later as published by the Free Software
+# Foundation and appearing in the file LICENSE.GPL included in the
+# packaging of this file.
+#
+# Quazaa is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# Please review the following information to ensure the GNU General Public
+# License version 3.0 requirements will be met:
+# http://www.gnu.org/copyleft/gpl.html.
+#
+# You should have received a copy of the GNU General Public License version
+# 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+
+# Shared settings of the unit tests and benchmarks. Each test compiles the Quazaa sources it
+# needs itself (QUAZAA_SOURCES) instead of linking against the application.
+
+QT = core network testlib
+CONFIG += testcase console no_testcase_installs
+CONFIG -= app_bundle
+
+QUAZAA_SOURCES = $$PWD/..
+
+INCLUDEPATH += $$QUAZAA_SOURCES \
+		$$QUAZAA_SOURCES/3rdparty \
+		$$QUAZAA_SOURCES/3rdparty/nvwa \
+		$$QUAZAA_SOURCES/FileFragments \
+		$$QUAZAA_SOURCES/HostCache \
+		$$QUAZAA_SOURCES/Misc \
+		$$QUAZAA_SOURCES/NetworkCore \
+		$$QUAZAA_SOURCES/Security \
+		$$QUAZAA_SOURCES/ShareManager \
+		$$QUAZAA_SOURCES/Transfers
+
+# Qt's zlib, as in Quazaa.pro
+INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+
+unix {
+		LIBS += -lz
+}
+
+CONFIG(debug, debug|release) {
+		DEFINES += _DEBUG
+}
@@ -0,0 +1,264 @@
+/*
+** tst_chunkselector.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtTest/QtTest>
+
+#include "chunkselector.h"
+
+// The simulated file: SIM_CHUNKS chunks of SIM_CHUNK bytes, each source delivers SIM_RATE bytes
+// per tick, so a chunk takes 4 ticks.
+static const quint64 SIM_CHUNK = 16384;
+static const int SIM_CHUNKS = 64;
+static const quint64 SIM_RATE = 4096;
+static const int SIM_TICKS_MAX = 5000;
+static const int SIM_FOREVER = SIM_TICKS_MAX;
+
+// A synthetic source: the ranges it has and when it goes offline.
+struct CSimulatedSource
+{
+	Fragments::List		oAvailable;	// empty: the complete file
+	int					tLeave;
+	bool				bRequest;
+	Fragments::Fragment	oRequest;	// what is left of its current request
+
+	CSimulatedSource(int tLeaveAt) :
+		oAvailable( SIM_CHUNK * SIM_CHUNKS ),
+		tLeave( tLeaveAt ),
+		bRequest( false ),
+		oRequest( 0, 0 )
+	{
+	}
+
+	void addChunks(int nFirst, int nEnd)
+	{
+		oAvailable.insert( Fragments::Fragment( nFirst * SIM_CHUNK, nEnd * SIM_CHUNK ) );
+	}
+};
+
+class tst_ChunkSelector : public QObject
+{
+	Q_OBJECT
+
+public:
+	tst_ChunkSelector()
+	{
+	}
+
+private:
+	// The order used before rarest-first: the first possible range, cut at the end of its chunk.
+	static bool sequentialBlock(const Fragments::List& oPossible, Fragments::Fragment& oBlock)
+	{
+		if ( oPossible.empty() )
+			return false;
+
+		const quint64 nBegin = oPossible.begin()->begin();
+		const quint64 nChunkEnd = ( nBegin / SIM_CHUNK + 1 ) * SIM_CHUNK;
+
+		oBlock = Fragments::Fragment( nBegin, qMin( oPossible.begin()->end(), nChunkEnd ) );
+		return true;
+	}
+
+	/**
+	  * Downloads the file from lSources one tick at a time, each source with one request in
+	  * flight, and returns the number of ticks until it was complete, or -1 if it never was
+	  * because the last source of a range left.
+	  */
+	static int simulate(QList<CSimulatedSource> lSources, bool bRarestFirst)
+	{
+		Fragments::List oCompleted( SIM_CHUNK * SIM_CHUNKS );
+
+		for ( int tNow = 0; tNow < SIM_TICKS_MAX; ++tNow )
+		{
+			QVector<quint16> vAvailability( SIM_CHUNKS, 0 );
+
+			for ( int i = 0; i < lSources.size(); ++i )
+			{
+				if ( tNow < lSources[i].tLeave )
+					CChunkSelector::addSource( vAvailability, lSources[i].oAvailable, SIM_CHUNK );
+				else
+					lSources[i].bRequest = false;
+			}
+
+			for ( int i = 0; i < lSources.size(); ++i )
+			{
+				CSimulatedSource& oSource = lSources[i];
+
+				if ( tNow >= oSource.tLeave )
+					continue;
+
+				if ( !oSource.bRequest )
+				{
+					Fragments::List oPossible = inverse( oCompleted );
+
+					if ( !oSource.oAvailable.empty() )
+					{
+						Fragments::List oTmp = intersect( oPossible, oSource.oAvailable );
+						oPossible.swap( oTmp );
+					}
+
+					for ( int j = 0; j < lSources.size(); ++j )
+					{
+						if ( j != i && lSources[j].bRequest )
+							oPossible.erase( lSources[j].oRequest );
+					}
+
+					oSource.bRequest = bRarestFirst ? CChunkSelector::nextBlock( oPossible, vAvailability, SIM_CHUNK, SIM_CHUNK, oSource.oRequest )
+													: sequentialBlock( oPossible, oSource.oRequest );
+				}
+
+				if ( oSource.bRequest )
+				{
+					const quint64 nEnd = qMin( oSource.oRequest.end(), oSource.oRequest.begin() + SIM_RATE );
+					oCompleted.insert( Fragments::Fragment( oSource.oRequest.begin(), nEnd ) );
+
+					if ( nEnd == oSource.oRequest.end() )
+						oSource.bRequest = false;
+					else
+						oSource.oRequest = Fragments::Fragment( nEnd, oSource.oRequest.end() );
+				}
+			}
+
+			if ( oCompleted.missing() == 0 )
+				return tNow + 1;
+		}
+
+		return -1;
+	}
+
+private slots:
+	void availability()
+	{
+		QVector<quint16> vAvailability( 4, 0 );
+
+		CSimulatedSource oPartial( SIM_FOREVER );
+		oPartial.oAvailable.insert( Fragments::Fragment( 0, 10 ) );
+		oPartial.oAvailable.insert( Fragments::Fragment( 20, SIM_CHUNK + 1 ) );
+		oPartial.oAvailable.insert( Fragments::Fragment( 3 * SIM_CHUNK, 3 * SIM_CHUNK + 1 ) );
+
+		CChunkSelector::addSource( vAvailability, oPartial.oAvailable, SIM_CHUNK );
+		CChunkSelector::addSource( vAvailability, Fragments::List( SIM_CHUNK * 4 ), SIM_CHUNK );
+
+		// two ranges in chunk 0 count once, an empty list is the complete file
+		QCOMPARE( vAvailability, QVector<quint16>() << 2 << 2 << 1 << 2 );
+	}
+
+	void partialAndRarestFirst()
+	{
+		const quint64 nSize = SIM_CHUNK * 4;
+		QVector<quint16> vAvailability;
+		vAvailability << 3 << 1 << 2 << 1;
+
+		Fragments::Fragment oBlock( 0, 0 );
+		Fragments::List oPossible( nSize );
+
+		// the rarest chunk, the first of two equally rare ones
+		oPossible.insert( Fragments::Fragment( 0, nSize ) );
+		QVERIFY( CChunkSelector::nextBlock( oPossible, vAvailability, SIM_CHUNK, SIM_CHUNK, oBlock ) );
+		QCOMPARE( oBlock.begin(), SIM_CHUNK );
+		QCOMPARE( oBlock.end(), 2 * SIM_CHUNK );
+
+		// a chunk that is partially downloaded comes before rarer ones, and the block is capped
+		oPossible.erase( Fragments::Fragment( 0, 100 ) );
+		QVERIFY( CChunkSelector::nextBlock( oPossible, vAvailability, SIM_CHUNK, 1000, oBlock ) );
+		QCOMPARE( oBlock.begin(), quint64( 100 ) );
+		QCOMPARE( oBlock.end(), quint64( 1100 ) );
+
+		oPossible.clear();
+		QVERIFY( !CChunkSelector::nextBlock( oPossible, vAvailability, SIM_CHUNK, SIM_CHUNK, oBlock ) );
+	}
+
+	// A seed that leaves early is the only source of the last quarter of the file.
+	void seedLeaves()
+	{
+		QList<CSimulatedSource> lSources;
+		lSources << CSimulatedSource( 80 );
+
+		for ( int i = 0; i < 3; ++i )
+		{
+			lSources << CSimulatedSource( SIM_FOREVER );
+			lSources.last().addChunks( 0, 48 );
+		}
+
+		const int nRarest = simulate( lSources, true );
+		const int nSequential = simulate( lSources, false );
+
+		qDebug( "rarest-first: %d ticks, sequential: %d ticks", nRarest, nSequential );
+
+		QVERIFY( nRarest > 0 );
+		QCOMPARE( nSequential, -1 );
+	}
+
+	void randomSources_data()
+	{
+		QTest::addColumn<quint32>( "nSeed" );
+		QTest::addColumn<int>( "tSeedLeaves" );
+
+		for ( quint32 nSeed = 1; nSeed <= 5; ++nSeed )
+		{
+			QTest::newRow( qPrintable( QString( "seed %1, all stay" ).arg( nSeed ) ) ) << nSeed << SIM_FOREVER;
+			QTest::newRow( qPrintable( QString( "seed %1, seed leaves" ).arg( nSeed ) ) ) << nSeed << 56;
+		}
+	}
+
+	// A seed and three sources with a random half of the chunks each.
+	void randomSources()
+	{
+		QFETCH( quint32, nSeed );
+		QFETCH( int, tSeedLeaves );
+
+		QList<CSimulatedSource> lSources;
+		lSources << CSimulatedSource( tSeedLeaves );
+
+		quint32 nState = nSeed * 7919;
+
+		for ( int i = 0; i < 3; ++i )
+		{
+			lSources << CSimulatedSource( SIM_FOREVER );
+
+			for ( int nChunk = 0; nChunk < SIM_CHUNKS; ++nChunk )
+			{
+				nState = nState * 1103515245 + 12345;
+
+				if ( ( nState >> 16 ) % 2 )
+					lSources.last().addChunks( nChunk, nChunk + 1 );
+			}
+
+			QVERIFY( !lSources.last().oAvailable.empty() );
+		}
+
+		const int nRarest = simulate( lSources, true );
+		const int nSequential = simulate( lSources, false );
+
+		qDebug( "rarest-first: %d ticks, sequential: %d ticks", nRarest, nSequential );
+
+		// rarest-first finishes whenever the file is still out there, and not later
+		QVERIFY( nRarest > 0 );
+		if ( nSequential > 0 )
+			QVERIFY( nRarest <= nSequential );
+	}
+};
+
+QTEST_MAIN(tst_ChunkSelector)
+
+#include "tst_chunkselector.moc"
@@ -0,0 +1,249 @@
+/*
+** tst_downloadjournal.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QtEndian>
+
+#include "downloadjournal.h"
+#include "diskwriter.h"
+
+static const quint64 FILE_SIZE = 1000000;
+
+// The journal syncs through DiskWriter, which is not part of this test.
+bool CDiskWriter::syncFile(QFile* pFile)
+{
+	return pFile->flush();
+}
+
+class tst_DownloadJournal : public QObject
+{
+	Q_OBJECT
+
+public:
+	tst_DownloadJournal()
+	{
+	}
+
+private:
+	QTemporaryDir m_oDir;
+
+	static QByteArray header(quint64 nFileSize = FILE_SIZE)
+	{
+		return CDownloadJournal::record( CDownloadJournal::jrHeader, nFileSize, DOWNLOAD_JOURNAL_VERSION );
+	}
+	static QByteArray completed(quint64 nBegin, quint64 nEnd)
+	{
+		return CDownloadJournal::record( CDownloadJournal::jrCompleted, nBegin, nEnd );
+	}
+	static QByteArray verified(quint64 nBegin, quint64 nEnd)
+	{
+		return CDownloadJournal::record( CDownloadJournal::jrVerified, nBegin, nEnd );
+	}
+	static QByteArray erased(quint64 nBegin, quint64 nEnd)
+	{
+		return CDownloadJournal::record( CDownloadJournal::jrErased, nBegin, nEnd );
+	}
+
+	// "0-4096 8192-12288"
+	static QString toString(const Fragments::List& oList)
+	{
+		QStringList lRanges;
+
+		for ( Fragments::List::const_iterator it = oList.begin(); it != oList.end(); ++it )
+			lRanges << QString( "%1-%2" ).arg( it->begin() ).arg( it->end() );
+
+		return lRanges.join( " " );
+	}
+	static Fragments::List fromString(const QString& sRanges)
+	{
+		Fragments::List oList( FILE_SIZE );
+
+		foreach ( const QString& sRange, sRanges.split( ' ', QString::SkipEmptyParts ) )
+			oList.insert( Fragments::Fragment( sRange.section( '-', 0, 0 ).toULongLong(), sRange.section( '-', 1, 1 ).toULongLong() ) );
+
+		return oList;
+	}
+
+	QString writeJournal(const QByteArray& baJournal)
+	{
+		const QString sPath = m_oDir.path() + "/" + QTest::currentDataTag() + ".!qj";
+		QFile oFile( sPath );
+
+		if ( !oFile.open( QFile::WriteOnly | QFile::Truncate ) || oFile.write( baJournal ) != baJournal.size() )
+			return QString();
+
+		return sPath;
+	}
+
+private slots:
+	void initTestCase()
+	{
+		QVERIFY( m_oDir.isValid() );
+	}
+
+	// The on-disk format: little endian magic, type, begin, end and the CRC-32 of those 20 bytes.
+	void recordLayout()
+	{
+		QCOMPARE( header().toHex(), QByteArray( "514a010040420f00000000000200000000000000d8657138" ) );
+		QCOMPARE( completed( 4096, 8192 ).toHex(), QByteArray( "514a020000100000000000000020000000000000f4919a01" ) );
+	}
+
+	void replay_data()
+	{
+		QTest::addColumn<QString>( "sSnapshot" );
+		QTest::addColumn<QByteArray>( "baJournal" );
+		QTest::addColumn<bool>( "bResult" );
+		QTest::addColumn<QString>( "sCompleted" );
+		QTest::addColumn<QString>( "sVerified" );
+
+		QTest::newRow( "empty" ) << "" << QByteArray() << true << "" << "";
+		QTest::newRow( "header" ) << "" << header() << true << "" << "";
+		QTest::newRow( "completed" ) << ""
+			<< header() + completed( 0, 4096 ) + completed( 8192, 12288 ) + completed( 4096, 6000 )
+			<< true << "0-6000 8192-12288" << "";
+		QTest::newRow( "verified" ) << ""
+			<< header() + completed( 0, 8192 ) + verified( 0, 4096 )
+			<< true << "0-8192" << "0-4096";
+		QTest::newRow( "erased" ) << ""
+			<< header() + completed( 0, 8192 ) + verified( 0, 8192 ) + erased( 4096, 8192 )
+			<< true << "0-4096" << "0-4096";
+		QTest::newRow( "verifiedFirst" ) << ""
+			<< header() + verified( 0, 4096 ) + completed( 0, 2048 )
+			<< true << "0-2048" << "0-2048";
+		QTest::newRow( "inSnapshot" ) << "0-4096"
+			<< header() + completed( 0, 4096 ) + completed( 2048, 8192 )
+			<< true << "0-8192" << "";
+		QTest::newRow( "outOfRange" ) << ""
+			<< header() + completed( 0, FILE_SIZE + 1 ) + completed( 4096, 4096 ) + completed( 8192, 4096 ) + completed( 4096, 8192 )
+			<< true << "4096-8192" << "";
+		QTest::newRow( "tornTail" ) << ""
+			<< header() + completed( 0, 4096 ) + completed( 4096, 8192 ).left( 10 )
+			<< true << "0-4096" << "";
+
+		QByteArray baDamaged = completed( 8192, 12288 );
+		baDamaged[5] = baDamaged[5] ^ 0x01;
+		QTest::newRow( "damaged" ) << ""
+			<< header() + completed( 0, 4096 ) + baDamaged + completed( 16384, 20480 )
+			<< true << "0-4096" << "";
+
+		QTest::newRow( "tornHeader" ) << "0-4096" << header().left( 20 ) << true << "0-4096" << "";
+		QTest::newRow( "otherFile" ) << "" << header( FILE_SIZE + 1 ) + completed( 0, 4096 ) << false << "" << "";
+
+		// version 1 used the 16 bit qChecksum(), its records are not read as valid
+		QByteArray baOld = header();
+		qToLittleEndian<quint32>( qChecksum( baOld.constData(), 20 ), (uchar*)baOld.data() + 20 );
+		QTest::newRow( "oldChecksum" ) << "" << baOld + completed( 0, 4096 ) << true << "" << "";
+	}
+
+	void replay()
+	{
+		QFETCH( QString, sSnapshot );
+		QFETCH( QByteArray, baJournal );
+		QFETCH( bool, bResult );
+		QFETCH( QString, sCompleted );
+		QFETCH( QString, sVerified );
+
+		const QString sPath = writeJournal( baJournal );
+		QVERIFY( !sPath.isEmpty() );
+
+		Fragments::List oCompleted = fromString( sSnapshot );
+		Fragments::List oVerified( FILE_SIZE );
+
+		QCOMPARE( CDownloadJournal::replay( sPath, FILE_SIZE, oCompleted, oVerified ), bResult );
+
+		if ( bResult )
+		{
+			QCOMPARE( toString( oCompleted ), sCompleted );
+			QCOMPARE( toString( oVerified ), sVerified );
+		}
+	}
+
+	void noJournal()
+	{
+		Fragments::List oCompleted = fromString( "0-4096" );
+		Fragments::List oVerified( FILE_SIZE );
+
+		QVERIFY( CDownloadJournal::replay( m_oDir.path() + "/missing.!qj", FILE_SIZE, oCompleted, oVerified ) );
+		QCOMPARE( toString( oCompleted ), QString( "0-4096" ) );
+		QCOMPARE( toString( oVerified ), QString() );
+	}
+
+	// Reopening cuts a torn record off, so records written afterwards are replayed.
+	void appendAfterTornRecord()
+	{
+		const QString sPath = m_oDir.path() + "/append.!qj";
+
+		{
+			CDownloadJournal oJournal( sPath, FILE_SIZE );
+			QVERIFY( oJournal.reset() );
+			QVERIFY( oJournal.write( completed( 0, 4096 ) ) );
+			QCOMPARE( oJournal.length(), qint64( 2 * DOWNLOAD_JOURNAL_RECORD ) );
+		}
+
+		QFile oFile( sPath );
+		QVERIFY( oFile.open( QFile::Append ) );
+		QCOMPARE( oFile.write( completed( 4096, 8192 ).left( 7 ) ), qint64( 7 ) );
+		oFile.close();
+
+		{
+			CDownloadJournal oJournal( sPath, FILE_SIZE );
+			QVERIFY( oJournal.write( completed( 8192, 12288 ) + erased( 0, 1024 ) ) );
+			QCOMPARE( oJournal.length(), qint64( 4 * DOWNLOAD_JOURNAL_RECORD ) );
+		}
+
+		Fragments::List oCompleted( FILE_SIZE );
+		Fragments::List oVerified( FILE_SIZE );
+
+		QVERIFY( CDownloadJournal::replay( sPath, FILE_SIZE, oCompleted, oVerified ) );
+		QCOMPARE( toString( oCompleted ), QString( "1024-4096 8192-12288" ) );
+	}
+
+	// A journal of a different file is started over rather than appended to.
+	void resetOtherFile()
+	{
+		const QString sPath = m_oDir.path() + "/other.!qj";
+
+		{
+			CDownloadJournal oJournal( sPath, FILE_SIZE + 1 );
+			QVERIFY( oJournal.reset() );
+			QVERIFY( oJournal.write( completed( 0, 4096 ) ) );
+		}
+
+		{
+			CDownloadJournal oJournal( sPath, FILE_SIZE );
+			QVERIFY( oJournal.write( completed( 8192, 12288 ) ) );
+		}
+
+		Fragments::List oCompleted( FILE_SIZE );
+		Fragments::List oVerified( FILE_SIZE );
+
+		QVERIFY( CDownloadJournal::replay( sPath, FILE_SIZE, oCompleted, oVerified ) );
+		QCOMPARE( toString( oCompleted ), QString( "8192-12288" ) );
+	}
+};
+
+QTEST_MAIN(tst_DownloadJournal)
+
+#include "tst_downloadjournal.moc"
@@ -0,0 +1,352 @@
+/*
+** tst_downloadtransferhttp.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtTest/QtTest>
+#include <QCryptographicHash>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+
+#include "download.h"
+#include "downloads.h"
+#include "transfers.h"
+#include "uploads.h"
+#include "queryhit.h"
+#include "quazaasettings.h"
+
+// The upload side of Transfers is not part of this test.
+CUploads Uploads;
+
+CUploads::CUploads(QObject* parent) :
+	QObject(parent)
+{
+}
+
+CUploads::~CUploads()
+{
+}
+
+void CUploads::stop()
+{
+}
+
+// Delay before the stand-in server answers, so pipelined requests can pile up.
+static const int STANDIN_ANSWER_DELAY = 20;
+// Time a download may take, including the retries after errors (Downloads polls once a second).
+static const int DOWNLOAD_TIMEOUT = 30000;
+
+/**
+ * @brief CStandInServer serves one file with HTTP/1.1 range requests, like a Gnutella client
+ * would on /uri-res/N2R. It can answer the first requests with canned responses and cut off
+ * the bodies of the next ones, and records what the client asked for.
+ */
+class CStandInServer : public QTcpServer
+{
+	Q_OBJECT
+
+public:
+	QByteArray			m_baContent;
+	QList<QByteArray>	m_lScript;			// canned responses for the first requests
+	int					m_nShortResponses;	// then this many bodies are cut off halfway
+
+	int					m_nConnections;
+	int					m_nRequests;
+	int					m_nBadRequests;		// requests without a valid range
+	int					m_nMaxPending;		// most requests waiting on one connection at a time
+
+public:
+	CStandInServer(const QByteArray& baContent) :
+		m_baContent(baContent),
+		m_nShortResponses(0),
+		m_nConnections(0),
+		m_nRequests(0),
+		m_nBadRequests(0),
+		m_nMaxPending(0)
+	{
+	}
+
+	// Writes the answer to baRequest. Returns false if the connection should be closed.
+	bool respond(QTcpSocket* pSocket, const QByteArray& baRequest)
+	{
+		m_nRequests++;
+
+		if ( !m_lScript.isEmpty() )
+		{
+			const QByteArray baResponse = m_lScript.takeFirst();
+			pSocket->write( baResponse );
+			return !baResponse.contains( "Connection: close" );
+		}
+
+		QRegExp rxRange( "\r\nRange: bytes=(\\d+)-(\\d+)\r\n" );
+		if ( rxRange.indexIn( QString::fromLatin1( baRequest ) ) < 0
+			 || rxRange.cap( 1 ).toLongLong() > rxRange.cap( 2 ).toLongLong()
+			 || rxRange.cap( 2 ).toLongLong() >= m_baContent.size() )
+		{
+			m_nBadRequests++;
+			pSocket->write( "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n" );
+			return false;
+		}
+
+		const int nBegin = rxRange.cap( 1 ).toInt();
+		const int nLast = rxRange.cap( 2 ).toInt();
+		const QByteArray baBody = m_baContent.mid( nBegin, nLast + 1 - nBegin );
+
+		QByteArray baResponse = "HTTP/1.1 206 Partial Content\r\n";
+		baResponse += "Content-Range: bytes " + QByteArray::number( nBegin ) + "-" + QByteArray::number( nLast )
+					  + "/" + QByteArray::number( m_baContent.size() ) + "\r\n";
+		baResponse += "Content-Length: " + QByteArray::number( baBody.size() ) + "\r\n";
+		baResponse += "\r\n";
+
+		if ( m_nShortResponses > 0 )
+		{
+			m_nShortResponses--;
+			pSocket->write( baResponse + baBody.left( baBody.size() / 2 ) );
+			return false;
+		}
+
+		pSocket->write( baResponse + baBody );
+		return true;
+	}
+
+protected:
+	void incomingConnection(qintptr nHandle);
+};
+
+// One connection to the stand-in server.
+class CStandInConnection : public QObject
+{
+	Q_OBJECT
+
+	CStandInServer*	m_pServer;
+	QTcpSocket*		m_pSocket;
+	QByteArray		m_baRequests;	// received, not answered yet
+	QTimer			m_oAnswer;
+
+public:
+	CStandInConnection(CStandInServer* pServer, qintptr nHandle) :
+		QObject( pServer ),
+		m_pServer( pServer ),
+		m_pSocket( new QTcpSocket( this ) )
+	{
+		m_pSocket->setSocketDescriptor( nHandle );
+
+		m_oAnswer.setSingleShot( true );
+		m_oAnswer.setInterval( STANDIN_ANSWER_DELAY );
+
+		connect( m_pSocket, SIGNAL(readyRead()), this, SLOT(onReadyRead()) );
+		connect( m_pSocket, SIGNAL(disconnected()), this, SLOT(deleteLater()) );
+		connect( &m_oAnswer, SIGNAL(timeout()), this, SLOT(answer()) );
+	}
+
+private slots:
+	void onReadyRead()
+	{
+		m_baRequests += m_pSocket->readAll();
+
+		if ( !m_oAnswer.isActive() )
+			m_oAnswer.start();
+	}
+
+	void answer()
+	{
+		m_pServer->m_nMaxPending = qMax( m_pServer->m_nMaxPending, m_baRequests.count( "\r\n\r\n" ) );
+
+		int nEnd;
+		while ( (nEnd = m_baRequests.indexOf( "\r\n\r\n" )) >= 0 )
+		{
+			const QByteArray baRequest = m_baRequests.left( nEnd + 4 );
+			m_baRequests.remove( 0, nEnd + 4 );
+
+			if ( !m_pServer->respond( m_pSocket, baRequest ) )
+			{
+				m_pSocket->disconnectFromHost();
+				return;
+			}
+		}
+	}
+};
+
+void CStandInServer::incomingConnection(qintptr nHandle)
+{
+	m_nConnections++;
+	new CStandInConnection( this, nHandle );
+}
+
+class tst_DownloadTransferHTTP : public QObject
+{
+	Q_OBJECT
+
+	QTemporaryDir m_oDir;
+
+public:
+	tst_DownloadTransferHTTP()
+	{
+	}
+
+private:
+	static QByteArray content(int nSize)
+	{
+		QByteArray baContent( nSize, '\0' );
+		quint32 nState = 0x12345678;
+
+		for ( int i = 0; i < nSize; ++i )
+		{
+			nState = nState * 1103515245 + 12345;
+			baContent[i] = char( nState >> 24 );
+		}
+
+		return baContent;
+	}
+
+	// Adds a download of the file oServer serves, with oServer as its only source.
+	CDownload* addDownload(const CStandInServer& oServer, const QString& sName)
+	{
+		CQueryHit* pHit = new CQueryHit();
+		pHit->m_pHitInfo = QSharedPointer<QueryHitInfo>( new QueryHitInfo() );
+		pHit->m_pHitInfo->m_oNodeAddress = CEndPoint( QHostAddress( QHostAddress::LocalHost ), oServer.serverPort() );
+		pHit->m_pHitInfo->m_oNodeGUID = QUuid::createUuid();
+		pHit->m_lHashes.append( CHash( QCryptographicHash::hash( oServer.m_baContent, QCryptographicHash::Sha1 ), CHash::SHA1 ) );
+		pHit->m_sDescriptiveName = sName;
+		pHit->m_nObjectSize = oServer.m_baContent.size();
+
+		QSignalSpy oAdded( &Downloads, SIGNAL(downloadAdded(CDownload*)) );
+
+		Downloads.m_pSection.lock();
+		Downloads.add( pHit );
+		Downloads.m_pSection.unlock();
+
+		delete pHit;
+
+		return oAdded.isEmpty() ? 0 : qvariant_cast<CDownload*>( oAdded.first().at( 0 ) );
+	}
+
+	static CDownload::DownloadState state(CDownload* pDownload)
+	{
+		QMutexLocker l( &Downloads.m_pSection );
+		return pDownload->m_nState;
+	}
+
+	static QByteArray fileContent(CDownload* pDownload)
+	{
+		QMutexLocker l( &Downloads.m_pSection );
+
+		QFile oFile( quazaaSettings.Downloads.IncompletePath + "/" + pDownload->m_sTempName );
+		return oFile.open( QFile::ReadOnly ) ? oFile.readAll() : QByteArray();
+	}
+
+private slots:
+	void initTestCase()
+	{
+		QVERIFY( m_oDir.isValid() );
+
+		quazaaSettings.Downloads.IncompletePath = m_oDir.path();
+		quazaaSettings.Downloads.ChunkStrap = 65536;
+		quazaaSettings.Downloads.MaxFiles = 10;
+		quazaaSettings.Downloads.MaxTransfers = 10;
+		quazaaSettings.Downloads.MaxTransfersPerFile = 1;
+		quazaaSettings.Downloads.MinSources = 1;
+		quazaaSettings.Downloads.SourcesWanted = 1;
+		quazaaSettings.Downloads.NeverDrop = true;
+		quazaaSettings.Downloads.MaxAllowedFailures = 10;
+		quazaaSettings.Downloads.QueueLimit = 0;
+		quazaaSettings.Downloads.RequestHTTP11 = true;
+		quazaaSettings.Downloads.RetryDelay = 0;
+		quazaaSettings.Connection.TimeoutConnect = 10;
+		quazaaSettings.Connection.TimeoutTraffic = 10;
+
+		Transfers.start();
+	}
+
+	void cleanupTestCase()
+	{
+		Transfers.stop();
+	}
+
+	// A keep-alive connection carries several requests in flight and the file arrives intact.
+	void pipelinedRanges()
+	{
+		CStandInServer oServer( content( 65536 + 123 ) );
+		QVERIFY( oServer.listen( QHostAddress::LocalHost ) );
+
+		CDownload* pDownload = addDownload( oServer, "pipelined.bin" );
+		QVERIFY( pDownload );
+
+		QTRY_COMPARE_WITH_TIMEOUT( state( pDownload ), CDownload::dsCompleted, DOWNLOAD_TIMEOUT );
+
+		QCOMPARE( fileContent( pDownload ), oServer.m_baContent );
+		QCOMPARE( oServer.m_nBadRequests, 0 );
+		QCOMPARE( oServer.m_nConnections, 1 );
+		QVERIFY( oServer.m_nRequests > 1 );
+		QVERIFY( oServer.m_nMaxPending >= 2 );
+	}
+
+	// Busy, refused and unsatisfiable answers are retried until the file is complete.
+	void errorResponses()
+	{
+		CStandInServer oServer( content( 20000 ) );
+		QVERIFY( oServer.listen( QHostAddress::LocalHost ) );
+
+		oServer.m_lScript << "HTTP/1.1 503 Busy\r\nRetry-After: 1\r\nContent-Length: 0\r\n\r\n"
+						  << "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nNot found"
+						  << "HTTP/1.1 416 Requested Range Not Satisfiable\r\nX-Available-Ranges: bytes 0-19999\r\n"
+							 "Content-Length: 0\r\n\r\n"
+						  << "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+		CDownload* pDownload = addDownload( oServer, "errors.bin" );
+		QVERIFY( pDownload );
+
+		QTRY_COMPARE_WITH_TIMEOUT( state( pDownload ), CDownload::dsCompleted, DOWNLOAD_TIMEOUT );
+
+		QVERIFY( oServer.m_lScript.isEmpty() );
+		QCOMPARE( fileContent( pDownload ), oServer.m_baContent );
+		QCOMPARE( oServer.m_nBadRequests, 0 );
+
+		// the busy, refused and failed answers each cost the connection, the 416 does not
+		QVERIFY( oServer.m_nConnections >= 4 );
+	}
+
+	// Bodies cut off by the server and a mismatching Content-Range never end up in the file.
+	void shortResponses()
+	{
+		CStandInServer oServer( content( 30000 ) );
+		QVERIFY( oServer.listen( QHostAddress::LocalHost ) );
+
+		oServer.m_lScript << "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 0-9/1000\r\nContent-Length: 10\r\n\r\n0123456789";
+		oServer.m_nShortResponses = 2;
+
+		CDownload* pDownload = addDownload( oServer, "short.bin" );
+		QVERIFY( pDownload );
+
+		QTRY_COMPARE_WITH_TIMEOUT( state( pDownload ), CDownload::dsCompleted, DOWNLOAD_TIMEOUT );
+
+		QCOMPARE( oServer.m_nShortResponses, 0 );
+		QCOMPARE( fileContent( pDownload ), oServer.m_baContent );
+		QCOMPARE( oServer.m_nBadRequests, 0 );
+		QVERIFY( oServer.m_nConnections >= 4 );
+	}
+};
+
+QTEST_MAIN(tst_DownloadTransferHTTP)
+
+#include "tst_downloadtransferhttp.moc"
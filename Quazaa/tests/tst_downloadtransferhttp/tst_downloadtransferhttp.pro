@@ -0,0 +1,82 @@
+#
+# tst_downloadtransferhttp.pro
+#
+# Copyright © Quazaa Development Team, 2009-2013.
+# This file is part of QUAZAA (quazaa.sourceforge.net)
+#
+# Quazaa is free software; this file may be used under the terms of the GNU
+# General Public License version 3.0 or later as published by the Free Software
+# Foundation and appearing in the file LICENSE.GPL included in the
+# packaging of this file.
+#
+# Quazaa is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# Please review the following information to ensure the GNU General Public
+# License version 3.0 requirements will be met:
+# http://www.gnu.org/copyleft/gpl.html.
+#
+# You should have received a copy of the GNU General Public License version
+# 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+TARGET = tst_downloadtransferhttp
+
+include(../tests.pri)
+
+QT += gui widgets
+
+# The download side of Transfers runs for real against a stand-in server; the upload side is
+# stubbed in the test.
+HEADERS += $$QUAZAA_SOURCES/systemlog.h \
+		$$QUAZAA_SOURCES/quazaaglobals.h \
+		$$QUAZAA_SOURCES/quazaasettings.h \
+		$$QUAZAA_SOURCES/NetworkCore/thread.h \
+		$$QUAZAA_SOURCES/NetworkCore/networkconnection.h \
+		$$QUAZAA_SOURCES/NetworkCore/ratecontroller.h \
+		$$QUAZAA_SOURCES/NetworkCore/trafficshaper.h \
+		$$QUAZAA_SOURCES/Transfers/diskwriter.h \
+		$$QUAZAA_SOURCES/Transfers/download.h \
+		$$QUAZAA_SOURCES/Transfers/downloads.h \
+		$$QUAZAA_SOURCES/Transfers/downloadsource.h \
+		$$QUAZAA_SOURCES/Transfers/downloadtransfer.h \
+		$$QUAZAA_SOURCES/Transfers/downloadtransferhttp.h \
+		$$QUAZAA_SOURCES/Transfers/transfer.h \
+		$$QUAZAA_SOURCES/Transfers/transfers.h \
+		$$QUAZAA_SOURCES/Transfers/uploads.h
+
+SOURCES += tst_downloadtransferhttp.cpp \
+		$$QUAZAA_SOURCES/commonfunctions.cpp \
+		$$QUAZAA_SOURCES/quazaaglobals.cpp \
+		$$QUAZAA_SOURCES/quazaasettings.cpp \
+		$$QUAZAA_SOURCES/systemlog.cpp \
+		$$QUAZAA_SOURCES/Discovery/networktype.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/buffer.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/endpoint.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/g2packet.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/networkconnection.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/parser.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/queryhit.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/ratecontroller.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/thread.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/trafficshaper.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/hash.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/hashset.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/sha1.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/tiger.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/tigertree.cpp \
+		$$QUAZAA_SOURCES/3rdparty/CyoEncode/CyoEncode.c \
+		$$QUAZAA_SOURCES/3rdparty/CyoEncode/CyoDecode.c \
+		$$QUAZAA_SOURCES/Transfers/chunkselector.cpp \
+		$$QUAZAA_SOURCES/Transfers/diskwriter.cpp \
+		$$QUAZAA_SOURCES/Transfers/download.cpp \
+		$$QUAZAA_SOURCES/Transfers/downloadjournal.cpp \
+		$$QUAZAA_SOURCES/Transfers/downloads.cpp \
+		$$QUAZAA_SOURCES/Transfers/downloadsource.cpp \
+		$$QUAZAA_SOURCES/Transfers/downloadtransfer.cpp \
+		$$QUAZAA_SOURCES/Transfers/downloadtransferhttp.cpp \
+		$$QUAZAA_SOURCES/Transfers/sourcestore.cpp \
+		$$QUAZAA_SOURCES/Transfers/transfer.cpp \
+		$$QUAZAA_SOURCES/Transfers/transfers.cpp \
+		$$QUAZAA_SOURCES/Transfers/transferstats.cpp
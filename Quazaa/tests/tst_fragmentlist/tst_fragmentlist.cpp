@@ -0,0 +1,527 @@
+/*
+** tst_fragmentlist.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtTest/QtTest>
+#include <QBitArray>
+
+#include <set>
+#include <vector>
+
+#include "FileFragments.hpp"
+
+static const quint64 LIST_LIMIT = 100;
+
+// Fragments::List with chunks of 4 ranges, so a few ranges already split and join chunks.
+typedef Ranges::List< Fragments::Fragment, Fragments::ListTraits, Ranges::ChunkedVector< Fragments::Fragment,
+		Ranges::RangeCompare< quint64, Ranges::EmptyType >, std::allocator< Fragments::Fragment >, 4 > > SmallChunkList;
+static const int SMALL_LIMIT = 2000;
+
+// The benchmark file: 50 GB with 50000 completed and 7000 available fragments in random order.
+static const quint64 BENCH_SIZE = Q_UINT64_C( 50 ) << 30;
+static const int BENCH_COMPLETED = 50000;
+static const int BENCH_AVAILABLE = 7000;
+
+typedef std::vector< Fragments::Fragment > FlatRanges;
+typedef std::set< Fragments::Fragment, Ranges::RangeCompare< quint64, Ranges::EmptyType > > TreeRanges;
+
+// The layouts the benchmarks compare.
+enum Layout
+{
+	layoutChunked,	// Fragments::List
+	layoutTree,		// CTreeFragments
+	layoutFlat		// CFlatFragments
+};
+
+Q_DECLARE_METATYPE(Layout)
+
+/**
+ * The layout Fragments::List used before: ranges in a std::set, merged on insert. A range is
+ * inserted anywhere in O( log( n ) ), but every range is a node of its own, so building the result
+ * of a merge allocates once per range.
+ */
+struct CTreeFragments
+{
+	TreeRanges lRanges;
+
+	void insert(const Fragments::Fragment& oRange)
+	{
+		// one more on each side, so touching ranges are merged as well
+		const Fragments::Fragment oKey( oRange.begin() ? oRange.begin() - 1 : 0, oRange.end() + 1 );
+		std::pair< TreeRanges::iterator, TreeRanges::iterator > itMerge = lRanges.equal_range( oKey );
+
+		quint64 nBegin = oRange.begin(), nEnd = oRange.end();
+
+		if ( itMerge.first != itMerge.second )
+		{
+			TreeRanges::iterator itLast = itMerge.second;
+			nBegin = qMin( nBegin, itMerge.first->begin() );
+			nEnd = qMax( nEnd, ( --itLast )->end() );
+			lRanges.erase( itMerge.first, itMerge.second );
+		}
+
+		lRanges.insert( itMerge.second, Fragments::Fragment( nBegin, nEnd ) );
+	}
+
+	static TreeRanges subtract(const TreeRanges& lhs, const TreeRanges& rhs)
+	{
+		TreeRanges lResult;
+		TreeRanges::const_iterator j = rhs.begin();
+
+		for ( TreeRanges::const_iterator i = lhs.begin(); i != lhs.end(); ++i )
+		{
+			quint64 nLow = i->begin();
+
+			while ( j != rhs.end() && j->end() <= nLow )
+				++j;
+
+			for ( ; j != rhs.end() && j->begin() < i->end(); ++j )
+			{
+				if ( nLow < j->begin() )
+					lResult.insert( lResult.end(), Fragments::Fragment( nLow, j->begin() ) );
+
+				nLow = j->end();
+
+				if ( nLow > i->end() )
+					break;
+			}
+
+			if ( nLow < i->end() )
+				lResult.insert( lResult.end(), Fragments::Fragment( nLow, i->end() ) );
+		}
+
+		return lResult;
+	}
+};
+
+/**
+ * A single sorted std::vector of ranges, merged on insert. Lookups are binary searches and merges
+ * need no allocation per range, but inserting in the middle moves every range behind it.
+ */
+struct CFlatFragments
+{
+	FlatRanges vRanges;
+
+	static bool endsBefore(const Fragments::Fragment& oRange, quint64 nPos)
+	{
+		return oRange.end() < nPos;
+	}
+	static bool beginsAfter(quint64 nPos, const Fragments::Fragment& oRange)
+	{
+		return nPos < oRange.begin();
+	}
+
+	void insert(const Fragments::Fragment& oRange)
+	{
+		// the ranges oRange overlaps or touches
+		FlatRanges::iterator itFirst = std::lower_bound( vRanges.begin(), vRanges.end(), oRange.begin(), endsBefore );
+		FlatRanges::iterator itLast = std::upper_bound( itFirst, vRanges.end(), oRange.end(), beginsAfter );
+
+		if ( itFirst == itLast )
+		{
+			vRanges.insert( itFirst, oRange );
+			return;
+		}
+
+		*itFirst = Fragments::Fragment( qMin( itFirst->begin(), oRange.begin() ), qMax( ( itLast - 1 )->end(), oRange.end() ) );
+		vRanges.erase( itFirst + 1, itLast );
+	}
+
+	static FlatRanges subtract(const FlatRanges& lhs, const FlatRanges& rhs)
+	{
+		FlatRanges vResult;
+		vResult.reserve( lhs.size() );
+		FlatRanges::const_iterator j = rhs.begin();
+
+		for ( FlatRanges::const_iterator i = lhs.begin(); i != lhs.end(); ++i )
+		{
+			quint64 nLow = i->begin();
+
+			while ( j != rhs.end() && j->end() <= nLow )
+				++j;
+
+			for ( ; j != rhs.end() && j->begin() < i->end(); ++j )
+			{
+				if ( nLow < j->begin() )
+					vResult.push_back( Fragments::Fragment( nLow, j->begin() ) );
+
+				nLow = j->end();
+
+				if ( nLow > i->end() )
+					break;
+			}
+
+			if ( nLow < i->end() )
+				vResult.push_back( Fragments::Fragment( nLow, i->end() ) );
+		}
+
+		return vResult;
+	}
+};
+
+class tst_FragmentList : public QObject
+{
+	Q_OBJECT
+
+public:
+	tst_FragmentList()
+	{
+	}
+
+private:
+	QList<Fragments::Fragment> m_lCompleted;	// benchmark input, in the order it arrives
+	QList<Fragments::Fragment> m_lAvailable;
+
+	// "0-10 20-30"
+	static QString toString(const Fragments::List& oList)
+	{
+		QStringList lRanges;
+
+		for ( Fragments::List::const_iterator it = oList.begin(); it != oList.end(); ++it )
+			lRanges << QString( "%1-%2" ).arg( it->begin() ).arg( it->end() );
+
+		return lRanges.join( " " );
+	}
+	static Fragments::Fragment toRange(const QString& sRange)
+	{
+		return Fragments::Fragment( sRange.section( '-', 0, 0 ).toULongLong(), sRange.section( '-', 1, 1 ).toULongLong() );
+	}
+	static Fragments::List fromString(const QString& sRanges)
+	{
+		Fragments::List oList( LIST_LIMIT );
+
+		foreach ( const QString& sRange, sRanges.split( ' ', QString::SkipEmptyParts ) )
+			oList.insert( toRange( sRange ) );
+
+		return oList;
+	}
+
+	// The bytes covered by oList; empty if the ranges are not sorted, separate and non-empty.
+	static QBitArray toBits(const SmallChunkList& oList)
+	{
+		QBitArray baBits( SMALL_LIMIT );
+		quint64 nLast = 0;
+
+		for ( SmallChunkList::const_iterator it = oList.begin(); it != oList.end(); ++it )
+		{
+			if ( !it->size() || ( it != oList.begin() && it->begin() <= nLast ) )
+				return QBitArray();
+
+			baBits.fill( true, it->begin(), it->end() );
+			nLast = it->end();
+		}
+
+		return baBits;
+	}
+
+	static quint64 random(quint64& nState)
+	{
+		nState = nState * Q_UINT64_C( 6364136223846793005 ) + Q_UINT64_C( 1442695040888963407 );
+		return nState >> 16;
+	}
+
+	static QList<Fragments::Fragment> randomRanges(int nCount, quint64 nMaxLength, quint64 nSeed)
+	{
+		QList<Fragments::Fragment> lRanges;
+
+		for ( int i = 0; i < nCount; ++i )
+		{
+			const quint64 nLength = 1 + random( nSeed ) % nMaxLength;
+			const quint64 nBegin = random( nSeed ) % ( BENCH_SIZE - nLength );
+
+			lRanges << Fragments::Fragment( nBegin, nBegin + nLength );
+		}
+
+		return lRanges;
+	}
+
+private slots:
+	void initTestCase()
+	{
+		m_lCompleted = randomRanges( BENCH_COMPLETED, 65536, 1 );
+		m_lAvailable = randomRanges( BENCH_AVAILABLE, 10000000, 2 );
+	}
+
+	// "+a-b" inserts, "-a-b" erases; sReturns are the lengths each of them added or removed.
+	void insertErase_data()
+	{
+		QTest::addColumn<QString>( "sOperations" );
+		QTest::addColumn<QString>( "sReturns" );
+		QTest::addColumn<QString>( "sResult" );
+
+		QTest::newRow( "disjoint" ) << "+20-30 +0-10" << "10 10" << "0-10 20-30";
+		QTest::newRow( "adjacent" ) << "+0-10 +10-20" << "10 10" << "0-20";
+		QTest::newRow( "overlapping" ) << "+0-10 +5-15" << "10 5" << "0-15";
+		QTest::newRow( "bridge" ) << "+0-10 +20-30 +5-25" << "10 10 10" << "0-30";
+		QTest::newRow( "covered" ) << "+0-30 +10-20" << "30 0" << "0-30";
+		QTest::newRow( "empty" ) << "+5-5" << "0" << "";
+		QTest::newRow( "beyondLimit" ) << "+90-101" << "0" << "";
+		QTest::newRow( "eraseMiddle" ) << "+0-30 -10-20" << "30 10" << "0-10 20-30";
+		QTest::newRow( "eraseAcross" ) << "+0-10 +20-30 +40-50 -5-45" << "10 10 10 20" << "0-5 45-50";
+		QTest::newRow( "eraseExact" ) << "+0-10 +20-30 -0-10" << "10 10 10" << "20-30";
+		QTest::newRow( "eraseGap" ) << "+0-10 -10-20" << "10 0" << "0-10";
+		QTest::newRow( "eraseAll" ) << "+0-10 +20-30 -0-100" << "10 10 20" << "";
+	}
+
+	void insertErase()
+	{
+		QFETCH( QString, sOperations );
+		QFETCH( QString, sReturns );
+		QFETCH( QString, sResult );
+
+		Fragments::List oList( LIST_LIMIT );
+		QStringList lReturns;
+
+		foreach ( const QString& sOperation, sOperations.split( ' ' ) )
+		{
+			const Fragments::Fragment oRange = toRange( sOperation.mid( 1 ) );
+			const quint64 nLength = sOperation.startsWith( '+' ) ? oList.insert( oRange ) : oList.erase( oRange );
+			lReturns << QString::number( nLength );
+		}
+
+		QCOMPARE( lReturns.join( " " ), sReturns );
+		QCOMPARE( toString( oList ), sResult );
+		QCOMPARE( toString( inverse( inverse( oList ) ) ), sResult );
+	}
+
+	void merge_data()
+	{
+		QTest::addColumn<QString>( "sLeft" );
+		QTest::addColumn<QString>( "sRight" );
+		QTest::addColumn<QString>( "sInverse" );	// of sLeft
+		QTest::addColumn<QString>( "sIntersect" );
+		QTest::addColumn<QString>( "sSubtract" );
+
+		QTest::newRow( "empty" ) << "" << "0-100" << "0-100" << "" << "";
+		QTest::newRow( "emptyRight" ) << "0-50" << "" << "50-100" << "" << "0-50";
+		QTest::newRow( "full" ) << "0-100" << "10-20 30-40" << "" << "10-20 30-40" << "0-10 20-30 40-100";
+		QTest::newRow( "covering" ) << "10-20 30-40" << "0-100" << "0-10 20-30 40-100" << "10-20 30-40" << "";
+		QTest::newRow( "partial" ) << "0-10 20-30" << "5-25" << "10-20 30-100" << "5-10 20-25" << "0-5 25-30";
+		QTest::newRow( "touching" ) << "0-50" << "50-100" << "50-100" << "" << "0-50";
+		QTest::newRow( "spanning" ) << "0-10 20-30 40-50" << "5-45" << "10-20 30-40 50-100" << "5-10 20-30 40-45" << "0-5 45-50";
+		QTest::newRow( "ends" ) << "0-10 90-100" << "5-95" << "10-90" << "5-10 90-95" << "0-5 95-100";
+	}
+
+	void merge()
+	{
+		QFETCH( QString, sLeft );
+		QFETCH( QString, sRight );
+		QFETCH( QString, sInverse );
+		QFETCH( QString, sIntersect );
+		QFETCH( QString, sSubtract );
+
+		const Fragments::List oLeft = fromString( sLeft );
+		const Fragments::List oRight = fromString( sRight );
+
+		QCOMPARE( toString( inverse( oLeft ) ), sInverse );
+		QCOMPARE( toString( intersect( oLeft, oRight ) ), sIntersect );
+		QCOMPARE( toString( subtract( oLeft, oRight ) ), sSubtract );
+
+		// the merges keep the length sum up to date, and agree with range by range erasing
+		QCOMPARE( subtract( oLeft, oRight ).length_sum(), oLeft.length_sum() - intersect( oLeft, oRight ).length_sum() );
+
+		Fragments::List oErased( oLeft );
+		oErased.erase( oRight.begin(), oRight.end() );
+		QCOMPARE( toString( oErased ), sSubtract );
+	}
+
+	// Random inserts and erases split and join the chunks; the list is checked against a bitmap.
+	void smallChunks()
+	{
+		quint64 nState = 3;
+
+		for ( int nRound = 0; nRound < 200; ++nRound )
+		{
+			SmallChunkList oLeft( SMALL_LIMIT ), oRight( SMALL_LIMIT );
+			QBitArray baLeft( SMALL_LIMIT ), baRight( SMALL_LIMIT );
+
+			for ( int i = 0; i < 100; ++i )
+			{
+				quint64 nBegin = random( nState ) % SMALL_LIMIT, nEnd = random( nState ) % SMALL_LIMIT;
+				if ( nBegin > nEnd )
+					qSwap( nBegin, nEnd );
+
+				const bool bInsert = random( nState ) % 3 != 0;
+				SmallChunkList& oList = i & 1 ? oRight : oLeft;
+				QBitArray& baBits = i & 1 ? baRight : baLeft;
+
+				const quint64 nLength = bInsert ? oList.insert( Fragments::Fragment( nBegin, nEnd ) )
+												: oList.erase( Fragments::Fragment( nBegin, nEnd ) );
+				quint64 nChanged = 0;
+
+				for ( quint64 n = nBegin; n < nEnd; ++n )
+				{
+					if ( baBits.testBit( n ) != bInsert )
+					{
+						baBits.setBit( n, bInsert );
+						++nChanged;
+					}
+				}
+
+				QCOMPARE( nLength, nChanged );
+			}
+
+			QCOMPARE( toBits( oLeft ), baLeft );
+			QCOMPARE( toBits( oRight ), baRight );
+			QCOMPARE( oLeft.length_sum(), quint64( baLeft.count( true ) ) );
+
+			QCOMPARE( toBits( inverse( oLeft ) ), ~baLeft );
+			QCOMPARE( toBits( intersect( oLeft, oRight ) ), baLeft & baRight );
+			QCOMPARE( toBits( subtract( oLeft, oRight ) ), baLeft & ~baRight );
+
+			SmallChunkList oErased( oLeft );
+			oErased.erase( oRight.begin(), oRight.end() );
+			QCOMPARE( toBits( oErased ), baLeft & ~baRight );
+		}
+	}
+
+	// All layouts hold the same ranges after the benchmark input.
+	void layoutsMatch()
+	{
+		Fragments::List oList( BENCH_SIZE );
+		CTreeFragments oTree;
+		CFlatFragments oFlat;
+
+		foreach ( const Fragments::Fragment& oRange, m_lCompleted )
+		{
+			oList.insert( oRange );
+			oTree.insert( oRange );
+			oFlat.insert( oRange );
+		}
+
+		QCOMPARE( quint64( oTree.lRanges.size() ), quint64( oList.size() ) );
+		QCOMPARE( quint64( oFlat.vRanges.size() ), quint64( oList.size() ) );
+		QVERIFY( std::equal( oTree.lRanges.begin(), oTree.lRanges.end(), oList.begin() ) );
+		QVERIFY( std::equal( oFlat.vRanges.begin(), oFlat.vRanges.end(), oList.begin() ) );
+	}
+
+	// Completed fragments arrive in random order: the tree and the chunks insert them without
+	// moving much, the flat vector moves half of the ranges on average.
+	void benchmarkRandomInsert_data()
+	{
+		QTest::addColumn<Layout>( "nLayout" );
+
+		QTest::newRow( "chunked" ) << layoutChunked;
+		QTest::newRow( "std::set" ) << layoutTree;
+		QTest::newRow( "std::vector" ) << layoutFlat;
+	}
+
+	void benchmarkRandomInsert()
+	{
+		QFETCH( Layout, nLayout );
+
+		switch ( nLayout )
+		{
+		case layoutChunked:
+			QBENCHMARK
+			{
+				Fragments::List oList( BENCH_SIZE );
+
+				foreach ( const Fragments::Fragment& oRange, m_lCompleted )
+					oList.insert( oRange );
+			}
+			break;
+
+		case layoutTree:
+			QBENCHMARK
+			{
+				CTreeFragments oTree;
+
+				foreach ( const Fragments::Fragment& oRange, m_lCompleted )
+					oTree.insert( oRange );
+			}
+			break;
+
+		case layoutFlat:
+			QBENCHMARK
+			{
+				CFlatFragments oFlat;
+
+				foreach ( const Fragments::Fragment& oRange, m_lCompleted )
+					oFlat.insert( oRange );
+			}
+			break;
+		}
+	}
+
+	// What CDownload::getPossibleFragments() does for every block request: the tree allocates a
+	// node per range of the result, the others append to a few blocks.
+	void benchmarkSubtract_data()
+	{
+		benchmarkRandomInsert_data();
+	}
+
+	void benchmarkSubtract()
+	{
+		QFETCH( Layout, nLayout );
+
+		Fragments::List oCompleted( BENCH_SIZE ), oAvailable( BENCH_SIZE );
+		CTreeFragments oTreeCompleted, oTreeAvailable;
+		CFlatFragments oFlatCompleted, oFlatAvailable;
+
+		foreach ( const Fragments::Fragment& oRange, m_lCompleted )
+		{
+			oCompleted.insert( oRange );
+			oTreeCompleted.insert( oRange );
+			oFlatCompleted.insert( oRange );
+		}
+
+		foreach ( const Fragments::Fragment& oRange, m_lAvailable )
+		{
+			oAvailable.insert( oRange );
+			oTreeAvailable.insert( oRange );
+			oFlatAvailable.insert( oRange );
+		}
+
+		switch ( nLayout )
+		{
+		case layoutChunked:
+			QBENCHMARK
+			{
+				Fragments::List oPossible = subtract( oAvailable, oCompleted );
+				QVERIFY( !oPossible.empty() );
+			}
+			break;
+
+		case layoutTree:
+			QBENCHMARK
+			{
+				TreeRanges lPossible = CTreeFragments::subtract( oTreeAvailable.lRanges, oTreeCompleted.lRanges );
+				QVERIFY( !lPossible.empty() );
+			}
+			break;
+
+		case layoutFlat:
+			QBENCHMARK
+			{
+				FlatRanges vPossible = CFlatFragments::subtract( oFlatAvailable.vRanges, oFlatCompleted.vRanges );
+				QVERIFY( !vPossible.empty() );
+			}
+			break;
+		}
+	}
+};
+
+QTEST_MAIN(tst_FragmentList)
+
+#include "tst_fragmentlist.moc"
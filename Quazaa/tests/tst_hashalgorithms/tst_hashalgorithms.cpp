@@ -0,0 +1,109 @@
+/*
+** tst_hashalgorithms.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <QtTest/QtTest>
+
+#include "Hashes/hash.h"
+
+Q_DECLARE_METATYPE(QList<int>)
+
+// Same block size as the library hasher hands to its workers.
+static const int BLOCK_SIZE = 1024 * 1024;
+static const int BLOCKS     = 32; // 32 MB per iteration
+
+/**
+ * Measures the cost of hashing the same data with different sets of algorithms. The library
+ * hasher runs one worker per algorithm, so its throughput is bound by the slowest algorithm of
+ * the set, while the sequential cost measured here is what the set costs in CPU time.
+ */
+class tst_HashAlgorithms : public QObject
+{
+	Q_OBJECT
+
+private:
+	QByteArray m_baBlock;
+
+private slots:
+	void initTestCase();
+
+	void benchmarkSets_data();
+	void benchmarkSets();
+};
+
+void tst_HashAlgorithms::initTestCase()
+{
+	m_baBlock.resize( BLOCK_SIZE );
+
+	// Not compressible and not all zeros, although no algorithm here cares.
+	quint32 nState = 0x12345678;
+	for ( int i = 0; i < BLOCK_SIZE; ++i )
+	{
+		nState = nState * 1103515245 + 12345;
+		m_baBlock[i] = (char)( nState >> 24 );
+	}
+}
+
+void tst_HashAlgorithms::benchmarkSets_data()
+{
+	QTest::addColumn<QList<int> >("lAlgorithms");
+
+	QTest::newRow("sha1")      << ( QList<int>() << CHash::SHA1 );
+	QTest::newRow("md5")       << ( QList<int>() << CHash::MD5 );
+	QTest::newRow("ed2k")      << ( QList<int>() << CHash::ED2K );
+	QTest::newRow("tigertree") << ( QList<int>() << CHash::TIGERTREE );
+
+	QTest::newRow("sha1+tigertree")      << ( QList<int>() << CHash::SHA1 << CHash::TIGERTREE );
+	QTest::newRow("sha1+ed2k")           << ( QList<int>() << CHash::SHA1 << CHash::ED2K );
+	QTest::newRow("sha1+ed2k+tigertree") << ( QList<int>() << CHash::SHA1 << CHash::ED2K << CHash::TIGERTREE );
+	QTest::newRow("sha1+md5+ed2k+tigertree")
+			<< ( QList<int>() << CHash::SHA1 << CHash::MD5 << CHash::ED2K << CHash::TIGERTREE );
+}
+
+void tst_HashAlgorithms::benchmarkSets()
+{
+	QFETCH(QList<int>, lAlgorithms);
+
+	QBENCHMARK
+	{
+		QList<CHash*> lHashes;
+		foreach ( int nAlgorithm, lAlgorithms )
+			lHashes.append( new CHash( (CHash::Algorithm)nAlgorithm ) );
+
+		for ( int nBlock = 0; nBlock < BLOCKS; ++nBlock )
+		{
+			foreach ( CHash* pHash, lHashes )
+				pHash->addData( m_baBlock.constData(), BLOCK_SIZE );
+		}
+
+		foreach ( CHash* pHash, lHashes )
+			pHash->finalize();
+
+		qDeleteAll( lHashes );
+	}
+}
+
+QTEST_MAIN(tst_HashAlgorithms)
+
+#include "tst_hashalgorithms.moc"
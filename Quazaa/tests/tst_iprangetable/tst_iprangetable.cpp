@@ -0,0 +1,216 @@
+/*
+** tst_iprangetable.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+#include "iprangetable.h"
+
+static const quint32 tNow = 1000000;
+
+static quint32 ip(const char* szAddress)
+{
+	return QHostAddress( QString( szAddress ) ).toIPv4Address();
+}
+
+class tst_IPRangeTable : public QObject
+{
+	Q_OBJECT
+
+private:
+	QTemporaryDir        m_oDir;
+	QList<CIPRangeRule*> m_lRules;
+
+	CIPRangeRule* rule(const QString& sRange, RuleAction::Action nAction,
+					   quint32 tExpire = (quint32)RuleTime::Special);
+	bool writeTable(const QString& sName, const CIPRangeTable* pTable, CIPRangeTable& oTable);
+
+private slots:
+	void cleanup();
+
+	void testFind_data();
+	void testFind();
+	void testPriorityKeptOnRewrite();
+	void testRemovedAndExpired();
+	void testDuplicates();
+};
+
+CIPRangeRule* tst_IPRangeTable::rule(const QString& sRange, RuleAction::Action nAction, quint32 tExpire)
+{
+	CIPRangeRule* pRule = new CIPRangeRule();
+	pRule->parseContent( sRange );
+	pRule->m_nAction = nAction;
+	pRule->setExpiryTime( tExpire );
+	pRule->setForever( tExpire == (quint32)RuleTime::Special );
+	m_lRules.append( pRule );
+	return pRule;
+}
+
+bool tst_IPRangeTable::writeTable(const QString& sName, const CIPRangeTable* pTable, CIPRangeTable& oTable)
+{
+	const QString sPath = m_oDir.path() + "/" + sName;
+
+	QFile oFile( sPath );
+	if ( !oFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+		return false;
+
+	CIPRangeTable::write( oFile, pTable, m_lRules, tNow );
+	oFile.close();
+
+	return oTable.open( sPath );
+}
+
+void tst_IPRangeTable::cleanup()
+{
+	qDeleteAll( m_lRules );
+	m_lRules.clear();
+}
+
+void tst_IPRangeTable::testFind_data()
+{
+	QTest::addColumn<bool>("bDenyFirst");
+	QTest::addColumn<QString>("sAddress");
+	QTest::addColumn<int>("nAction");
+
+	// The wide deny rule comes first in rule order and shadows the narrow accept rule.
+	QTest::newRow("deny first, inside both")    << true  << "10.1.2.3"   << (int)RuleAction::Deny;
+	QTest::newRow("deny first, outer only")     << true  << "10.2.0.1"   << (int)RuleAction::Deny;
+	QTest::newRow("deny first, range start")    << true  << "10.0.0.0"   << (int)RuleAction::Deny;
+	QTest::newRow("deny first, outside")        << true  << "11.0.0.0"   << (int)RuleAction::None;
+
+	// With the accept rule first, it wins wherever it applies although it starts at a higher address.
+	QTest::newRow("accept first, inside both")  << false << "10.1.2.3"   << (int)RuleAction::Accept;
+	QTest::newRow("accept first, inner end")    << false << "10.1.255.255" << (int)RuleAction::Accept;
+	QTest::newRow("accept first, outer only")   << false << "10.200.0.0" << (int)RuleAction::Deny;
+	QTest::newRow("accept first, below")        << false << "9.255.255.255" << (int)RuleAction::None;
+}
+
+void tst_IPRangeTable::testFind()
+{
+	QFETCH(bool, bDenyFirst);
+	QFETCH(QString, sAddress);
+	QFETCH(int, nAction);
+
+	if ( bDenyFirst )
+	{
+		rule( "10.0.0.0-10.255.255.255", RuleAction::Deny );
+		rule( "10.1.0.0-10.1.255.255", RuleAction::Accept );
+	}
+	else
+	{
+		rule( "10.1.0.0-10.1.255.255", RuleAction::Accept );
+		rule( "10.0.0.0-10.255.255.255", RuleAction::Deny );
+	}
+	// An unrelated rule in between, so the table is not trivially small.
+	rule( "192.168.0.0-192.168.255.255", RuleAction::Deny );
+
+	CIPRangeTable oTable;
+	QVERIFY( writeTable( "find.dat", NULL, oTable ) );
+	QCOMPARE( oTable.count(), 3u );
+
+	const int nIndex = oTable.find( ip( sAddress.toLatin1().constData() ), tNow );
+	QCOMPARE( nIndex == -1 ? (int)RuleAction::None : (int)oTable.action( nIndex ), nAction );
+}
+
+void tst_IPRangeTable::testPriorityKeptOnRewrite()
+{
+	rule( "10.0.0.0-10.255.255.255", RuleAction::Deny );
+
+	CIPRangeTable oFirst;
+	QVERIFY( writeTable( "first.dat", NULL, oFirst ) );
+
+	// New rules rank behind the rules that are already stored in the table.
+	cleanup();
+	rule( "10.1.0.0-10.1.255.255", RuleAction::Accept );
+
+	CIPRangeTable oSecond;
+	QVERIFY( writeTable( "second.dat", &oFirst, oSecond ) );
+	QCOMPARE( oSecond.count(), 2u );
+
+	int nIndex = oSecond.find( ip( "10.1.0.1" ), tNow );
+	QVERIFY( nIndex != -1 );
+	QCOMPARE( oSecond.action( nIndex ), RuleAction::Deny );
+
+	// ... and keep their order through further rewrites.
+	cleanup();
+	CIPRangeTable oThird;
+	QVERIFY( writeTable( "third.dat", &oSecond, oThird ) );
+	QCOMPARE( oThird.count(), 2u );
+
+	nIndex = oThird.find( ip( "10.1.0.1" ), tNow );
+	QVERIFY( nIndex != -1 );
+	QCOMPARE( oThird.action( nIndex ), RuleAction::Deny );
+	QVERIFY( oThird.priority( nIndex ) < oThird.priority( oThird.indexOf( ip( "10.1.0.0" ), ip( "10.1.255.255" ),
+																		   RuleAction::Accept ) ) );
+}
+
+void tst_IPRangeTable::testRemovedAndExpired()
+{
+	rule( "10.0.0.0-10.255.255.255", RuleAction::Deny, tNow - 1 );	// expired
+	rule( "10.0.0.0-10.127.255.255", RuleAction::Deny, tNow + 60 );
+	rule( "10.1.0.0-10.1.255.255", RuleAction::Accept );
+
+	CIPRangeTable oTable;
+	QVERIFY( writeTable( "removed.dat", NULL, oTable ) );
+
+	// The expired rule is not written at all.
+	QCOMPARE( oTable.count(), 2u );
+
+	int nIndex = oTable.find( ip( "10.1.0.1" ), tNow );
+	QVERIFY( nIndex != -1 );
+	QCOMPARE( oTable.action( nIndex ), RuleAction::Deny );
+
+	// Rules may expire while the table is mapped.
+	QCOMPARE( oTable.find( ip( "10.1.0.1" ), tNow + 61 ), oTable.indexOf( ip( "10.1.0.0" ), ip( "10.1.255.255" ),
+																			RuleAction::Accept ) );
+
+	// Once removed, the next best overlapping rule applies.
+	oTable.remove( nIndex );
+	nIndex = oTable.find( ip( "10.1.0.1" ), tNow );
+	QVERIFY( nIndex != -1 );
+	QCOMPARE( oTable.action( nIndex ), RuleAction::Accept );
+
+	QCOMPARE( oTable.find( ip( "10.2.0.0" ), tNow ), -1 );
+}
+
+void tst_IPRangeTable::testDuplicates()
+{
+	CIPRangeRule* pFirst = rule( "10.0.0.0-10.0.0.255", RuleAction::Deny );
+	pFirst->m_sComment = "first";
+	CIPRangeRule* pSecond = rule( "10.0.0.0-10.0.0.255", RuleAction::Deny );
+	pSecond->m_sComment = "second";
+
+	CIPRangeTable oTable;
+	QVERIFY( writeTable( "duplicates.dat", NULL, oTable ) );
+	QCOMPARE( oTable.count(), 1u );
+
+	CIPRangeRule* pRule = oTable.createRule( 0 );
+	QCOMPARE( pRule->m_sComment, QString( "first" ) );
+	QCOMPARE( pRule->m_oUUID, pFirst->m_oUUID );
+	delete pRule;
+}
+
+QTEST_MAIN(tst_IPRangeTable)
+
+#include "tst_iprangetable.moc"
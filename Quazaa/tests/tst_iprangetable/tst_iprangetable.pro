@@ -0,0 +1,46 @@
+#
+# tst_iprangetable.pro
+#
+# Copyright © Quazaa Development Team, 2009-2013.
+# This file is part of QUAZAA (quazaa.sourceforge.net)
+#
+# Quazaa is free software; this file may be used under the terms of the GNU
+# General Public License version 3.0 or later as published by the Free Software
+# Foundation and appearing in the file LICENSE.GPL included in the
+# packaging of this file.
+#
+# Quazaa is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# Please review the following information to ensure the GNU General Public
+# License version 3.0 requirements will be met:
+# http://www.gnu.org/copyleft/gpl.html.
+#
+# You should have received a copy of the GNU General Public License version
+# 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+
+TARGET = tst_iprangetable
+
+include(../tests.pri)
+
+QT += gui
+
+SOURCES += tst_iprangetable.cpp \
+		$$QUAZAA_SOURCES/commonfunctions.cpp \
+		$$QUAZAA_SOURCES/systemlog.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/endpoint.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/hash.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/sha1.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/tiger.cpp \
+		$$QUAZAA_SOURCES/NetworkCore/Hashes/tigertree.cpp \
+		$$QUAZAA_SOURCES/3rdparty/CyoEncode/CyoEncode.c \
+		$$QUAZAA_SOURCES/3rdparty/CyoEncode/CyoDecode.c \
+		$$QUAZAA_SOURCES/Security/securerule.cpp \
+		$$QUAZAA_SOURCES/Security/iprangerule.cpp \
+		$$QUAZAA_SOURCES/Security/iprangetable.cpp
+
+HEADERS += $$QUAZAA_SOURCES/systemlog.h \
+		$$QUAZAA_SOURCES/Security/securerule.h
@@ -0,0 +1,166 @@
+/*
+** tst_sha1.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <QtTest/QtTest>
+#include <QCryptographicHash>
+
+#include "Hashes/sha1.h"
+
+/**
+ * Known answer tests for every SHA1 block function the CPU supports. Each test runs once per
+ * implementation; implementations the CPU does not support are skipped.
+ */
+class tst_SHA1 : public QObject
+{
+	Q_OBJECT
+
+private:
+	void addImplementationColumn();
+
+private slots:
+	void cleanupTestCase();
+
+	void testKnownAnswers_data();
+	void testKnownAnswers();
+	void testMillionA_data();
+	void testMillionA();
+	void testSplitInput_data();
+	void testSplitInput();
+};
+
+void tst_SHA1::addImplementationColumn()
+{
+	QTest::addColumn<QString>("sImplementation");
+}
+
+void tst_SHA1::cleanupTestCase()
+{
+	// Leave the fastest implementation selected, as the dispatcher would.
+	if ( !CSHA1::setImplementation( "SHA-NI" ) )
+		CSHA1::setImplementation( "portable" );
+}
+
+void tst_SHA1::testKnownAnswers_data()
+{
+	addImplementationColumn();
+	QTest::addColumn<QByteArray>("baInput");
+	QTest::addColumn<QByteArray>("baDigest");
+
+	static const char* const pVectors[][2] = {
+		// FIPS 180-2 appendix A and B, plus a few lengths around the padding boundaries.
+		{ "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+		{ "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+		  "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+		{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+		  "a49b2446a02c645bf419f995b67091253a04a259" },
+		{ "The quick brown fox jumps over the lazy dog", "2fd4e1c67a2d28fced849ee1bb76e7391b93eb12" }
+	};
+
+	foreach ( const QString& sImplementation, QStringList() << "portable" << "SHA-NI" )
+	{
+		for ( int i = 0; i < (int)( sizeof( pVectors ) / sizeof( pVectors[0] ) ); ++i )
+		{
+			QTest::newRow( qPrintable( QString( "%1 vector %2" ).arg( sImplementation ).arg( i ) ) )
+					<< sImplementation << QByteArray( pVectors[i][0] )
+					<< QByteArray::fromHex( pVectors[i][1] );
+		}
+	}
+}
+
+void tst_SHA1::testKnownAnswers()
+{
+	QFETCH(QString, sImplementation);
+	QFETCH(QByteArray, baInput);
+	QFETCH(QByteArray, baDigest);
+
+	if ( !CSHA1::setImplementation( sImplementation ) )
+		QSKIP( "Implementation not supported by this CPU" );
+
+	CSHA1 oSHA1;
+	oSHA1.addData( baInput.constData(), baInput.size() );
+	QCOMPARE( oSHA1.result().toHex(), baDigest.toHex() );
+
+	// result() does not change the state.
+	QCOMPARE( oSHA1.result().toHex(), baDigest.toHex() );
+}
+
+void tst_SHA1::testMillionA_data()
+{
+	addImplementationColumn();
+	QTest::newRow("portable") << QString( "portable" );
+	QTest::newRow("SHA-NI")   << QString( "SHA-NI" );
+}
+
+void tst_SHA1::testMillionA()
+{
+	QFETCH(QString, sImplementation);
+
+	if ( !CSHA1::setImplementation( sImplementation ) )
+		QSKIP( "Implementation not supported by this CPU" );
+
+	// FIPS 180-2 appendix A.3, fed in chunks that are not a multiple of the block size.
+	const QByteArray baChunk( 1000, 'a' );
+
+	CSHA1 oSHA1;
+	for ( int i = 0; i < 1000; ++i )
+		oSHA1.addData( baChunk.constData(), baChunk.size() );
+
+	QCOMPARE( oSHA1.result().toHex(), QByteArray( "34aa973cd4c4daa4f61eeb2bdbad27316534016f" ) );
+}
+
+void tst_SHA1::testSplitInput_data()
+{
+	testMillionA_data();
+}
+
+void tst_SHA1::testSplitInput()
+{
+	QFETCH(QString, sImplementation);
+
+	if ( !CSHA1::setImplementation( sImplementation ) )
+		QSKIP( "Implementation not supported by this CPU" );
+
+	QByteArray baData( 1000, 0 );
+	for ( int i = 0; i < baData.size(); ++i )
+		baData[i] = (char)( i * 167 + 13 );
+
+	// Every length up to a few blocks, split at an odd position, against Qt's SHA1.
+	for ( int nLength = 0; nLength <= 300; ++nLength )
+	{
+		const int nSplit = nLength / 3;
+
+		CSHA1 oSHA1;
+		oSHA1.addData( baData.constData(), nSplit );
+		oSHA1.addData( baData.constData() + nSplit, nLength - nSplit );
+
+		QCOMPARE( oSHA1.result().toHex(),
+				  QCryptographicHash::hash( baData.left( nLength ), QCryptographicHash::Sha1 ).toHex() );
+	}
+}
+
+QTEST_MAIN(tst_SHA1)
+
+#include "tst_sha1.moc"
@@ -0,0 +1,241 @@
+/*
+** tst_uploadsendfile.cpp
+**
+** Copyright © Quazaa Development Team, 2009-2013.
+** This file is part of QUAZAA (quazaa.sourceforge.net)
+**
+** Quazaa is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** Quazaa is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <QtTest/QtTest>
+#include <QTemporaryFile>
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+static const int FILE_SIZE	= 32 * 1024 * 1024;	// served once per iteration
+static const int READ_CHUNK	= 65536;			// UPLOAD_HTTP_CHUNK, what the fallback reads at once
+
+// Reads and drops a given number of bytes on its own thread, like a fast downloading client.
+class CDrain : public QThread
+{
+public:
+	int		m_nSocket;
+	qint64	m_nBytes;
+
+protected:
+	void run()
+	{
+#ifdef Q_OS_LINUX
+		QByteArray baBuffer( 262144, 0 );
+
+		while ( m_nBytes > 0 )
+		{
+			const ssize_t nRead = ::recv( m_nSocket, baBuffer.data(), qMin<qint64>( m_nBytes, baBuffer.size() ), 0 );
+
+			if ( nRead <= 0 )
+				break;
+
+			m_nBytes -= nRead;
+		}
+#endif
+	}
+};
+
+/**
+ * Measures how CUploadTransferHTTP passes file data to the socket: with sendfile(), the file
+ * goes from the page cache to the socket without a copy through user space, the fallback reads
+ * chunks of the file and writes them. The file is served as range requests of different sizes
+ * over a loopback TCP connection, the way a client fetching many ranges would see it.
+ */
+class tst_UploadSendfile : public QObject
+{
+	Q_OBJECT
+
+private:
+	QTemporaryFile	m_oFile;
+	int				m_nSender;
+	int				m_nReceiver;
+
+	// Sends nLength bytes at nOffset of the file with sendfile(). Returns false on an error.
+	bool sendRange(quint64 nOffset, quint64 nLength)
+	{
+#ifdef Q_OS_LINUX
+		off_t nFileOffset = nOffset;
+
+		while ( nLength > 0 )
+		{
+			const ssize_t nSent = ::sendfile( m_nSender, m_oFile.handle(), &nFileOffset, nLength );
+
+			if ( nSent <= 0 )
+				return false;
+
+			nLength -= nSent;
+		}
+#endif
+		return true;
+	}
+
+	// Sends nLength bytes at nOffset of the file, read in READ_CHUNK pieces.
+	bool copyRange(quint64 nOffset, quint64 nLength, QByteArray& baBuffer)
+	{
+#ifdef Q_OS_LINUX
+		while ( nLength > 0 )
+		{
+			const ssize_t nRead = ::pread( m_oFile.handle(), baBuffer.data(), qMin<quint64>( nLength, READ_CHUNK ), nOffset );
+
+			if ( nRead <= 0 )
+				return false;
+
+			for ( ssize_t nSent = 0; nSent < nRead; )
+			{
+				const ssize_t nWritten = ::send( m_nSender, baBuffer.constData() + nSent, nRead - nSent, 0 );
+
+				if ( nWritten <= 0 )
+					return false;
+
+				nSent += nWritten;
+			}
+
+			nOffset += nRead;
+			nLength -= nRead;
+		}
+#endif
+		return true;
+	}
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void benchmarkRanges_data();
+	void benchmarkRanges();
+};
+
+void tst_UploadSendfile::initTestCase()
+{
+#ifndef Q_OS_LINUX
+	QSKIP( "sendfile() is only used on Linux" );
+#else
+	QVERIFY( m_oFile.open() );
+
+	QByteArray baBlock( 1024 * 1024, 0 );
+	quint32 nState = 0x12345678;
+	for ( int i = 0; i < baBlock.size(); ++i )
+	{
+		nState = nState * 1103515245 + 12345;
+		baBlock[i] = (char)( nState >> 24 );
+	}
+
+	for ( int nWritten = 0; nWritten < FILE_SIZE; nWritten += baBlock.size() )
+		QCOMPARE( m_oFile.write( baBlock ), qint64( baBlock.size() ) );
+
+	QVERIFY( m_oFile.flush() );
+
+	// a connected pair of blocking loopback sockets
+	const int nListener = ::socket( AF_INET, SOCK_STREAM, 0 );
+	QVERIFY( nListener >= 0 );
+
+	sockaddr_in oAddress;
+	memset( &oAddress, 0, sizeof( oAddress ) );
+	oAddress.sin_family = AF_INET;
+	oAddress.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+	socklen_t nAddressLength = sizeof( oAddress );
+	QVERIFY( ::bind( nListener, (sockaddr*)&oAddress, sizeof( oAddress ) ) == 0 );
+	QVERIFY( ::listen( nListener, 1 ) == 0 );
+	QVERIFY( ::getsockname( nListener, (sockaddr*)&oAddress, &nAddressLength ) == 0 );
+
+	m_nSender = ::socket( AF_INET, SOCK_STREAM, 0 );
+	QVERIFY( ::connect( m_nSender, (sockaddr*)&oAddress, sizeof( oAddress ) ) == 0 );
+
+	m_nReceiver = ::accept( nListener, 0, 0 );
+	::close( nListener );
+	QVERIFY( m_nReceiver >= 0 );
+#endif
+}
+
+void tst_UploadSendfile::cleanupTestCase()
+{
+#ifdef Q_OS_LINUX
+	::close( m_nSender );
+	::close( m_nReceiver );
+#endif
+}
+
+void tst_UploadSendfile::benchmarkRanges_data()
+{
+	QTest::addColumn<bool>( "bSendfile" );
+	QTest::addColumn<int>( "nRange" );
+
+	QTest::newRow( "sendfile, 64 KB ranges" )   << true  << 65536;
+	QTest::newRow( "read+write, 64 KB ranges" ) << false << 65536;
+	QTest::newRow( "sendfile, 1 MB ranges" )    << true  << 1048576;
+	QTest::newRow( "read+write, 1 MB ranges" )  << false << 1048576;
+	QTest::newRow( "sendfile, 4 MB ranges" )    << true  << 4194304;
+	QTest::newRow( "read+write, 4 MB ranges" )  << false << 4194304;
+}
+
+void tst_UploadSendfile::benchmarkRanges()
+{
+	QFETCH( bool, bSendfile );
+	QFETCH( int, nRange );
+
+	QByteArray baBuffer( READ_CHUNK, 0 );
+
+	QBENCHMARK
+	{
+		CDrain oDrain;
+		oDrain.m_nSocket = m_nReceiver;
+		oDrain.m_nBytes = FILE_SIZE;
+		oDrain.start();
+
+		bool bOK = true;
+
+		// the ranges are served in a scattered order, as a swarm of downloaders asks for them
+		const int nRanges = FILE_SIZE / nRange;
+		for ( int i = 0; bOK && i < nRanges; ++i )
+		{
+			const quint64 nOffset = (quint64)( ( i * 7 ) % nRanges ) * nRange;
+
+			bOK = bSendfile ? sendRange( nOffset, nRange ) : copyRange( nOffset, nRange, baBuffer );
+		}
+
+#ifdef Q_OS_LINUX
+		// a failed send would leave the drain waiting
+		if ( !bOK )
+			::shutdown( m_nSender, SHUT_RDWR );
+#endif
+
+		oDrain.wait();
+
+		QVERIFY( bOK );
+		QCOMPARE( oDrain.m_nBytes, qint64( 0 ) );
+	}
+}
+
+QTEST_MAIN(tst_UploadSendfile)
+
+#include "tst_uploadsendfile.moc"